@@ -0,0 +1,194 @@
+/**
+ * @file bench.cpp
+ * @brief Command line of `pecotmr_bench`: parses the sweeps, runs the benchmarks
+ *        and writes one CSV row per case to stdout (see README.md).
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include "bench.h"
+
+std::string bench_result::key() const {
+	std::ostringstream s;
+	s << benchmark << ',' << ld << ',' << p << ',' << block_size << ',' << M << ',' << K << ',' << threads;
+	return s.str();
+}
+
+bool bench_runner::wants(const std::string& benchmark) const {
+	return opt.filter.empty() || benchmark.find(opt.filter) != std::string::npos;
+}
+
+void bench_runner::run(bench_result row, const std::function<double()>& f) {
+	if (!wants(row.benchmark)) {
+		return;
+	}
+	sink += f();
+	std::vector<double> times(opt.reps);
+	for (int r = 0; r < opt.reps; r++) {
+		auto start = std::chrono::steady_clock::now();
+		sink += f();
+		times[r] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	std::sort(times.begin(), times.end());
+	row.reps = opt.reps;
+	row.min_s = times.front();
+	row.max_s = times.back();
+	row.median_s = (opt.reps % 2 == 1) ? times[opt.reps / 2] : 0.5 * (times[opt.reps / 2 - 1] + times[opt.reps / 2]);
+	std::cerr << row.key() << ": " << row.median_s << " s" << std::endl;
+	rows.push_back(row);
+}
+
+static void usage() {
+	std::cerr <<
+	        "Usage: pecotmr_bench [options] > results.csv\n"
+	        "  --filter NAME      only run benchmarks whose name contains NAME\n"
+	        "  --ld KINDS         LD generators, among block, ar1 and panel (default block,ar1,panel)\n"
+	        "  --p LIST           numbers of variants (default 2000,10000)\n"
+	        "  --block-size LIST  LD block sizes (default 200,1000)\n"
+	        "  --M LIST           SDPR mixture components (default 100,1000)\n"
+	        "  --K LIST           mr.ash mixture components (default 4,8,16,20,32,50)\n"
+	        "  --threads LIST     thread counts (default 1 and the number of cores)\n"
+	        "  --reps N           timed repetitions per case (default 5)\n"
+	        "  --seed N           seed of the synthetic data (default 1)\n"
+	        "  --quick            small sizes and short chains, for a smoke test\n"
+	        "  --baseline FILE    add the median time of the same case in FILE, a\n"
+	        "                     previous output, and the ratio to it\n";
+}
+
+template <typename T>
+static std::vector<T> parse_list(const std::string& s) {
+	std::vector<T> out;
+	std::istringstream in(s);
+	std::string item;
+	while (std::getline(in, item, ',')) {
+		std::istringstream value(item);
+		T v;
+		if (!(value >> v)) {
+			throw std::invalid_argument("Cannot parse the list " + s + ".");
+		}
+		out.push_back(v);
+	}
+	return out;
+}
+
+// Median time of every case of a previous run, by case key
+static std::map<std::string, double> read_baseline(const std::string& file) {
+	std::ifstream in(file);
+	if (!in) {
+		throw std::runtime_error("Cannot open the baseline " + file + ".");
+	}
+	std::map<std::string, double> baseline;
+	std::string line;
+	std::getline(in, line);
+	while (std::getline(in, line)) {
+		std::vector<std::string> fields;
+		std::istringstream s(line);
+		std::string field;
+		while (std::getline(s, field, ',')) {
+			fields.push_back(field);
+		}
+		if (fields.size() < 9) {
+			continue;
+		}
+		std::string key = fields[0];
+		for (int i = 1; i < 7; i++) {
+			key += ',' + fields[i];
+		}
+		baseline[key] = std::atof(fields[8].c_str());
+	}
+	return baseline;
+}
+
+int main(int argc, char** argv) {
+	unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+	bench_options opt;
+	opt.ld = {"block", "ar1", "panel"};
+	opt.p = {2000, 10000};
+	opt.block_size = {200, 1000};
+	opt.M = {100, 1000};
+	opt.K = {4, 8, 16, 20, 32, 50};
+	opt.threads = {1};
+	if (cores > 1) {
+		opt.threads.push_back(cores);
+	}
+	opt.reps = 5;
+	opt.quick = false;
+	opt.seed = 1;
+	std::string baseline_file;
+
+	try {
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg == "--quick") {
+				opt.quick = true;
+				opt.p = {1000};
+				opt.block_size = {100};
+				opt.M = {100};
+				opt.reps = 3;
+				continue;
+			}
+			if (arg == "--help" || arg == "-h") {
+				usage();
+				return 0;
+			}
+			if (i + 1 == argc) {
+				throw std::invalid_argument("Missing value of " + arg + ".");
+			}
+			std::string value = argv[++i];
+			if (arg == "--filter") opt.filter = value;
+			else if (arg == "--ld") opt.ld = parse_list<std::string>(value);
+			else if (arg == "--p") opt.p = parse_list<long>(value);
+			else if (arg == "--block-size") opt.block_size = parse_list<long>(value);
+			else if (arg == "--M") opt.M = parse_list<long>(value);
+			else if (arg == "--K") opt.K = parse_list<long>(value);
+			else if (arg == "--threads") opt.threads = parse_list<unsigned>(value);
+			else if (arg == "--reps") opt.reps = std::max(1, std::atoi(value.c_str()));
+			else if (arg == "--seed") opt.seed = std::strtoull(value.c_str(), nullptr, 10);
+			else if (arg == "--baseline") baseline_file = value;
+			else throw std::invalid_argument("Unknown option " + arg + ".");
+		}
+
+		std::map<std::string, double> baseline;
+		if (!baseline_file.empty()) {
+			baseline = read_baseline(baseline_file);
+		}
+
+		bench_runner runner(opt);
+		bench_mr_ash(runner);
+		bench_prscs(runner);
+		bench_sdpr(runner);
+
+		std::cout << "benchmark,ld,p,block_size,M,K,threads,reps,median_s,min_s,max_s";
+		if (!baseline_file.empty()) {
+			std::cout << ",baseline_median_s,ratio";
+		}
+		std::cout << '\n' << std::setprecision(6);
+		for (const bench_result& row : runner.results()) {
+			std::cout << row.key() << ',' << row.reps << ',' << row.median_s << ',' << row.min_s << ',' << row.max_s;
+			if (!baseline_file.empty()) {
+				auto it = baseline.find(row.key());
+				if (it != baseline.end() && it->second > 0) {
+					std::cout << ',' << it->second << ',' << row.median_s / it->second;
+				}
+				else {
+					std::cout << ",NA,NA";
+				}
+			}
+			std::cout << '\n';
+		}
+	}
+	catch (const std::exception& e) {
+		std::cerr << "pecotmr_bench: " << e.what() << std::endl;
+		usage();
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file bench.h
+ * @brief Timing harness of the C++ microbenchmarks (see README.md).
+ *
+ * Every benchmark case is timed by `bench_runner::run` and becomes one row of
+ * the CSV written by `pecotmr_bench`. The columns that identify a case
+ * (benchmark, ld, p, block_size, M, K, threads) are the key used to compare a
+ * run with a baseline; parameters that do not apply to a benchmark are 0.
+ */
+
+#ifndef PECOTMR_BENCH_H
+#define PECOTMR_BENCH_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/// Parameter sweeps and settings, from the command line
+struct bench_options {
+	std::vector<std::string> ld;
+	std::vector<long> p, block_size, M, K;
+	std::vector<unsigned> threads;
+	std::string filter;
+	int reps;
+	bool quick;
+	uint64_t seed;
+};
+
+/// One benchmark case and its timings, in seconds
+struct bench_result {
+	std::string benchmark;
+	std::string ld;
+	long p, block_size, M, K;
+	unsigned threads;
+	int reps;
+	double median_s, min_s, max_s;
+
+	bench_result(const std::string& benchmark, const std::string& ld = "none", long p = 0, long block_size = 0,
+	             long M = 0, long K = 0, unsigned threads = 1)
+		: benchmark(benchmark), ld(ld), p(p), block_size(block_size), M(M), K(K), threads(threads),
+		reps(0), median_s(0), min_s(0), max_s(0) {
+	}
+
+	/// The columns that identify the case
+	std::string key() const;
+};
+
+class bench_runner {
+public:
+explicit bench_runner(const bench_options& opt) : opt(opt) {
+}
+
+const bench_options& options() const {
+	return opt;
+}
+/// Whether the benchmark is selected by `--filter`
+bool wants(const std::string& benchmark) const;
+/**
+ * Time `f`: one untimed warm-up call, then `reps` timed calls. `f` returns a
+ * value computed from its output, which is kept so the work is not optimized out.
+ */
+void run(bench_result row, const std::function<double()>& f);
+const std::vector<bench_result>& results() const {
+	return rows;
+}
+
+private:
+bench_options opt;
+std::vector<bench_result> rows;
+double sink = 0;
+};
+
+/// bayes_mix_sufficient over K and mr_ash_rss over the LD sweeps
+void bench_mr_ash(bench_runner& runner);
+/// gigrnd, gig_batch and prs_cs_mcmc
+void bench_prscs(bench_runner& runner);
+/// solve_ldmat, MCMC_state::sample_assignment and the SDPR sampler
+void bench_sdpr(bench_runner& runner);
+
+#endif // PECOTMR_BENCH_H
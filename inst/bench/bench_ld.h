@@ -0,0 +1,140 @@
+/**
+ * @file bench_ld.h
+ * @brief Synthetic LD panels and summary statistics for the microbenchmarks.
+ *
+ * Every panel is a list of square LD blocks covering p variants, the last block
+ * holding the remainder:
+ * - "block": exchangeable blocks, every pair of variants in a block at r = 0.3;
+ * - "ar1": r = 0.9^|i - j| within a block, a smooth LD decay;
+ * - "panel": the correlation of genotypes simulated for 500 reference samples,
+ *   two haplotypes each from a thresholded AR(1) process, so the blocks have
+ *   the spread allele frequencies and the decaying, rank-deficient spectrum of
+ *   a real reference panel once the blocks are larger than the sample.
+ */
+
+#ifndef PECOTMR_BENCH_LD_H
+#define PECOTMR_BENCH_LD_H
+
+#include <armadillo>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+inline std::vector<long> bench_block_sizes(long p, long block_size) {
+	std::vector<long> sizes;
+	for (long start = 0; start < p; start += block_size) {
+		sizes.push_back(std::min(block_size, p - start));
+	}
+	return sizes;
+}
+
+inline arma::mat bench_exchangeable_block(long size, double r) {
+	arma::mat R(size, size);
+	R.fill(r);
+	R.diag().ones();
+	return R;
+}
+
+inline arma::mat bench_ar1_block(long size, double rho) {
+	arma::mat R(size, size);
+	for (long j = 0; j < size; j++) {
+		for (long i = 0; i < size; i++) {
+			R(i, j) = std::pow(rho, std::abs(i - j));
+		}
+	}
+	return R;
+}
+
+inline arma::mat bench_panel_block(long size, long n_ref, std::mt19937_64& rng) {
+	const double rho = 0.95;
+	std::normal_distribution<double> norm(0.0, 1.0);
+	std::uniform_real_distribution<double> unif(0.5, 2.0);
+	std::vector<double> threshold(size);
+	for (long j = 0; j < size; j++) {
+		// allele frequencies between 0.02 and 0.31
+		threshold[j] = unif(rng);
+	}
+	arma::mat G(n_ref, size, arma::fill::zeros);
+	for (long i = 0; i < n_ref; i++) {
+		for (int h = 0; h < 2; h++) {
+			double z = norm(rng);
+			for (long j = 0; j < size; j++) {
+				if (j > 0) {
+					z = rho * z + std::sqrt(1 - rho * rho) * norm(rng);
+				}
+				G(i, j) += (z > threshold[j]) ? 1.0 : 0.0;
+			}
+		}
+	}
+	// a monomorphic variant has no correlation; give it one minor allele
+	for (long j = 0; j < size; j++) {
+		if (arma::var(G.col(j)) == 0) {
+			G(j % n_ref, j) = (G(j % n_ref, j) > 0) ? 0.0 : 1.0;
+		}
+	}
+	return arma::cor(G);
+}
+
+/// LD blocks of the named kind covering p variants
+inline std::vector<arma::mat> bench_ld(const std::string& kind, long p, long block_size, uint64_t seed) {
+	std::mt19937_64 rng(seed);
+	std::vector<arma::mat> blocks;
+	for (long size : bench_block_sizes(p, block_size)) {
+		if (kind == "block") {
+			blocks.push_back(bench_exchangeable_block(size, 0.3));
+		}
+		else if (kind == "ar1") {
+			blocks.push_back(bench_ar1_block(size, 0.9));
+		}
+		else if (kind == "panel") {
+			blocks.push_back(bench_panel_block(size, 500, rng));
+		}
+		else {
+			throw std::invalid_argument("Unknown LD kind " + kind + "; use block, ar1 or panel.");
+		}
+	}
+	return blocks;
+}
+
+/**
+ * Marginal effects b = R beta + e, as seen in a GWAS of n samples with
+ * standardized genotypes: 1% of the variants are causal with effects
+ * explaining h2 = 0.2, and e ~ N(0, R / n) within each block.
+ */
+inline arma::vec bench_marginal_effects(const std::vector<arma::mat>& blocks, double n, uint64_t seed) {
+	std::mt19937_64 rng(seed);
+	std::normal_distribution<double> norm(0.0, 1.0);
+	long p = 0;
+	for (const arma::mat& R : blocks) {
+		p += R.n_rows;
+	}
+	long n_causal = std::max(1L, p / 100);
+	double sd = std::sqrt(0.2 / n_causal);
+	arma::vec bhat(p);
+	long start = 0;
+	for (const arma::mat& R : blocks) {
+		long size = R.n_rows;
+		arma::vec beta(size, arma::fill::zeros), e(size);
+		for (long j = 0; j < size; j++) {
+			if ((start + j) % 100 == 0) {
+				beta(j) = sd * norm(rng);
+			}
+			e(j) = norm(rng);
+		}
+		// R^(1/2) e from the eigendecomposition, which also holds for singular panels
+		arma::vec eval;
+		arma::mat evec;
+		arma::eig_sym(eval, evec, R);
+		arma::vec noise = evec * (arma::sqrt(arma::clamp(eval, 0.0, arma::datum::inf)) % (evec.t() * e)) / std::sqrt(n);
+		bhat.subvec(start, start + size - 1) = R * beta + noise;
+		start += size;
+	}
+	return bhat;
+}
+
+#endif // PECOTMR_BENCH_LD_H
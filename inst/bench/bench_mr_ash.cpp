@@ -0,0 +1,92 @@
+/**
+ * @file bench_mr_ash.cpp
+ * @brief mr.ash benchmarks: the coordinate kernel `bayes_mix_sufficient` over K
+ *        and `mr_ash_rss` over the LD sweeps.
+ */
+
+#include <random>
+#include "bench.h"
+#include "bench_ld.h"
+#include "mr_ash.h"
+
+// mr.ash grid of K prior variances: 0 and a geometric series up to 1
+static vec mr_ash_grid(long K) {
+	vec s0(K, fill::zeros);
+	for (long k = 1; k < K; k++) {
+		s0(k) = std::pow(2.0, static_cast<double>(k - K + 1) / 2);
+	}
+	return s0;
+}
+
+template <int K_MAX>
+static double mix_sweep(const std::vector<double>& xTx, const std::vector<double>& xTy, const mix_prior& prior) {
+	bayes_mix_fit<K_MAX> fit(prior.width);
+	double s = 0;
+	for (size_t j = 0; j < xTx.size(); j++) {
+		bayes_mix_sufficient<K_MAX>(xTx[j], xTy[j], 1.0, prior, fit);
+		s += fit.mu1;
+	}
+	return s;
+}
+
+// Coordinate updates as run by mr_ash_sufficient, through the kernel it dispatches to for K
+static double mix_kernel(const std::vector<double>& xTx, const std::vector<double>& xTy, long K) {
+	int width = mix_kernel_width(K);
+	mix_prior prior(vec(K, fill::value(1.0 / K)), mr_ash_grid(K), width > 0 ? width : K);
+	switch (width) {
+	case 4: return mix_sweep<4>(xTx, xTy, prior);
+	case 8: return mix_sweep<8>(xTx, xTy, prior);
+	case 16: return mix_sweep<16>(xTx, xTy, prior);
+	case 32: return mix_sweep<32>(xTx, xTy, prior);
+	default: return mix_sweep<0>(xTx, xTy, prior);
+	}
+}
+
+void bench_mr_ash(bench_runner& runner) {
+	const bench_options& opt = runner.options();
+
+	if (runner.wants("bayes_mix_sufficient")) {
+		// one million coordinate updates with the spread of X'X and X'y of a GWAS with n = 10,000
+		long n_update = opt.quick ? 100000 : 1000000;
+		std::mt19937_64 rng(opt.seed);
+		std::normal_distribution<double> norm(0.0, 1.0);
+		std::vector<double> xTx(n_update), xTy(n_update);
+		for (long j = 0; j < n_update; j++) {
+			xTx[j] = 10000 * (0.5 + std::abs(norm(rng)));
+			xTy[j] = std::sqrt(xTx[j]) * norm(rng) * (j % 100 == 0 ? 10 : 1);
+		}
+		for (long K : opt.K) {
+			runner.run(bench_result("bayes_mix_sufficient", "none", n_update, 0, 0, K), [&]() {
+				return mix_kernel(xTx, xTy, K);
+			});
+		}
+	}
+
+	if (!runner.wants("mr_ash_rss")) {
+		return;
+	}
+	const int n = 10000;
+	const int max_iter = opt.quick ? 5 : 20;
+	for (const std::string& ld : opt.ld) {
+		for (long p : opt.p) {
+			for (long block_size : opt.block_size) {
+				std::vector<mat> R = bench_ld(ld, p, block_size, opt.seed);
+				vec bhat = bench_marginal_effects(R, n, opt.seed + 1);
+				vec shat(p, fill::value(1.0 / std::sqrt(n)));
+				vec z = bhat / shat;
+				for (long K : opt.K) {
+					vec s0 = mr_ash_grid(K);
+					for (unsigned threads : opt.threads) {
+						// tol = 0 runs exactly max_iter sweeps
+						runner.run(bench_result("mr_ash_rss", ld, p, block_size, 0, K, threads), [&]() {
+							vec w0(K, fill::value(1.0 / K));
+							unordered_map<string, mat> fit = mr_ash_rss(bhat, shat, z, R, 1.0, n, 1.0, s0, w0, vec(p, fill::zeros),
+							                                            0.0, max_iter, true, true, true, false, threads);
+							return accu(fit["mu1"]);
+						});
+					}
+				}
+			}
+		}
+	}
+}
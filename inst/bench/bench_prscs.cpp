@@ -0,0 +1,67 @@
+/**
+ * @file bench_prscs.cpp
+ * @brief PRS-CS benchmarks: the generalized inverse Gaussian sampler, one draw
+ *        at a time (`gigrnd`) and batched (`gig_batch`), and `prs_cs_mcmc`.
+ */
+
+#include "bench.h"
+#include "bench_ld.h"
+#include "prscs_mcmc.h"
+
+void bench_prscs(bench_runner& runner) {
+	const bench_options& opt = runner.options();
+
+	// The psi draws of one sweep over p SNPs: p = a - 1/2, a = 2 delta and b = n beta^2 / sigma
+	for (long p : opt.p) {
+		if (!runner.wants("gigrnd") && !runner.wants("gig_batch")) {
+			break;
+		}
+		std::mt19937_64 gen(opt.seed);
+		std::gamma_distribution<double> delta(1.0, 1.0);
+		std::normal_distribution<double> beta(0.0, 0.01);
+		gig_batch gig;
+		gig.a.resize(p);
+		gig.b.resize(p);
+		for (long j = 0; j < p; j++) {
+			gig.a[j] = 2.0 * delta(gen);
+			gig.b[j] = 10000 * std::pow(beta(gen), 2);
+		}
+		std::vector<double> psi(p);
+		runner.run(bench_result("gigrnd", "none", p), [&]() {
+			rng_stream rng(opt.seed, 1);
+			double s = 0;
+			for (long j = 0; j < p; j++) {
+				s += gigrnd(0.5, gig.a[j], gig.b[j], rng);
+			}
+			return s;
+		});
+		runner.run(bench_result("gig_batch", "none", p), [&]() {
+			rng_stream rng(opt.seed, 1);
+			gig.sample(0.5, rng, psi.data());
+			return psi[0];
+		});
+	}
+
+	if (!runner.wants("prs_cs_mcmc")) {
+		return;
+	}
+	const int n = 10000;
+	const int n_iter = opt.quick ? 20 : 100;
+	double phi = 1e-4;
+	for (const std::string& ld : opt.ld) {
+		for (long p : opt.p) {
+			for (long block_size : opt.block_size) {
+				std::vector<arma::mat> R = bench_ld(ld, p, block_size, opt.seed);
+				std::vector<double> bhat = arma::conv_to<std::vector<double> >::from(bench_marginal_effects(R, n, opt.seed + 1));
+				std::vector<double> maf(p, 0.2);
+				for (unsigned threads : opt.threads) {
+					runner.run(bench_result("prs_cs_mcmc", ld, p, block_size, 0, 0, threads), [&]() {
+						std::map<std::string, arma::vec> fit = prs_cs_mcmc(1.0, 0.5, &phi, bhat, maf, n, R,
+						                                                   n_iter, n_iter / 2, 5, false, opt.seed, threads);
+						return arma::accu(fit["beta_est"]);
+					});
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,65 @@
+/**
+ * @file bench_sdpr.cpp
+ * @brief SDPR benchmarks: the LD preprocessing (`solve_ldmat`), one sweep of
+ *        `MCMC_state::sample_assignment` over the blocks, and the whole sampler.
+ */
+
+#include "bench.h"
+#include "bench_ld.h"
+#include "sdpr_mcmc.h"
+
+void bench_sdpr(bench_runner& runner) {
+	const bench_options& opt = runner.options();
+	if (!runner.wants("solve_ldmat") && !runner.wants("sample_assignment") && !runner.wants("sdpr_mcmc")) {
+		return;
+	}
+	const unsigned n = 10000;
+	const int iter = opt.quick ? 20 : 100;
+	const size_t active_buffer = 20;
+	for (const std::string& ld : opt.ld) {
+		for (long p : opt.p) {
+			for (long block_size : opt.block_size) {
+				std::vector<arma::mat> R = bench_ld(ld, p, block_size, opt.seed);
+				std::vector<double> beta = arma::conv_to<std::vector<double> >::from(bench_marginal_effects(R, n, opt.seed + 1));
+				mcmc_data data(beta, R, std::vector<double>(p, n), std::vector<int>(p, 1));
+				size_t n_block = R.size();
+
+				for (unsigned threads : opt.threads) {
+					runner.run(bench_result("solve_ldmat", ld, p, block_size, 0, 0, threads), [&]() {
+						ldmat_data ldmat;
+						solve_ldmat(data, ldmat, 0.1, n, 1, threads, "", false, nullptr);
+						return arma::accu(ldmat.B_diag[0]);
+					});
+				}
+
+				ldmat_data ldmat;
+				if (runner.wants("sample_assignment")) {
+					solve_ldmat(data, ldmat, 0.1, n, 1, opt.threads.back(), "", false, nullptr);
+				}
+				for (long M : opt.M) {
+					// the first iteration, where the initial assignments occupy every component
+					runner.run(bench_result("sample_assignment", ld, p, block_size, M), [&]() {
+						MCMC_state state(p, n_block, M, active_buffer, 0.5, 0.5, n, opt.seed);
+						state.set_iteration(1);
+						state.update_suffstats();
+						state.sample_sigma2();
+						for (size_t i = 0; i < n_block; i++) {
+							size_t size = data.boundary[i].second - data.boundary[i].first;
+							state.calc_b(i, data, ldmat, arma::vec(size, arma::fill::zeros));
+							state.sample_assignment(i, data, ldmat);
+						}
+						return static_cast<double>(state.cls_assgn[0]);
+					});
+					for (unsigned threads : opt.threads) {
+						runner.run(bench_result("sdpr_mcmc", ld, p, block_size, M, 0, threads), [&]() {
+							std::unordered_map<std::string, arma::mat> fit = mcmc(data, n, 0.1, 1.0, M, active_buffer, 0.5, 0.5,
+							                                                      iter, iter / 5, 5, threads, 1, false, opt.seed,
+							                                                      "", 1, false, mcmc_checkpoint_options(), nullptr, nullptr);
+							return arma::accu(fit["beta"]);
+						});
+					}
+				}
+			}
+		}
+	}
+}
@@ -12,13 +12,31 @@ Rcpp::Rostream<true>&  Rcpp::Rcout = Rcpp::Rcpp_cout_get();
 Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 #endif
 
+// coloc_bf_bf_rcpp
+Rcpp::List coloc_bf_bf_rcpp(Rcpp::List bf1, Rcpp::List bf2, Rcpp::List idx1, Rcpp::List idx2, std::vector<double> p1, std::vector<double> p2, std::vector<double> p12, int num_threads);
+RcppExport SEXP _pecotmr_coloc_bf_bf_rcpp(SEXP bf1SEXP, SEXP bf2SEXP, SEXP idx1SEXP, SEXP idx2SEXP, SEXP p1SEXP, SEXP p2SEXP, SEXP p12SEXP, SEXP num_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type bf1(bf1SEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type bf2(bf2SEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type idx1(idx1SEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type idx2(idx2SEXP);
+    Rcpp::traits::input_parameter< std::vector<double> >::type p1(p1SEXP);
+    Rcpp::traits::input_parameter< std::vector<double> >::type p2(p2SEXP);
+    Rcpp::traits::input_parameter< std::vector<double> >::type p12(p12SEXP);
+    Rcpp::traits::input_parameter< int >::type num_threads(num_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(coloc_bf_bf_rcpp(bf1, bf2, idx1, idx2, p1, p2, p12, num_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
 // dentist_iterative_impute
-List dentist_iterative_impute(const arma::mat& LD_mat, size_t nSample, const arma::vec& zScore, double pValueThreshold, float propSVD, bool gcControl, int nIter, double gPvalueThreshold, int ncpus, int seed, bool correct_chen_et_al_bug, bool verbose);
-RcppExport SEXP _pecotmr_dentist_iterative_impute(SEXP LD_matSEXP, SEXP nSampleSEXP, SEXP zScoreSEXP, SEXP pValueThresholdSEXP, SEXP propSVDSEXP, SEXP gcControlSEXP, SEXP nIterSEXP, SEXP gPvalueThresholdSEXP, SEXP ncpusSEXP, SEXP seedSEXP, SEXP correct_chen_et_al_bugSEXP, SEXP verboseSEXP) {
+List dentist_iterative_impute(SEXP LD_mat, size_t nSample, const arma::vec& zScore, double pValueThreshold, float propSVD, bool gcControl, int nIter, double gPvalueThreshold, int ncpus, int seed, bool correct_chen_et_al_bug, bool verbose, bool truncated_eigen, bool profile);
+RcppExport SEXP _pecotmr_dentist_iterative_impute(SEXP LD_matSEXP, SEXP nSampleSEXP, SEXP zScoreSEXP, SEXP pValueThresholdSEXP, SEXP propSVDSEXP, SEXP gcControlSEXP, SEXP nIterSEXP, SEXP gPvalueThresholdSEXP, SEXP ncpusSEXP, SEXP seedSEXP, SEXP correct_chen_et_al_bugSEXP, SEXP verboseSEXP, SEXP truncated_eigenSEXP, SEXP profileSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< const arma::mat& >::type LD_mat(LD_matSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type LD_mat(LD_matSEXP);
     Rcpp::traits::input_parameter< size_t >::type nSample(nSampleSEXP);
     Rcpp::traits::input_parameter< const arma::vec& >::type zScore(zScoreSEXP);
     Rcpp::traits::input_parameter< double >::type pValueThreshold(pValueThresholdSEXP);
@@ -30,20 +48,72 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< int >::type seed(seedSEXP);
     Rcpp::traits::input_parameter< bool >::type correct_chen_et_al_bug(correct_chen_et_al_bugSEXP);
     Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
-    rcpp_result_gen = Rcpp::wrap(dentist_iterative_impute(LD_mat, nSample, zScore, pValueThreshold, propSVD, gcControl, nIter, gPvalueThreshold, ncpus, seed, correct_chen_et_al_bug, verbose));
+    Rcpp::traits::input_parameter< bool >::type truncated_eigen(truncated_eigenSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    rcpp_result_gen = Rcpp::wrap(dentist_iterative_impute(LD_mat, nSample, zScore, pValueThreshold, propSVD, gcControl, nIter, gPvalueThreshold, ncpus, seed, correct_chen_et_al_bug, verbose, truncated_eigen, profile));
+    return rcpp_result_gen;
+END_RCPP
+}
+// dentist_multi_window
+List dentist_multi_window(SEXP LD, size_t nSample, const arma::vec& zScore, const std::vector<int>& windowStartIdx, const std::vector<int>& windowEndIdx, const std::vector<int>& fillStartIdx, const std::vector<int>& fillEndIdx, double pValueThreshold, float propSVD, bool gcControl, int nIter, double gPvalueThreshold, double duprThreshold, int ncpus, int seed, bool correct_chen_et_al_bug, bool truncated_eigen, bool profile);
+RcppExport SEXP _pecotmr_dentist_multi_window(SEXP LDSEXP, SEXP nSampleSEXP, SEXP zScoreSEXP, SEXP windowStartIdxSEXP, SEXP windowEndIdxSEXP, SEXP fillStartIdxSEXP, SEXP fillEndIdxSEXP, SEXP pValueThresholdSEXP, SEXP propSVDSEXP, SEXP gcControlSEXP, SEXP nIterSEXP, SEXP gPvalueThresholdSEXP, SEXP duprThresholdSEXP, SEXP ncpusSEXP, SEXP seedSEXP, SEXP correct_chen_et_al_bugSEXP, SEXP truncated_eigenSEXP, SEXP profileSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type LD(LDSEXP);
+    Rcpp::traits::input_parameter< size_t >::type nSample(nSampleSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type zScore(zScoreSEXP);
+    Rcpp::traits::input_parameter< const std::vector<int>& >::type windowStartIdx(windowStartIdxSEXP);
+    Rcpp::traits::input_parameter< const std::vector<int>& >::type windowEndIdx(windowEndIdxSEXP);
+    Rcpp::traits::input_parameter< const std::vector<int>& >::type fillStartIdx(fillStartIdxSEXP);
+    Rcpp::traits::input_parameter< const std::vector<int>& >::type fillEndIdx(fillEndIdxSEXP);
+    Rcpp::traits::input_parameter< double >::type pValueThreshold(pValueThresholdSEXP);
+    Rcpp::traits::input_parameter< float >::type propSVD(propSVDSEXP);
+    Rcpp::traits::input_parameter< bool >::type gcControl(gcControlSEXP);
+    Rcpp::traits::input_parameter< int >::type nIter(nIterSEXP);
+    Rcpp::traits::input_parameter< double >::type gPvalueThreshold(gPvalueThresholdSEXP);
+    Rcpp::traits::input_parameter< double >::type duprThreshold(duprThresholdSEXP);
+    Rcpp::traits::input_parameter< int >::type ncpus(ncpusSEXP);
+    Rcpp::traits::input_parameter< int >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< bool >::type correct_chen_et_al_bug(correct_chen_et_al_bugSEXP);
+    Rcpp::traits::input_parameter< bool >::type truncated_eigen(truncated_eigenSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    rcpp_result_gen = Rcpp::wrap(dentist_multi_window(LD, nSample, zScore, windowStartIdx, windowEndIdx, fillStartIdx, fillEndIdx, pValueThreshold, propSVD, gcControl, nIter, gPvalueThreshold, duprThreshold, ncpus, seed, correct_chen_et_al_bug, truncated_eigen, profile));
+    return rcpp_result_gen;
+END_RCPP
+}
+// ld_handle_rcpp
+SEXP ld_handle_rcpp(SEXP LD);
+RcppExport SEXP _pecotmr_ld_handle_rcpp(SEXP LDSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type LD(LDSEXP);
+    rcpp_result_gen = Rcpp::wrap(ld_handle_rcpp(LD));
+    return rcpp_result_gen;
+END_RCPP
+}
+// ld_handle_info
+Rcpp::List ld_handle_info(SEXP handle);
+RcppExport SEXP _pecotmr_ld_handle_info(SEXP handleSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type handle(handleSEXP);
+    rcpp_result_gen = Rcpp::wrap(ld_handle_info(handle));
     return rcpp_result_gen;
 END_RCPP
 }
 // rcpp_mr_ash_rss
-List rcpp_mr_ash_rss(const NumericVector& bhat, const NumericVector& shat, const NumericVector& z, const NumericMatrix& R, double var_y, int n, double sigma2_e, const NumericVector& s0, const NumericVector& w0, const NumericVector& mu1_init, double tol, int max_iter, bool update_w0, bool update_sigma, bool compute_ELBO, bool standardize, int ncpus);
-RcppExport SEXP _pecotmr_rcpp_mr_ash_rss(SEXP bhatSEXP, SEXP shatSEXP, SEXP zSEXP, SEXP RSEXP, SEXP var_ySEXP, SEXP nSEXP, SEXP sigma2_eSEXP, SEXP s0SEXP, SEXP w0SEXP, SEXP mu1_initSEXP, SEXP tolSEXP, SEXP max_iterSEXP, SEXP update_w0SEXP, SEXP update_sigmaSEXP, SEXP compute_ELBOSEXP, SEXP standardizeSEXP, SEXP ncpusSEXP) {
+List rcpp_mr_ash_rss(const NumericVector& bhat, const NumericVector& shat, const NumericVector& z, SEXP R, double var_y, int n, double sigma2_e, const NumericVector& s0, const NumericVector& w0, const NumericVector& mu1_init, double tol, int max_iter, bool update_w0, bool update_sigma, bool compute_ELBO, bool standardize, int ncpus, double concurrent_ld, bool squarem, double active_set_tol, int full_sweep_every, bool profile);
+RcppExport SEXP _pecotmr_rcpp_mr_ash_rss(SEXP bhatSEXP, SEXP shatSEXP, SEXP zSEXP, SEXP RSEXP, SEXP var_ySEXP, SEXP nSEXP, SEXP sigma2_eSEXP, SEXP s0SEXP, SEXP w0SEXP, SEXP mu1_initSEXP, SEXP tolSEXP, SEXP max_iterSEXP, SEXP update_w0SEXP, SEXP update_sigmaSEXP, SEXP compute_ELBOSEXP, SEXP standardizeSEXP, SEXP ncpusSEXP, SEXP concurrent_ldSEXP, SEXP squaremSEXP, SEXP active_set_tolSEXP, SEXP full_sweep_everySEXP, SEXP profileSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const NumericVector& >::type bhat(bhatSEXP);
     Rcpp::traits::input_parameter< const NumericVector& >::type shat(shatSEXP);
     Rcpp::traits::input_parameter< const NumericVector& >::type z(zSEXP);
-    Rcpp::traits::input_parameter< const NumericMatrix& >::type R(RSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type R(RSEXP);
     Rcpp::traits::input_parameter< double >::type var_y(var_ySEXP);
     Rcpp::traits::input_parameter< int >::type n(nSEXP);
     Rcpp::traits::input_parameter< double >::type sigma2_e(sigma2_eSEXP);
@@ -57,13 +127,50 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< bool >::type compute_ELBO(compute_ELBOSEXP);
     Rcpp::traits::input_parameter< bool >::type standardize(standardizeSEXP);
     Rcpp::traits::input_parameter< int >::type ncpus(ncpusSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_mr_ash_rss(bhat, shat, z, R, var_y, n, sigma2_e, s0, w0, mu1_init, tol, max_iter, update_w0, update_sigma, compute_ELBO, standardize, ncpus));
+    Rcpp::traits::input_parameter< double >::type concurrent_ld(concurrent_ldSEXP);
+    Rcpp::traits::input_parameter< bool >::type squarem(squaremSEXP);
+    Rcpp::traits::input_parameter< double >::type active_set_tol(active_set_tolSEXP);
+    Rcpp::traits::input_parameter< int >::type full_sweep_every(full_sweep_everySEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_mr_ash_rss(bhat, shat, z, R, var_y, n, sigma2_e, s0, w0, mu1_init, tol, max_iter, update_w0, update_sigma, compute_ELBO, standardize, ncpus, concurrent_ld, squarem, active_set_tol, full_sweep_every, profile));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_mr_ash_rss_multi
+List rcpp_mr_ash_rss_multi(const NumericMatrix& bhat, const NumericMatrix& shat, const NumericMatrix& z, SEXP R, const NumericVector& var_y, const IntegerVector& n, const NumericVector& sigma2_e, const List& s0, const List& w0, const NumericMatrix& mu1_init, double tol, int max_iter, bool update_w0, bool update_sigma, bool compute_ELBO, bool standardize, bool warm_start, int ncpus, double concurrent_ld, bool squarem, double active_set_tol, int full_sweep_every);
+RcppExport SEXP _pecotmr_rcpp_mr_ash_rss_multi(SEXP bhatSEXP, SEXP shatSEXP, SEXP zSEXP, SEXP RSEXP, SEXP var_ySEXP, SEXP nSEXP, SEXP sigma2_eSEXP, SEXP s0SEXP, SEXP w0SEXP, SEXP mu1_initSEXP, SEXP tolSEXP, SEXP max_iterSEXP, SEXP update_w0SEXP, SEXP update_sigmaSEXP, SEXP compute_ELBOSEXP, SEXP standardizeSEXP, SEXP warm_startSEXP, SEXP ncpusSEXP, SEXP concurrent_ldSEXP, SEXP squaremSEXP, SEXP active_set_tolSEXP, SEXP full_sweep_everySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type bhat(bhatSEXP);
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type shat(shatSEXP);
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type z(zSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type R(RSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type var_y(var_ySEXP);
+    Rcpp::traits::input_parameter< const IntegerVector& >::type n(nSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type sigma2_e(sigma2_eSEXP);
+    Rcpp::traits::input_parameter< const List& >::type s0(s0SEXP);
+    Rcpp::traits::input_parameter< const List& >::type w0(w0SEXP);
+    Rcpp::traits::input_parameter< const NumericMatrix& >::type mu1_init(mu1_initSEXP);
+    Rcpp::traits::input_parameter< double >::type tol(tolSEXP);
+    Rcpp::traits::input_parameter< int >::type max_iter(max_iterSEXP);
+    Rcpp::traits::input_parameter< bool >::type update_w0(update_w0SEXP);
+    Rcpp::traits::input_parameter< bool >::type update_sigma(update_sigmaSEXP);
+    Rcpp::traits::input_parameter< bool >::type compute_ELBO(compute_ELBOSEXP);
+    Rcpp::traits::input_parameter< bool >::type standardize(standardizeSEXP);
+    Rcpp::traits::input_parameter< bool >::type warm_start(warm_startSEXP);
+    Rcpp::traits::input_parameter< int >::type ncpus(ncpusSEXP);
+    Rcpp::traits::input_parameter< double >::type concurrent_ld(concurrent_ldSEXP);
+    Rcpp::traits::input_parameter< bool >::type squarem(squaremSEXP);
+    Rcpp::traits::input_parameter< double >::type active_set_tol(active_set_tolSEXP);
+    Rcpp::traits::input_parameter< int >::type full_sweep_every(full_sweep_everySEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_mr_ash_rss_multi(bhat, shat, z, R, var_y, n, sigma2_e, s0, w0, mu1_init, tol, max_iter, update_w0, update_sigma, compute_ELBO, standardize, warm_start, ncpus, concurrent_ld, squarem, active_set_tol, full_sweep_every));
     return rcpp_result_gen;
 END_RCPP
 }
 // prs_cs_rcpp
-Rcpp::List prs_cs_rcpp(double a, double b, Rcpp::Nullable<double> phi, Rcpp::NumericVector bhat, Rcpp::Nullable<Rcpp::NumericVector> maf, int n, Rcpp::List ld_blk, int n_iter, int n_burnin, int thin, bool verbose, Rcpp::Nullable<unsigned int> seed);
-RcppExport SEXP _pecotmr_prs_cs_rcpp(SEXP aSEXP, SEXP bSEXP, SEXP phiSEXP, SEXP bhatSEXP, SEXP mafSEXP, SEXP nSEXP, SEXP ld_blkSEXP, SEXP n_iterSEXP, SEXP n_burninSEXP, SEXP thinSEXP, SEXP verboseSEXP, SEXP seedSEXP) {
+Rcpp::List prs_cs_rcpp(double a, double b, Rcpp::Nullable<double> phi, Rcpp::NumericVector bhat, Rcpp::Nullable<Rcpp::NumericVector> maf, int n, SEXP ld_blk, int n_iter, int n_burnin, int thin, bool verbose, Rcpp::Nullable<unsigned int> seed, unsigned n_threads, const std::string& checkpoint_file, int checkpoint_every, double min_ess, bool profile);
+RcppExport SEXP _pecotmr_prs_cs_rcpp(SEXP aSEXP, SEXP bSEXP, SEXP phiSEXP, SEXP bhatSEXP, SEXP mafSEXP, SEXP nSEXP, SEXP ld_blkSEXP, SEXP n_iterSEXP, SEXP n_burninSEXP, SEXP thinSEXP, SEXP verboseSEXP, SEXP seedSEXP, SEXP n_threadsSEXP, SEXP checkpoint_fileSEXP, SEXP checkpoint_everySEXP, SEXP min_essSEXP, SEXP profileSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -73,19 +180,62 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< Rcpp::NumericVector >::type bhat(bhatSEXP);
     Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::NumericVector> >::type maf(mafSEXP);
     Rcpp::traits::input_parameter< int >::type n(nSEXP);
-    Rcpp::traits::input_parameter< Rcpp::List >::type ld_blk(ld_blkSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type ld_blk(ld_blkSEXP);
     Rcpp::traits::input_parameter< int >::type n_iter(n_iterSEXP);
     Rcpp::traits::input_parameter< int >::type n_burnin(n_burninSEXP);
     Rcpp::traits::input_parameter< int >::type thin(thinSEXP);
     Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
     Rcpp::traits::input_parameter< Rcpp::Nullable<unsigned int> >::type seed(seedSEXP);
-    rcpp_result_gen = Rcpp::wrap(prs_cs_rcpp(a, b, phi, bhat, maf, n, ld_blk, n_iter, n_burnin, thin, verbose, seed));
+    Rcpp::traits::input_parameter< unsigned >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type checkpoint_file(checkpoint_fileSEXP);
+    Rcpp::traits::input_parameter< int >::type checkpoint_every(checkpoint_everySEXP);
+    Rcpp::traits::input_parameter< double >::type min_ess(min_essSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    rcpp_result_gen = Rcpp::wrap(prs_cs_rcpp(a, b, phi, bhat, maf, n, ld_blk, n_iter, n_burnin, thin, verbose, seed, n_threads, checkpoint_file, checkpoint_every, min_ess, profile));
+    return rcpp_result_gen;
+END_RCPP
+}
+// prs_cs_grid_rcpp
+Rcpp::List prs_cs_grid_rcpp(double a, double b, Rcpp::NumericVector phi, Rcpp::NumericVector bhat, Rcpp::Nullable<Rcpp::NumericVector> maf, int n, SEXP ld_blk, int n_iter, int n_burnin, int thin, bool verbose, Rcpp::Nullable<unsigned int> seed, unsigned n_threads, const std::string& checkpoint_file, int checkpoint_every, double min_ess, bool profile);
+RcppExport SEXP _pecotmr_prs_cs_grid_rcpp(SEXP aSEXP, SEXP bSEXP, SEXP phiSEXP, SEXP bhatSEXP, SEXP mafSEXP, SEXP nSEXP, SEXP ld_blkSEXP, SEXP n_iterSEXP, SEXP n_burninSEXP, SEXP thinSEXP, SEXP verboseSEXP, SEXP seedSEXP, SEXP n_threadsSEXP, SEXP checkpoint_fileSEXP, SEXP checkpoint_everySEXP, SEXP min_essSEXP, SEXP profileSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< double >::type a(aSEXP);
+    Rcpp::traits::input_parameter< double >::type b(bSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type phi(phiSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type bhat(bhatSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::NumericVector> >::type maf(mafSEXP);
+    Rcpp::traits::input_parameter< int >::type n(nSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type ld_blk(ld_blkSEXP);
+    Rcpp::traits::input_parameter< int >::type n_iter(n_iterSEXP);
+    Rcpp::traits::input_parameter< int >::type n_burnin(n_burninSEXP);
+    Rcpp::traits::input_parameter< int >::type thin(thinSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<unsigned int> >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< unsigned >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type checkpoint_file(checkpoint_fileSEXP);
+    Rcpp::traits::input_parameter< int >::type checkpoint_every(checkpoint_everySEXP);
+    Rcpp::traits::input_parameter< double >::type min_ess(min_essSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    rcpp_result_gen = Rcpp::wrap(prs_cs_grid_rcpp(a, b, phi, bhat, maf, n, ld_blk, n_iter, n_burnin, thin, verbose, seed, n_threads, checkpoint_file, checkpoint_every, min_ess, profile));
+    return rcpp_result_gen;
+END_RCPP
+}
+// susie_fit_store_info
+Rcpp::List susie_fit_store_info(const std::string& file);
+RcppExport SEXP _pecotmr_susie_fit_store_info(SEXP fileSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type file(fileSEXP);
+    rcpp_result_gen = Rcpp::wrap(susie_fit_store_info(file));
     return rcpp_result_gen;
 END_RCPP
 }
 // qtl_enrichment_rcpp
-Rcpp::List qtl_enrichment_rcpp(SEXP r_gwas_pip, SEXP r_qtl_susie_fit, double pi_gwas, double pi_qtl, int ImpN, double shrinkage_lambda, int num_threads);
-RcppExport SEXP _pecotmr_qtl_enrichment_rcpp(SEXP r_gwas_pipSEXP, SEXP r_qtl_susie_fitSEXP, SEXP pi_gwasSEXP, SEXP pi_qtlSEXP, SEXP ImpNSEXP, SEXP shrinkage_lambdaSEXP, SEXP num_threadsSEXP) {
+Rcpp::List qtl_enrichment_rcpp(SEXP r_gwas_pip, SEXP r_qtl_susie_fit, double pi_gwas, double pi_qtl, int ImpN, double shrinkage_lambda, int num_threads, Rcpp::Nullable<unsigned int> seed, bool profile, bool coloc, double coloc_threshold);
+RcppExport SEXP _pecotmr_qtl_enrichment_rcpp(SEXP r_gwas_pipSEXP, SEXP r_qtl_susie_fitSEXP, SEXP pi_gwasSEXP, SEXP pi_qtlSEXP, SEXP ImpNSEXP, SEXP shrinkage_lambdaSEXP, SEXP num_threadsSEXP, SEXP seedSEXP, SEXP profileSEXP, SEXP colocSEXP, SEXP coloc_thresholdSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -96,18 +246,42 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< int >::type ImpN(ImpNSEXP);
     Rcpp::traits::input_parameter< double >::type shrinkage_lambda(shrinkage_lambdaSEXP);
     Rcpp::traits::input_parameter< int >::type num_threads(num_threadsSEXP);
-    rcpp_result_gen = Rcpp::wrap(qtl_enrichment_rcpp(r_gwas_pip, r_qtl_susie_fit, pi_gwas, pi_qtl, ImpN, shrinkage_lambda, num_threads));
+    Rcpp::traits::input_parameter< Rcpp::Nullable<unsigned int> >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    Rcpp::traits::input_parameter< bool >::type coloc(colocSEXP);
+    Rcpp::traits::input_parameter< double >::type coloc_threshold(coloc_thresholdSEXP);
+    rcpp_result_gen = Rcpp::wrap(qtl_enrichment_rcpp(r_gwas_pip, r_qtl_susie_fit, pi_gwas, pi_qtl, ImpN, shrinkage_lambda, num_threads, seed, profile, coloc, coloc_threshold));
+    return rcpp_result_gen;
+END_RCPP
+}
+// qtl_enrichment_multi_rcpp
+Rcpp::List qtl_enrichment_multi_rcpp(Rcpp::List r_gwas_pips, SEXP r_qtl_susie_fit, std::vector<double> pi_gwas, double pi_qtl, int ImpN, double shrinkage_lambda, int num_threads, Rcpp::Nullable<unsigned int> seed, bool coloc, double coloc_threshold);
+RcppExport SEXP _pecotmr_qtl_enrichment_multi_rcpp(SEXP r_gwas_pipsSEXP, SEXP r_qtl_susie_fitSEXP, SEXP pi_gwasSEXP, SEXP pi_qtlSEXP, SEXP ImpNSEXP, SEXP shrinkage_lambdaSEXP, SEXP num_threadsSEXP, SEXP seedSEXP, SEXP colocSEXP, SEXP coloc_thresholdSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type r_gwas_pips(r_gwas_pipsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type r_qtl_susie_fit(r_qtl_susie_fitSEXP);
+    Rcpp::traits::input_parameter< std::vector<double> >::type pi_gwas(pi_gwasSEXP);
+    Rcpp::traits::input_parameter< double >::type pi_qtl(pi_qtlSEXP);
+    Rcpp::traits::input_parameter< int >::type ImpN(ImpNSEXP);
+    Rcpp::traits::input_parameter< double >::type shrinkage_lambda(shrinkage_lambdaSEXP);
+    Rcpp::traits::input_parameter< int >::type num_threads(num_threadsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<unsigned int> >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< bool >::type coloc(colocSEXP);
+    Rcpp::traits::input_parameter< double >::type coloc_threshold(coloc_thresholdSEXP);
+    rcpp_result_gen = Rcpp::wrap(qtl_enrichment_multi_rcpp(r_gwas_pips, r_qtl_susie_fit, pi_gwas, pi_qtl, ImpN, shrinkage_lambda, num_threads, seed, coloc, coloc_threshold));
     return rcpp_result_gen;
 END_RCPP
 }
 // sdpr_rcpp
-Rcpp::List sdpr_rcpp(const std::vector<double>& bhat, const Rcpp::List& LD, int n, Rcpp::Nullable<Rcpp::NumericVector> per_variant_sample_size, Rcpp::Nullable<Rcpp::IntegerVector> array, double a, double c, size_t M, double a0k, double b0k, int iter, int burn, int thin, unsigned n_threads, int opt_llk, bool verbose);
-RcppExport SEXP _pecotmr_sdpr_rcpp(SEXP bhatSEXP, SEXP LDSEXP, SEXP nSEXP, SEXP per_variant_sample_sizeSEXP, SEXP arraySEXP, SEXP aSEXP, SEXP cSEXP, SEXP MSEXP, SEXP a0kSEXP, SEXP b0kSEXP, SEXP iterSEXP, SEXP burnSEXP, SEXP thinSEXP, SEXP n_threadsSEXP, SEXP opt_llkSEXP, SEXP verboseSEXP) {
+Rcpp::List sdpr_rcpp(const std::vector<double>& bhat, SEXP LD, int n, Rcpp::Nullable<Rcpp::NumericVector> per_variant_sample_size, Rcpp::Nullable<Rcpp::IntegerVector> array, double a, double c, size_t M, double a0k, double b0k, int iter, int burn, int thin, unsigned n_threads, int opt_llk, bool verbose, Rcpp::Nullable<unsigned int> seed, const std::string& ld_cache_dir, unsigned n_chains, bool compact_ld, const std::string& checkpoint_file, int checkpoint_every, double min_ess, bool profile, size_t active_buffer);
+RcppExport SEXP _pecotmr_sdpr_rcpp(SEXP bhatSEXP, SEXP LDSEXP, SEXP nSEXP, SEXP per_variant_sample_sizeSEXP, SEXP arraySEXP, SEXP aSEXP, SEXP cSEXP, SEXP MSEXP, SEXP a0kSEXP, SEXP b0kSEXP, SEXP iterSEXP, SEXP burnSEXP, SEXP thinSEXP, SEXP n_threadsSEXP, SEXP opt_llkSEXP, SEXP verboseSEXP, SEXP seedSEXP, SEXP ld_cache_dirSEXP, SEXP n_chainsSEXP, SEXP compact_ldSEXP, SEXP checkpoint_fileSEXP, SEXP checkpoint_everySEXP, SEXP min_essSEXP, SEXP profileSEXP, SEXP active_bufferSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const std::vector<double>& >::type bhat(bhatSEXP);
-    Rcpp::traits::input_parameter< const Rcpp::List& >::type LD(LDSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type LD(LDSEXP);
     Rcpp::traits::input_parameter< int >::type n(nSEXP);
     Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::NumericVector> >::type per_variant_sample_size(per_variant_sample_sizeSEXP);
     Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::IntegerVector> >::type array(arraySEXP);
@@ -122,17 +296,83 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< unsigned >::type n_threads(n_threadsSEXP);
     Rcpp::traits::input_parameter< int >::type opt_llk(opt_llkSEXP);
     Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
-    rcpp_result_gen = Rcpp::wrap(sdpr_rcpp(bhat, LD, n, per_variant_sample_size, array, a, c, M, a0k, b0k, iter, burn, thin, n_threads, opt_llk, verbose));
+    Rcpp::traits::input_parameter< Rcpp::Nullable<unsigned int> >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type ld_cache_dir(ld_cache_dirSEXP);
+    Rcpp::traits::input_parameter< unsigned >::type n_chains(n_chainsSEXP);
+    Rcpp::traits::input_parameter< bool >::type compact_ld(compact_ldSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type checkpoint_file(checkpoint_fileSEXP);
+    Rcpp::traits::input_parameter< int >::type checkpoint_every(checkpoint_everySEXP);
+    Rcpp::traits::input_parameter< double >::type min_ess(min_essSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    Rcpp::traits::input_parameter< size_t >::type active_buffer(active_bufferSEXP);
+    rcpp_result_gen = Rcpp::wrap(sdpr_rcpp(bhat, LD, n, per_variant_sample_size, array, a, c, M, a0k, b0k, iter, burn, thin, n_threads, opt_llk, verbose, seed, ld_cache_dir, n_chains, compact_ld, checkpoint_file, checkpoint_every, min_ess, profile, active_buffer));
+    return rcpp_result_gen;
+END_RCPP
+}
+
+// sdpr_multi_rcpp
+Rcpp::List sdpr_multi_rcpp(const arma::mat& bhat, SEXP LD, int n, Rcpp::Nullable<Rcpp::NumericVector> per_variant_sample_size, Rcpp::Nullable<Rcpp::IntegerVector> array, double a, double c, size_t M, double a0k, double b0k, int iter, int burn, int thin, unsigned n_threads, int opt_llk, bool verbose, Rcpp::Nullable<unsigned int> seed, const std::string& ld_cache_dir, unsigned n_chains, bool compact_ld, const std::string& checkpoint_file, int checkpoint_every, double min_ess, bool profile, size_t active_buffer);
+RcppExport SEXP _pecotmr_sdpr_multi_rcpp(SEXP bhatSEXP, SEXP LDSEXP, SEXP nSEXP, SEXP per_variant_sample_sizeSEXP, SEXP arraySEXP, SEXP aSEXP, SEXP cSEXP, SEXP MSEXP, SEXP a0kSEXP, SEXP b0kSEXP, SEXP iterSEXP, SEXP burnSEXP, SEXP thinSEXP, SEXP n_threadsSEXP, SEXP opt_llkSEXP, SEXP verboseSEXP, SEXP seedSEXP, SEXP ld_cache_dirSEXP, SEXP n_chainsSEXP, SEXP compact_ldSEXP, SEXP checkpoint_fileSEXP, SEXP checkpoint_everySEXP, SEXP min_essSEXP, SEXP profileSEXP, SEXP active_bufferSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const arma::mat& >::type bhat(bhatSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type LD(LDSEXP);
+    Rcpp::traits::input_parameter< int >::type n(nSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::NumericVector> >::type per_variant_sample_size(per_variant_sample_sizeSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::IntegerVector> >::type array(arraySEXP);
+    Rcpp::traits::input_parameter< double >::type a(aSEXP);
+    Rcpp::traits::input_parameter< double >::type c(cSEXP);
+    Rcpp::traits::input_parameter< size_t >::type M(MSEXP);
+    Rcpp::traits::input_parameter< double >::type a0k(a0kSEXP);
+    Rcpp::traits::input_parameter< double >::type b0k(b0kSEXP);
+    Rcpp::traits::input_parameter< int >::type iter(iterSEXP);
+    Rcpp::traits::input_parameter< int >::type burn(burnSEXP);
+    Rcpp::traits::input_parameter< int >::type thin(thinSEXP);
+    Rcpp::traits::input_parameter< unsigned >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< int >::type opt_llk(opt_llkSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<unsigned int> >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type ld_cache_dir(ld_cache_dirSEXP);
+    Rcpp::traits::input_parameter< unsigned >::type n_chains(n_chainsSEXP);
+    Rcpp::traits::input_parameter< bool >::type compact_ld(compact_ldSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type checkpoint_file(checkpoint_fileSEXP);
+    Rcpp::traits::input_parameter< int >::type checkpoint_every(checkpoint_everySEXP);
+    Rcpp::traits::input_parameter< double >::type min_ess(min_essSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    Rcpp::traits::input_parameter< size_t >::type active_buffer(active_bufferSEXP);
+    rcpp_result_gen = Rcpp::wrap(sdpr_multi_rcpp(bhat, LD, n, per_variant_sample_size, array, a, c, M, a0k, b0k, iter, burn, thin, n_threads, opt_llk, verbose, seed, ld_cache_dir, n_chains, compact_ld, checkpoint_file, checkpoint_every, min_ess, profile, active_buffer));
+    return rcpp_result_gen;
+END_RCPP
+}
+
+// thread_budget_info
+Rcpp::List thread_budget_info();
+RcppExport SEXP _pecotmr_thread_budget_info() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(thread_budget_info());
     return rcpp_result_gen;
 END_RCPP
 }
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_pecotmr_dentist_iterative_impute", (DL_FUNC) &_pecotmr_dentist_iterative_impute, 12},
-    {"_pecotmr_rcpp_mr_ash_rss", (DL_FUNC) &_pecotmr_rcpp_mr_ash_rss, 17},
-    {"_pecotmr_prs_cs_rcpp", (DL_FUNC) &_pecotmr_prs_cs_rcpp, 12},
-    {"_pecotmr_qtl_enrichment_rcpp", (DL_FUNC) &_pecotmr_qtl_enrichment_rcpp, 7},
-    {"_pecotmr_sdpr_rcpp", (DL_FUNC) &_pecotmr_sdpr_rcpp, 16},
+    {"_pecotmr_coloc_bf_bf_rcpp", (DL_FUNC) &_pecotmr_coloc_bf_bf_rcpp, 8},
+    {"_pecotmr_dentist_iterative_impute", (DL_FUNC) &_pecotmr_dentist_iterative_impute, 14},
+    {"_pecotmr_dentist_multi_window", (DL_FUNC) &_pecotmr_dentist_multi_window, 18},
+    {"_pecotmr_ld_handle_rcpp", (DL_FUNC) &_pecotmr_ld_handle_rcpp, 1},
+    {"_pecotmr_ld_handle_info", (DL_FUNC) &_pecotmr_ld_handle_info, 1},
+    {"_pecotmr_rcpp_mr_ash_rss", (DL_FUNC) &_pecotmr_rcpp_mr_ash_rss, 22},
+    {"_pecotmr_rcpp_mr_ash_rss_multi", (DL_FUNC) &_pecotmr_rcpp_mr_ash_rss_multi, 22},
+    {"_pecotmr_prs_cs_rcpp", (DL_FUNC) &_pecotmr_prs_cs_rcpp, 17},
+    {"_pecotmr_prs_cs_grid_rcpp", (DL_FUNC) &_pecotmr_prs_cs_grid_rcpp, 17},
+    {"_pecotmr_susie_fit_store_info", (DL_FUNC) &_pecotmr_susie_fit_store_info, 1},
+    {"_pecotmr_qtl_enrichment_rcpp", (DL_FUNC) &_pecotmr_qtl_enrichment_rcpp, 11},
+    {"_pecotmr_qtl_enrichment_multi_rcpp", (DL_FUNC) &_pecotmr_qtl_enrichment_multi_rcpp, 10},
+    {"_pecotmr_sdpr_rcpp", (DL_FUNC) &_pecotmr_sdpr_rcpp, 25},
+    {"_pecotmr_sdpr_multi_rcpp", (DL_FUNC) &_pecotmr_sdpr_multi_rcpp, 25},
+    {"_pecotmr_thread_budget_info", (DL_FUNC) &_pecotmr_thread_budget_info, 0},
     {NULL, NULL, 0}
 };
 
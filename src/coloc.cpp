@@ -0,0 +1,90 @@
+#include <RcppArmadillo.h>
+#include "coloc.h"
+#include "thread_budget_rcpp.h"
+
+// 1-based variant positions from R to 0-based columns of a matrix with n_cols columns
+static std::vector<size_t> variant_columns(const Rcpp::IntegerVector& index, size_t n_cols) {
+	std::vector<size_t> columns(index.size());
+	for (R_xlen_t k = 0; k < index.size(); k++) {
+		if (index[k] < 1 || static_cast<size_t>(index[k]) > n_cols) {
+			Rcpp::stop("Variant index out of the columns of the log Bayes factor matrix.");
+		}
+		columns[k] = index[k] - 1;
+	}
+	return columns;
+}
+
+/**
+ * @brief coloc.bf_bf for a batch of pairs of SuSiE log Bayes factor matrices.
+ *
+ * @param bf1 List of matrices of log Bayes factors of the first trait, one row per single effect.
+ * @param bf2 List of matrices of the second trait, one per matrix of bf1.
+ * @param idx1 List of the 1-based column in bf1[[t]] of every variant shared by pair t.
+ * @param idx2 List of the column in bf2[[t]] of the same variants, in the same order.
+ * @param p1, p2, p12 Priors of each pair.
+ * @param num_threads Threads over all the effect pairs of the batch.
+ * @return One list per pair of matrices with `hit1` and `hit2`, the top shared
+ *         variant of each effect (1-based in idx1), `idx1` and `idx2`, the effects
+ *         of every effect pair, `pp`, the pairs x 5 matrix of PP.H0-H4, and
+ *         `snp_pp`, the variants x pairs matrix of SNP.PP.H4.
+ */
+// [[Rcpp::export]]
+Rcpp::List coloc_bf_bf_rcpp(Rcpp::List bf1, Rcpp::List bf2, Rcpp::List idx1, Rcpp::List idx2,
+                            std::vector<double> p1, std::vector<double> p2, std::vector<double> p12,
+                            int num_threads = 1) {
+	size_t n_jobs = bf1.size();
+	if (static_cast<size_t>(bf2.size()) != n_jobs || static_cast<size_t>(idx1.size()) != n_jobs ||
+	    static_cast<size_t>(idx2.size()) != n_jobs || p1.size() != n_jobs || p2.size() != n_jobs || p12.size() != n_jobs) {
+		Rcpp::stop("bf1, bf2, idx1, idx2, p1, p2 and p12 must have one element per pair of matrices.");
+	}
+	thread_budget budget(num_threads, thread_limit());
+
+	// Effects gathered once per matrix, and the outputs allocated, on the main thread
+	std::vector<coloc_effects> effects1, effects2;
+	effects1.reserve(n_jobs);
+	effects2.reserve(n_jobs);
+	std::vector<Rcpp::NumericMatrix> pp, snp_pp;
+	for (size_t t = 0; t < n_jobs; t++) {
+		Rcpp::NumericMatrix m1 = bf1[t], m2 = bf2[t];
+		Rcpp::IntegerVector v1 = idx1[t], v2 = idx2[t];
+		if (v1.size() != v2.size() || v1.size() == 0) {
+			Rcpp::stop("Each pair of matrices must share at least one variant, indexed in both.");
+		}
+		effects1.emplace_back(m1.begin(), m1.nrow(), variant_columns(v1, m1.ncol()));
+		effects2.emplace_back(m2.begin(), m2.nrow(), variant_columns(v2, m2.ncol()));
+		size_t n_pairs = m1.nrow() * m2.nrow();
+		pp.push_back(Rcpp::NumericMatrix(n_pairs, 5));
+		snp_pp.push_back(Rcpp::NumericMatrix(v1.size(), n_pairs));
+	}
+	std::vector<coloc_job> jobs(n_jobs);
+	for (size_t t = 0; t < n_jobs; t++) {
+		jobs[t] = {&effects1[t], &effects2[t], p1[t], p2[t], p12[t], pp[t].begin(), snp_pp[t].begin()};
+	}
+
+	coloc_bf_bf_batch(jobs, budget.engine_threads());
+
+	Rcpp::List output(n_jobs);
+	for (size_t t = 0; t < n_jobs; t++) {
+		const coloc_effects& e1 = effects1[t];
+		const coloc_effects& e2 = effects2[t];
+		size_t n_pairs = jobs[t].n_pairs();
+		Rcpp::IntegerVector hit1(n_pairs), hit2(n_pairs), pair1(n_pairs), pair2(n_pairs);
+		for (size_t q = 0; q < n_pairs; q++) {
+			size_t i = q % e1.n_effects, j = q / e1.n_effects;
+			pair1[q] = i + 1;
+			pair2[q] = j + 1;
+			hit1[q] = e1.hit[i] + 1;
+			hit2[q] = e2.hit[j] + 1;
+		}
+		Rcpp::colnames(pp[t]) = Rcpp::CharacterVector::create("PP.H0.abf", "PP.H1.abf", "PP.H2.abf", "PP.H3.abf", "PP.H4.abf");
+		output[t] = Rcpp::List::create(
+			Rcpp::Named("hit1") = hit1,
+			Rcpp::Named("hit2") = hit2,
+			Rcpp::Named("idx1") = pair1,
+			Rcpp::Named("idx2") = pair2,
+			Rcpp::Named("pp") = pp[t],
+			Rcpp::Named("snp_pp") = snp_pp[t]
+			);
+	}
+	return output;
+}
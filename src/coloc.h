@@ -0,0 +1,149 @@
+#ifndef COLOC_H
+#define COLOC_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+#include <omp.h>
+#include "log_sum_exp.h"
+
+/**
+ * @brief The single effects of one trait at the variants shared with the other.
+ *
+ * The log Bayes factors are gathered once, through the integer position of
+ * every shared variant in the trait's matrix, into contiguous rows, with the
+ * log-sum-exp and the top variant of each effect, which every pair it enters
+ * reuses.
+ */
+struct coloc_effects {
+	size_t n_effects, n_variants;
+	std::vector<double> lbf;
+	std::vector<double> log_sum;
+	std::vector<size_t> hit;
+
+	/**
+	 * @param bf Column-major n_rows x n_cols matrix of log Bayes factors, one row per effect.
+	 * @param variants Column of each shared variant in bf, 0-based.
+	 */
+	coloc_effects(const double* bf, size_t n_rows, const std::vector<size_t>& variants)
+		: n_effects(n_rows), n_variants(variants.size()), lbf(n_rows * variants.size()),
+		log_sum(n_rows), hit(n_rows, 0) {
+		for (size_t i = 0; i < n_effects; i++) {
+			double* row = effect(i);
+			for (size_t k = 0; k < n_variants; k++) {
+				row[k] = bf[i + variants[k] * n_rows];
+				if (row[k] > row[hit[i]]) {
+					hit[i] = k;
+				}
+			}
+			log_sum[i] = log_sum_exp(row, n_variants);
+		}
+	}
+
+	double* effect(size_t i) {
+		return &lbf[i * n_variants];
+	}
+	const double* effect(size_t i) const {
+		return &lbf[i * n_variants];
+	}
+};
+
+/**
+ * @brief Posterior probabilities of H0-H4 for one pair of single effects, as
+ *        `coloc::combine.abf`, and the SNP.PP.H4 of each shared variant.
+ *
+ * With a and b the log Bayes factors of the two effects, A = logsum(a),
+ * B = logsum(b) and S = logsum(a + b), the log ABF of the hypotheses are
+ * 0, log(p1) + A, log(p2) + B, log(p1) + log(p2) + log(exp(A + B) - exp(S))
+ * and log(p12) + S, and SNP.PP.H4 = exp(a + b - S).
+ *
+ * @param pp The 5 posterior probabilities, `stride` apart.
+ * @param snp_pp The n_variants values of SNP.PP.H4.
+ */
+inline void coloc_abf_pair(const coloc_effects& e1, size_t i, const coloc_effects& e2, size_t j,
+                           double log_p1, double log_p2, double log_p12, double* pp, size_t stride, double* snp_pp) {
+	const size_t n = e1.n_variants;
+	const double* a = e1.effect(i);
+	const double* b = e2.effect(j);
+
+	// log-sum-exp over a + b, with SNP.PP.H4 left in snp_pp
+	double u = -std::numeric_limits<double>::infinity();
+	#pragma omp simd reduction(max:u)
+	for (size_t k = 0; k < n; k++) {
+		snp_pp[k] = a[k] + b[k];
+		u = std::max(u, snp_pp[k]);
+	}
+	double total = 0;
+	#pragma omp simd reduction(+:total)
+	for (size_t k = 0; k < n; k++) {
+		snp_pp[k] = exp_nonpositive(snp_pp[k] - u);
+		total += snp_pp[k];
+	}
+	double inv_total = 1 / total;
+	#pragma omp simd
+	for (size_t k = 0; k < n; k++) {
+		snp_pp[k] *= inv_total;
+	}
+	double S = u + std::log(total);
+
+	double A = e1.log_sum[i], B = e2.log_sum[j];
+	double lH[5];
+	lH[0] = 0;
+	lH[1] = log_p1 + A;
+	lH[2] = log_p2 + B;
+	// A + B >= S, the difference vanishes with a single shared variant
+	lH[3] = log_p1 + log_p2 + A + B + std::log1p(-std::exp(S - A - B));
+	lH[4] = log_p12 + S;
+	double denom = log_sum_exp(lH, 5);
+	for (int h = 0; h < 5; h++) {
+		pp[h * stride] = std::exp(lH[h] - denom);
+	}
+}
+
+/**
+ * @brief One pair of traits of a batch: every effect of the first against every
+ *        effect of the second, with the first trait's effect varying fastest.
+ */
+struct coloc_job {
+	const coloc_effects* e1;
+	const coloc_effects* e2;
+	double p1, p2, p12;
+	/// Column-major n_pairs x 5 matrix of PP.H0-H4
+	double* pp;
+	/// Column-major n_variants x n_pairs matrix of SNP.PP.H4
+	double* snp_pp;
+
+	size_t n_pairs() const {
+		return e1->n_effects * e2->n_effects;
+	}
+};
+
+/**
+ * @brief Colocalization of every pair of effects of every job of a batch.
+ *
+ * The pairs of all jobs are scheduled together over `n_threads` threads, so a
+ * batch of many small regions or contexts keeps every thread busy. Each pair
+ * writes its own rows of the output, and the results do not depend on the
+ * number of threads.
+ */
+inline void coloc_bf_bf_batch(const std::vector<coloc_job>& jobs, int n_threads) {
+	std::vector<size_t> offset(jobs.size() + 1, 0);
+	for (size_t t = 0; t < jobs.size(); t++) {
+		offset[t + 1] = offset[t] + jobs[t].n_pairs();
+	}
+	const long n_total = static_cast<long>(offset.back());
+
+	#pragma omp parallel for schedule(dynamic, 16) num_threads(n_threads)
+	for (long q = 0; q < n_total; q++) {
+		size_t t = std::upper_bound(offset.begin(), offset.end(), static_cast<size_t>(q)) - offset.begin() - 1;
+		const coloc_job& job = jobs[t];
+		size_t pair = q - offset[t];
+		size_t i = pair % job.e1->n_effects, j = pair / job.e1->n_effects;
+		coloc_abf_pair(*job.e1, i, *job.e2, j, std::log(job.p1), std::log(job.p2), std::log(job.p12),
+		               job.pp + pair, job.n_pairs(), job.snp_pp + pair * job.e1->n_variants);
+	}
+}
+
+#endif // COLOC_H
@@ -0,0 +1,53 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/// 128-bit content hash, used to name and validate files derived from the inputs of a run
+struct content_hash {
+	uint64_t h[2];
+};
+
+// 64-bit mixing function (the splitmix64 finalizer)
+inline uint64_t mix64(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+// Two independent streaming hashes of a sequence of 64-bit words
+class content_hasher {
+public:
+content_hasher() : h0(0x243f6a8885a308d3ULL), h1(0x13198a2e03707344ULL) {
+}
+void add(uint64_t w) {
+	h0 = mix64(h0 ^ w) + 0x9e3779b97f4a7c15ULL;
+	h1 = mix64(h1 + w * 0xff51afd7ed558ccdULL) ^ (h1 >> 17);
+}
+void add(double x) {
+	uint64_t w;
+	std::memcpy(&w, &x, sizeof(w));
+	add(w);
+}
+void add(const double* x, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		add(x[i]);
+	}
+}
+content_hash digest() const {
+	content_hash k;
+	k.h[0] = mix64(h0);
+	k.h[1] = mix64(h1 ^ h0);
+	return k;
+}
+
+private:
+uint64_t h0, h1;
+};
+
+#endif // CONTENT_HASH_H
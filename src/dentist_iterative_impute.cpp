@@ -8,10 +8,17 @@
 #include <RcppArmadillo.h>
 #include <omp.h> // Required for parallel processing
 #include <algorithm>
+#include <memory>
+#include <numeric>
 #include <random>
 #include <vector>
 #include <gsl/gsl_cdf.h>
+#include <stdexcept>
+#include <string>
 #include <unordered_set>
+#include "engine_profile_rcpp.h"
+#include "ld_blocks.h"
+#include "thread_budget_rcpp.h"
 
 // Enable C++11 via this plugin (Rcpp 0.10.3 or later)
 // [[Rcpp::depends(RcppArmadillo)]]
@@ -21,6 +28,27 @@
 using namespace Rcpp;
 using namespace arma;
 
+// Phases and counters of a DENTIST call (see engine_profile). They are timed on the thread that runs the
+// window, so with windows run in parallel (dentist_multi_window()) they are summed over threads. eigenpairs
+// sums the K eigenpairs used by every imputation pass.
+enum dentist_phase {
+	DENTIST_PHASE_DEDUPLICATE = 0,
+	DENTIST_PHASE_GATHER,
+	DENTIST_PHASE_EIGEN,
+	DENTIST_PHASE_IMPUTE,
+	DENTIST_PHASE_QC
+};
+enum dentist_counter {
+	DENTIST_COUNT_WINDOWS = 0,
+	DENTIST_COUNT_ITERATIONS,
+	DENTIST_COUNT_IMPUTATIONS,
+	DENTIST_COUNT_EIGENPAIRS
+};
+static engine_profile dentist_profile() {
+	return engine_profile({"deduplicate", "gather", "eigen", "impute", "qc"},
+	                      {"windows", "iterations", "imputations", "eigenpairs"});
+}
+
 std::vector<size_t> generateSetOfNumbers(size_t size, unsigned int seed) {
 	std::vector<size_t> indexes(size);
 	std::iota(indexes.begin(), indexes.end(), 0);
@@ -29,58 +57,166 @@ std::vector<size_t> generateSetOfNumbers(size_t size, unsigned int seed) {
 	return indexes;
 }
 
-// Get a quantile value
-double getQuantile(const std::vector<double>& dat, double whichQuantile) {
-	std::vector<double> sortedData = dat;
-	std::sort(sortedData.begin(), sortedData.end());
-	size_t pos = ceil(sortedData.size() * whichQuantile) - 1;
-	return sortedData.at(pos);
+// Get a quantile value: the ceil(n * whichQuantile)-th smallest of dat, which is reordered
+double getQuantile(std::vector<double>& dat, double whichQuantile) {
+	size_t pos = dat.empty() ? 0 : static_cast<size_t>(ceil(dat.size() * whichQuantile)) - 1;
+	if (pos >= dat.size()) {
+		throw std::out_of_range("getQuantile(): no value at quantile " + std::to_string(whichQuantile));
+	}
+	std::nth_element(dat.begin(), dat.begin() + pos, dat.end());
+	return dat[pos];
 }
 
-// Get a quantile value based on grouping
-double getQuantile2(const std::vector<double>& dat, const std::vector<size_t>& grouping, double whichQuantile, bool invert_grouping = false) {
-	std::vector<double> filteredData;
+// Buffers of getGroupQuantiles(), reused across iterations
+struct quantileBuffers {
+	std::vector<double> all, group1, group0;
+};
+
+// Get the quantile of dat, and within the markers of grouping 1 and 0 (threshold1 and threshold0,
+// 0 for a group of fewer than 50 markers), from one partitioning pass and a selection per group
+void getGroupQuantiles(const std::vector<double>& dat, const std::vector<size_t>& grouping, double whichQuantile,
+                       quantileBuffers& buf, double& threshold, double& threshold1, double& threshold0) {
+	buf.all.assign(dat.begin(), dat.end());
+	buf.group1.clear();
+	buf.group0.clear();
 	for (size_t i = 0; i < dat.size(); ++i) {
-		// Apply grouping filter with optional inversion
-		if ((grouping[i] == 1) != invert_grouping) {
-			filteredData.push_back(dat[i]);
-		}
+		(grouping[i] == 1 ? buf.group1 : buf.group0).push_back(dat[i]);
+	}
+	threshold = getQuantile(buf.all, whichQuantile);
+	threshold1 = buf.group1.size() < 50 ? 0 : getQuantile(buf.group1, whichQuantile);
+	threshold0 = buf.group0.size() < 50 ? 0 : getQuantile(buf.group0, whichQuantile);
+}
+
+// Chi-squared statistic (1 df) above which the p-value is below pValue
+double chisqCutoff(double pValue) {
+	return gsl_cdf_chisq_Qinv(pValue, 1.0);
+}
+
+// Top eigenpairs of the symmetric n x n matrix A, given as the product multiply(Q) = A * Q, by randomized
+// subspace iteration (Halko, Martinsson & Tropp 2011, Algorithms 4.4 and 5.3), in ascending order like
+// arma::eig_sym. The subspace is twice as large as the K pairs that are used: with four power iterations
+// this recovers them closely even where the LD spectrum is flat around the K-th eigenvalue.
+template <typename MultiplyT>
+void truncatedEigSym(arma::vec& eigval, arma::mat& eigvec, size_t n, MultiplyT multiply, size_t K, unsigned int seed) {
+	const int nPower = 4;
+	size_t l = std::min(n, 2 * K);
+	std::mt19937 gen(seed);
+	std::normal_distribution<double> normal;
+	arma::mat Q(n, l);
+	Q.imbue([&]() {
+		return normal(gen);
+	});
+	arma::mat Y, R;
+	for (int q = 0; q <= nPower; ++q) {
+		Y = multiply(Q);
+		arma::qr_econ(Q, R, Y);
+	}
+	arma::mat B = Q.t() * multiply(Q);
+	arma::mat U;
+	arma::eig_sym(eigval, U, arma::symmatu(B));
+	eigvec = Q * U;
+}
+
+// The LD of the markers as read by oneIteration(), from a dense matrix or from a low-rank factor
+// (ld_factor, R = F F') that is never formed
+size_t ldSize(const arma::mat& LD_mat) {
+	return LD_mat.n_rows;
+}
+size_t ldSize(const ld_factor& LD_mat) {
+	return LD_mat.n_variants();
+}
+double ldEntry(const arma::mat& LD_mat, size_t i, size_t j) {
+	return LD_mat(i, j);
+}
+double ldEntry(const ld_factor& LD_mat, size_t i, size_t j) {
+	return LD_mat.entry(i, j);
+}
+
+// The LD among the markers idx of one iteration (VV) and between idx2 and idx (LD_it), gathered from a
+// dense LD matrix; LD_mat is symmetric, so LD_it(i, k) = LD_mat(idx2[i], idx[k])
+class denseLDGather {
+public:
+denseLDGather(const arma::mat& LD_mat, const arma::uvec& ld_idx, const arma::uvec& ld_idx2)
+	: LD_it(LD_mat.submat(ld_idx2, ld_idx)), VV(LD_mat.submat(ld_idx, ld_idx)) {
+}
+
+// Eigen decomposition of VV, in ascending order; only the top K pairs are computed in truncated mode,
+// unless their subspace would cover half of VV, where the full decomposition is as fast
+void eigen(arma::vec& eigval, arma::mat& eigvec, size_t K, bool truncatedEigen, unsigned int seed) const {
+	if (truncatedEigen && 4 * K < VV.n_rows) {
+		truncatedEigSym(eigval, eigvec, VV.n_rows, [&](const arma::mat& Q) {
+			return arma::mat(VV * Q);
+		}, K, seed);
+	} else {
+		arma::eig_sym(eigval, eigvec, VV);
 	}
-	if (filteredData.size() < 50) return 0;
-	return getQuantile(filteredData, whichQuantile);
+}
+// LD_it * ui
+arma::mat cross(const arma::mat& ui) const {
+	return LD_it * ui;
 }
 
-// Get a quantile value based on grouping
-double getQuantile2_chen_et_al(const std::vector<double> &dat, std::vector<size_t> grouping, double whichQuantile)
-{
-	size_t sum = std::accumulate(grouping.begin(), grouping.end(), 0);
+private:
+arma::mat LD_it, VV;
+};
+
+// The same from a low-rank factor: with F and F2 the loadings of idx and idx2, VV = F F' and
+// LD_it = F2 F', so the eigenpairs of VV are the left singular vectors and squared singular values of F,
+// and the gathers take O(|idx| k) memory
+class factorLDGather {
+public:
+factorLDGather(const ld_factor& LD_mat, const arma::uvec& ld_idx, const arma::uvec& ld_idx2)
+	: F(loadings(LD_mat, ld_idx)), F2(loadings(LD_mat, ld_idx2)) {
+}
 
-	if (sum < 50)
-	{
-		return 0;
+void eigen(arma::vec& eigval, arma::mat& eigvec, size_t K, bool truncatedEigen, unsigned int seed) const {
+	if (truncatedEigen && 4 * K < std::min(F.n_rows, F.n_cols)) {
+		truncatedEigSym(eigval, eigvec, F.n_rows, [&](const arma::mat& Q) {
+			return arma::mat(F * (F.t() * Q));
+		}, K, seed);
+	} else {
+		arma::mat U, V;
+		arma::vec d;
+		arma::svd_econ(U, d, V, F, 'l');
+		eigval = arma::reverse(arma::square(d));
+		eigvec = arma::fliplr(U);
 	}
+}
+arma::mat cross(const arma::mat& ui) const {
+	return F2 * (F.t() * ui);
+}
 
-	std::vector<double> diff2;
-	for (size_t i = 0; i < dat.size(); i++)
-	{
-		if (grouping[i] == 1)
-			diff2.push_back(dat[i]);
+private:
+// Rows ld_idx of the factor, in double precision
+static arma::mat loadings(const ld_factor& LD_mat, const arma::uvec& ld_idx) {
+	arma::mat Ft(LD_mat.rank(), ld_idx.n_elem);
+	for (size_t i = 0; i < ld_idx.n_elem; ++i) {
+		const float* f = LD_mat.loadings(ld_idx[i]);
+		std::copy(f, f + LD_mat.rank(), Ft.colptr(i));
 	}
-	return getQuantile(diff2, whichQuantile);
+	return Ft.t();
 }
 
-// Calculate minus log p-value of chi-squared statistic
-double minusLogPvalueChisq2(double stat) {
-	double p = 1.0 - gsl_cdf_chisq_P(stat, 1.0);
-	return -log10(p);
+arma::mat F, F2;
+};
+
+denseLDGather gatherLD(const arma::mat& LD_mat, const arma::uvec& ld_idx, const arma::uvec& ld_idx2) {
+	return denseLDGather(LD_mat, ld_idx, ld_idx2);
+}
+factorLDGather gatherLD(const ld_factor& LD_mat, const arma::uvec& ld_idx, const arma::uvec& ld_idx2) {
+	return factorLDGather(LD_mat, ld_idx, ld_idx2);
 }
 
-// Perform one iteration of the algorithm, assuming LD_mat is an arma::mat
-void oneIteration(const arma::mat& LD_mat, const std::vector<size_t>& idx, const std::vector<size_t>& idx2,
-                  const arma::vec& zScore, arma::vec& imputedZ, arma::vec& rsqList, arma::vec& zScore_e,
-                  size_t nSample, float probSVD, int ncpus, bool verbose) {
+// Perform one iteration of the algorithm, LD_mat being an arma::mat or an ld_factor. Marker i of zScore is
+// the variant variants[i] of LD_mat, so a window (or its deduplicated markers) is read in place. Errors are
+// thrown as std::runtime_error and warnings are appended to `warnings`, so that windows can run in threads.
+template <typename LD_T>
+void oneIteration(const LD_T& LD_mat, const arma::uvec& variants, const std::vector<size_t>& idx,
+                  const std::vector<size_t>& idx2, const arma::vec& zScore, arma::vec& imputedZ, arma::vec& rsqList,
+                  arma::vec& zScore_e, size_t nSample, float probSVD, int ncpus, bool verbose, bool truncatedEigen,
+                  unsigned int seed, std::vector<std::string>& warnings, engine_profile* profile) {
 	if (verbose) {
-		Rcpp::Rcout << "LD_mat dimensions: " << LD_mat.n_rows << " x " << LD_mat.n_cols << std::endl;
+		Rcpp::Rcout << "LD_mat dimensions: " << ldSize(LD_mat) << " x " << ldSize(LD_mat) << std::endl;
 		Rcpp::Rcout << "idx size: " << idx.size() << std::endl;
 		Rcpp::Rcout << "idx2 size: " << idx2.size() << std::endl;
 		Rcpp::Rcout << "zScore size: " << zScore.size() << std::endl;
@@ -91,28 +227,23 @@ void oneIteration(const arma::mat& LD_mat, const std::vector<size_t>& idx, const
 
 	int nProcessors = omp_get_max_threads();
 	if (ncpus < nProcessors) nProcessors = ncpus;
-	omp_set_num_threads(nProcessors);
 
 	size_t K = std::min(static_cast<size_t>(idx.size()), nSample) * probSVD;
 
-	arma::vec zScore_eigen(idx.size());
-	arma::mat LD_it(idx2.size(), idx.size());
-	arma::mat VV(idx.size(), idx.size());
-
 	// Check dimensions before filling LD_it and VV matrices
-	if (idx2.size() > LD_mat.n_rows || idx.size() > LD_mat.n_cols) {
-		Rcpp::stop("Inconsistent dimensions between LD_mat and idx2/idx in oneIteration()");
+	if (idx2.size() > variants.n_elem || idx.size() > variants.n_elem) {
+		throw std::runtime_error("Inconsistent dimensions between LD_mat and idx2/idx in oneIteration()");
 	}
 
 	// Check if any index in idx or idx2 is greater than or equal to zscore size
 	for (size_t i = 0; i < idx.size(); ++i) {
 		if (idx[i] >= zScore.size()) {
-			Rcpp::stop("Invalid index in idx: " + std::to_string(idx[i]));
+			throw std::runtime_error("Invalid index in idx: " + std::to_string(idx[i]));
 		}
 	}
 	for (size_t i = 0; i < idx2.size(); ++i) {
 		if (idx2[i] >= zScore.size()) {
-			Rcpp::stop("Invalid index in idx2: " + std::to_string(idx2[i]));
+			throw std::runtime_error("Invalid index in idx2: " + std::to_string(idx2[i]));
 		}
 	}
 
@@ -120,40 +251,28 @@ void oneIteration(const arma::mat& LD_mat, const std::vector<size_t>& idx, const
 		Rcpp::Rcout << "Filling LD_it and VV matrices" << std::endl;
 	}
 
-	// Fill LD_it and VV matrices using direct indexing
-#pragma omp parallel for collapse(2)
-	for (size_t i = 0; i < idx2.size(); i++) {
-		for (size_t k = 0; k < idx.size(); k++) {
-			// if (verbose) {
-			//	Rcpp::Rcout << "Filling LD_it: i = " << i << ", k = " << k << ", idx2[i] = " << idx2[i] << ", idx[k] = " << idx[k] << std::endl;
-			//}
-			LD_it(i, k) = LD_mat.at(idx2[i] * LD_mat.n_cols + idx[k]);
-		}
-	}
+	// Gather LD_it and VV
+	profile_scope gather_timer(profile, DENTIST_PHASE_GATHER);
+	arma::uvec uidx(idx.size()), uidx2(idx2.size());
+	std::copy(idx.begin(), idx.end(), uidx.begin());
+	std::copy(idx2.begin(), idx2.end(), uidx2.begin());
+	arma::uvec ld_idx = variants.elem(uidx), ld_idx2 = variants.elem(uidx2);
+	auto gathered = gatherLD(LD_mat, ld_idx, ld_idx2);
+	arma::vec zScore_eigen = zScore.elem(uidx);
+	gather_timer.stop();
 
-#pragma omp parallel for
-	for (size_t i = 0; i < idx.size(); i++) {
-		//if (verbose) {
-		//	Rcpp::Rcout << "Filling VV: i = " << i << ", idx[i] = " << idx[i] << std::endl;
-		//}
-		zScore_eigen(i) = zScore[idx[i]];
-		for (size_t j = 0; j < idx.size(); j++) {
-			//if (verbose) {
-			//	Rcpp::Rcout << "Filling VV: i = " << i << ", j = " << j << ", idx[i] = " << idx[i] << ", idx[j] = " << idx[j] << std::endl;
-			//}
-			VV(i, j) = LD_mat.at(idx[i] * LD_mat.n_rows + idx[j]);
-		}
-	}
 	if (verbose) {
 		Rcpp::Rcout << "Performing eigen decomposition" << std::endl;
 	}
 
-	// Eigen decomposition
 	arma::vec eigval;
 	arma::mat eigvec;
-	arma::eig_sym(eigval, eigvec, VV);
+	profile_scope eigen_timer(profile, DENTIST_PHASE_EIGEN);
+	gathered.eigen(eigval, eigvec, K, truncatedEigen, seed);
+	eigen_timer.stop();
 
-	int nRank = eigvec.n_rows;
+	// Rank among the computed pairs, which is all that bounds K
+	int nRank = eigval.n_elem;
 	int nZeros = arma::sum(eigval < 0.0001);
 	nRank -= nZeros;
 	K = std::min(K, static_cast<size_t>(nRank));
@@ -163,95 +282,56 @@ void oneIteration(const arma::mat& LD_mat, const std::vector<size_t>& idx, const
 	}
 
 	if (K <= 1) {
-		Rcpp::stop("Rank of eigen matrix <= 1");
+		throw std::runtime_error("Rank of eigen matrix <= 1");
 	}
-	arma::mat ui = arma::eye<arma::mat>(eigvec.n_rows, K);
-	arma::mat wi = arma::eye<arma::mat>(K, K);
+	if (profile != nullptr) {
+		profile->add_count(DENTIST_COUNT_IMPUTATIONS, 1);
+		profile->add_count(DENTIST_COUNT_EIGENPAIRS, K);
+	}
+	arma::mat ui(eigvec.n_rows, K);
+	arma::vec wi(K);
 	for (size_t m = 0; m < K; ++m) {
-		int j = eigvec.n_rows - m - 1;
+		int j = eigvec.n_cols - m - 1;
 		ui.col(m) = eigvec.col(j);
-		wi(m, m) = 1.0 / eigval(j);
+		wi(m) = 1.0 / eigval(j);
 	}
 
 	if (verbose) {
 		Rcpp::Rcout << "Calculating imputed Z scores and R squared values" << std::endl;
 	}
 
-	// Calculate imputed Z scores and R squared values
-	arma::mat beta = LD_it * ui * wi;
-	arma::vec zScore_eigen_imp = beta * (ui.t() * zScore_eigen);
-	arma::mat product = beta * (ui.t() * LD_it.t());
-	arma::vec rsq_eigen = product.diag();
+	// Calculate imputed Z scores and R squared values. With C = LD_it * ui, the imputation is
+	// C * diag(wi) * ui' z and R squared is the diagonal of C * diag(wi) * C', i.e. the rows of C
+	// squared and weighted by wi, so the |idx2| x |idx2| product is never formed
+	profile_scope impute_timer(profile, DENTIST_PHASE_IMPUTE);
+	arma::mat C = gathered.cross(ui);
+	arma::vec zScore_eigen_imp = C * (wi % (ui.t() * zScore_eigen));
+	arma::vec rsq_eigen = arma::square(C) * wi;
 
-#pragma omp parallel for
+#pragma omp parallel for num_threads(nProcessors)
 	for (size_t i = 0; i < idx2.size(); ++i) {
 		imputedZ[idx2[i]] = zScore_eigen_imp(i);
 		rsqList[idx2[i]] = rsq_eigen(i);
 		rsqList[idx2[i]] = std::min(rsq_eigen(i), 1.0); // Ensure rsq does not exceed 1
 		if (rsq_eigen(i) >= 1) {
 			// Handle the case where rsq_eigen is unexpectedly high
-			Rcpp::warning("Adjusted rsq_eigen value exceeding 1: " + std::to_string(rsq_eigen(i)));
+#pragma omp critical
+			warnings.push_back("Adjusted rsq_eigen value exceeding 1: " + std::to_string(rsq_eigen(i)));
 		}
 		size_t j = idx2[i];
-		zScore_e[j] = (zScore[j] - imputedZ[j]) / std::sqrt(LD_mat(j, j) - rsqList[j]);
+		zScore_e[j] = (zScore[j] - imputedZ[j]) / std::sqrt(ldEntry(LD_mat, variants[j], variants[j]) - rsqList[j]);
 	}
 
 }
 
-/**
- * @brief Executes DENTIST algorithm for quality control in GWAS summary data: the iterative imputation function.
- *
- * DENTIST (Detecting Errors iN analyses of summary staTISTics) identifies and removes problematic variants
- * in GWAS summary data by comparing observed GWAS statistics to predicted values based on linkage disequilibrium (LD)
- * information from a reference panel. It helps detect genotyping/imputation errors, allelic errors, and heterogeneity
- * between GWAS and LD reference samples, improving the reliability of subsequent analyses.
- *
- * @param LD_mat The linkage disequilibrium (LD) matrix from a reference panel, as an arma::mat object.
- * @param nSample The sample size used in the GWAS whose summary statistics are being analyzed.
- * @param zScore A vector of Z-scores from GWAS summary statistics.
- * @param pValueThreshold Threshold for the p-value below which variants are considered for quality control.
- * @param propSVD Proportion of singular value decomposition (SVD) components retained in the analysis.
- * @param gcControl A boolean flag to apply genetic control corrections.
- * @param nIter The number of iterations to run the DENTIST algorithm.
- * @param gPvalueThreshold P-value threshold for grouping variants into significant and null categories.
- * @param ncpus The number of CPU cores to use for parallel processing.
- * @param seed Seed for random number generation, affecting the selection of variants for analysis.
- * @param verbose A boolean flag to enable verbose output for debugging.
- *
- * @return A List object containing:
- * - original_z: A vector of original Z-scores for each marker.
- * - imputed_z: A vector of imputed Z-scores for each marker.
- * - z_diff: A vector of outlier test z-scores
- * - rsq: A vector of R-squared values for each marker, indicating goodness of fit.
- * - iter_to_correct: An integer vector indicating the iteration in which each marker passed the quality control.
- *
- * @note The function is designed for use in Rcpp and requires Armadillo for matrix operations and OpenMP for parallel processing.
- */
-
-// [[Rcpp::export]]
-List dentist_iterative_impute(const arma::mat& LD_mat, size_t nSample, const arma::vec& zScore,
-                              double pValueThreshold, float propSVD, bool gcControl, int nIter,
-                              double gPvalueThreshold, int ncpus, int seed, bool correct_chen_et_al_bug,
-                              bool verbose = false) {
-	if (verbose) {
-		Rcpp::Rcout << "LD_mat dimensions: " << LD_mat.n_rows << " x " << LD_mat.n_cols << std::endl;
-		Rcpp::Rcout << "nSample: " << nSample << std::endl;
-		Rcpp::Rcout << "zScore size: " << zScore.size() << std::endl;
-		Rcpp::Rcout << "pValueThreshold: " << pValueThreshold << std::endl;
-		Rcpp::Rcout << "propSVD: " << propSVD << std::endl;
-		Rcpp::Rcout << "gcControl: " << gcControl << std::endl;
-		Rcpp::Rcout << "nIter: " << nIter << std::endl;
-		Rcpp::Rcout << "gPvalueThreshold: " << gPvalueThreshold << std::endl;
-		Rcpp::Rcout << "ncpus: " << ncpus << std::endl;
-		Rcpp::Rcout << "seed: " << seed << std::endl;
-		Rcpp::Rcout << "correct_chen_et_al_bug: " << correct_chen_et_al_bug << std::endl;
-	}
-
-	// Set number of threads for parallel processing
-	int nProcessors = omp_get_max_threads();
-	if (ncpus < nProcessors) nProcessors = ncpus;
-	omp_set_num_threads(nProcessors);
-
+// The iterative imputation of DENTIST on the markers `zScore`, marker i being the variant variants[i] of
+// LD_mat; see dentist_iterative_impute() for the parameters. The results are the columns of its output.
+template <typename LD_T>
+void dentistImpute(const LD_T& LD_mat, const arma::uvec& variants, size_t nSample, const arma::vec& zScore,
+                   double pValueThreshold, float propSVD, bool gcControl, int nIter, double gPvalueThreshold,
+                   int ncpus, int seed, bool correct_chen_et_al_bug, bool verbose, bool truncated_eigen,
+                   arma::vec& imputedZ, arma::vec& rsq, arma::vec& zScore_e, arma::ivec& iterID,
+                   std::vector<std::string>& warnings, engine_profile* profile) {
 	size_t markerSize = zScore.size();
 	std::vector<size_t> randOrder = generateSetOfNumbers(markerSize, seed);
 	std::vector<size_t> idx, idx2;
@@ -269,9 +349,13 @@ List dentist_iterative_impute(const arma::mat& LD_mat, size_t nSample, const arm
 		Rcpp::Rcout << "Indices partitioned" << std::endl;
 	}
 
+	// The p-value thresholds as chi-squared cutoffs, so that each marker is a single comparison
+	const double gChisqCutoff = chisqCutoff(gPvalueThreshold);
+	const double chisqCutoffQC = chisqCutoff(pValueThreshold);
+
 	std::vector<size_t> groupingGWAS(markerSize, 0);
 	for (size_t i = 0; i < markerSize; ++i) {
-		if (minusLogPvalueChisq2(std::pow(zScore(i), 2)) > -log10(gPvalueThreshold)) {
+		if (std::pow(zScore(i), 2) > gChisqCutoff) {
 			groupingGWAS[i] = 1;
 		}
 	}
@@ -280,13 +364,15 @@ List dentist_iterative_impute(const arma::mat& LD_mat, size_t nSample, const arm
 		Rcpp::Rcout << "Grouping GWAS finished" << std::endl;
 	}
 
-	arma::vec imputedZ = arma::zeros<arma::vec>(markerSize);
-	arma::vec rsq = arma::zeros<arma::vec>(markerSize);
-	arma::vec zScore_e = arma::zeros<arma::vec>(markerSize);
-	arma::ivec iterID = arma::zeros<arma::ivec>(markerSize);
+	imputedZ.zeros(markerSize);
+	rsq.zeros(markerSize);
+	zScore_e.zeros(markerSize);
+	iterID.zeros(markerSize);
 
 	std::vector<double> diff(idx2.size());
 	std::vector<size_t> grouping_tmp(idx2.size());
+	std::vector<double> chisq, chisqSorted;
+	quantileBuffers quantileBuf;
 
 	for (int t = 0; t < nIter; ++t) {
 		// Perform iteration with current subsets
@@ -296,8 +382,11 @@ List dentist_iterative_impute(const arma::mat& LD_mat, size_t nSample, const arm
 			Rcpp::Rcout << "Performing oneIteration()" << std::endl;
 		}
 
-		oneIteration(LD_mat, idx, idx2, zScore, imputedZ, rsq, zScore_e, nSample, propSVD, ncpus, verbose);
+		if (profile != nullptr) profile->add_count(DENTIST_COUNT_ITERATIONS, 1);
+		oneIteration(LD_mat, variants, idx, idx2, zScore, imputedZ, rsq, zScore_e, nSample, propSVD, ncpus, verbose, truncated_eigen, seed,
+		             warnings, profile);
 
+		profile_scope qc_timer(profile, DENTIST_PHASE_QC);
 		diff.resize(idx2.size());
 		grouping_tmp.resize(idx2.size());
 
@@ -311,8 +400,8 @@ List dentist_iterative_impute(const arma::mat& LD_mat, size_t nSample, const arm
 			Rcpp::Rcout << "Assessing differences and grouping for thresholding" << std::endl;
 		}
 
-		double threshold = getQuantile(diff, 0.995);
-		double threshold1, threshold0;
+		double threshold, threshold1, threshold0;
+		getGroupQuantiles(diff, grouping_tmp, 0.995, quantileBuf, threshold, threshold1, threshold0);
 		/*
 		        In the original DENTIST method, whenever you call !grouping_tmp, it is going to change the original value of grouping_tmp as well.
 		        For example, if grouping_tmp is (0,0,1,1,1), and you run:
@@ -320,19 +409,15 @@ List dentist_iterative_impute(const arma::mat& LD_mat, size_t nSample, const arm
 		        then your grouping_tmp will become (1,1,0,0,0) even you are just calling it in the function.
 		        https://github.com/Yves-CHEN/DENTIST/blob/2fefddb1bbee19896a30bf56229603561ea1dba8/main/inversion.cpp#L647
 		        https://github.com/Yves-CHEN/DENTIST/blob/2fefddb1bbee19896a30bf56229603561ea1dba8/main/inversion.cpp#L675
+		        The thresholds themselves are the same either way, so getGroupQuantiles() computes them once.
 		        Thus if we correct the original DENTIST code, i.e., correct_chen_et_al_bug = TRUE,
-		                we go through our function, getQuantile2, which doesn't have this issue
-		                else, i.e., correct_chen_et_al_bug = TRUE, it goes through the original function getQuantile2_chen_et_al
+		                grouping_tmp is left as is
+		                else, i.e., correct_chen_et_al_bug = FALSE, grouping_tmp is inverted as in the original code
 		 */
-		if (correct_chen_et_al_bug) {
-			threshold1 = getQuantile2(diff, grouping_tmp, 0.995, false);
-			threshold0 = getQuantile2(diff, grouping_tmp, 0.995, true);
-		} else {
-			threshold1 = getQuantile2_chen_et_al(diff, grouping_tmp, 0.995);
+		if (!correct_chen_et_al_bug) {
 			std::transform(grouping_tmp.begin(), grouping_tmp.end(), grouping_tmp.begin(), [](size_t val) {
 				return 1 - val;
 			});
-			threshold0 = getQuantile2_chen_et_al(diff, grouping_tmp, 0.995);
 		}
 
 		if (threshold1 == 0) {
@@ -373,7 +458,10 @@ List dentist_iterative_impute(const arma::mat& LD_mat, size_t nSample, const arm
 			Rcpp::Rcout << "Performing oneIteration() with updated sets of indices" << std::endl;
 		}
 
-		oneIteration(LD_mat, idx2_QCed, idx, zScore, imputedZ, rsq, zScore_e, nSample, propSVD, ncpus, verbose);
+		qc_timer.stop();
+		oneIteration(LD_mat, variants, idx2_QCed, idx, zScore, imputedZ, rsq, zScore_e, nSample, propSVD, ncpus, verbose, truncated_eigen, seed,
+		             warnings, profile);
+		profile_scope requalify_timer(profile, DENTIST_PHASE_QC);
 
 		if (verbose) {
 			Rcpp::Rcout << "Recalculating differences and groupings after the iteration" << std::endl;
@@ -393,16 +481,11 @@ List dentist_iterative_impute(const arma::mat& LD_mat, size_t nSample, const arm
 		}
 
 		// Re-determine thresholds based on the recalculated differences and groupings
-		threshold = getQuantile(diff, 0.995);
-		if (correct_chen_et_al_bug) {
-			threshold1 = getQuantile2(diff, grouping_tmp, 0.995, false);
-			threshold0 = getQuantile2(diff, grouping_tmp, 0.995, true);
-		} else {
-			threshold1 = getQuantile2_chen_et_al(diff, grouping_tmp, 0.995);
+		getGroupQuantiles(diff, grouping_tmp, 0.995, quantileBuf, threshold, threshold1, threshold0);
+		if (!correct_chen_et_al_bug) {
 			std::transform(grouping_tmp.begin(), grouping_tmp.end(), grouping_tmp.begin(), [](size_t val) {
 				return 1 - val;
 			});
-			threshold0 = getQuantile2_chen_et_al(diff, grouping_tmp, 0.995);
 		}
 
 
@@ -423,30 +506,32 @@ List dentist_iterative_impute(const arma::mat& LD_mat, size_t nSample, const arm
 		}
 
 		// Adjust for genetic control and inflation factor if necessary
-		std::vector<double> chisq(fullIdx.size());
+		chisq.resize(fullIdx.size());
 		for (size_t i = 0; i < fullIdx.size(); ++i) {
 			chisq[i] = std::pow(zScore_e[fullIdx[i]], 2);
 		}
 
 		if (chisq.size() <= 2) {
-			Rcpp::stop("chisq.size() must be greater than 2.");
+			throw std::runtime_error("chisq.size() must be greater than 2.");
 		}
 
-		// Calculate the median chi-squared value as the inflation factor
-		std::nth_element(chisq.begin(), chisq.begin() + chisq.size() / 2, chisq.end());
-		double medianChisq = chisq[chisq.size() / 2];
+		// Calculate the median chi-squared value as the inflation factor, selecting in a copy so that
+		// chisq stays aligned with fullIdx
+		chisqSorted.assign(chisq.begin(), chisq.end());
+		std::nth_element(chisqSorted.begin(), chisqSorted.begin() + chisqSorted.size() / 2, chisqSorted.end());
+		double medianChisq = chisqSorted[chisqSorted.size() / 2];
 		double inflationFactor = medianChisq / 0.46;
 
 		std::vector<size_t> fullIdx_tmp;
 		for (size_t i = 0; i < fullIdx.size(); ++i) {
 			if (gcControl) {
 				// When gcControl is true, check if the variant passes the adjusted threshold
-				if (!(diff[i] > threshold && minusLogPvalueChisq2(chisq[i] / inflationFactor) > -log10(pValueThreshold))) {
+				if (!(diff[i] > threshold && chisq[i] / inflationFactor > chisqCutoffQC)) {
 					fullIdx_tmp.push_back(fullIdx[i]);
 				}
 			} else {
 				// When gcControl is false, simply check if the variant passes the basic threshold
-				if (minusLogPvalueChisq2(chisq[i]) < -log10(pValueThreshold)) {
+				if (chisq[i] < chisqCutoffQC) {
 					if ((groupingGWAS[fullIdx[i]] == 1 && diff[i] <= threshold1) ||
 					    (groupingGWAS[fullIdx[i]] == 0 && diff[i] <= threshold0)) {
 						fullIdx_tmp.push_back(fullIdx[i]);
@@ -469,10 +554,323 @@ List dentist_iterative_impute(const arma::mat& LD_mat, size_t nSample, const arm
 			else idx2.push_back(fullIdx[i]);
 		}
 	}
+}
 
-	return List::create(Named("original_z") = zScore,
-	                    Named("imputed_z") = imputedZ,
-	                    Named("rsq") = rsq,
-	                    Named("z_diff") = zScore_e,
-	                    Named("iter_to_correct") = iterID);
+/**
+ * @brief Executes DENTIST algorithm for quality control in GWAS summary data: the iterative imputation function.
+ *
+ * DENTIST (Detecting Errors iN analyses of summary staTISTics) identifies and removes problematic variants
+ * in GWAS summary data by comparing observed GWAS statistics to predicted values based on linkage disequilibrium (LD)
+ * information from a reference panel. It helps detect genotyping/imputation errors, allelic errors, and heterogeneity
+ * between GWAS and LD reference samples, improving the reliability of subsequent analyses.
+ *
+ * @param LD_mat The linkage disequilibrium (LD) matrix from a reference panel, read in place; an "ld_factor" object
+ *        holding its low-rank factor, from which the LD is read without forming the matrix; or an LD handle
+ *        holding either (see `ld_handle`).
+ * @param nSample The sample size used in the GWAS whose summary statistics are being analyzed.
+ * @param zScore A vector of Z-scores from GWAS summary statistics.
+ * @param pValueThreshold Threshold for the p-value below which variants are considered for quality control.
+ * @param propSVD Proportion of singular value decomposition (SVD) components retained in the analysis.
+ * @param gcControl A boolean flag to apply genetic control corrections.
+ * @param nIter The number of iterations to run the DENTIST algorithm.
+ * @param gPvalueThreshold P-value threshold for grouping variants into significant and null categories.
+ * @param ncpus The number of CPU cores to use for parallel processing, within the thread budget (see
+ *        `thread_budget`).
+ * @param seed Seed for random number generation, affecting the selection of variants for analysis.
+ * @param verbose A boolean flag to enable verbose output for debugging.
+ * @param truncated_eigen Compute only the top eigenpairs of the LD submatrix, by randomized subspace
+ *        iteration, instead of its full eigendecomposition.
+ * @param profile Also return `profile`, the time spent gathering the LD, in the eigendecompositions,
+ *        imputing and in the QC between them, with the number of iterations, imputation passes and
+ *        eigenpairs used (see `profile_list`).
+ *
+ * @return A List object containing:
+ * - original_z: A vector of original Z-scores for each marker.
+ * - imputed_z: A vector of imputed Z-scores for each marker.
+ * - z_diff: A vector of outlier test z-scores
+ * - rsq: A vector of R-squared values for each marker, indicating goodness of fit.
+ * - iter_to_correct: An integer vector indicating the iteration in which each marker passed the quality control.
+ *
+ * @note The function is designed for use in Rcpp and requires Armadillo for matrix operations and OpenMP for parallel processing.
+ */
+
+// [[Rcpp::export]]
+List dentist_iterative_impute(SEXP LD_mat, size_t nSample, const arma::vec& zScore,
+                              double pValueThreshold, float propSVD, bool gcControl, int nIter,
+                              double gPvalueThreshold, int ncpus, int seed, bool correct_chen_et_al_bug,
+                              bool verbose = false, bool truncated_eigen = false, bool profile = false) {
+	std::shared_ptr<const ld_factor> LD_factor;
+	std::unique_ptr<ld_blocks> LD_blocks;
+	if (is_ld_factor(LD_mat)) {
+		LD_factor = as_ld_factor(LD_mat);
+	} else {
+		LD_blocks.reset(new ld_blocks(LD_mat));
+		if (LD_blocks->size() != 1) {
+			Rcpp::stop("LD_mat must be a single matrix.");
+		}
+	}
+	static const arma::mat no_ld;
+	const arma::mat& LD_dense = LD_blocks ? LD_blocks->blocks()[0] : no_ld;
+	size_t nVariants = LD_factor ? LD_factor->n_variants() : LD_dense.n_rows;
+	if (nVariants != zScore.n_elem || (!LD_factor && LD_dense.n_cols != zScore.n_elem)) {
+		Rcpp::stop("LD_mat must be a square matrix with dimensions equal to the length of zScore.");
+	}
+
+	if (verbose) {
+		Rcpp::Rcout << "LD_mat dimensions: " << nVariants << " x " << nVariants << std::endl;
+		Rcpp::Rcout << "nSample: " << nSample << std::endl;
+		Rcpp::Rcout << "zScore size: " << zScore.size() << std::endl;
+		Rcpp::Rcout << "pValueThreshold: " << pValueThreshold << std::endl;
+		Rcpp::Rcout << "propSVD: " << propSVD << std::endl;
+		Rcpp::Rcout << "gcControl: " << gcControl << std::endl;
+		Rcpp::Rcout << "nIter: " << nIter << std::endl;
+		Rcpp::Rcout << "gPvalueThreshold: " << gPvalueThreshold << std::endl;
+		Rcpp::Rcout << "ncpus: " << ncpus << std::endl;
+		Rcpp::Rcout << "seed: " << seed << std::endl;
+		Rcpp::Rcout << "correct_chen_et_al_bug: " << correct_chen_et_al_bug << std::endl;
+		Rcpp::Rcout << "truncated_eigen: " << truncated_eigen << std::endl;
+	}
+
+	arma::vec imputedZ, rsq, zScore_e;
+	arma::ivec iterID;
+	std::vector<std::string> warnings;
+	arma::uvec variants(zScore.n_elem);
+	std::iota(variants.begin(), variants.end(), 0);
+	thread_budget budget(ncpus, thread_limit());
+	ncpus = budget.engine_threads();
+	engine_profile prof = dentist_profile();
+	engine_profile* prof_ptr = profile ? &prof : nullptr;
+	if (prof_ptr != nullptr) prof.add_count(DENTIST_COUNT_WINDOWS, 1);
+	if (LD_factor) {
+		dentistImpute(*LD_factor, variants, nSample, zScore, pValueThreshold, propSVD,
+		              gcControl, nIter, gPvalueThreshold, ncpus, seed, correct_chen_et_al_bug, verbose, truncated_eigen,
+		              imputedZ, rsq, zScore_e, iterID, warnings, prof_ptr);
+	} else {
+		dentistImpute(LD_dense, variants, nSample, zScore, pValueThreshold, propSVD,
+		              gcControl, nIter, gPvalueThreshold, ncpus, seed, correct_chen_et_al_bug, verbose, truncated_eigen,
+		              imputedZ, rsq, zScore_e, iterID, warnings, prof_ptr);
+	}
+	for (const std::string& w : warnings) {
+		Rcpp::warning(w);
+	}
+
+	List out = List::create(Named("original_z") = zScore,
+	                        Named("imputed_z") = imputedZ,
+	                        Named("rsq") = rsq,
+	                        Named("z_diff") = zScore_e,
+	                        Named("iter_to_correct") = iterID);
+	if (profile) {
+		out["profile"] = profile_list(prof);
+	}
+	return out;
+}
+
+// Markers of a window of LD_mat left after removing duplicates, as find_duplicate_variants() in R:
+// marker j duplicates the first earlier kept marker i with |r| > rThreshold. dupBearer[j] is then the
+// (1-based) rank of i among the kept markers, and -1 for kept markers; sign[j] is the sign of r.
+template <typename LD_T>
+static std::vector<size_t> findDuplicateVariants(const LD_T& LD_mat, size_t start, size_t size, double rThreshold,
+                                                 std::vector<int>& dupBearer, std::vector<int>& sign) {
+	dupBearer.assign(size, -1);
+	sign.assign(size, 1);
+	std::vector<size_t> kept;
+	for (size_t i = 0; i < size; ++i) {
+		if (dupBearer[i] != -1) continue;
+		kept.push_back(i);
+		for (size_t j = i + 1; j < size; ++j) {
+			if (dupBearer[j] != -1) continue;
+			double r = ldEntry(LD_mat, start + i, start + j);
+			if (std::abs(r) > rThreshold) {
+				if (r < 0) sign[j] = -1;
+				dupBearer[j] = kept.size();
+			}
+		}
+	}
+	return kept;
+}
+
+// dentist_multi_window() on the LD of the region, LD_mat being an arma::mat or an ld_factor
+template <typename LD_T>
+static List dentistMultiWindow(const LD_T& LD_mat, size_t nSample, const arma::vec& zScore,
+                               const std::vector<int>& windowStartIdx, const std::vector<int>& windowEndIdx,
+                               const std::vector<int>& fillStartIdx, const std::vector<int>& fillEndIdx,
+                               double pValueThreshold, float propSVD, bool gcControl, int nIter,
+                               double gPvalueThreshold, double duprThreshold, int ncpus, int seed,
+                               bool correct_chen_et_al_bug, bool truncated_eigen, engine_profile* profile) {
+	size_t nWindows = windowStartIdx.size();
+	if (windowEndIdx.size() != nWindows || fillStartIdx.size() != nWindows || fillEndIdx.size() != nWindows) {
+		Rcpp::stop("Window and fill ranges must have the same length.");
+	}
+	for (size_t w = 0; w < nWindows; ++w) {
+		if (windowStartIdx[w] < 1 || windowEndIdx[w] < windowStartIdx[w] || static_cast<size_t>(windowEndIdx[w]) > zScore.n_elem) {
+			Rcpp::stop("Invalid range of window " + std::to_string(w + 1) + ".");
+		}
+	}
+	bool dedup = duprThreshold < 1.0;
+
+	// Per window: the output columns over its markers, before adding back the duplicates
+	std::vector<std::vector<int> > dupBearer(nWindows), dupSign(nWindows);
+	std::vector<arma::vec> imputedZ(nWindows), rsq(nWindows), zScore_e(nWindows);
+	std::vector<arma::ivec> iterID(nWindows);
+	std::vector<std::vector<std::string> > warnings(nWindows);
+	std::vector<std::string> errors(nWindows);
+
+	int nOuter = std::max(1, std::min(ncpus, static_cast<int>(nWindows)));
+	int nInner = std::max(1, ncpus / nOuter);
+	int maxLevels = omp_get_max_active_levels();
+	omp_set_max_active_levels(nInner > 1 ? 2 : 1);
+#pragma omp parallel for schedule(dynamic) num_threads(nOuter)
+	for (size_t w = 0; w < nWindows; ++w) {
+		try {
+			size_t start = windowStartIdx[w] - 1, size = windowEndIdx[w] - windowStartIdx[w] + 1;
+			std::vector<size_t> kept;
+			if (dedup) {
+				profile_scope timer(profile, DENTIST_PHASE_DEDUPLICATE);
+				kept = findDuplicateVariants(LD_mat, start, size, duprThreshold, dupBearer[w], dupSign[w]);
+			} else {
+				kept.resize(size);
+				std::iota(kept.begin(), kept.end(), 0);
+			}
+			arma::uvec variants(kept.size());
+			arma::vec z(kept.size());
+			for (size_t i = 0; i < kept.size(); ++i) {
+				variants[i] = start + kept[i];
+				z[i] = zScore[start + kept[i]];
+			}
+			dentistImpute(LD_mat, variants, nSample, z, pValueThreshold, propSVD, gcControl, nIter, gPvalueThreshold,
+			              nInner, seed, correct_chen_et_al_bug, false, truncated_eigen,
+			              imputedZ[w], rsq[w], zScore_e[w], iterID[w], warnings[w], profile);
+		} catch (const std::exception& e) {
+			errors[w] = e.what();
+		}
+	}
+	omp_set_max_active_levels(maxLevels);
+	if (profile != nullptr) profile->add_count(DENTIST_COUNT_WINDOWS, nWindows);
+
+	for (size_t w = 0; w < nWindows; ++w) {
+		if (!errors[w].empty()) {
+			Rcpp::stop("DENTIST failed in window " + std::to_string(w + 1) + ": " + errors[w]);
+		}
+	}
+	for (size_t w = 0; w < nWindows; ++w) {
+		for (const std::string& msg : warnings[w]) {
+			Rcpp::warning(msg);
+		}
+	}
+
+	// Merge: add the duplicates back, drop the markers that were never imputed, and keep the
+	// fill range of each window, with the indices counted over the markers that are left
+	std::vector<double> original_z, imputed_z, rsq_out, z_diff;
+	std::vector<int> iter_to_correct, index_within_window, index_global, n_variants(nWindows), n_duplicates(nWindows);
+	std::vector<bool> is_duplicate;
+	for (size_t w = 0; w < nWindows; ++w) {
+		size_t start = windowStartIdx[w] - 1, size = windowEndIdx[w] - windowStartIdx[w] + 1;
+		n_variants[w] = size;
+		n_duplicates[w] = size - imputedZ[w].n_elem;
+		int index = 0;
+		size_t keptRank = 0;
+		for (size_t i = 0; i < size; ++i) {
+			bool duplicate = dedup && dupBearer[w][i] != -1;
+			size_t k = duplicate ? dupBearer[w][i] - 1 : keptRank++;
+			double imputed = duplicate ? imputedZ[w][k] * dupSign[w][i] : imputedZ[w][k];
+			if (imputed == 0 && rsq[w][k] == 0) continue;
+			int global = ++index + windowStartIdx[w] - 1;
+			if (global < fillStartIdx[w] || global > fillEndIdx[w]) continue;
+			original_z.push_back(zScore[start + i]);
+			imputed_z.push_back(imputed);
+			rsq_out.push_back(rsq[w][k]);
+			z_diff.push_back(zScore_e[w][k]);
+			iter_to_correct.push_back(iterID[w][k]);
+			is_duplicate.push_back(duplicate);
+			index_within_window.push_back(index);
+			index_global.push_back(global);
+		}
+	}
+
+	// The columns in the order of dentist_single_window(), whose order depends on deduplication
+	List out;
+	out["original_z"] = original_z;
+	out["imputed_z"] = imputed_z;
+	if (dedup) {
+		out["iter_to_correct"] = iter_to_correct;
+		out["rsq"] = rsq_out;
+		out["z_diff"] = z_diff;
+		out["is_duplicate"] = is_duplicate;
+	} else {
+		out["rsq"] = rsq_out;
+		out["z_diff"] = z_diff;
+		out["iter_to_correct"] = iter_to_correct;
+	}
+	out["index_within_window"] = index_within_window;
+	out["index_global"] = index_global;
+	out["n_variants"] = n_variants;
+	out["n_duplicates"] = n_duplicates;
+	return out;
+}
+
+/**
+ * @brief DENTIST over the sliding windows of a region, with the windows run in parallel.
+ *
+ * This is `dentist()` in R for more than one window: each window is deduplicated, imputed by
+ * dentist_iterative_impute(), has its duplicates added back, and contributes its fill range to the
+ * merged result. The windows read the LD of the region in place; no window copies its LD.
+ *
+ * Windows are scheduled dynamically on up to `ncpus` threads. When there are fewer windows than
+ * threads, the remaining threads go to the OpenMP loops inside each window; otherwise each window
+ * runs single-threaded, and nested parallelism is disabled so that an OpenMP-threaded BLAS called
+ * from a window does not oversubscribe the cores.
+ *
+ * @param LD The LD of the whole region: a numeric matrix, an LD block file (see `ld_blocks`), an
+ *        "ld_factor" object holding its low-rank factor, or an LD handle holding either.
+ * @param windowStartIdx,windowEndIdx,fillStartIdx,fillEndIdx 1-based marker ranges of the windows
+ *        and of the part of each window kept in the merged result, as from divide_into_windows().
+ * @param duprThreshold The absolute correlation above which markers of a window are duplicates;
+ *        no deduplication when it is 1 or more.
+ * @param profile Also return `profile`, as dentist_iterative_impute() plus the time spent finding
+ *        duplicates; the phases are summed over the windows, and so over threads.
+ *
+ * The remaining parameters are those of dentist_iterative_impute().
+ *
+ * @return A List with the merged columns `original_z`, `imputed_z`, `iter_to_correct`, `rsq`,
+ *         `z_diff` (plus `is_duplicate` when deduplicating), `index_within_window` and
+ *         `index_global`, and for each window its number of markers (`n_variants`) and of
+ *         duplicates (`n_duplicates`).
+ */
+// [[Rcpp::export]]
+List dentist_multi_window(SEXP LD, size_t nSample, const arma::vec& zScore,
+                          const std::vector<int>& windowStartIdx, const std::vector<int>& windowEndIdx,
+                          const std::vector<int>& fillStartIdx, const std::vector<int>& fillEndIdx,
+                          double pValueThreshold, float propSVD, bool gcControl, int nIter,
+                          double gPvalueThreshold, double duprThreshold, int ncpus, int seed,
+                          bool correct_chen_et_al_bug, bool truncated_eigen = false, bool profile = false) {
+	thread_budget budget(ncpus, thread_limit());
+	ncpus = budget.engine_threads();
+	engine_profile prof = dentist_profile();
+	engine_profile* prof_ptr = profile ? &prof : nullptr;
+	List out;
+	if (is_ld_factor(LD)) {
+		std::shared_ptr<const ld_factor> LD_factor = as_ld_factor(LD);
+		if (LD_factor->n_variants() != zScore.n_elem) {
+			Rcpp::stop("The factor of LD must have one row per element of zScore.");
+		}
+		out = dentistMultiWindow(*LD_factor, nSample, zScore, windowStartIdx, windowEndIdx, fillStartIdx, fillEndIdx,
+		                         pValueThreshold, propSVD, gcControl, nIter, gPvalueThreshold, duprThreshold, ncpus,
+		                         seed, correct_chen_et_al_bug, truncated_eigen, prof_ptr);
+	} else {
+		ld_blocks ld(LD);
+		if (ld.size() != 1) {
+			Rcpp::stop("LD must be a single matrix or LD block file for the region.");
+		}
+		const arma::mat& LD_mat = ld.blocks()[0];
+		if (LD_mat.n_rows != LD_mat.n_cols || LD_mat.n_rows != zScore.n_elem) {
+			Rcpp::stop("LD must be a square matrix with dimensions equal to the length of zScore.");
+		}
+		out = dentistMultiWindow(LD_mat, nSample, zScore, windowStartIdx, windowEndIdx, fillStartIdx, fillEndIdx,
+		                         pValueThreshold, propSVD, gcControl, nIter, gPvalueThreshold, duprThreshold, ncpus,
+		                         seed, correct_chen_et_al_bug, truncated_eigen, prof_ptr);
+	}
+	if (profile) {
+		out["profile"] = profile_list(prof);
+	}
+	return out;
 }
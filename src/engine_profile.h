@@ -0,0 +1,133 @@
+#ifndef ENGINE_PROFILE_H
+#define ENGINE_PROFILE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @class engine_profile
+ * @brief Time spent in each phase of an engine call and counts of its units of work.
+ *
+ * An engine names its phases and counters once (see e.g. `sdpr_profile()`) and
+ * records them through `profile_scope` and `profile_tally`, given a pointer to
+ * the profile that is null when the caller did not ask for one. The Rcpp layer
+ * returns the totals as the `profile` element of the result (`profile = TRUE`).
+ *
+ * Phases timed on the calling thread report wall time. Phases timed inside the
+ * tasks of a parallel region report the time summed over the threads that ran
+ * them, so they may exceed the wall time of the call. Every thread accumulates
+ * into its own scope or tally and adds to the shared totals once, with an atomic
+ * add, when that scope ends.
+ *
+ * Building with `-DPECOTMR_NO_PROFILE` compiles the timers and counters out:
+ * their constructors and destructors are empty, and every total reads 0.
+ */
+class engine_profile {
+public:
+engine_profile(const std::vector<std::string>& phases, const std::vector<std::string>& counters)
+	: phase_names(phases), counter_names(counters),
+	nanoseconds(new std::atomic<uint64_t>[phases.size()]), counts(new std::atomic<uint64_t>[counters.size()]) {
+	for (size_t i = 0; i < phases.size(); i++) {
+		nanoseconds[i].store(0);
+	}
+	for (size_t i = 0; i < counters.size(); i++) {
+		counts[i].store(0);
+	}
+}
+engine_profile(engine_profile&&) = default;
+engine_profile(const engine_profile&) = delete;
+engine_profile& operator=(const engine_profile&) = delete;
+
+void add_time(size_t phase, uint64_t ns) {
+#ifndef PECOTMR_NO_PROFILE
+	nanoseconds[phase].fetch_add(ns, std::memory_order_relaxed);
+#endif
+}
+void add_count(size_t counter, uint64_t n) {
+#ifndef PECOTMR_NO_PROFILE
+	counts[counter].fetch_add(n, std::memory_order_relaxed);
+#endif
+}
+
+const std::vector<std::string>& phases() const {
+	return phase_names;
+}
+const std::vector<std::string>& counters() const {
+	return counter_names;
+}
+double seconds(size_t phase) const {
+	return nanoseconds[phase].load() * 1e-9;
+}
+uint64_t count(size_t counter) const {
+	return counts[counter].load();
+}
+
+private:
+std::vector<std::string> phase_names, counter_names;
+std::unique_ptr<std::atomic<uint64_t>[]> nanoseconds, counts;
+};
+
+/// Adds the time from its construction to its destruction to a phase of `profile` (if not null).
+class profile_scope {
+public:
+profile_scope(engine_profile* profile, size_t phase) : profile(profile), phase(phase) {
+#ifndef PECOTMR_NO_PROFILE
+	if (profile != nullptr) {
+		start = std::chrono::steady_clock::now();
+	}
+#endif
+}
+~profile_scope() {
+	stop();
+}
+/// Add the time so far and stop timing, before the end of the scope
+void stop() {
+#ifndef PECOTMR_NO_PROFILE
+	if (profile != nullptr) {
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		profile->add_time(phase, static_cast<uint64_t>(ns));
+		profile = nullptr;
+	}
+#endif
+}
+profile_scope(const profile_scope&) = delete;
+profile_scope& operator=(const profile_scope&) = delete;
+
+private:
+engine_profile* profile;
+size_t phase;
+std::chrono::steady_clock::time_point start;
+};
+
+/// Counts locally and adds the total to a counter of `profile` (if not null) on destruction.
+class profile_tally {
+public:
+profile_tally(engine_profile* profile, size_t counter) : profile(profile), counter(counter), n(0) {
+}
+void add(uint64_t k = 1) {
+#ifndef PECOTMR_NO_PROFILE
+	n += k;
+#endif
+}
+~profile_tally() {
+#ifndef PECOTMR_NO_PROFILE
+	if (profile != nullptr && n > 0) {
+		profile->add_count(counter, n);
+	}
+#endif
+}
+profile_tally(const profile_tally&) = delete;
+profile_tally& operator=(const profile_tally&) = delete;
+
+private:
+engine_profile* profile;
+size_t counter;
+uint64_t n;
+};
+
+#endif // ENGINE_PROFILE_H
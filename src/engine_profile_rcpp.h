@@ -0,0 +1,30 @@
+#ifndef ENGINE_PROFILE_RCPP_H
+#define ENGINE_PROFILE_RCPP_H
+
+#include <RcppArmadillo.h>
+#include "engine_profile.h"
+
+/**
+ * @brief The `profile` element of an engine result.
+ *
+ * @return A list with `time`, the seconds spent in each phase, and `count`, the
+ *         value of each counter, both named vectors (see `engine_profile`).
+ */
+inline Rcpp::List profile_list(const engine_profile& profile) {
+	Rcpp::NumericVector time(profile.phases().size());
+	for (size_t i = 0; i < profile.phases().size(); i++) {
+		time[i] = profile.seconds(i);
+	}
+	time.names() = Rcpp::wrap(profile.phases());
+	Rcpp::NumericVector count(profile.counters().size());
+	for (size_t i = 0; i < profile.counters().size(); i++) {
+		count[i] = static_cast<double>(profile.count(i));
+	}
+	count.names() = Rcpp::wrap(profile.counters());
+	return Rcpp::List::create(
+		Rcpp::Named("time") = time,
+		Rcpp::Named("count") = count
+		);
+}
+
+#endif // ENGINE_PROFILE_RCPP_H
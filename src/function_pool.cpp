@@ -1,60 +1,317 @@
-
 #include "function_pool.h"
-#include <iostream>
-/* based on 
+#include <algorithm>
+#include <numeric>
+#ifdef _WIN32
+#include <process.h>
+#define pool_getpid _getpid
+#else
+#include <unistd.h>
+#define pool_getpid getpid
+#endif
+/* based on
 https://stackoverflow.com/a/51400041
 
 https://stackoverflow.com/questions/23896421/efficiently-waiting-for-all-tasks-in-a-threadpool-to-finish
+
+The single shared queue of the original version is replaced by one deque per worker:
+owners take work from the front of their own deque and idle threads steal from the back
+of the others. Threads waiting on a parallel_for() run queued tasks rather than block.
 */
 
-Function_pool::Function_pool(unsigned int n) : m_function_queue(), m_lock(), m_data_condition(), busy(0), stop(false) {
-    for (size_t i=0; i<n; i++) {
-	thread_pool.push_back(std::thread(&Function_pool::infinite_loop_func, this));
-    }
+namespace {
+// Identify the pool worker (if any) running on the current thread
+thread_local const Function_pool* tl_pool = nullptr;
+thread_local size_t tl_worker = 0;
+const size_t no_worker = static_cast<size_t>(-1);
+}
+
+struct Function_pool::Latch {
+	std::atomic<size_t> remaining;
+	std::mutex lock;
+	std::condition_variable done;
+	std::exception_ptr error;
+
+	explicit Latch(size_t n) : remaining(n) {}
+
+	// Decrement under the lock so the waiting thread cannot destroy the latch
+	// while the last task is still notifying
+	void count_down() {
+		std::lock_guard<std::mutex> guard(lock);
+		if (remaining.fetch_sub(1) == 1) {
+			done.notify_all();
+		}
+	}
+};
+
+Function_pool::Function_pool(unsigned int n) : m_lock(), m_data_condition(), queued(0), unfinished(0),
+	sleepers(0), next_worker(0), stop(false) {
+	for (size_t i=0; i<n; i++) {
+		workers.push_back(std::unique_ptr<Worker>(new Worker()));
+	}
+	for (size_t i=0; i<n; i++) {
+		thread_pool.push_back(std::thread(&Function_pool::infinite_loop_func, this, i));
+	}
 }
 
 Function_pool::~Function_pool() {
-    std::unique_lock<std::mutex> lock(m_lock);
-    stop = true;
-    m_data_condition.notify_all();
-    lock.unlock();
-    for (size_t i=0; i<thread_pool.size(); i++) {
-	thread_pool[i].join();
-    }
+	std::unique_lock<std::mutex> lock(m_lock);
+	stop = true;
+	m_data_condition.notify_all();
+	lock.unlock();
+	for (size_t i=0; i<thread_pool.size(); i++) {
+		thread_pool[i].join();
+	}
 }
 
-void Function_pool::push(std::function<void()> func) {
-    std::unique_lock<std::mutex> lock(m_lock);
-    m_function_queue.push(func);
-    lock.unlock();
-    m_data_condition.notify_one();
+size_t Function_pool::self_index() const {
+	return (tl_pool == this) ? tl_worker : no_worker;
 }
 
-void Function_pool::infinite_loop_func() {
-    std::function<void()> func;
-    while (true) {
-	std::unique_lock<std::mutex> lock(m_lock);
-	m_data_condition.wait(lock, [this]() {return \
-		!m_function_queue.empty() || stop; });
-	if (!m_function_queue.empty()) {
-	    busy++;
-	    func = m_function_queue.front();
-	    m_function_queue.pop();
-	    lock.unlock();
-	    func();
-	    lock.lock();
-	    busy--;
-	    lock.unlock();
-	    finished.notify_one();
+void Function_pool::enqueue(size_t target, Task task) {
+	// Count the task as unfinished before it becomes visible to other threads
+	unfinished++;
+	{
+		std::lock_guard<std::mutex> guard(workers[target]->lock);
+		workers[target]->tasks.push_back(std::move(task));
 	}
-	else if (stop) {
-	    return;
+	queued++;
+}
+
+void Function_pool::notify_workers(bool all) {
+	if (sleepers.load() == 0) {
+		return;
+	}
+	// Taking the lock orders the notification after a sleeper's predicate check
+	std::lock_guard<std::mutex> guard(m_lock);
+	if (all) {
+		m_data_condition.notify_all();
+	} else {
+		m_data_condition.notify_one();
+	}
+}
+
+bool Function_pool::try_pop(size_t self, Task& task) {
+	if (workers.empty() || queued.load() == 0) {
+		return false;
+	}
+	size_t n = workers.size();
+	// Own deque first, front to back
+	if (self != no_worker) {
+		Worker& own = *workers[self];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.tasks.empty()) {
+			task = std::move(own.tasks.front());
+			own.tasks.pop_front();
+			queued--;
+			return true;
+		}
+	}
+	// Steal from the back of the other deques
+	size_t start = (self != no_worker) ? self + 1 : next_worker.fetch_add(1);
+	for (size_t i=0; i<n; i++) {
+		size_t victim = (start + i) % n;
+		if (victim == self) {
+			continue;
+		}
+		Worker& other = *workers[victim];
+		std::lock_guard<std::mutex> guard(other.lock);
+		if (!other.tasks.empty()) {
+			task = std::move(other.tasks.back());
+			other.tasks.pop_back();
+			queued--;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Function_pool::run_one(size_t self) {
+	Task task;
+	if (!try_pop(self, task)) {
+		return false;
+	}
+	try {
+		task();
+	} catch (...) {
+		std::lock_guard<std::mutex> guard(m_lock);
+		if (!m_error) {
+			m_error = std::current_exception();
+		}
+	}
+	if (unfinished.fetch_sub(1) == 1) {
+		std::lock_guard<std::mutex> guard(m_lock);
+		finished.notify_all();
+	}
+	return true;
+}
+
+void Function_pool::push(Task func) {
+	if (workers.empty()) {
+		// No worker threads: run the task when waitFinished() is called
+		unfinished++;
+		pending_inline.push_back(std::move(func));
+		return;
+	}
+	size_t self = self_index();
+	size_t target = (self != no_worker) ? self : next_worker.fetch_add(1) % workers.size();
+	enqueue(target, std::move(func));
+	notify_workers(false);
+}
+
+void Function_pool::infinite_loop_func(size_t id) {
+	tl_pool = this;
+	tl_worker = id;
+	while (true) {
+		if (run_one(id)) {
+			continue;
+		}
+		sleepers++;
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_data_condition.wait(lock, [this]() {return \
+			queued.load() > 0 || stop; });
+		sleepers--;
+		if (stop && queued.load() == 0) {
+			return;
+		}
 	}
-    }
 }
 
 void Function_pool::waitFinished() {
-    std::unique_lock<std::mutex> lock(m_lock);
-    finished.wait(lock, [this](){return m_function_queue.empty() && busy == 0; });
+	size_t self = self_index();
+	for (size_t i=0; i<pending_inline.size(); i++) {
+		Task task = std::move(pending_inline[i]);
+		try {
+			task();
+		} catch (...) {
+			if (!m_error) {
+				m_error = std::current_exception();
+			}
+		}
+		unfinished--;
+	}
+	pending_inline.clear();
+	while (unfinished.load() > 0) {
+		if (run_one(self)) {
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(m_lock);
+		finished.wait(lock, [this](){return unfinished.load() == 0 || queued.load() > 0; });
+	}
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		std::swap(error, m_error);
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+void Function_pool::parallel_for(size_t begin, size_t end, size_t grain,
+                                 const std::function<void(size_t)>& body,
+                                 const std::vector<double>* cost_hint) {
+	if (end <= begin) {
+		return;
+	}
+	size_t n = end - begin;
+	grain = std::max<size_t>(grain, 1);
+
+	if (workers.empty() || n <= grain) {
+		for (size_t i=begin; i<end; i++) {
+			body(i);
+		}
+		return;
+	}
+
+	// Partition [begin, end) into contiguous chunks of roughly equal cost,
+	// aiming for a few chunks per thread so stealing can even out the tail
+	size_t n_slots = 4 * (workers.size() + 1);
+	std::vector<std::pair<size_t, size_t> > chunks;
+	std::vector<double> chunk_cost;
+	if (cost_hint != nullptr && cost_hint->size() == n) {
+		double total = std::accumulate(cost_hint->begin(), cost_hint->end(), 0.0);
+		double target = total / n_slots;
+		size_t chunk_begin = begin;
+		double acc = 0;
+		for (size_t i=begin; i<end; i++) {
+			acc += (*cost_hint)[i - begin];
+			if ((acc >= target && i + 1 - chunk_begin >= grain) || i + 1 == end) {
+				chunks.push_back(std::make_pair(chunk_begin, i + 1));
+				chunk_cost.push_back(acc);
+				chunk_begin = i + 1;
+				acc = 0;
+			}
+		}
+	} else {
+		size_t chunk_size = std::max(grain, (n + n_slots - 1) / n_slots);
+		for (size_t i=begin; i<end; i+=chunk_size) {
+			size_t chunk_end = std::min(end, i + chunk_size);
+			chunks.push_back(std::make_pair(i, chunk_end));
+			chunk_cost.push_back(static_cast<double>(chunk_end - i));
+		}
+	}
+
+	// Hand out the most expensive chunks first
+	std::vector<size_t> order(chunks.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&chunk_cost](size_t x, size_t y) {
+		return chunk_cost[x] > chunk_cost[y];
+	});
+
+	Latch latch(chunks.size());
+	size_t self = self_index();
+	size_t offset = (self != no_worker) ? self : next_worker.fetch_add(1);
+	for (size_t c=0; c<order.size(); c++) {
+		std::pair<size_t, size_t> range = chunks[order[c]];
+		Latch* latch_ptr = &latch;
+		const std::function<void(size_t)>* body_ptr = &body;
+		enqueue((offset + c) % workers.size(), Task([range, latch_ptr, body_ptr]() {
+			try {
+				for (size_t i=range.first; i<range.second; i++) {
+					(*body_ptr)(i);
+				}
+			} catch (...) {
+				std::lock_guard<std::mutex> guard(latch_ptr->lock);
+				if (!latch_ptr->error) {
+					latch_ptr->error = std::current_exception();
+				}
+			}
+			latch_ptr->count_down();
+		}));
+	}
+	notify_workers(true);
+
+	// Help out until every chunk of this call has completed
+	while (latch.remaining.load() > 0) {
+		if (run_one(self)) {
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(latch.lock);
+		latch.done.wait(lock, [&latch](){return latch.remaining.load() == 0; });
+	}
+	std::lock_guard<std::mutex> guard(latch.lock);
+	if (latch.error) {
+		std::rethrow_exception(latch.error);
+	}
 }
 
+Function_pool& Function_pool::shared(unsigned int n_threads) {
+	static std::unique_ptr<Function_pool> pool;
+	static unsigned int pool_threads = 0;
+	static long pool_pid = 0;
+	if (n_threads == 0) {
+		n_threads = 1;
+	}
+	long pid = static_cast<long>(pool_getpid());
+	if (pool && pool_pid != pid) {
+		// Forked child: the worker threads do not exist here, so the old pool
+		// cannot be joined; abandon it and start a fresh one
+		pool.release();
+	}
+	if (!pool || pool_threads != n_threads) {
+		pool.reset(new Function_pool(n_threads - 1));
+		pool_threads = n_threads;
+		pool_pid = pid;
+	}
+	return *pool;
+}
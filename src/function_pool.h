@@ -1,26 +1,140 @@
-#include <queue>
+#ifndef FUNCTION_POOL_H
+#define FUNCTION_POOL_H
+
+#include <deque>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
-#include <cassert>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include <thread>
 
+/**
+ * @class Function_pool
+ * @brief Work-stealing thread pool shared by the C++ engines.
+ *
+ * Each worker owns a deque of move-only tasks. A worker takes tasks from the
+ * front of its own deque and, when that is empty, steals from the back of the
+ * other workers' deques. Threads that wait for work to finish (the caller of
+ * `parallel_for()` or `waitFinished()`) execute queued tasks themselves until
+ * their work is done, so a pool of `n` workers keeps `n + 1` threads busy and
+ * `parallel_for()` may be nested from inside a task without deadlocking.
+ *
+ * `parallel_for()` accepts optional per-index cost weights (e.g. LD block sizes).
+ * Indices are grouped into contiguous chunks of roughly equal cost, and the
+ * chunks are handed out heaviest first so a single large block does not end up
+ * as the tail of an iteration.
+ *
+ * Use `Function_pool::shared()` to obtain a process-wide pool that is created
+ * once and reused across engine calls instead of starting and joining threads
+ * on every call.
+ */
 class Function_pool {
+    public:
+	/**
+	 * @brief Type-erased, move-only callable stored in the worker deques.
+	 */
+	class Task {
+	    public:
+		Task() {}
+		template <typename F, typename = typename std::enable_if<
+				  !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+		Task(F&& f) : impl(new model<typename std::decay<F>::type>(std::forward<F>(f))) {}
+		Task(Task&&) = default;
+		Task& operator=(Task&&) = default;
+		Task(const Task&) = delete;
+		Task& operator=(const Task&) = delete;
+
+		void operator()() { impl->run(); }
+		explicit operator bool() const { return static_cast<bool>(impl); }
+
+	    private:
+		struct concept_t {
+			virtual ~concept_t() {}
+			virtual void run() = 0;
+		};
+		template <typename F>
+		struct model : concept_t {
+			F f;
+			template <typename G>
+			explicit model(G&& g) : f(std::forward<G>(g)) {}
+			void run() { f(); }
+		};
+		std::unique_ptr<concept_t> impl;
+	};
+
+	Function_pool(unsigned int n);
+	~Function_pool();
+
+	/// Queue a single task; use waitFinished() to block until all tasks are done.
+	void push(Task func);
+	void infinite_loop_func(size_t id);
+	void waitFinished();
+
+	/**
+	 * @brief Run `body(i)` for every `i` in `[begin, end)` and wait for completion.
+	 *
+	 * @param begin First index.
+	 * @param end One past the last index.
+	 * @param grain Minimum number of indices per chunk.
+	 * @param body Function invoked once per index.
+	 * @param cost_hint Optional relative cost of each index (length `end - begin`).
+	 *
+	 * The first exception thrown by `body` is rethrown on the calling thread once
+	 * all chunks have finished.
+	 */
+	void parallel_for(size_t begin, size_t end, size_t grain,
+	                  const std::function<void(size_t)>& body,
+	                  const std::vector<double>* cost_hint = nullptr);
+	void parallel_for(size_t begin, size_t end, size_t grain,
+	                  const std::function<void(size_t)>& body,
+	                  const std::vector<double>& cost_hint) {
+		parallel_for(begin, end, grain, body, &cost_hint);
+	}
+
+	/// Number of worker threads (the calling thread is not counted).
+	unsigned int size() const { return static_cast<unsigned int>(thread_pool.size()); }
+
+	/**
+	 * @brief Process-wide pool giving `n_threads` threads of parallelism.
+	 *
+	 * The pool is kept with `n_threads - 1` workers (the caller is the remaining
+	 * thread). It is rebuilt only when a different thread count is requested or
+	 * after the process has been forked, since worker threads do not survive fork().
+	 * Must be called from the main thread while no pool work is in flight.
+	 */
+	static Function_pool& shared(unsigned int n_threads);
+
     private:
+	struct Worker {
+		std::deque<Task> tasks;
+		std::mutex lock;
+	};
+
+	struct Latch;
+
+	bool try_pop(size_t self, Task& task);
+	bool run_one(size_t self);
+	void enqueue(size_t target, Task task);
+	void notify_workers(bool all);
+	size_t self_index() const;
+
 	std::vector<std::thread> thread_pool;
-	std::queue<std::function<void()>> m_function_queue;
+	std::vector<std::unique_ptr<Worker> > workers;
+	std::vector<Task> pending_inline;
 	std::mutex m_lock;
 	std::condition_variable m_data_condition;
 	std::condition_variable finished;
-	std::atomic<bool> m_accept_functions;
-	int busy;
-	bool stop;
-
-    public:
-	Function_pool(unsigned int n);
-	~Function_pool();
-	void push(std::function<void()> func);
-	void infinite_loop_func();
-	void waitFinished();
+	std::atomic<size_t> queued;
+	std::atomic<size_t> unfinished;
+	std::atomic<size_t> sleepers;
+	std::atomic<size_t> next_worker;
+	std::atomic<bool> stop;
+	std::exception_ptr m_error;
 };
+
+#endif // FUNCTION_POOL_H
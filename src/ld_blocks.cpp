@@ -0,0 +1,79 @@
+#include "ld_blocks.h"
+#include <cmath>
+#include "ld_handle.h"
+
+ld_blocks::ld_blocks(SEXP LD, bool copy) : copy(copy) {
+	// Reserve up front: the views must never be moved by a reallocation
+	if (is_ld_handle(LD)) {
+		const ld_handle& handle = as_ld_handle(LD);
+		if (handle.has_factor()) {
+			Rcpp::stop("This method does not take an LD handle holding a low-rank factor.");
+		}
+		mats.reserve(handle.blocks().size());
+		for (const arma::mat& blk : handle.blocks()) {
+			// the handle is only read, and outlives the call
+			mats.emplace_back(const_cast<double*>(blk.memptr()), blk.n_rows, blk.n_cols, false, true);
+		}
+	}
+	else if (TYPEOF(LD) == STRSXP) {
+		Rcpp::CharacterVector files(LD);
+		mats.reserve(files.size());
+		for (R_xlen_t i = 0; i < files.size(); i++) {
+			add_file(Rcpp::as<std::string>(files[i]));
+		}
+	}
+	else if (TYPEOF(LD) == VECSXP) {
+		Rcpp::List list(LD);
+		mats.reserve(list.size());
+		for (R_xlen_t i = 0; i < list.size(); i++) {
+			add_matrix(list[i]);
+		}
+	}
+	else {
+		mats.reserve(1);
+		add_matrix(LD);
+	}
+}
+
+void ld_blocks::add_matrix(SEXP x) {
+	if (TYPEOF(x) == REALSXP && Rf_isMatrix(x) && !copy) {
+		// R keeps the object alive for the duration of the call
+		mats.emplace_back(REAL(x), Rf_nrows(x), Rf_ncols(x), false, true);
+	}
+	else {
+		mats.emplace_back(Rcpp::as<arma::mat>(x));
+	}
+}
+
+void ld_blocks::add_file(const std::string& path) {
+	std::shared_ptr<mapped_file> file(new mapped_file(path));
+	if (file->data() == nullptr) {
+		Rcpp::stop("Unable to read the LD block file " + path + ".");
+	}
+	size_t n_elem = file->size() / sizeof(double);
+	size_t n = static_cast<size_t>(std::floor(std::sqrt(static_cast<double>(n_elem)) + 0.5));
+	if (n * n * sizeof(double) != file->size()) {
+		Rcpp::stop("The LD block file " + path + " does not hold a square matrix of doubles.");
+	}
+	mats.emplace_back(reinterpret_cast<double*>(file->data()), n, n, false, true);
+	mapped.push_back(file);
+}
+
+bool is_ld_factor(SEXP LD) {
+	if (is_ld_handle(LD)) {
+		return as_ld_handle(LD).has_factor();
+	}
+	return TYPEOF(LD) == VECSXP && Rf_inherits(LD, "ld_factor");
+}
+
+std::shared_ptr<const ld_factor> as_ld_factor(SEXP LD) {
+	if (is_ld_handle(LD)) {
+		return as_ld_handle(LD).factor();
+	}
+	Rcpp::List obj(LD);
+	if (!obj.containsElementNamed("factor")) {
+		Rcpp::stop("An ld_factor object must hold its factor matrix.");
+	}
+	Rcpp::NumericMatrix F(obj["factor"]);
+	return std::make_shared<const ld_factor>(F.begin(), F.nrow(), F.ncol());
+}
@@ -0,0 +1,66 @@
+#ifndef LD_BLOCKS_H
+#define LD_BLOCKS_H
+
+#include <RcppArmadillo.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ld_factor.h"
+#include "ldmat_cache.h"
+
+/**
+ * @class ld_blocks
+ * @brief LD blocks handed from R to the C++ engines without copying them.
+ *
+ * `LD` may be
+ * - a numeric matrix or a list of numeric matrices. Double matrices are wrapped
+ *   as non-owning `arma::mat(ptr, n_rows, n_cols, false, true)` views of R's
+ *   memory; matrices of other storage modes (integer, logical) are converted,
+ *   which needs a copy;
+ * - a character vector of LD block files, one block per file, holding the square
+ *   block as raw column-major doubles in native byte order (`write_ld_blocks()`
+ *   in R). Files are mapped and the blocks point into the mapping, so the panel
+ *   is paged in block by block as the engines reach it and never has to be
+ *   materialized in R;
+ * - an LD handle (`ld_handle`), whose blocks are wrapped as views.
+ *
+ * The engines only read the blocks: they take them by const reference, or move
+ * the whole vector (which does not move the elements, so the views stay
+ * intact). Copying an element makes an owned deep copy. The file mappings are
+ * private, so nothing written to a block could ever reach the file.
+ */
+class ld_blocks {
+public:
+/// With `copy`, matrices in R memory are deep-copied (files stay mapped), so the blocks outlive the call.
+explicit ld_blocks(SEXP LD, bool copy = false);
+ld_blocks(const ld_blocks&) = delete;
+ld_blocks& operator=(const ld_blocks&) = delete;
+
+/// The blocks; must not outlive this object.
+std::vector<arma::mat>& blocks() {
+	return mats;
+}
+const std::vector<arma::mat>& blocks() const {
+	return mats;
+}
+size_t size() const {
+	return mats.size();
+}
+
+private:
+void add_matrix(SEXP x);
+void add_file(const std::string& path);
+
+// declared first so the mappings outlive the views into them
+std::vector<std::shared_ptr<mapped_file> > mapped;
+std::vector<arma::mat> mats;
+bool copy;
+};
+
+/// Whether LD is an "ld_factor" object from R (a list holding the p x k matrix `factor`), or an LD handle holding one.
+bool is_ld_factor(SEXP LD);
+
+/// The factor of an "ld_factor" object, converted to single precision, or the factor of an LD handle.
+std::shared_ptr<const ld_factor> as_ld_factor(SEXP LD);
+
+#endif // LD_BLOCKS_H
@@ -0,0 +1,78 @@
+#ifndef LD_FACTOR_H
+#define LD_FACTOR_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * @class ld_factor
+ * @brief A low-rank LD matrix R = F F', kept as its p x k factor F in single precision.
+ *
+ * F is the standardized reference genotype matrix, transposed and divided by
+ * sqrt(n_ref - 1), or a precomputed factor U diag(d) (`ld_factor()` in R). The
+ * engines read R through its entries, diagonal and products with F, so memory
+ * is O(p k) instead of O(p^2). The k loadings of a variant are contiguous.
+ */
+class ld_factor {
+public:
+/// Factor from the column-major p x k matrix F
+ld_factor(const double* F, size_t p, size_t k) : p(p), k(k), loads(p * k), dgl(p, 0.0) {
+	for (size_t j = 0; j < p; j++) {
+		for (size_t c = 0; c < k; c++) {
+			loads[j * k + c] = static_cast<float>(F[j + c * p]);
+		}
+		dgl[j] = dot(j, j);
+	}
+}
+
+size_t n_variants() const {
+	return p;
+}
+size_t rank() const {
+	return k;
+}
+/// The k loadings of variant j
+const float* loadings(size_t j) const {
+	return &loads[j * k];
+}
+double diag(size_t j) const {
+	return dgl[j];
+}
+/// R(i, j), accumulated in double precision
+double entry(size_t i, size_t j) const {
+	return i == j ? dgl[i] : dot(i, j);
+}
+/// The loadings of variant j dotted with the k-vector u
+double project(size_t j, const double* u) const {
+	const float* f = loadings(j);
+	double s = 0;
+	for (size_t c = 0; c < k; c++) {
+		s += f[c] * u[c];
+	}
+	return s;
+}
+/// u += a * (loadings of variant j)
+void add_loadings(size_t j, double a, double* u) const {
+	const float* f = loadings(j);
+	for (size_t c = 0; c < k; c++) {
+		u[c] += a * f[c];
+	}
+}
+
+private:
+double dot(size_t i, size_t j) const {
+	const float* fi = loadings(i);
+	const float* fj = loadings(j);
+	double s = 0;
+	for (size_t c = 0; c < k; c++) {
+		s += static_cast<double>(fi[c]) * fj[c];
+	}
+	return s;
+}
+
+size_t p, k;
+std::vector<float> loads;
+std::vector<double> dgl;
+};
+
+#endif // LD_FACTOR_H
@@ -0,0 +1,87 @@
+#include "ld_handle.h"
+
+ld_handle::ld_handle(SEXP LD) {
+	if (is_ld_handle(LD)) {
+		Rcpp::stop("LD is already an LD handle.");
+	}
+	if (is_ld_factor(LD)) {
+		R_factor = as_ld_factor(LD);
+		return;
+	}
+	R_blocks.reset(new ld_blocks(LD, true));
+	for (const arma::mat& blk : R_blocks->blocks()) {
+		if (blk.n_rows != blk.n_cols) {
+			Rcpp::stop("Every LD block must be a square matrix.");
+		}
+	}
+}
+
+const std::vector<arma::mat>& ld_handle::blocks() const {
+	static const std::vector<arma::mat> none;
+	return R_blocks ? R_blocks->blocks() : none;
+}
+
+size_t ld_handle::n_variants() const {
+	if (R_factor) {
+		return R_factor->n_variants();
+	}
+	size_t n = 0;
+	for (const arma::mat& blk : blocks()) {
+		n += blk.n_rows;
+	}
+	return n;
+}
+
+bool is_ld_handle(SEXP LD) {
+	return TYPEOF(LD) == EXTPTRSXP && Rf_inherits(LD, "ld_handle");
+}
+
+ld_handle& as_ld_handle(SEXP LD) {
+	ld_handle* handle = static_cast<ld_handle*>(R_ExternalPtrAddr(LD));
+	if (handle == nullptr) {
+		// external pointers are not saved with the session
+		Rcpp::stop("The LD handle is no longer valid; create it again with ld_handle().");
+	}
+	return *handle;
+}
+
+/**
+ * @brief Build an LD handle.
+ *
+ * @param LD A matrix, a list of LD blocks, a character vector of LD block files
+ *        (see `ld_blocks`) or an "ld_factor" object.
+ * @return An external pointer of class "ld_handle"; the handle is freed when R
+ *         collects it.
+ */
+// [[Rcpp::export]]
+SEXP ld_handle_rcpp(SEXP LD) {
+	Rcpp::XPtr<ld_handle> handle(new ld_handle(LD), true);
+	handle.attr("class") = "ld_handle";
+	return handle;
+}
+
+/**
+ * @brief Contents of an LD handle.
+ *
+ * @return A list with the number of variants (`n_variants`), the size of each
+ *         LD block (`block_sizes`, empty for a factor), the rank of the factor
+ *         (`rank`, 0 for blocks) and the number of SDPR preprocessed blocks
+ *         cached on the handle (`sdpr_cached`).
+ */
+// [[Rcpp::export]]
+Rcpp::List ld_handle_info(SEXP handle) {
+	if (!is_ld_handle(handle)) {
+		Rcpp::stop("handle must be an LD handle.");
+	}
+	ld_handle& h = as_ld_handle(handle);
+	Rcpp::IntegerVector block_sizes(h.blocks().size());
+	for (size_t i = 0; i < h.blocks().size(); i++) {
+		block_sizes[i] = h.blocks()[i].n_rows;
+	}
+	return Rcpp::List::create(
+		Rcpp::Named("n_variants") = static_cast<double>(h.n_variants()),
+		Rcpp::Named("block_sizes") = block_sizes,
+		Rcpp::Named("rank") = static_cast<double>(h.has_factor() ? h.factor()->rank() : 0),
+		Rcpp::Named("sdpr_cached") = static_cast<double>(h.sdpr_cache().size())
+		);
+}
@@ -0,0 +1,60 @@
+#ifndef LD_HANDLE_H
+#define LD_HANDLE_H
+
+#include <RcppArmadillo.h>
+#include <memory>
+#include <vector>
+#include "ld_blocks.h"
+#include "ld_factor.h"
+#include "ldmat_cache.h"
+
+/**
+ * @class ld_handle
+ * @brief An LD panel held by C++ across calls, handed to R as an external pointer (`ld_handle()` in R).
+ *
+ * The handle is built once from any LD accepted by `ld_blocks` or from an
+ * "ld_factor" object. Matrices held in R memory are copied once; LD block files
+ * stay mapped for the lifetime of the handle; a factor is kept in single
+ * precision. Every engine that reads its LD through `ld_blocks` or
+ * `as_ld_factor()` accepts the handle, and sees the handle's blocks or factor in
+ * place, so repeated fits against one panel neither convert nor copy it again.
+ *
+ * The handle also keeps the derived products that only depend on the panel:
+ * the SDPR preprocessing of every block (A and B of `solve_ldmat`), keyed by
+ * content and options as in `ldmat_cache`, is computed once per option set and
+ * reused by every later SDPR run on the handle.
+ */
+class ld_handle {
+public:
+explicit ld_handle(SEXP LD);
+ld_handle(const ld_handle&) = delete;
+ld_handle& operator=(const ld_handle&) = delete;
+
+bool has_factor() const {
+	return R_factor != nullptr;
+}
+std::shared_ptr<const ld_factor> factor() const {
+	return R_factor;
+}
+/// The LD blocks; empty for a handle that holds a factor.
+const std::vector<arma::mat>& blocks() const;
+size_t n_variants() const;
+
+/// In-memory SDPR preprocessing of the blocks
+ldmat_memo& sdpr_cache() {
+	return sdpr_memo;
+}
+
+private:
+std::unique_ptr<ld_blocks> R_blocks;
+std::shared_ptr<const ld_factor> R_factor;
+ldmat_memo sdpr_memo;
+};
+
+/// Whether LD is an LD handle: an external pointer of class "ld_handle".
+bool is_ld_handle(SEXP LD);
+
+/// The handle behind LD, which stays valid while R holds LD.
+ld_handle& as_ld_handle(SEXP LD);
+
+#endif // LD_HANDLE_H
@@ -0,0 +1,214 @@
+#include "ldmat_cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#ifdef _WIN32
+#include <process.h>
+#define cache_getpid _getpid
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define cache_getpid getpid
+#endif
+
+namespace {
+const char cache_magic[8] = {'P', 'E', 'C', 'O', 'L', 'D', 'C', '1'};
+const uint32_t cache_version = 1;
+const size_t header_size = 64;
+
+// File header; padded to 64 bytes so the matrices that follow are aligned
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t elem_size;
+	uint64_t n;
+	uint64_t key[2];
+	uint64_t reserved[3];
+};
+}
+
+mapped_file::mapped_file(const std::string& path) : ptr(nullptr), len(0) {
+#ifdef _WIN32
+	std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+	if (!in) {
+		return;
+	}
+	std::streamsize n = in.tellg();
+	if (n <= 0) {
+		return;
+	}
+	buffer.resize(static_cast<size_t>(n));
+	in.seekg(0);
+	if (in.read(buffer.data(), n)) {
+		ptr = buffer.data();
+		len = buffer.size();
+	}
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		// Private writable mapping: pages are copy-on-write and never reach the file
+		void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			ptr = static_cast<char*>(p);
+			len = static_cast<size_t>(st.st_size);
+		}
+	}
+	close(fd);
+#endif
+}
+
+mapped_file::~mapped_file() {
+#ifndef _WIN32
+	if (ptr != nullptr) {
+		munmap(ptr, len);
+	}
+#endif
+}
+
+bool write_file_atomic(const std::string& path, const std::vector<std::pair<const char*, size_t> >& parts) {
+	std::ostringstream tmp_name;
+	tmp_name << path << ".tmp." << cache_getpid() << "." << std::this_thread::get_id();
+	std::string tmp = tmp_name.str();
+	{
+		std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out) {
+			return false;
+		}
+		for (size_t i=0; i<parts.size(); i++) {
+			out.write(parts[i].first, parts[i].second);
+		}
+		out.close();
+		if (!out) {
+			std::remove(tmp.c_str());
+			return false;
+		}
+	}
+#ifdef _WIN32
+	std::remove(path.c_str());
+#endif
+	if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+		std::remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+ldmat_cache::key ldmat_cache::block_key(const arma::mat& R, double a, unsigned sz, int opt_llk,
+                                        const double* snp_sz, const int* snp_array) {
+	content_hasher h;
+	h.add(static_cast<uint64_t>(cache_version));
+	h.add(static_cast<uint64_t>(R.n_rows));
+	h.add(static_cast<uint64_t>(R.n_cols));
+	h.add(static_cast<uint64_t>(opt_llk));
+	if (opt_llk == 1) {
+		h.add(a);
+		h.add(static_cast<uint64_t>(sz));
+	}
+	else {
+		for (size_t j=0; j<R.n_rows; j++) {
+			h.add(snp_sz != nullptr ? snp_sz[j] : 0.0);
+			h.add(static_cast<uint64_t>(snp_array != nullptr ? snp_array[j] : 0));
+		}
+	}
+	h.add(R.memptr(), R.n_elem);
+	return h.digest();
+}
+
+std::string ldmat_cache::path(const key& k) const {
+	std::ostringstream os;
+	os << dir << "/sdpr_ld_" << std::hex << std::setfill('0') << std::setw(16) << k.h[0]
+	   << std::setw(16) << k.h[1] << ".bin";
+	return os.str();
+}
+
+double* ldmat_cache::load(const key& k, size_t n, std::shared_ptr<const void>& owner) const {
+	if (memo != nullptr) {
+		double* hit = memo->find(k, owner);
+		if (hit != nullptr) {
+			return hit;
+		}
+	}
+	if (dir.empty()) {
+		return nullptr;
+	}
+	std::shared_ptr<mapped_file> file(new mapped_file(path(k)));
+	size_t n_elem = n * n;
+	if (file->data() == nullptr || file->size() != header_size + 2 * n_elem * sizeof(double)) {
+		return nullptr;
+	}
+	cache_header header;
+	std::memcpy(&header, file->data(), sizeof(header));
+	if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != cache_version ||
+	    header.elem_size != sizeof(double) || header.n != n ||
+	    header.key[0] != k.h[0] || header.key[1] != k.h[1]) {
+		return nullptr;
+	}
+	double* mem = reinterpret_cast<double*>(file->data() + header_size);
+	if (memo != nullptr) {
+		memo->insert(k, file, mem);
+	}
+	owner = file;
+	return mem;
+}
+
+bool ldmat_cache::store(const key& k, const arma::mat& A, const arma::mat& B) const {
+	if (memo != nullptr) {
+		std::shared_ptr<std::vector<double> > buffer(new std::vector<double>(A.n_elem + B.n_elem));
+		std::copy(A.memptr(), A.memptr() + A.n_elem, buffer->begin());
+		std::copy(B.memptr(), B.memptr() + B.n_elem, buffer->begin() + A.n_elem);
+		memo->insert(k, buffer, buffer->data());
+	}
+	if (dir.empty()) {
+		return memo != nullptr;
+	}
+	cache_header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+	header.version = cache_version;
+	header.elem_size = sizeof(double);
+	header.n = A.n_rows;
+	header.key[0] = k.h[0];
+	header.key[1] = k.h[1];
+	char pad[header_size];
+	std::memset(pad, 0, sizeof(pad));
+	std::memcpy(pad, &header, sizeof(header));
+
+	std::vector<std::pair<const char*, size_t> > parts;
+	parts.push_back(std::make_pair(pad, header_size));
+	parts.push_back(std::make_pair(reinterpret_cast<const char*>(A.memptr()), A.n_elem * sizeof(double)));
+	parts.push_back(std::make_pair(reinterpret_cast<const char*>(B.memptr()), B.n_elem * sizeof(double)));
+	return write_file_atomic(path(k), parts);
+}
+
+double* ldmat_memo::find(const content_hash& k, std::shared_ptr<const void>& owner) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = entries.find(std::make_pair(k.h[0], k.h[1]));
+	if (it == entries.end()) {
+		return nullptr;
+	}
+	owner = it->second.owner;
+	return it->second.data;
+}
+
+void ldmat_memo::insert(const content_hash& k, std::shared_ptr<const void> owner, double* data) {
+	std::lock_guard<std::mutex> lock(mutex);
+	entry e;
+	e.owner = std::move(owner);
+	e.data = data;
+	entries.emplace(std::make_pair(k.h[0], k.h[1]), std::move(e));
+}
+
+size_t ldmat_memo::size() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return entries.size();
+}
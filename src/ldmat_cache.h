@@ -0,0 +1,147 @@
+#ifndef LDMAT_CACHE_H
+#define LDMAT_CACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <armadillo>
+#include "content_hash.h"
+
+/**
+ * @class mapped_file
+ * @brief Read-only view of a file mapped into memory.
+ *
+ * The mapping is private (copy-on-write), so matrices constructed on top of it
+ * can never modify the file. On platforms without mmap the file is read into
+ * an owned buffer instead.
+ */
+class mapped_file {
+public:
+/// Map `path`; `data()` is null if the file cannot be opened or mapped.
+explicit mapped_file(const std::string& path);
+~mapped_file();
+mapped_file(const mapped_file&) = delete;
+mapped_file& operator=(const mapped_file&) = delete;
+
+char* data() const {
+	return ptr;
+}
+size_t size() const {
+	return len;
+}
+
+private:
+char* ptr;
+size_t len;
+std::vector<char> buffer;
+};
+
+/**
+ * @brief Write the concatenation of `parts` to `path`.
+ *
+ * The data is written to a temporary name and renamed into place, so readers
+ * never see a partial file; returns false (and leaves no file behind) on failure.
+ */
+bool write_file_atomic(const std::string& path, const std::vector<std::pair<const char*, size_t> >& parts);
+
+/**
+ * @class ldmat_memo
+ * @brief In-memory tier of `ldmat_cache`, kept on an LD handle (`ld_handle`) across runs.
+ *
+ * Entries are keyed like the cache files and hold A followed by B, either in a
+ * buffer owned by the entry or in a mapped cache file that the entry keeps
+ * mapped. Lookups and insertions are thread-safe.
+ */
+class ldmat_memo {
+public:
+/// A and B of the block with key `k`, or null; `owner` keeps them alive.
+double* find(const content_hash& k, std::shared_ptr<const void>& owner) const;
+/// Add A and B at `data`, kept alive by `owner`; an existing entry is kept.
+void insert(const content_hash& k, std::shared_ptr<const void> owner, double* data);
+size_t size() const;
+
+private:
+struct entry {
+	std::shared_ptr<const void> owner;
+	double* data;
+};
+mutable std::mutex mutex;
+std::map<std::pair<uint64_t, uint64_t>, entry> entries;
+};
+
+/**
+ * @class ldmat_cache
+ * @brief Persistent on-disk cache of the per-block SDPR LD preprocessing.
+ *
+ * `solve_ldmat()` turns every reference LD block R into A = (R + aI)^-1 R
+ * (scaled by N for `opt_llk == 1`) and B = R A. This depends only on the LD
+ * panel and the preprocessing options, not on the GWAS, so it is identical for
+ * every trait fitted against the same panel. The cache stores A and B of one
+ * block per file, named after a 128-bit content hash of the block and of every
+ * option that affects the result:
+ * - `opt_llk == 1`: the LD block, `a` and `sz`;
+ * - `opt_llk == 2`: the LD block and the per-SNP sample sizes and array labels.
+ *
+ * Files hold a fixed 64-byte header followed by A and B in column-major order,
+ * so a hit is served by mapping the file and pointing Armadillo matrices at it
+ * without any copy or factorization. Files are written to a temporary name and
+ * renamed into place, so concurrent jobs sharing a cache directory never see a
+ * partial file.
+ *
+ * With a `memo`, blocks are looked up there before the directory, and every block
+ * loaded or stored is added to it, so repeated runs against one LD handle in the
+ * same session skip both the factorization and the file. Either tier may be absent.
+ */
+class ldmat_cache {
+public:
+typedef content_hash key;
+
+explicit ldmat_cache(const std::string& dir, ldmat_memo* memo = nullptr) : dir(dir), memo(memo) {
+}
+
+bool enabled() const {
+	return !dir.empty() || memo != nullptr;
+}
+
+/**
+ * @brief Hash of the LD block and the preprocessing options.
+ *
+ * @param R The reference LD block.
+ * @param a Shrinkage added to the diagonal (opt_llk == 1).
+ * @param sz GWAS sample size (opt_llk == 1).
+ * @param opt_llk Likelihood option.
+ * @param snp_sz Per-SNP sample sizes of the block (opt_llk == 2), may be null.
+ * @param snp_array Per-SNP array labels of the block (opt_llk == 2), may be null.
+ */
+static key block_key(const arma::mat& R, double a, unsigned sz, int opt_llk,
+                     const double* snp_sz, const int* snp_array);
+
+/**
+ * @brief Look up a block.
+ *
+ * On a hit, returns a pointer to A inside the memo entry or the mapped file,
+ * with B following at offset n * n. The caller builds non-owning matrices on
+ * top of it, e.g. `arma::mat(mem, n, n, false, true)`, and keeps `owner` alive
+ * for as long as they are in use.
+ *
+ * @return null if the block is not in the memo and its file is missing,
+ *         truncated or was built for a different key.
+ */
+double* load(const key& k, size_t n, std::shared_ptr<const void>& owner) const;
+
+/// Store a block, returning false (and leaving no file behind) if the write fails.
+bool store(const key& k, const arma::mat& A, const arma::mat& B) const;
+
+private:
+std::string path(const key& k) const;
+
+std::string dir;
+ldmat_memo* memo;
+};
+
+#endif // LDMAT_CACHE_H
@@ -0,0 +1,67 @@
+#ifndef LOG_SUM_EXP_H
+#define LOG_SUM_EXP_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+/**
+ * exp(x) for x <= 0, without branches or library calls so that loops over it
+ * vectorize. Cody-Waite reduction x = n log(2) + r with |r| <= log(2) / 2 and a
+ * degree-13 Taylor polynomial of exp(r), accurate to a few ulp. Returns 0 below
+ * -708 (where exp(x) turns subnormal), in particular for x = -Inf.
+ */
+inline double exp_nonpositive(double x) {
+	const double shift = 6755399441055744.0; // 1.5 * 2^52: adding it rounds to an integer
+	double xc = x < -708.0 ? -708.0 : x;
+	double t = xc * 1.4426950408889634074 + shift;
+	double n = t - shift;
+	double r = (xc - n * 6.93147180369123816490e-01) - n * 1.90821492927058770002e-10;
+	double e = 1.0 / 6227020800.0;
+	e = e * r + 1.0 / 479001600.0;
+	e = e * r + 1.0 / 39916800.0;
+	e = e * r + 1.0 / 3628800.0;
+	e = e * r + 1.0 / 362880.0;
+	e = e * r + 1.0 / 40320.0;
+	e = e * r + 1.0 / 5040.0;
+	e = e * r + 1.0 / 720.0;
+	e = e * r + 1.0 / 120.0;
+	e = e * r + 1.0 / 24.0;
+	e = e * r + 1.0 / 6.0;
+	e = e * r + 0.5;
+	e = e * r + 1.0;
+	e = e * r + 1.0;
+	// 2^n from the integer left in the low mantissa bits of t
+	uint64_t bits;
+	std::memcpy(&bits, &t, sizeof(bits));
+	bits = (bits + 1023) << 52;
+	double scale;
+	std::memcpy(&scale, &bits, sizeof(scale));
+	return x < -708.0 ? 0.0 : e * scale;
+}
+
+/**
+ * log(sum_k exp(x[k])) over n values, in two vectorized passes (maximum, then
+ * the sum of exp_nonpositive(x[k] - max)). -Inf when n is 0 or every x[k] is -Inf.
+ */
+inline double log_sum_exp(const double* x, size_t n) {
+	double u = -std::numeric_limits<double>::infinity();
+	#pragma omp simd reduction(max:u)
+	for (size_t k = 0; k < n; k++) {
+		u = std::max(u, x[k]);
+	}
+	if (u == -std::numeric_limits<double>::infinity()) {
+		return u;
+	}
+	double total = 0;
+	#pragma omp simd reduction(+:total)
+	for (size_t k = 0; k < n; k++) {
+		total += exp_nonpositive(x[k] - u);
+	}
+	return u + std::log(total);
+}
+
+#endif // LOG_SUM_EXP_H
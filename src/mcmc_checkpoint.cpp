@@ -0,0 +1,78 @@
+#include "mcmc_checkpoint.h"
+#include <fstream>
+
+namespace {
+const char checkpoint_magic[8] = {'P', 'E', 'C', 'O', 'M', 'C', 'K', '1'};
+const uint32_t checkpoint_version = 1;
+const size_t header_size = 64;
+
+struct checkpoint_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t finished;
+	uint64_t fingerprint[2];
+	uint64_t iteration;
+	uint64_t payload_size;
+	uint64_t reserved[2];
+};
+}
+
+void checkpoint_writer::commit(const std::string& path, const content_hash& fingerprint, uint64_t iteration,
+                               bool finished) const {
+	checkpoint_header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, checkpoint_magic, sizeof(checkpoint_magic));
+	header.version = checkpoint_version;
+	header.finished = finished ? 1 : 0;
+	header.fingerprint[0] = fingerprint.h[0];
+	header.fingerprint[1] = fingerprint.h[1];
+	header.iteration = iteration;
+	header.payload_size = payload.size();
+	char pad[header_size];
+	std::memset(pad, 0, sizeof(pad));
+	std::memcpy(pad, &header, sizeof(header));
+
+	std::vector<std::pair<const char*, size_t> > parts;
+	parts.push_back(std::make_pair(pad, header_size));
+	parts.push_back(std::make_pair(payload.data(), payload.size()));
+	if (!write_file_atomic(path, parts)) {
+		throw std::runtime_error("Unable to write the checkpoint file " + path + ".");
+	}
+}
+
+checkpoint_reader::checkpoint_reader(const std::string& path, const content_hash& fingerprint)
+	: path(path), pos(nullptr), end(nullptr), itr(0), done(false) {
+	if (!std::ifstream(path.c_str()).good()) {
+		return;
+	}
+	std::shared_ptr<mapped_file> mapping(new mapped_file(path));
+	checkpoint_header header;
+	if (mapping->data() == nullptr || mapping->size() < header_size) {
+		throw std::runtime_error("The checkpoint file " + path + " is not a valid checkpoint.");
+	}
+	std::memcpy(&header, mapping->data(), sizeof(header));
+	if (std::memcmp(header.magic, checkpoint_magic, sizeof(checkpoint_magic)) != 0 ||
+	    header.version != checkpoint_version || header.payload_size != mapping->size() - header_size) {
+		throw std::runtime_error("The checkpoint file " + path + " is not a valid checkpoint.");
+	}
+	if (header.fingerprint[0] != fingerprint.h[0] || header.fingerprint[1] != fingerprint.h[1]) {
+		throw std::runtime_error("The checkpoint file " + path + " was written by a run with different inputs or settings.");
+	}
+	file = mapping;
+	pos = file->data() + header_size;
+	end = file->data() + file->size();
+	itr = header.iteration;
+	done = header.finished != 0;
+}
+
+void checkpoint_reader::check(uint64_t n) const {
+	if (n > static_cast<uint64_t>(end - pos)) {
+		throw std::runtime_error("The checkpoint file " + path + " is truncated.");
+	}
+}
+
+void checkpoint_reader::finish() const {
+	if (pos != end) {
+		throw std::runtime_error("The checkpoint file " + path + " does not match the sampler state.");
+	}
+}
@@ -0,0 +1,164 @@
+/**
+ * @file mcmc_checkpoint.h
+ * @brief Binary checkpoints of MCMC sampler state.
+ *
+ * The samplers draw from counter-based streams keyed by the seed and the
+ * iteration (`rng_stream`), so the random number state of a run is determined by
+ * the iteration it has reached. A checkpoint therefore holds that iteration, the
+ * sampler state, the posterior accumulators and the convergence monitors, and a
+ * resumed run continues bit-identically to one that was never interrupted.
+ *
+ * State objects list their fields once, in
+ * `template <typename Archive> void checkpoint(Archive& ar)`, through
+ * `ar.field(x)`; the same method saves them to a `checkpoint_writer` and restores
+ * them from a `checkpoint_reader`. Fields are trivially copyable values, vectors
+ * of fields, `arma::vec` and `chain_monitor`.
+ *
+ * Files hold a fixed 64-byte header (magic, version, a fingerprint of the inputs
+ * and settings of the run, the iteration and whether the run has finished)
+ * followed by the fields in order. They are written to a temporary name and
+ * renamed into place (`write_file_atomic`), so a run preempted while writing
+ * leaves the previous checkpoint intact.
+ */
+
+#ifndef MCMC_CHECKPOINT_H
+#define MCMC_CHECKPOINT_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <armadillo>
+#include "content_hash.h"
+#include "ldmat_cache.h"
+#include "mcmc_diagnostics.h"
+
+/// Checkpointing and early stopping settings shared by the samplers
+struct mcmc_checkpoint_options {
+	explicit mcmc_checkpoint_options(const std::string& path = "", int every = 100, double min_ess = 0)
+		: path(path), every(every), min_ess(min_ess) {
+	}
+
+	std::string path;   // checkpoint file; empty disables checkpoints
+	int every;          // iterations between checkpoints
+	double min_ess;     // stop once the monitored scalar reaches this effective sample size; 0 runs all iterations
+
+	bool enabled() const {
+		return !path.empty();
+	}
+};
+
+class checkpoint_writer {
+public:
+template <typename T>
+void field(T& x) {
+	static_assert(std::is_trivially_copyable<T>::value, "checkpoint fields must be trivially copyable");
+	append(&x, sizeof(T));
+}
+template <typename T>
+void field(std::vector<T>& x) {
+	uint64_t n = x.size();
+	field(n);
+	for (size_t i=0; i<x.size(); i++) {
+		field(x[i]);
+	}
+}
+void field(arma::vec& x) {
+	uint64_t n = x.n_elem;
+	field(n);
+	append(x.memptr(), x.n_elem * sizeof(double));
+}
+void field(chain_monitor& x) {
+	x.checkpoint(*this);
+}
+
+/**
+ * @brief Write the fields added so far to `path`.
+ *
+ * @param fingerprint Hash of the inputs and settings of the run.
+ * @param iteration Last completed iteration.
+ * @param finished Whether the run has ended (all iterations done, or stopped early).
+ * @throws std::runtime_error if the file cannot be written.
+ */
+void commit(const std::string& path, const content_hash& fingerprint, uint64_t iteration, bool finished) const;
+
+private:
+void append(const void* p, size_t n) {
+	const char* c = static_cast<const char*>(p);
+	payload.insert(payload.end(), c, c + n);
+}
+
+std::vector<char> payload;
+};
+
+class checkpoint_reader {
+public:
+/**
+ * @brief Open the checkpoint at `path`.
+ *
+ * `found()` is false if there is no file.
+ *
+ * @throws std::runtime_error if the file is not a checkpoint or was written by a
+ *         run with a different `fingerprint`, so that it is never overwritten.
+ */
+checkpoint_reader(const std::string& path, const content_hash& fingerprint);
+
+bool found() const {
+	return file != nullptr;
+}
+uint64_t iteration() const {
+	return itr;
+}
+bool finished() const {
+	return done;
+}
+
+template <typename T>
+void field(T& x) {
+	static_assert(std::is_trivially_copyable<T>::value, "checkpoint fields must be trivially copyable");
+	extract(&x, sizeof(T));
+}
+template <typename T>
+void field(std::vector<T>& x) {
+	uint64_t n;
+	field(n);
+	check(n);
+	x.resize(n);
+	for (size_t i=0; i<x.size(); i++) {
+		field(x[i]);
+	}
+}
+void field(arma::vec& x) {
+	uint64_t n;
+	field(n);
+	check(n * sizeof(double));
+	x.set_size(n);
+	extract(x.memptr(), n * sizeof(double));
+}
+void field(chain_monitor& x) {
+	x.checkpoint(*this);
+}
+
+/// Throws unless every field of the file has been read
+void finish() const;
+
+private:
+void check(uint64_t n) const;
+void extract(void* p, size_t n) {
+	check(n);
+	std::memcpy(p, pos, n);
+	pos += n;
+}
+
+std::string path;
+std::shared_ptr<mapped_file> file;
+const char* pos;
+const char* end;
+uint64_t itr;
+bool done;
+};
+
+#endif // MCMC_CHECKPOINT_H
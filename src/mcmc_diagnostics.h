@@ -0,0 +1,226 @@
+/**
+ * @file mcmc_diagnostics.h
+ * @brief Online convergence diagnostics for multiple MCMC chains.
+ *
+ * `chain_monitor` accumulates the post burn-in draws of one scalar in one chain
+ * without storing them. It keeps Welford moments of the two halves of the chain
+ * (for split-R-hat) and of consecutive batch means (for the batch-means
+ * effective sample size). `split_rhat()` and `effective_size()` combine the
+ * monitors of the same scalar across chains, following Gelman et al. (2013),
+ * Bayesian Data Analysis, 3rd ed., section 11.4. `ess_reached()` is the
+ * stopping rule of runs that end once the draws are informative enough.
+ */
+
+#ifndef MCMC_DIAGNOSTICS_H
+#define MCMC_DIAGNOSTICS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+/// Running mean and variance (Welford's algorithm)
+class running_moments {
+public:
+running_moments() : n(0), m(0), s(0) {
+}
+
+void add(double x) {
+	n++;
+	double d = x - m;
+	m += d / n;
+	s += d * (x - m);
+}
+
+/// Combine with the moments of another sample (Chan et al., 1979)
+void merge(const running_moments& o) {
+	if (o.n == 0) {
+		return;
+	}
+	size_t n_ab = n + o.n;
+	double d = o.m - m;
+	m += d * o.n / n_ab;
+	s += o.s + d * d * (static_cast<double>(n) * o.n / n_ab);
+	n = n_ab;
+}
+
+size_t count() const {
+	return n;
+}
+double mean() const {
+	return m;
+}
+/// Unbiased sample variance
+double variance() const {
+	return n > 1 ? s / (n - 1) : 0.0;
+}
+
+private:
+size_t n;
+double m, s;
+};
+
+/**
+ * @class chain_monitor
+ *
+ * Besides the moments of the two halves of the planned chain, the monitor keeps
+ * the moments of every completed batch (O(sqrt(n_draws)) memory), so a chain
+ * that is stopped early can still be split in halves, at a batch boundary.
+ */
+class chain_monitor {
+public:
+/**
+ * @param n_draws Number of draws that will be added; used to split the chain
+ *                in halves and to choose the batch size (sqrt(n_draws)).
+ */
+explicit chain_monitor(size_t n_draws = 0) : n_draws(n_draws), n_seen(0) {
+	batch_size = std::max<size_t>(1, static_cast<size_t>(std::sqrt(static_cast<double>(n_draws))));
+}
+
+void add(double x) {
+	// The middle draw of an odd-length chain is left out of both halves
+	size_t half = n_draws / 2;
+	if (n_seen < half) {
+		halves[0].add(x);
+	}
+	else if (n_seen >= n_draws - half) {
+		halves[1].add(x);
+	}
+	n_seen++;
+	all.add(x);
+
+	batch.add(x);
+	if (batch.count() == batch_size) {
+		batches.add(batch.mean());
+		batch_stats.push_back(batch);
+		batch = running_moments();
+	}
+}
+
+/**
+ * @brief Moments of the first (h = 0) or second (h = 1) half of the chain.
+ *
+ * Exact once all `n_draws` draws were added. Before that, the halves are the
+ * first and last floor(b / 2) of the b completed batches.
+ */
+running_moments half(size_t h) const {
+	if (n_seen == n_draws) {
+		return halves[h];
+	}
+	size_t n_batch = batch_stats.size();
+	size_t k = n_batch / 2;
+	running_moments seq;
+	for (size_t i = (h == 0) ? 0 : n_batch - k; i < ((h == 0) ? k : n_batch); i++) {
+		seq.merge(batch_stats[i]);
+	}
+	return seq;
+}
+const running_moments& draws() const {
+	return all;
+}
+const running_moments& batch_means() const {
+	return batches;
+}
+size_t batch_length() const {
+	return batch_size;
+}
+
+/// Save or restore the monitor through a checkpoint archive (see `mcmc_checkpoint.h`)
+template <typename Archive>
+void checkpoint(Archive& ar) {
+	ar.field(n_draws);
+	ar.field(n_seen);
+	ar.field(halves[0]);
+	ar.field(halves[1]);
+	ar.field(all);
+	ar.field(batches);
+	ar.field(batch_size);
+	ar.field(batch);
+	ar.field(batch_stats);
+}
+
+private:
+size_t n_draws, n_seen;
+running_moments halves[2];
+running_moments all;
+running_moments batches;
+size_t batch_size;
+running_moments batch;
+std::vector<running_moments> batch_stats;
+};
+
+/**
+ * @brief Split-R-hat of one scalar from its monitors in every chain.
+ *
+ * Each chain is split in two halves, giving 2 * n_chains sequences of length n;
+ * R-hat = sqrt(((n - 1) / n * W + B / n) / W). Returns NaN with fewer than 4
+ * draws per chain and 1 if the scalar is constant.
+ */
+inline double split_rhat(const std::vector<const chain_monitor*>& chains) {
+	running_moments seq_means;
+	double W = 0;
+	size_t n = std::numeric_limits<size_t>::max();
+	for (size_t c=0; c<chains.size(); c++) {
+		for (size_t h=0; h<2; h++) {
+			running_moments seq = chains[c]->half(h);
+			n = std::min(n, seq.count());
+			seq_means.add(seq.mean());
+			W += seq.variance();
+		}
+	}
+	if (chains.empty() || n < 2) {
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+	W /= seq_means.count();
+	double B_over_n = seq_means.variance();
+	if (W <= 0) {
+		return (B_over_n <= 0) ? 1.0 : std::numeric_limits<double>::infinity();
+	}
+	double var_plus = (n - 1.0) / n * W + B_over_n;
+	return std::sqrt(var_plus / W);
+}
+
+/**
+ * @brief Batch-means effective sample size of one scalar, summed over chains.
+ *
+ * For each chain, ESS = n * s^2 / (b * s_b^2) where s^2 is the variance of the
+ * draws and s_b^2 that of the means of consecutive batches of length b. The
+ * per-chain estimate is capped at the number of draws.
+ */
+inline double effective_size(const std::vector<const chain_monitor*>& chains) {
+	double ess = 0;
+	for (size_t c=0; c<chains.size(); c++) {
+		const running_moments& x = chains[c]->draws();
+		const running_moments& bm = chains[c]->batch_means();
+		double n = static_cast<double>(x.count());
+		double sigma2 = chains[c]->batch_length() * bm.variance();
+		if (bm.count() < 2 || sigma2 <= 0) {
+			ess += n;
+		}
+		else {
+			ess += std::min(n, n * x.variance() / sigma2);
+		}
+	}
+	return ess;
+}
+
+/// Completed batches every chain needs before `ess_reached()` trusts the batch-means estimate
+const size_t min_stopping_batches = 5;
+
+/**
+ * @brief Stopping rule on the effective sample size of one scalar.
+ *
+ * True once every chain has at least `min_stopping_batches` completed batches
+ * and the effective sample size summed over chains is at least `min_ess`.
+ */
+inline bool ess_reached(const std::vector<const chain_monitor*>& chains, double min_ess) {
+	for (size_t c=0; c<chains.size(); c++) {
+		if (chains[c]->batch_means().count() < min_stopping_batches) {
+			return false;
+		}
+	}
+	return !chains.empty() && effective_size(chains) >= min_ess;
+}
+
+#endif // MCMC_DIAGNOSTICS_H
@@ -1,36 +1,159 @@
 #include <RcppArmadillo.h>
+#include "engine_profile_rcpp.h"
+#include "ld_blocks.h"
 #include "mr_ash.h"
+#include "thread_budget_rcpp.h"
 
 using namespace Rcpp;
 using namespace arma;
 using namespace std;
 
+// Banded or thresholded LD given as a sparse Matrix: X'X keeps only the non-zeros
+static bool is_sparse_ld(SEXP R) {
+	return Rf_isS4(R) && Rf_inherits(R, "sparseMatrix");
+}
+
+static sp_mat sparse_ld(SEXP R, uword p) {
+	sp_mat R_sp = as<sp_mat>(R);
+	if (R_sp.n_rows != R_sp.n_cols || R_sp.n_cols != p) {
+		stop("R must be a square sparse matrix with one row per variant.");
+	}
+	return R_sp;
+}
+
+// Low-rank LD as its reference genotype factor: X'X is never formed
+static std::shared_ptr<const ld_factor> factor_ld(SEXP R, uword p) {
+	std::shared_ptr<const ld_factor> R_factor = as_ld_factor(R);
+	if (R_factor->n_variants() != p) {
+		stop("The factor of R must have one row per variant.");
+	}
+	return R_factor;
+}
+
+// A matrix, a list of diagonal LD blocks, LD block files or an LD handle, used in place
+static void check_ld_blocks(ld_blocks& R_blocks, uword p) {
+	uword n_var = 0;
+	for (const mat& blk : R_blocks.blocks()) {
+		if (blk.n_rows != blk.n_cols) {
+			stop("Every LD block in R must be a square matrix.");
+		}
+		n_var += blk.n_cols;
+	}
+	if (n_var != p) {
+		stop("The LD blocks in R must cover every variant, in order.");
+	}
+}
+
+static List wrap_result(const unordered_map<string, mat>& result) {
+	List ret;
+	for (const auto& item : result) {
+		ret[item.first] = wrap(item.second);
+	}
+	return ret;
+}
+
 // [[Rcpp::export]]
 List rcpp_mr_ash_rss(const NumericVector& bhat, const NumericVector& shat, const NumericVector& z,
-                     const NumericMatrix& R, double var_y, int n, double sigma2_e, const NumericVector& s0,
+                     SEXP R, double var_y, int n, double sigma2_e, const NumericVector& s0,
                      const NumericVector& w0, const NumericVector& mu1_init, double tol = 1e-8,
                      int max_iter = 1e5, bool update_w0 = true, bool update_sigma = true,
-                     bool compute_ELBO = true, bool standardize = false, int ncpus = 1) {
+                     bool compute_ELBO = true, bool standardize = false, int ncpus = 1,
+                     double concurrent_ld = -1, bool squarem = false, double active_set_tol = 0,
+                     int full_sweep_every = 10, bool profile = false) {
 
 	    // Convert input types
 	vec bhat_vec = as<vec>(bhat);
 	vec shat_vec = as<vec>(shat);
 	vec z_vec = as<vec>(z);
-	mat R_mat = as<mat>(R);
 	vec s0_vec = as<vec>(s0);
 	vec w0_vec = as<vec>(w0);
 	vec mu1_init_vec = as<vec>(mu1_init);
+	mr_ash_acceleration accel(squarem, active_set_tol, full_sweep_every);
+	thread_budget budget(ncpus, thread_limit());
+	ncpus = budget.engine_threads();
+	engine_profile prof = mr_ash_profile();
+	engine_profile* prof_ptr = profile ? &prof : nullptr;
 
 	    // Call the C++ function
-	unordered_map<string, mat> result = mr_ash_rss(bhat_vec, shat_vec, z_vec, R_mat, var_y, n, sigma2_e, s0_vec, w0_vec,
-	                                               mu1_init_vec, tol, max_iter, update_w0, update_sigma, compute_ELBO,
-	                                               standardize, ncpus);
+	unordered_map<string, mat> result;
+	if (is_ld_factor(R)) {
+		std::shared_ptr<const ld_factor> R_factor = factor_ld(R, z_vec.n_elem);
+		result = mr_ash_rss(bhat_vec, shat_vec, z_vec, *R_factor, var_y, n, sigma2_e, s0_vec, w0_vec,
+		                    mu1_init_vec, tol, max_iter, update_w0, update_sigma, compute_ELBO,
+		                    standardize, ncpus, concurrent_ld, accel, prof_ptr);
+	}
+	else if (is_sparse_ld(R)) {
+		sp_mat R_sp = sparse_ld(R, z_vec.n_elem);
+		result = mr_ash_rss(bhat_vec, shat_vec, z_vec, R_sp, var_y, n, sigma2_e, s0_vec, w0_vec,
+		                    mu1_init_vec, tol, max_iter, update_w0, update_sigma, compute_ELBO,
+		                    standardize, ncpus, concurrent_ld, accel, prof_ptr);
+	}
+	else {
+		ld_blocks R_blocks(R);
+		check_ld_blocks(R_blocks, z_vec.n_elem);
+		result = mr_ash_rss(bhat_vec, shat_vec, z_vec, R_blocks.blocks(), var_y, n, sigma2_e, s0_vec, w0_vec,
+		                    mu1_init_vec, tol, max_iter, update_w0, update_sigma, compute_ELBO,
+		                    standardize, ncpus, concurrent_ld, accel, prof_ptr);
+	}
 
 	    // Convert the result to a list
-	List ret;
-	for (const auto& item : result) {
-		ret[item.first] = wrap(item.second);
+	List ret = wrap_result(result);
+	if (profile) {
+		ret["profile"] = profile_list(prof);
+	}
+	return ret;
+}
+
+// [[Rcpp::export]]
+List rcpp_mr_ash_rss_multi(const NumericMatrix& bhat, const NumericMatrix& shat, const NumericMatrix& z,
+                           SEXP R, const NumericVector& var_y, const IntegerVector& n,
+                           const NumericVector& sigma2_e, const List& s0, const List& w0,
+                           const NumericMatrix& mu1_init, double tol = 1e-8, int max_iter = 1e5,
+                           bool update_w0 = true, bool update_sigma = true, bool compute_ELBO = true,
+                           bool standardize = false, bool warm_start = false, int ncpus = 1,
+                           double concurrent_ld = -1, bool squarem = false, double active_set_tol = 0,
+                           int full_sweep_every = 10) {
+	// One fit per column; the per-fit arguments have been recycled in R
+	mat bhat_mat = as<mat>(bhat);
+	mat shat_mat = as<mat>(shat);
+	mat z_mat = as<mat>(z);
+	mat mu1_init_mat = as<mat>(mu1_init);
+	vec var_y_vec = as<vec>(var_y);
+	vec sigma2_e_vec = as<vec>(sigma2_e);
+	std::vector<int> n_vec = as<std::vector<int> >(n);
+	std::vector<vec> s0_vec, w0_vec;
+	for (R_xlen_t t = 0; t < s0.size(); t++) {
+		s0_vec.push_back(as<vec>(s0[t]));
+		w0_vec.push_back(as<vec>(w0[t]));
 	}
+	mr_ash_acceleration accel(squarem, active_set_tol, full_sweep_every);
+	thread_budget budget(ncpus, thread_limit());
+	ncpus = budget.engine_threads();
 
+	std::vector<unordered_map<string, mat> > results;
+	if (is_ld_factor(R)) {
+		std::shared_ptr<const ld_factor> R_factor = factor_ld(R, bhat_mat.n_rows);
+		results = mr_ash_rss_multi(bhat_mat, shat_mat, z_mat, *R_factor, var_y_vec, n_vec, sigma2_e_vec, s0_vec, w0_vec,
+		                           mu1_init_mat, tol, max_iter, update_w0, update_sigma, compute_ELBO,
+		                           standardize, warm_start, ncpus, concurrent_ld, accel);
+	}
+	else if (is_sparse_ld(R)) {
+		sp_mat R_sp = sparse_ld(R, bhat_mat.n_rows);
+		results = mr_ash_rss_multi(bhat_mat, shat_mat, z_mat, R_sp, var_y_vec, n_vec, sigma2_e_vec, s0_vec, w0_vec,
+		                           mu1_init_mat, tol, max_iter, update_w0, update_sigma, compute_ELBO,
+		                           standardize, warm_start, ncpus, concurrent_ld, accel);
+	}
+	else {
+		ld_blocks R_blocks(R);
+		check_ld_blocks(R_blocks, bhat_mat.n_rows);
+		results = mr_ash_rss_multi(bhat_mat, shat_mat, z_mat, R_blocks.blocks(), var_y_vec, n_vec, sigma2_e_vec, s0_vec,
+		                           w0_vec, mu1_init_mat, tol, max_iter, update_w0, update_sigma, compute_ELBO,
+		                           standardize, warm_start, ncpus, concurrent_ld, accel);
+	}
+
+	List ret(results.size());
+	for (size_t t = 0; t < results.size(); t++) {
+		ret[t] = wrap_result(results[t]);
+	}
 	return ret;
-}
\ No newline at end of file
+}
@@ -1,24 +1,24 @@
 #include <armadillo>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include <vector>
 #include <string>
 #include <algorithm>
 #include <unordered_map>
 #include <omp.h>
+#include "engine_profile.h"
+#include "ld_factor.h"
+#include "log_sum_exp.h"
 
 using namespace arma;
 using namespace std;
 
-/**
- * Softmax function
- *
- * @param x Input vector
- * @return Softmax output vector
- */
-vec softmax(const vec& x) {
-	vec y = exp(x - max(x));
-	return y / sum(y);
-}
+/// Least-squares estimate, Normal-prior posterior and log-Bayes factor of one coefficient
+struct bayes_ridge_fit {
+	double bhat, s2, mu1, sigma2_1, logbf;
+};
 
 /**
  * Bayesian regression with Normal prior from sufficient statistics
@@ -27,74 +27,748 @@ vec softmax(const vec& x) {
  * @param xTy X'y (scalar)
  * @param sigma2_e Error variance
  * @param sigma2_0 Prior variance
- * @return An unordered_map containing the least-squares estimate (bhat, s2), the posterior mean and standard deviation (mu1, sigma2_1), and the log-Bayes factor (logbf)
+ * @return The least-squares estimate (bhat, s2), the posterior mean and variance (mu1, sigma2_1), and the log-Bayes factor (logbf)
  */
-unordered_map<string, double> bayes_ridge_sufficient(double xTx, double xTy, double sigma2_e, double sigma2_0) {
+inline bayes_ridge_fit bayes_ridge_sufficient(double xTx, double xTy, double sigma2_e, double sigma2_0) {
+	bayes_ridge_fit out;
 	// Compute the least-squares estimate and its variance
-	double bhat = xTy / xTx;
-	double s2 = sigma2_e / xTx;
+	out.bhat = xTy / xTx;
+	out.s2 = sigma2_e / xTx;
 
 	// Compute the posterior mean and variance assuming a normal prior with zero mean and variance sigma2_0
-	double sigma2_1 = 1 / (1 / s2 + 1 / sigma2_0);
-	double mu1 = sigma2_1 / s2 * bhat;
+	double v = sigma2_0 + out.s2;
+	out.sigma2_1 = sigma2_0 * out.s2 / v;
+	out.mu1 = sigma2_0 / v * out.bhat;
 
 	// Compute the log-Bayes factor
-	double logbf = log(s2 / (sigma2_0 + s2)) / 2 + (pow(bhat, 2) / s2 - pow(bhat, 2) / (sigma2_0 + s2)) / 2;
+	out.logbf = log(out.s2 / v) / 2 + (pow(out.bhat, 2) / out.s2 - pow(out.bhat, 2) / v) / 2;
+	return out;
+}
+
+/**
+ * Mixture prior of the coordinate updates, prepared once per sweep.
+ *
+ * The K components are padded to `width` slots with a zero weight (log w0 =
+ * -Inf) and a unit variance, so the kernels below run over a fixed width. Padded
+ * components get posterior weight exactly 0.
+ */
+struct mix_prior {
+	int K, width;
+	std::vector<double> sigma2_0, log_w0;
+
+	mix_prior(const vec& w0, const vec& sigma2_0_in, int width)
+		: K(sigma2_0_in.n_elem), width(width), sigma2_0(width, 1.0),
+		log_w0(width, -std::numeric_limits<double>::infinity()) {
+		for (int i = 0; i < K; i++) {
+			sigma2_0[i] = sigma2_0_in[i];
+			log_w0[i] = log(w0[i]);
+		}
+	}
+};
+
+/**
+ * Posterior of one coefficient under the mixture prior. `K_MAX` is the padded
+ * width of the kernel that fills it; the per-component arrays live on the stack.
+ */
+template <int K_MAX>
+struct bayes_mix_fit {
+	double mu1, sigma2_1, logbf;
+	double w1[K_MAX], mu1_k[K_MAX], sigma2_1_k[K_MAX];
+
+	explicit bayes_mix_fit(int) {
+	}
+};
 
-	// Return the least-squares estimate (bhat, s2), the posterior mean and standard deviation (mu1, sigma2_1), and the log-Bayes factor (logbf)
-	return {{"bhat", bhat}, {"s2", s2}, {"mu1", mu1}, {"sigma2_1", sigma2_1}, {"logbf", logbf}};
+/// Any number of components: arrays sized once, outside the coordinate loop
+template <>
+struct bayes_mix_fit<0> {
+	double mu1, sigma2_1, logbf;
+	std::vector<double> w1, mu1_k, sigma2_1_k;
+
+	explicit bayes_mix_fit(int width) : w1(width), mu1_k(width), sigma2_1_k(width) {
+	}
+};
+
+/// Width of the kernel used for K components: a compile-time bucket, or 0 for the generic kernel
+inline int mix_kernel_width(int K) {
+	if (K <= 4) return 4;
+	if (K <= 8) return 8;
+	if (K <= 16) return 16;
+	if (K <= 32) return 32;
+	return 0;
 }
 
 /**
  * Bayesian regression with mixture-of-normals prior from sufficient statistics
  *
+ * Fills the log-Bayes factor (logbf), the posterior assignment probabilities
+ * (w1), the posterior mean (mu1) and variance (sigma2_1) of the coefficient, and
+ * the posterior mean (mu1_k) and variance (sigma2_1_k) for each mixture
+ * component. With `K_MAX > 0` every loop has a compile-time trip count; the
+ * log-sum-exp over the components is computed in SIMD lanes.
+ *
  * @param xTx X'X (scalar)
  * @param xTy X'y (scalar)
  * @param sigma2_e Error variance
- * @param w0 Mixture weights
- * @param sigma2_0 Mixture variances
- * @return An unordered_map containing the log-Bayes factor (logbf), the posterior assignment probabilities (w1), the posterior mean (mu1) and variance (sigma2_1) of the coefficients, and the posterior mean (mu1_k) and variance (sigma2_1_k) for each mixture component
+ * @param prior Mixture weights and variances, padded to the kernel width
+ * @param fit Output
  */
-unordered_map<string, vec> bayes_mix_sufficient(double xTx, double xTy, double sigma2_e, const vec& w0, const vec& sigma2_0) {
-	// Get the number of mixture components (K)
-	int K = sigma2_0.n_elem;
+template <int K_MAX>
+inline void bayes_mix_sufficient(double xTx, double xTy, double sigma2_e, const mix_prior& prior, bayes_mix_fit<K_MAX>& fit) {
+	const int width = K_MAX > 0 ? K_MAX : prior.width;
+	const double* sigma2_0 = prior.sigma2_0.data();
+	const double* log_w0 = prior.log_w0.data();
+	double* w1 = &fit.w1[0];
+	double* mu1_k = &fit.mu1_k[0];
+	double* sigma2_1_k = &fit.sigma2_1_k[0];
+
+	// Ridge posterior and log-Bayes factor of each component (see bayes_ridge_sufficient);
+	// w1 holds the unnormalized log posterior weights logbf_k + log(w0_k) for now
+	double bhat = xTy / xTx;
+	double s2 = sigma2_e / xTx;
+	double z2 = bhat * bhat / s2;
+	for (int i = 0; i < width; i++) {
+		double v = sigma2_0[i] + s2;
+		sigma2_1_k[i] = sigma2_0[i] * s2 / v;
+		mu1_k[i] = sigma2_0[i] / v * bhat;
+		w1[i] = log(s2 / v) / 2 + (z2 - bhat * bhat / v) / 2 + log_w0[i];
+	}
+
+	// Log-sum-exp: logbf = log(sum_k w0_k * BF_k), w1 = softmax(logbf_k + log(w0_k))
+	double u = -std::numeric_limits<double>::infinity();
+	#pragma omp simd reduction(max:u)
+	for (int i = 0; i < width; i++) {
+		u = std::max(u, w1[i]);
+	}
+	double total = 0;
+	#pragma omp simd reduction(+:total)
+	for (int i = 0; i < width; i++) {
+		w1[i] = exp_nonpositive(w1[i] - u);
+		total += w1[i];
+	}
+	fit.logbf = u + log(total);
 
-	// Compute the Bayes factors and posterior statistics separately for each mixture component
-	mat out(K, 5);
-	for (int i = 0; i < K; i++) {
-		unordered_map<string, double> ridge_out = bayes_ridge_sufficient(xTx, xTy, sigma2_e, sigma2_0[i]);
-		out(i, 0) = ridge_out["bhat"];
-		out(i, 1) = ridge_out["s2"];
-		out(i, 2) = ridge_out["mu1"];
-		out(i, 3) = ridge_out["sigma2_1"];
-		out(i, 4) = ridge_out["logbf"];
+	// Posterior mean (mu1) and variance (sigma2_1) of the regression coefficient
+	double inv_total = 1 / total;
+	double mu1 = 0, m2 = 0;
+	#pragma omp simd reduction(+:mu1,m2)
+	for (int i = 0; i < width; i++) {
+		w1[i] *= inv_total;
+		mu1 += w1[i] * mu1_k[i];
+		m2 += w1[i] * (mu1_k[i] * mu1_k[i] + sigma2_1_k[i]);
+	}
+	fit.mu1 = mu1;
+	fit.sigma2_1 = m2 - mu1 * mu1;
+}
+
+/**
+ * X'X of mr_ash_sufficient as dense diagonal blocks: block b covers the
+ * variables [offset[b], offset[b + 1]) and X'X is zero outside the blocks. A
+ * single dense matrix is one block.
+ *
+ * This and `sparse_xtx` provide what the coordinate ascent reads from X'X:
+ * diagonal entries, the non-zeros of a column, column axpys into the expected
+ * residuals and the product with a vector. Both are built from an LD matrix R
+ * and a scale s as X'X(i, j) = s_i s_j (R(i, j) + R(j, i)) / 2.
+ */
+class block_xtx {
+public:
+block_xtx(const std::vector<mat>& R, const vec& s) {
+	offset.push_back(0);
+	blk.reserve(R.size());
+	for (size_t b = 0; b < R.size(); b++) {
+		const mat& Rb = R[b];
+		int m = Rb.n_cols, o = offset.back();
+		mat A(m, m);
+		for (int j = 0; j < m; j++) {
+			for (int i = 0; i <= j; i++) {
+				A(i, j) = A(j, i) = s[o + i] * s[o + j] * (0.5 * (Rb(i, j) + Rb(j, i)));
+			}
+		}
+		blk.push_back(std::move(A));
+		offset.push_back(o + m);
+		block_of.insert(block_of.end(), m, (int) b);
 	}
+}
 
-	// Compute the posterior assignment probabilities for the latent indicator variable
-	vec w1 = softmax(out.col(4) + log(w0));
+int n_cols() const {
+	return offset.back();
+}
+double diag(int j) const {
+	int b = block_of[j];
+	return blk[b](j - offset[b], j - offset[b]);
+}
+/// Last row with a non-zero entry in column j (j itself for none below the diagonal)
+int reach(int j) const {
+	int b = block_of[j];
+	const double* x = blk[b].colptr(j - offset[b]);
+	int last = offset[b + 1] - 1;
+	while (last > j && x[last - offset[b]] == 0) {
+		last--;
+	}
+	return last;
+}
+/// f(i, X'X(i, j)) over the rows of column j that may be non-zero
+template <typename F>
+void for_each_nonzero(int j, F f) const {
+	int b = block_of[j];
+	const double* x = blk[b].colptr(j - offset[b]);
+	for (int i = offset[b]; i < offset[b + 1]; i++) {
+		f(i, x[i - offset[b]]);
+	}
+}
+/// r[i] += a * X'X(i, j) for the rows i in [row_begin, row_end)
+void axpy_col(int j, double a, double* r, int row_begin, int row_end) const {
+	int b = block_of[j];
+	const double* x = blk[b].colptr(j - offset[b]) - offset[b];
+	int begin = std::max(row_begin, offset[b]), end = std::min(row_end, offset[b + 1]);
+	for (int i = begin; i < end; i++) {
+		r[i] += a * x[i];
+	}
+}
+/// r[i] += a * w[i] * X'X(i, j) for the rows i in [row_begin, row_end)
+void axpy_col(int j, double a, const double* w, double* r, int row_begin, int row_end) const {
+	int b = block_of[j];
+	const double* x = blk[b].colptr(j - offset[b]) - offset[b];
+	int begin = std::max(row_begin, offset[b]), end = std::min(row_end, offset[b + 1]);
+	for (int i = begin; i < end; i++) {
+		r[i] += a * w[i] * x[i];
+	}
+}
+vec times(const vec& x) const {
+	vec out(n_cols());
+	for (size_t b = 0; b < blk.size(); b++) {
+		if (offset[b + 1] > offset[b]) {
+			out.subvec(offset[b], offset[b + 1] - 1) = blk[b] * x.subvec(offset[b], offset[b + 1] - 1);
+		}
+	}
+	return out;
+}
 
-	// Compute the posterior mean (mu1) and variance (sigma2_1) of the regression coefficients
-	vec mu1_k_vec = out.col(2);
-	vec sigma2_1_k_vec = out.col(3);
+private:
+std::vector<mat> blk;
+std::vector<int> offset;
+std::vector<int> block_of;
+};
 
-	double mu1 = sum(w1 % mu1_k_vec);
-	double sigma2_1 = sum(w1 % (square(mu1_k_vec) + sigma2_1_k_vec)) - pow(mu1, 2);
+/// X'X of mr_ash_sufficient as a sparse (banded or thresholded) matrix, in compressed columns
+class sparse_xtx {
+public:
+sparse_xtx(const sp_mat& R, const vec& s) : n(R.n_cols), dgl(R.n_cols, 0.0) {
+	sp_mat A = 0.5 * (R + R.t());
+	A.sync();
+	col_ptr.assign(A.col_ptrs, A.col_ptrs + n + 1);
+	row_idx.assign(A.row_indices, A.row_indices + A.n_nonzero);
+	val.assign(A.values, A.values + A.n_nonzero);
+	for (int j = 0; j < n; j++) {
+		for (uword k = col_ptr[j]; k < col_ptr[j + 1]; k++) {
+			val[k] *= s[row_idx[k]] * s[j];
+			if ((int) row_idx[k] == j) {
+				dgl[j] = val[k];
+			}
+		}
+	}
+}
 
-	// Compute the log-Bayes factor as a linear combination of the individual BFs for each mixture component
-	double u = max(out.col(4));
-	double logbf = u + log(sum(w0 % exp(out.col(4) - u)));
+int n_cols() const {
+	return n;
+}
+double diag(int j) const {
+	return dgl[j];
+}
+int reach(int j) const {
+	// Row indices are sorted within a column
+	return col_ptr[j + 1] > col_ptr[j] ? std::max<int>(j, row_idx[col_ptr[j + 1] - 1]) : j;
+}
+template <typename F>
+void for_each_nonzero(int j, F f) const {
+	for (uword k = col_ptr[j]; k < col_ptr[j + 1]; k++) {
+		f((int) row_idx[k], val[k]);
+	}
+}
+void axpy_col(int j, double a, double* r, int row_begin, int row_end) const {
+	for (uword k = col_ptr[j]; k < col_ptr[j + 1]; k++) {
+		int i = row_idx[k];
+		if (i >= row_begin && i < row_end) {
+			r[i] += a * val[k];
+		}
+	}
+}
+void axpy_col(int j, double a, const double* w, double* r, int row_begin, int row_end) const {
+	for (uword k = col_ptr[j]; k < col_ptr[j + 1]; k++) {
+		int i = row_idx[k];
+		if (i >= row_begin && i < row_end) {
+			r[i] += a * w[i] * val[k];
+		}
+	}
+}
+vec times(const vec& x) const {
+	vec out(n, fill::zeros);
+	for (int j = 0; j < n; j++) {
+		for (uword k = col_ptr[j]; k < col_ptr[j + 1]; k++) {
+			out[row_idx[k]] += val[k] * x[j];
+		}
+	}
+	return out;
+}
 
-	// Return the posterior assignment probabilities (w1), the posterior mean (mu1) and variance (sigma2_1) of the coefficients,
-	// and the posterior mean (mu1_k) and variance (sigma2_1_k) for each mixture component, and the log-Bayes factor (logbf)
-	return {{"w1", w1}, {"mu1", vec(1, fill::value(mu1))}, {"sigma2_1", vec(1, fill::value(sigma2_1))},
-		{"mu1_k", mu1_k_vec}, {"sigma2_1_k", sigma2_1_k_vec}, {"logbf", vec(1, fill::value(logbf))}};
+private:
+int n;
+std::vector<uword> col_ptr, row_idx;
+std::vector<double> val, dgl;
+};
+
+/**
+ * X'X = diag(s) F F' diag(s) of a low-rank LD matrix R = F F' (`ld_factor`),
+ * never formed. Its entries are read from the factor, O(k) each, and it is a
+ * single block; mr_ash_sweep applies the residual updates of a sweep through
+ * the factor, so a sweep costs O(p k). The factor is not copied.
+ */
+class factor_xtx {
+public:
+factor_xtx(const ld_factor& F, const vec& s) : F(F), s(s) {
+}
+
+int n_cols() const {
+	return F.n_variants();
+}
+int rank() const {
+	return F.rank();
+}
+const ld_factor& factor() const {
+	return F;
+}
+double diag(int j) const {
+	return s[j] * s[j] * F.diag(j);
+}
+/// Every column of the dense X'X reaches the last row
+int reach(int) const {
+	return n_cols() - 1;
+}
+/// Every row of column j, O(p k): the coloring of concurrent_ld reads all of X'X
+template <typename G>
+void for_each_nonzero(int j, G f) const {
+	for (int i = 0; i < n_cols(); i++) {
+		f(i, s[i] * s[j] * F.entry(i, j));
+	}
+}
+void axpy_col(int j, double a, double* r, int row_begin, int row_end) const {
+	for (int i = row_begin; i < row_end; i++) {
+		r[i] += a * s[i] * s[j] * F.entry(i, j);
+	}
+}
+/// s_j times the loadings of j dotted with the k-vector u: row j of diag(s) F times u
+double project(int j, const double* u) const {
+	return s[j] * F.project(j, u);
+}
+/// u += a * F' diag(s) e_j
+void add_column(int j, double a, double* u) const {
+	F.add_loadings(j, a * s[j], u);
+}
+vec times(const vec& x) const {
+	std::vector<double> u(rank(), 0.0);
+	for (int j = 0; j < n_cols(); j++) {
+		add_column(j, x[j], u.data());
+	}
+	vec out(n_cols());
+	for (int j = 0; j < n_cols(); j++) {
+		out[j] = project(j, u.data());
+	}
+	return out;
+}
+
+private:
+const ld_factor& F;
+vec s;
+};
+
+/**
+ * X'X = diag(s) A diag(s) of a symmetrized LD matrix A (`block_xtx` or
+ * `sparse_xtx` built with a unit scale) that several fits share, scaled on the
+ * fly. Neither A nor s is copied.
+ */
+template <typename XTX_T>
+class scaled_xtx_view {
+public:
+scaled_xtx_view(const XTX_T& A, const vec& s) : A(A), s(s) {
+}
+
+int n_cols() const {
+	return A.n_cols();
+}
+double diag(int j) const {
+	return s[j] * s[j] * A.diag(j);
+}
+int reach(int j) const {
+	return A.reach(j);
+}
+template <typename F>
+void for_each_nonzero(int j, F f) const {
+	const vec& w = s;
+	double sj = s[j];
+	A.for_each_nonzero(j, [&](int i, double x) {
+		f(i, w[i] * sj * x);
+	});
+}
+void axpy_col(int j, double a, double* r, int row_begin, int row_end) const {
+	A.axpy_col(j, a * s[j], s.memptr(), r, row_begin, row_end);
+}
+vec times(const vec& x) const {
+	return s % A.times(s % x);
+}
+
+private:
+const XTX_T& A;
+const vec& s;
+};
+
+/// X'X = diag(s) A diag(s) of a symmetrized LD matrix A shared by several fits
+template <typename XTX_T>
+scaled_xtx_view<XTX_T> scaled_view(const XTX_T& A, const vec& s) {
+	return scaled_xtx_view<XTX_T>(A, s);
+}
+
+/// A factor, built with a unit scale, takes the scale of each fit directly
+inline factor_xtx scaled_view(const factor_xtx& A, const vec& s) {
+	return factor_xtx(A.factor(), s);
+}
+
+/**
+ * Update order of the coordinate ascent in mr_ash_sufficient.
+ *
+ * The variables are split into the diagonal blocks of X'X (`block_xtx` or
+ * `sparse_xtx`): contiguous ranges that share no non-zero entry with the rest, so their coordinate updates are
+ * independent and the blocks are swept concurrently. With `concurrent_ld >= 0`
+ * the variables of a block are further greedily colored so that no two
+ * variables of a color have an absolute correlation above `concurrent_ld`; a
+ * color is one stage, whose variables are updated concurrently from the
+ * residuals at the start of the stage. `concurrent_ld = 0` is exact (the sweep
+ * visits the variables color by color); a positive value ignores the weak
+ * couplings within a stage, Jacobi-style. Otherwise every stage holds one
+ * variable, in index order.
+ */
+struct coordinate_schedule {
+	/// Variables in update order, grouped by block (a permutation within each block)
+	std::vector<int> order;
+	/// Stage s is order[stage_start[s], stage_start[s + 1])
+	std::vector<int> stage_start;
+	/// Block b holds the variables [block_start[b], block_start[b + 1]) and the stages [block_stage[b], block_stage[b + 1])
+	std::vector<int> block_start, block_stage;
+
+	template <typename XTX_T>
+	coordinate_schedule(const XTX_T& XTX, double concurrent_ld) {
+		int p = XTX.n_cols();
+		// A block ends where no column reaches beyond it
+		block_start.push_back(0);
+		int reach = 0;
+		for (int j = 0; j < p; j++) {
+			reach = std::max(reach, XTX.reach(j));
+			if (reach == j) {
+				block_start.push_back(j + 1);
+			}
+		}
+
+		block_stage.push_back(0);
+		stage_start.push_back(0);
+		std::vector<int> color(p, 0);
+		for (int b = 0; b + 1 < (int) block_start.size(); b++) {
+			int first = block_start[b], end = block_start[b + 1];
+			if (concurrent_ld < 0) {
+				for (int j = first; j < end; j++) {
+					order.push_back(j);
+					stage_start.push_back(j + 1);
+				}
+			}
+			else {
+				int n_colors = 0;
+				std::vector<char> used;
+				for (int j = first; j < end; j++) {
+					used.assign(n_colors + 1, 0);
+					XTX.for_each_nonzero(j, [&](int k, double x) {
+						if (k >= first && k < j && std::abs(x / std::sqrt(XTX.diag(k) * XTX.diag(j))) > concurrent_ld) {
+							used[color[k]] = 1;
+						}
+					});
+					color[j] = std::find(used.begin(), used.end(), 0) - used.begin();
+					n_colors = std::max(n_colors, color[j] + 1);
+				}
+				for (int c = 0; c < n_colors; c++) {
+					for (int j = first; j < end; j++) {
+						if (color[j] == c) {
+							order.push_back(j);
+						}
+					}
+					stage_start.push_back(order.size());
+				}
+			}
+			block_stage.push_back(stage_start.size() - 1);
+		}
+	}
+
+	/// The schedule restricted to the variables j with keep[j] set, with the same blocks and stage order
+	coordinate_schedule subset(const std::vector<char>& keep) const {
+		coordinate_schedule out;
+		out.block_start = block_start;
+		out.block_stage.push_back(0);
+		out.stage_start.push_back(0);
+		for (int b = 0; b < n_blocks(); b++) {
+			for (int s = block_stage[b]; s < block_stage[b + 1]; s++) {
+				for (int m = stage_start[s]; m < stage_start[s + 1]; m++) {
+					if (keep[order[m]]) {
+						out.order.push_back(order[m]);
+					}
+				}
+				if ((int) out.order.size() > out.stage_start.back()) {
+					out.stage_start.push_back(out.order.size());
+				}
+			}
+			out.block_stage.push_back(out.stage_start.size() - 1);
+		}
+		return out;
+	}
+
+	int n_blocks() const {
+		return block_start.size() - 1;
+	}
+
+private:
+	coordinate_schedule() {
+	}
+};
+
+/// Variational parameters of mr_ash_sufficient, one row per variable
+struct mr_ash_state {
+	vec mu1, sigma2_1;
+	mat w1, mu1_k, sigma2_1_k;
+	/// Expected residuals X'(y - X mu1), kept up to date by the sweeps
+	vec XTrbar;
+	/// Per-variable ELBO terms of the latest sweep, summed in index order afterwards
+	vec var_part_ERSS, neg_KL;
+
+	mr_ash_state(const vec& mu1_init, int K)
+		: mu1(mu1_init), sigma2_1(mu1_init.n_elem, fill::zeros), w1(mu1_init.n_elem, K, fill::zeros),
+		mu1_k(mu1_init.n_elem, K, fill::zeros), sigma2_1_k(mu1_init.n_elem, K, fill::zeros),
+		var_part_ERSS(mu1_init.n_elem, fill::zeros), neg_KL(mu1_init.n_elem, fill::zeros) {
+	}
+};
+
+/**
+ * Acceleration of mr_ash_sufficient; the defaults run plain cyclic coordinate
+ * ascent. Convergence is only declared after a sweep over every variable, so
+ * the reported ELBO is that of a full sweep in any case.
+ */
+struct mr_ash_acceleration {
+	/// SQUAREM extrapolation of (mu1, w0) after every two sweeps (Varadhan and Roland, 2008, scheme S3)
+	bool squarem;
+	/// When positive, sweep only the variables whose non-null posterior mass (1 - w1 of the smallest s0) exceeds it
+	double active_set_tol;
+	/// Sweeps over the active set between two full sweeps, which also rebuild the set
+	int full_sweep_every;
+
+	mr_ash_acceleration(bool squarem = false, double active_set_tol = 0, int full_sweep_every = 10)
+		: squarem(squarem), active_set_tol(active_set_tol), full_sweep_every(full_sweep_every) {
+	}
+};
+
+/// Stages with fewer variables are not worth a parallel region
+const int min_concurrent_stage = 64;
+
+/// Iterations between recomputations of the expected residuals from scratch, bounding the drift of the axpy updates
+const int residual_refresh = 100;
+
+/// Coordinate update of variable j from the expected residuals left by the previous stage
+template <int K_MAX, typename XTX_T>
+inline void mr_ash_update(int j, const XTX_T& XTX, const vec& mu1_prev, double sigma2_e, const mix_prior& prior,
+                          bool compute_ELBO, mr_ash_state& st, bayes_mix_fit<K_MAX>& bfit) {
+	// Remove j-th effect from expected residuals
+	double xTx = XTX.diag(j);
+	double xTrbar_j = st.XTrbar[j] + xTx * mu1_prev[j];
+
+	// Run Bayesian SLR
+	bayes_mix_sufficient<K_MAX>(xTx, xTrbar_j, sigma2_e, prior, bfit);
+
+	// Update variational parameters
+	st.mu1[j] = bfit.mu1;
+	st.sigma2_1[j] = bfit.sigma2_1;
+	for (int k = 0; k < prior.K; k++) {
+		st.w1(j, k) = bfit.w1[k];
+		st.mu1_k(j, k) = bfit.mu1_k[k];
+		st.sigma2_1_k(j, k) = bfit.sigma2_1_k[k];
+	}
+
+	// Compute ELBO parameters; the variance part of ERSS is needed for sigma2_e in any case
+	st.var_part_ERSS[j] = st.sigma2_1[j] * xTx;
+	if (compute_ELBO) {
+		st.neg_KL[j] = bfit.logbf + (1 / (2 * sigma2_e)) * (-2 * xTrbar_j * st.mu1[j] + (xTx * (st.sigma2_1[j] + pow(st.mu1[j], 2))));
+	}
+}
+
+/**
+ * Update the expected residuals of rows [row_begin, row_end) for the variables
+ * order[first, last) of one stage, in stage order: one axpy with the change of
+ * mu1 per variable, skipped when it did not move.
+ */
+template <typename XTX_T>
+inline void mr_ash_apply_stage(const XTX_T& XTX, const coordinate_schedule& sched, int first, int last,
+                               int row_begin, int row_end, const vec& mu1_prev, mr_ash_state& st) {
+	for (int s = first; s < last; s++) {
+		int j = sched.order[s];
+		double delta = st.mu1[j] - mu1_prev[j];
+		if (delta != 0) {
+			XTX.axpy_col(j, -delta, st.XTrbar.memptr(), row_begin, row_end);
+		}
+	}
+}
+
+/// One block of the sweep, on the calling thread
+template <int K_MAX, typename XTX_T>
+void mr_ash_sweep_block(int b, const XTX_T& XTX, const coordinate_schedule& sched, const vec& mu1_prev, double sigma2_e,
+                        const mix_prior& prior, bool compute_ELBO, mr_ash_state& st, bayes_mix_fit<K_MAX>& bfit) {
+	int row_begin = sched.block_start[b], row_end = sched.block_start[b + 1];
+	for (int s = sched.block_stage[b]; s < sched.block_stage[b + 1]; s++) {
+		int first = sched.stage_start[s], last = sched.stage_start[s + 1];
+		for (int m = first; m < last; m++) {
+			mr_ash_update<K_MAX>(sched.order[m], XTX, mu1_prev, sigma2_e, prior, compute_ELBO, st, bfit);
+		}
+		mr_ash_apply_stage(XTX, sched, first, last, row_begin, row_end, mu1_prev, st);
+	}
+}
+
+/**
+ * One coordinate-ascent sweep of mr_ash_sufficient over all variables, with the
+ * mixture kernel of width `K_MAX` (0: generic). Updates the variational
+ * parameters and the expected residuals in place. Blocks are spread over the
+ * threads; a single block runs its large stages in parallel instead. Each
+ * variable is updated by exactly one thread and every residual entry is updated
+ * in a fixed order, so the result does not depend on the number of threads.
+ */
+template <int K_MAX, typename XTX_T>
+void mr_ash_sweep(const XTX_T& XTX, const coordinate_schedule& sched, const vec& mu1_prev, double sigma2_e,
+                  const mix_prior& prior, bool compute_ELBO, mr_ash_state& st, int n_threads) {
+	int n_blocks = sched.n_blocks();
+	if (n_blocks > 1) {
+		#pragma omp parallel num_threads(n_threads)
+		{
+			bayes_mix_fit<K_MAX> bfit(prior.width);
+			#pragma omp for schedule(dynamic)
+			for (int b = 0; b < n_blocks; b++) {
+				mr_ash_sweep_block<K_MAX>(b, XTX, sched, mu1_prev, sigma2_e, prior, compute_ELBO, st, bfit);
+			}
+		}
+		return;
+	}
+
+	bayes_mix_fit<K_MAX> bfit(prior.width);
+	int p = XTX.n_cols();
+	for (int s = sched.block_stage[0]; s < sched.block_stage[1]; s++) {
+		int first = sched.stage_start[s], last = sched.stage_start[s + 1];
+		if (n_threads == 1 || last - first < min_concurrent_stage) {
+			for (int m = first; m < last; m++) {
+				mr_ash_update<K_MAX>(sched.order[m], XTX, mu1_prev, sigma2_e, prior, compute_ELBO, st, bfit);
+			}
+			mr_ash_apply_stage(XTX, sched, first, last, 0, p, mu1_prev, st);
+			continue;
+		}
+		#pragma omp parallel num_threads(n_threads)
+		{
+			bayes_mix_fit<K_MAX> stage_fit(prior.width);
+			#pragma omp for
+			for (int m = first; m < last; m++) {
+				mr_ash_update<K_MAX>(sched.order[m], XTX, mu1_prev, sigma2_e, prior, compute_ELBO, st, stage_fit);
+			}
+			// Rows are split between the threads, each applying the whole stage to its rows
+			const int chunk = 256;
+			#pragma omp for
+			for (int i = 0; i < p; i += chunk) {
+				mr_ash_apply_stage(XTX, sched, first, last, i, std::min(p, i + chunk), mu1_prev, st);
+			}
+		}
+	}
+}
+
+/**
+ * mr_ash_sweep for a low-rank X'X (`factor_xtx`). The residuals of the
+ * variables of a stage are brought up to date from those at the start of the
+ * sweep as XTrbar - diag(s) F u, where u = F' diag(s) (mu1 - mu1_prev) collects
+ * the changes of the stages already applied; all residuals are updated once at
+ * the end. This is the same sweep as applying a column axpy per variable, at
+ * O(k) per variable instead of O(p).
+ */
+template <int K_MAX>
+void mr_ash_sweep(const factor_xtx& XTX, const coordinate_schedule& sched, const vec& mu1_prev, double sigma2_e,
+                  const mix_prior& prior, bool compute_ELBO, mr_ash_state& st, int n_threads) {
+	int p = XTX.n_cols();
+	int n_stages = sched.stage_start.size() - 1;
+	vec XTrbar_start = st.XTrbar;
+	std::vector<double> u(XTX.rank(), 0.0);
+	bayes_mix_fit<K_MAX> bfit(prior.width);
+	for (int s = 0; s < n_stages; s++) {
+		int first = sched.stage_start[s], last = sched.stage_start[s + 1];
+		if (n_threads == 1 || last - first < min_concurrent_stage) {
+			for (int m = first; m < last; m++) {
+				int j = sched.order[m];
+				st.XTrbar[j] = XTrbar_start[j] - XTX.project(j, u.data());
+				mr_ash_update<K_MAX>(j, XTX, mu1_prev, sigma2_e, prior, compute_ELBO, st, bfit);
+			}
+		}
+		else {
+			#pragma omp parallel num_threads(n_threads)
+			{
+				bayes_mix_fit<K_MAX> stage_fit(prior.width);
+				#pragma omp for
+				for (int m = first; m < last; m++) {
+					int j = sched.order[m];
+					st.XTrbar[j] = XTrbar_start[j] - XTX.project(j, u.data());
+					mr_ash_update<K_MAX>(j, XTX, mu1_prev, sigma2_e, prior, compute_ELBO, st, stage_fit);
+				}
+			}
+		}
+		// In stage order, so that the result does not depend on the number of threads
+		for (int m = first; m < last; m++) {
+			int j = sched.order[m];
+			double delta = st.mu1[j] - mu1_prev[j];
+			if (delta != 0) {
+				XTX.add_column(j, delta, u.data());
+			}
+		}
+	}
+	#pragma omp parallel for num_threads(n_threads)
+	for (int j = 0; j < p; j++) {
+		st.XTrbar[j] = XTrbar_start[j] - XTX.project(j, u.data());
+	}
+}
+
+/**
+ * Phases and counters of a mr_ash_sufficient fit (see `engine_profile`), all
+ * wall time. `elbo` covers the per-iteration bookkeeping after a sweep (the
+ * ERSS, the ELBO and the w0 and sigma2_e updates); `squarem` the extrapolation
+ * steps. `coordinate_updates` counts the variables visited by the sweeps,
+ * which the active set reduces below `iterations` times p.
+ */
+enum mr_ash_phase {
+	MR_ASH_PHASE_SCHEDULE = 0,
+	MR_ASH_PHASE_RESIDUALS,
+	MR_ASH_PHASE_SWEEP,
+	MR_ASH_PHASE_ELBO,
+	MR_ASH_PHASE_SQUAREM
+};
+enum mr_ash_counter {
+	MR_ASH_COUNT_ITERATIONS = 0,
+	MR_ASH_COUNT_FULL_SWEEPS,
+	MR_ASH_COUNT_COORDINATE_UPDATES,
+	MR_ASH_COUNT_RESIDUAL_REFRESHES,
+	MR_ASH_COUNT_SQUAREM_REJECTED
+};
+inline engine_profile mr_ash_profile() {
+	return engine_profile({"schedule", "residuals", "sweep", "elbo", "squarem"},
+	                      {"iterations", "full_sweeps", "coordinate_updates", "residual_refreshes", "squarem_rejected"});
 }
 
 /**
  * Bayesian multiple regression with mixture-of-normals prior from sufficient statistics
  *
  * @param XTy X'y vector
- * @param XTX X'X matrix
+ * @param XTX X'X matrix (block_xtx, sparse_xtx or factor_xtx)
  * @param yTy y'y scalar
  * @param n Sample size
  * @param sigma2_e Error variance
@@ -107,31 +781,40 @@ unordered_map<string, vec> bayes_mix_sufficient(double xTx, double xTy, double s
  * @param update_sigma Whether to update sigma2_e
  * @param compute_ELBO Whether to compute the Evidence Lower Bound (ELBO)
  * @param ncpus Number of CPUs to use for parallel processing
+ * @param concurrent_ld Variables of an LD block whose absolute correlation is at most this value may be updated concurrently; negative to update them one at a time (see coordinate_schedule)
+ * @param accel SQUAREM and active-set options
+ * @param profile Where to record the time and counts of the fit (see mr_ash_profile), or null
  * @return An unordered_map containing the posterior assignment probabilities (w1), the posterior mean (mu1) and variance (sigma2_1) of the coefficients, the error variance (sigma2_e), the mixture weights (w0), and optionally the ELBO
  */
-unordered_map<string, mat> mr_ash_sufficient(const vec& XTy, const mat& XTX, double yTy, int n, double& sigma2_e,
+template <typename XTX_T>
+unordered_map<string, mat> mr_ash_sufficient(const vec& XTy, const XTX_T& XTX, double yTy, int n, double& sigma2_e,
                                              const vec& sigma2_0, vec& w0, const vec& mu1_init, double tol = 1e-8,
                                              int max_iter = 1e5, bool update_w0 = true, bool update_sigma = true,
-                                             bool compute_ELBO = true, bool verbose = false, int ncpus = 1) {
+                                             bool compute_ELBO = true, bool verbose = false, int ncpus = 1,
+                                             double concurrent_ld = -1, const mr_ash_acceleration& accel = mr_ash_acceleration(),
+                                             engine_profile* profile = nullptr) {
 	// Set the number of threads for OpenMP
 	int nProcessors = omp_get_max_threads();
 	if (ncpus < nProcessors) nProcessors = ncpus;
-	omp_set_num_threads(nProcessors);
 
 	// Initialize parameters
-	int p = XTX.n_cols;
+	int p = XTX.n_cols();
 	int K = sigma2_0.n_elem;
-	vec mu1_t = mu1_init;
-	vec sigma2_1_t(p, fill::zeros);
-	mat w1_t(p, K, fill::zeros);
-	mat mu1_k_t(p, K, fill::zeros);
-	mat sigma2_1_k_t(p, K, fill::zeros);
+	mr_ash_state state(mu1_init, K);
+	vec& mu1_t = state.mu1;
+	vec& sigma2_1_t = state.sigma2_1;
+	mat& w1_t = state.w1;
+	profile_scope schedule_timer(profile, MR_ASH_PHASE_SCHEDULE);
+	coordinate_schedule schedule(XTX, concurrent_ld);
+	schedule_timer.stop();
+	int kernel_width = mix_kernel_width(K);
 	vec err(p, fill::value(datum::inf));
 	int t = 0;
 	double ELBO = 0;
+	bool refresh = true;
 
-	// Iterate until convergence
-	while (any(err > tol)) {
+	// One iteration over the variables of `sweep_schedule`; false once max_iter is exceeded
+	auto iterate = [&](const coordinate_schedule& sweep_schedule) -> bool {
 		double ELBO0 = ELBO;
 		double var_part_ERSS = 0;
 		double neg_KL = 0;
@@ -142,41 +825,52 @@ unordered_map<string, mat> mr_ash_sufficient(const vec& XTy, const mat& XTX, dou
 		// Exit loop if maximum number of iterations is reached
 		if (t > max_iter) {
 			cerr << "Max number of iterations reached. Try increasing max_iter." << endl;
-			break;
+			return false;
 		}
 
 		// Save current estimates
 		vec mu1_tminus1 = mu1_t;
 
-		vec XTrbar = XTy - XTX * mu1_t;
+		if (refresh || (t - 1) % residual_refresh == 0) {
+			profile_scope timer(profile, MR_ASH_PHASE_RESIDUALS);
+			state.XTrbar = XTy - XTX.times(mu1_t);
+			refresh = false;
+			if (profile != nullptr) profile->add_count(MR_ASH_COUNT_RESIDUAL_REFRESHES, 1);
+		}
 
-		// Loop through the variables
-		#pragma omp parallel for reduction(+:var_part_ERSS,neg_KL)
+		// Loop through the variables with the kernel specialized for K
+		profile_scope sweep_timer(profile, MR_ASH_PHASE_SWEEP);
+		mix_prior prior(w0, sigma2_0, kernel_width > 0 ? kernel_width : K);
+		switch (kernel_width) {
+		case 4:
+			mr_ash_sweep<4>(XTX, sweep_schedule, mu1_tminus1, sigma2_e, prior, compute_ELBO, state, nProcessors);
+			break;
+		case 8:
+			mr_ash_sweep<8>(XTX, sweep_schedule, mu1_tminus1, sigma2_e, prior, compute_ELBO, state, nProcessors);
+			break;
+		case 16:
+			mr_ash_sweep<16>(XTX, sweep_schedule, mu1_tminus1, sigma2_e, prior, compute_ELBO, state, nProcessors);
+			break;
+		case 32:
+			mr_ash_sweep<32>(XTX, sweep_schedule, mu1_tminus1, sigma2_e, prior, compute_ELBO, state, nProcessors);
+			break;
+		default:
+			mr_ash_sweep<0>(XTX, sweep_schedule, mu1_tminus1, sigma2_e, prior, compute_ELBO, state, nProcessors);
+		}
+		sweep_timer.stop();
+		if (profile != nullptr) {
+			profile->add_count(MR_ASH_COUNT_ITERATIONS, 1);
+			profile->add_count(MR_ASH_COUNT_COORDINATE_UPDATES, sweep_schedule.order.size());
+		}
+
+		profile_scope elbo_timer(profile, MR_ASH_PHASE_ELBO);
 		for (int j = 0; j < p; j++) {
-			// Remove j-th effect from expected residuals
-			vec XTrbar_j = XTrbar + XTX.col(j) * mu1_t[j];
-
-			double xTrbar_j = XTrbar_j[j];
-			double xTx = XTX(j, j);
-
-			// Run Bayesian SLR
-			unordered_map<string, vec> bfit = bayes_mix_sufficient(xTx, xTrbar_j, sigma2_e, w0, sigma2_0);
-
-			// Update variational parameters
-			mu1_t[j] = bfit["mu1"][0];
-			sigma2_1_t[j] = bfit["sigma2_1"][0];
-			w1_t.row(j) = bfit["w1"].t();
-			mu1_k_t.row(j) = bfit["mu1_k"].t();
-			sigma2_1_k_t.row(j) = bfit["sigma2_1_k"].t();
-
-			// Compute ELBO parameters
-			if (compute_ELBO) {
-				var_part_ERSS += sigma2_1_t[j] * xTx;
-				neg_KL += bfit["logbf"][0] + (1 / (2 * sigma2_e)) * (-2 * xTrbar_j * mu1_t[j] + (xTx * (sigma2_1_t[j] + pow(mu1_t[j], 2))));
+			var_part_ERSS += state.var_part_ERSS[j];
+		}
+		if (compute_ELBO) {
+			for (int j = 0; j < p; j++) {
+				neg_KL += state.neg_KL[j];
 			}
-
-			// Update expected residuals
-			XTrbar = XTrbar_j - XTX.col(j) * mu1_t[j];
 		}
 
 		// Update w0 if requested
@@ -187,8 +881,8 @@ unordered_map<string, mat> mr_ash_sufficient(const vec& XTy, const mat& XTX, dou
 		// Compute distance in mu1 between two successive iterations
 		err = abs(mu1_t - mu1_tminus1);
 
-		// Compute ERSS and ELBO
-		double ERSS = yTy - 2 * dot(XTy, mu1_t) + as_scalar(mu1_t.t() * XTX * mu1_t) + var_part_ERSS;
+		// Compute ERSS and ELBO; mu1' X'X mu1 = mu1' (X'y - X'rbar) from the expected residuals
+		double ERSS = yTy - dot(mu1_t, XTy + state.XTrbar) + var_part_ERSS;
 		if (compute_ELBO) {
 			ELBO = -0.5 * log(n) - 0.5 * n * log(2 * datum::pi * sigma2_e) - (1 / (2 * sigma2_e)) * ERSS + neg_KL;
 			if (verbose) {
@@ -206,6 +900,93 @@ unordered_map<string, mat> mr_ash_sufficient(const vec& XTy, const mat& XTX, dou
 		if (update_sigma) {
 			sigma2_e = ERSS / n;
 		}
+		return true;
+	};
+
+	// Active set: full sweeps every full_sweep_every iterations and once the active sweeps converge
+	bool use_active = accel.active_set_tol > 0;
+	uword null_k = sigma2_0.index_min();
+	coordinate_schedule active = schedule;
+	bool need_full = true, last_full = false;
+	int since_full = 0;
+	auto step = [&]() -> bool {
+		bool full = !use_active || need_full;
+		if (!iterate(full ? schedule : active)) {
+			return false;
+		}
+		last_full = full;
+		if (full && profile != nullptr) {
+			profile->add_count(MR_ASH_COUNT_FULL_SWEEPS, 1);
+		}
+		if (full && use_active) {
+			std::vector<char> keep(p);
+			for (int j = 0; j < p; j++) {
+				keep[j] = 1 - w1_t(j, null_k) > accel.active_set_tol;
+			}
+			active = schedule.subset(keep);
+			since_full = 0;
+			need_full = false;
+		}
+		else if (use_active) {
+			since_full++;
+			need_full = !any(err > tol) || since_full >= accel.full_sweep_every;
+		}
+		return true;
+	};
+	// Converged once a full sweep has no error above tol; a NaN error also stops
+	auto converged = [&]() {
+		return last_full && !any(err > tol);
+	};
+
+	// Iterate until convergence
+	while (!converged()) {
+		if (!accel.squarem) {
+			if (!step()) break;
+			continue;
+		}
+
+		// SQUAREM: two sweeps from theta0 = (mu1, w0), an extrapolation and a stabilizing sweep
+		vec mu1_0 = mu1_t, w0_0 = w0;
+		if (!step() || converged()) break;
+		vec mu1_1 = mu1_t, w0_1 = w0;
+		if (!step() || converged()) break;
+		profile_scope squarem_timer(profile, MR_ASH_PHASE_SQUAREM);
+		vec r_mu = mu1_1 - mu1_0, v_mu = mu1_t - 2 * mu1_1 + mu1_0;
+		vec r_w = w0_1 - w0_0, v_w = w0 - 2 * w0_1 + w0_0;
+		double r_norm2 = dot(r_mu, r_mu) + dot(r_w, r_w);
+		double v_norm2 = dot(v_mu, v_mu) + dot(v_w, v_w);
+		if (!(v_norm2 > 0)) continue;
+		double alpha = std::min(-1.0, -std::sqrt(r_norm2 / v_norm2));
+		if (alpha == -1.0) continue; // the extrapolation is the second sweep itself
+
+		// Keep the second sweep to fall back to if the extrapolation lowers the ELBO
+		mr_ash_state saved = state;
+		vec saved_w0 = w0, saved_err = err;
+		double saved_sigma2_e = sigma2_e, saved_ELBO = ELBO;
+		bool saved_last_full = last_full, saved_need_full = need_full;
+		coordinate_schedule saved_active = active;
+		int saved_since_full = since_full;
+
+		mu1_t = mu1_0 - 2 * alpha * r_mu + alpha * alpha * v_mu;
+		if (update_w0) {
+			vec w = clamp(w0_0 - 2 * alpha * r_w + alpha * alpha * v_w, 0, datum::inf);
+			if (accu(w) > 0) w0 = w / accu(w);
+		}
+		refresh = true;
+		squarem_timer.stop();
+		if (!step()) break;
+		if (compute_ELBO && !(ELBO >= saved_ELBO)) {
+			if (profile != nullptr) profile->add_count(MR_ASH_COUNT_SQUAREM_REJECTED, 1);
+			state = saved;
+			w0 = saved_w0;
+			err = saved_err;
+			sigma2_e = saved_sigma2_e;
+			ELBO = saved_ELBO;
+			last_full = saved_last_full;
+			active = saved_active;
+			need_full = saved_need_full;
+			since_full = saved_since_full;
+		}
 	}
 
 	// Return the posterior assignment probabilities (w1), the posterior mean (mu1) and variance (sigma2_1) of the coefficients,
@@ -224,43 +1005,69 @@ unordered_map<string, mat> mr_ash_sufficient(const vec& XTy, const mat& XTX, dou
  */
 unordered_map<string, mat> rescale_post_mean_covar(const vec& mu1, const mat& sigma2_1, const vec& sx) {
 	vec mu1_orig = mu1 / sx;
-	mat sigma2_1_orig = diagmat(1 / sx) * sigma2_1 * diagmat(1 / sx);
-	return {{"mu1_orig", mat(mu1_orig)}, {"sigma2_1_orig", sigma2_1_orig}};
+	// sigma2_1 holds the posterior variances, the diagonal of diag(1 / sx) * Sigma * diag(1 / sx)
+	vec sigma2_1_orig = vectorise(sigma2_1) / square(sx);
+	return {{"mu1_orig", mat(mu1_orig)}, {"sigma2_1_orig", mat(sigma2_1_orig)}};
+}
+
+/// Diagonal of an LD matrix given as its diagonal blocks
+inline vec ld_diag(const std::vector<mat>& R) {
+	vec d;
+	for (size_t b = 0; b < R.size(); b++) {
+		d = join_cols(d, vec(R[b].diag()));
+	}
+	return d;
+}
+
+/// Diagonal of a sparse LD matrix
+inline vec ld_diag(const sp_mat& R) {
+	return vec(R.diag());
+}
+
+/// Diagonal of a low-rank LD matrix
+inline vec ld_diag(const ld_factor& R) {
+	vec d(R.n_variants());
+	for (size_t j = 0; j < R.n_variants(); j++) {
+		d[j] = R.diag(j);
+	}
+	return d;
+}
+
+/// X'X of an LD matrix given as its diagonal blocks
+inline block_xtx scaled_xtx(const std::vector<mat>& R, const vec& s) {
+	return block_xtx(R, s);
+}
+
+/// X'X of a sparse LD matrix
+inline sparse_xtx scaled_xtx(const sp_mat& R, const vec& s) {
+	return sparse_xtx(R, s);
 }
 
+/// X'X of a low-rank LD matrix, through its factor
+inline factor_xtx scaled_xtx(const ld_factor& R, const vec& s) {
+	return factor_xtx(R, s);
+}
+
+/// X'y, the scale of X'X = diag(s) R diag(s) and the starting point of one mr_ash_rss fit
+struct mr_ash_rss_inputs {
+	vec Xty, s, sx, mu1_init;
+	double yTy;
+};
+
 /**
- * Bayesian multiple regression with mixture-of-normals prior
- *
- * @param bhat Observed effect sizes (standardized)
- * @param shat Standard errors of effect sizes
- * @param z Z-scores
- * @param R Correlation matrix
- * @param var_y Variance of the outcome
- * @param n Sample size
- * @param sigma2_e Error variance
- * @param s0 Prior variances for the mixture components
- * @param w0 Prior weights for the mixture components
- * @param mu1_init Initial value for the posterior mean of the coefficients
- * @param tol Convergence tolerance
- * @param max_iter Maximum number of iterations
- * @param update_w0 Whether to update the mixture weights
- * @param update_sigma Whether to update the error variance
- * @param compute_ELBO Whether to compute the Evidence Lower Bound (ELBO)
- * @param standardize Whether to standardize the input data
- * @param ncpus Number of CPUs to use for parallel processing
- * @return An unordered_map containing the posterior mean (mu1) and covariance (sigma2_1) of the coefficients, the posterior assignment probabilities (w1), the error variance (sigma2_e), the mixture weights (w0), and optionally the ELBO
+ * Sufficient statistics of one mr_ash_rss fit from its summary statistics
+ * (arguments as in mr_ash_rss; R_diag is the diagonal of R).
  */
-unordered_map<string, mat> mr_ash_rss(const vec& bhat, const vec& shat, const vec& z, const mat& R, double var_y, int n,
-                                      double sigma2_e, const vec& s0, vec& w0, const vec& mu1_init, double tol = 1e-8,
-                                      int max_iter = 1e5, bool update_w0 = true, bool update_sigma = true, bool compute_ELBO = true,
-                                      bool standardize = false, int ncpus = 1) {
+inline mr_ash_rss_inputs mr_ash_rss_prepare(const vec& bhat, const vec& shat, const vec& z, const vec& R_diag, double var_y,
+                                            int n, const vec& mu1_init, bool standardize) {
+	mr_ash_rss_inputs in;
 	// Get number of variables
 	int p = z.n_elem;
 
 	// Initialize regression coefficients to 0 if not provided
-	vec mu1_init_use = mu1_init;
+	in.mu1_init = mu1_init;
 	if (mu1_init.is_empty()) {
-		mu1_init_use = vec(p, fill::zeros);
+		in.mu1_init = vec(p, fill::zeros);
 	}
 
 	// Compute Z-scores if not provided
@@ -275,43 +1082,142 @@ unordered_map<string, mat> mr_ash_rss(const vec& bhat, const vec& shat, const ve
 		adj = (n - 1) / (square(z_use) + n - 2);
 		z_use %= sqrt(adj);
 	}
-	// Compute X'X and X'y
-	mat XtX;
-	vec Xty;
+	// Compute X'y and the scale of X'X = diag(s) R diag(s)
 	if (std::isfinite(var_y) && !shat.is_empty()) {
-		vec XtXdiag = var_y * adj / square(shat);
-		XtX = diagmat(sqrt(XtXdiag)) * R * diagmat(sqrt(XtXdiag));
-		XtX = 0.5 * (XtX + XtX.t());
-		Xty = z_use % sqrt(adj) % (var_y / shat);
+		in.s = sqrt(var_y * adj / square(shat));
+		in.Xty = z_use % sqrt(adj) % (var_y / shat);
 	} else {
 		// The effects are on the standardized X, y scale
-		XtX = (n - 1) * R;
-		Xty = z_use * sqrt(n - 1);
+		in.s = vec(p, fill::value(sqrt(n - 1.0)));
+		in.Xty = z_use * sqrt(n - 1);
 		var_y = 1.0;
 	}
+	in.yTy = var_y * (n - 1);
 
 	// Adjust X'X and X'y if X is standardized
-	vec sx(p, fill::ones);
+	in.sx = vec(p, fill::ones);
 	if (standardize) {
-		vec dXtX = XtX.diag();
-		sx = sqrt(dXtX / (n - 1));
-		sx.replace(0, 1);
-		XtX = diagmat(1 / sx) * XtX * diagmat(1 / sx);
-		Xty /= sx;
-		mu1_init_use %= sx;
+		vec dXtX = square(in.s) % R_diag;
+		in.sx = sqrt(dXtX / (n - 1));
+		in.sx.replace(0, 1);
+		in.s /= in.sx;
+		in.Xty /= in.sx;
+		in.mu1_init %= in.sx;
 	}
+	return in;
+}
 
-	// Run variational inference
-	unordered_map<string, mat> result = mr_ash_sufficient(Xty, XtX, var_y * (n - 1), n, sigma2_e, s0, w0, mu1_init_use,
-	                                                      tol, max_iter, update_w0, update_sigma, compute_ELBO, standardize, ncpus);
-
+/// Result of mr_ash_rss on the scale of the input, from that of mr_ash_sufficient
+inline unordered_map<string, mat> mr_ash_rss_result(unordered_map<string, mat>& result, const mr_ash_rss_inputs& in,
+                                                    bool standardize) {
 	// Rescale posterior mean and covariance if X was standardized
 	if (standardize) {
-		unordered_map<string, mat> out_adj = rescale_post_mean_covar(vectorise(result["mu1"]), result["sigma2_1"], sx);
+		unordered_map<string, mat> out_adj = rescale_post_mean_covar(vectorise(result["mu1"]), result["sigma2_1"], in.sx);
 		result["mu1"] = out_adj["mu1_orig"];
 		result["sigma2_1"] = out_adj["sigma2_1_orig"];
 	}
 
 	return {{"mu1", result["mu1"]}, {"sigma2_1", result["sigma2_1"]}, {"w1", result["w1"]},
 		{"sigma2_e", result["sigma2_e"]}, {"w0", result["w0"]}, {"ELBO", result["ELBO"]}};
-};
\ No newline at end of file
+}
+
+/**
+ * Bayesian multiple regression with mixture-of-normals prior
+ *
+ * @param bhat Observed effect sizes (standardized)
+ * @param shat Standard errors of effect sizes
+ * @param z Z-scores
+ * @param R Correlation matrix: its diagonal blocks (`std::vector<mat>`, a single dense matrix being one block), a sparse matrix (`sp_mat`) or a low-rank factor (`ld_factor`)
+ * @param var_y Variance of the outcome
+ * @param n Sample size
+ * @param sigma2_e Error variance
+ * @param s0 Prior variances for the mixture components
+ * @param w0 Prior weights for the mixture components
+ * @param mu1_init Initial value for the posterior mean of the coefficients
+ * @param tol Convergence tolerance
+ * @param max_iter Maximum number of iterations
+ * @param update_w0 Whether to update the mixture weights
+ * @param update_sigma Whether to update the error variance
+ * @param compute_ELBO Whether to compute the Evidence Lower Bound (ELBO)
+ * @param standardize Whether to standardize the input data
+ * @param ncpus Number of CPUs to use for parallel processing
+ * @param concurrent_ld See mr_ash_sufficient
+ * @param accel SQUAREM and active-set options (see mr_ash_acceleration)
+ * @param profile See mr_ash_sufficient
+ * @return An unordered_map containing the posterior mean (mu1) and covariance (sigma2_1) of the coefficients, the posterior assignment probabilities (w1), the error variance (sigma2_e), the mixture weights (w0), and optionally the ELBO
+ */
+template <typename LD_T>
+unordered_map<string, mat> mr_ash_rss(const vec& bhat, const vec& shat, const vec& z, const LD_T& R, double var_y, int n,
+                                      double sigma2_e, const vec& s0, vec& w0, const vec& mu1_init, double tol = 1e-8,
+                                      int max_iter = 1e5, bool update_w0 = true, bool update_sigma = true, bool compute_ELBO = true,
+                                      bool standardize = false, int ncpus = 1, double concurrent_ld = -1,
+                                      const mr_ash_acceleration& accel = mr_ash_acceleration(),
+                                      engine_profile* profile = nullptr) {
+	mr_ash_rss_inputs in = mr_ash_rss_prepare(bhat, shat, z, ld_diag(R), var_y, n, mu1_init, standardize);
+
+	// The scaling is applied element-wise, block by block or over the non-zeros
+	auto XtX = scaled_xtx(R, in.s);
+
+	// Run variational inference
+	unordered_map<string, mat> result = mr_ash_sufficient(in.Xty, XtX, in.yTy, n, sigma2_e, s0, w0, in.mu1_init,
+	                                                      tol, max_iter, update_w0, update_sigma, compute_ELBO, false, ncpus,
+	                                                      concurrent_ld, accel, profile);
+	return mr_ash_rss_result(result, in, standardize);
+}
+
+/**
+ * mr_ash_rss for several traits (or several priors) sharing one LD matrix
+ *
+ * Fit t uses column t of bhat, shat and z (z may be empty), var_y[t], n[t],
+ * sigma2_e[t], s0[t] and w0[t]. R is symmetrized once and each fit scales it on
+ * the fly (`scaled_view`). Independent fits run in parallel, one per
+ * thread. With `warm_start`, the fits form a path: they run in order, each
+ * starting from the mu1 of the previous fit (and its w0, if it has as many
+ * components), and use all threads within each fit.
+ *
+ * @param mu1_init Initial posterior means, one column per fit; empty for zeros
+ * @return One result of mr_ash_rss per fit
+ */
+template <typename LD_T>
+std::vector<unordered_map<string, mat> > mr_ash_rss_multi(const mat& bhat, const mat& shat, const mat& z, const LD_T& R,
+                                                         const vec& var_y, const std::vector<int>& n, const vec& sigma2_e,
+                                                         const std::vector<vec>& s0, const std::vector<vec>& w0,
+                                                         const mat& mu1_init, double tol = 1e-8, int max_iter = 1e5,
+                                                         bool update_w0 = true, bool update_sigma = true,
+                                                         bool compute_ELBO = true, bool standardize = false,
+                                                         bool warm_start = false, int ncpus = 1, double concurrent_ld = -1,
+                                                         const mr_ash_acceleration& accel = mr_ash_acceleration()) {
+	int n_fit = bhat.n_cols;
+	auto R_sym = scaled_xtx(R, vec(bhat.n_rows, fill::ones));
+	vec R_diag = ld_diag(R);
+	std::vector<unordered_map<string, mat> > results(n_fit);
+
+	auto fit = [&](int t, const vec& mu1_start, vec w0_t, int threads) {
+		vec z_t = z.is_empty() ? vec() : vec(z.col(t));
+		mr_ash_rss_inputs in = mr_ash_rss_prepare(bhat.col(t), shat.col(t), z_t, R_diag, var_y[t], n[t], mu1_start, standardize);
+		auto XtX = scaled_view(R_sym, in.s);
+		double sigma2_e_t = sigma2_e[t];
+		unordered_map<string, mat> result = mr_ash_sufficient(in.Xty, XtX, in.yTy, n[t], sigma2_e_t, s0[t], w0_t, in.mu1_init,
+		                                                      tol, max_iter, update_w0, update_sigma, compute_ELBO, false,
+		                                                      threads, concurrent_ld, accel);
+		results[t] = mr_ash_rss_result(result, in, standardize);
+	};
+
+	if (warm_start) {
+		for (int t = 0; t < n_fit; t++) {
+			if (t == 0) {
+				fit(t, mu1_init.is_empty() ? vec() : vec(mu1_init.col(t)), w0[t], ncpus);
+				continue;
+			}
+			const vec w0_prev = vectorise(results[t - 1]["w0"]);
+			fit(t, vectorise(results[t - 1]["mu1"]), w0_prev.n_elem == w0[t].n_elem ? w0_prev : w0[t], ncpus);
+		}
+	}
+	else {
+		#pragma omp parallel for schedule(dynamic) num_threads(std::max(1, std::min(ncpus, n_fit)))
+		for (int t = 0; t < n_fit; t++) {
+			fit(t, mu1_init.is_empty() ? vec() : vec(mu1_init.col(t)), w0[t], 1);
+		}
+	}
+	return results;
+}
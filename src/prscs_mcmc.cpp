@@ -4,7 +4,10 @@
  */
 
 #include <RcppArmadillo.h>
+#include "engine_profile_rcpp.h"
+#include "ld_blocks.h"
 #include "prscs_mcmc.h"
+#include "thread_budget_rcpp.h"
 
 // [[Rcpp::depends(RcppArmadillo)]]
 /**
@@ -16,20 +19,27 @@
  * @param bhat Vector of effect sizes.
  * @param maf Vector of minor allele frequencies. If nullptr, it is assumed to be a vector of zeros.
  * @param n Sample size.
- * @param ld_blk List of LD blocks.
+ * @param ld_blk List of LD blocks, a character vector of LD block files or an LD handle (see `ld_blocks`).
  * @param n_iter Number of MCMC iterations.
  * @param n_burnin Number of burn-in iterations.
  * @param thin Thinning interval.
  * @param verbose Whether to print verbose output.
- * @param seed Random seed. If nullptr, no seed is set.
+ * @param seed Random seed. If nullptr, a random seed is drawn.
+ * @param n_threads Number of threads. Results for a given seed do not depend on it.
+ * @param checkpoint_file Checkpoint file (see `mcmc_checkpoint.h`); empty disables checkpoints.
+ * @param checkpoint_every Iterations between checkpoints.
+ * @param min_ess Stop once the effective sample size of sigma reaches it; 0 runs all iterations.
+ * @param profile Whether to add `profile`, the phase times and counters of the run (see `prs_cs_profile()`).
  * @return A list containing the posterior estimates.
  */
 // [[Rcpp::export]]
 Rcpp::List prs_cs_rcpp(double a, double b, Rcpp::Nullable<double> phi,
                        Rcpp::NumericVector bhat, Rcpp::Nullable<Rcpp::NumericVector> maf,
-                       int n, Rcpp::List ld_blk,
+                       int n, SEXP ld_blk,
                        int n_iter, int n_burnin, int thin,
-                       bool verbose, Rcpp::Nullable<unsigned int> seed) {
+                       bool verbose, Rcpp::Nullable<unsigned int> seed, unsigned n_threads = 1,
+                       const std::string& checkpoint_file = "", int checkpoint_every = 100, double min_ess = 0,
+                       bool profile = false) {
 	// Convert Rcpp types to C++ types
 	std::vector<double> bhat_vec = Rcpp::as<std::vector<double> >(bhat);
 	std::vector<double> maf_vec;
@@ -39,15 +49,10 @@ Rcpp::List prs_cs_rcpp(double a, double b, Rcpp::Nullable<double> phi,
 		maf_vec = std::vector<double>(bhat_vec.size(), 0.0); // Populate with zeros if maf is NULL
 	}
 
-	std::vector<arma::mat> ld_blk_vec;
-	for (int i = 0; i < ld_blk.size(); ++i) {
-		ld_blk_vec.push_back(Rcpp::as<arma::mat>(ld_blk[i]));
-	}
+	// Views of R's matrices, of mapped LD block files or of an LD handle
+	ld_blocks ld_blk_vec(ld_blk);
 
-	double* phi_ptr = nullptr;
-	if (phi.isNotNull()) {
-		phi_ptr = new double(Rcpp::as<double>(phi));
-	}
+	double phi_val = phi.isNotNull() ? Rcpp::as<double>(phi) : 0.0;
 
 	unsigned int seed_val = 0;
 	if (seed.isNotNull()) {
@@ -56,8 +61,12 @@ Rcpp::List prs_cs_rcpp(double a, double b, Rcpp::Nullable<double> phi,
 		seed_val = std::random_device{}();
 	}
 
-	std::map<std::string, arma::vec> output = prs_cs_mcmc(a, b, phi_ptr, bhat_vec, maf_vec, n, ld_blk_vec,
-	                                                      n_iter, n_burnin, thin, verbose, seed_val);
+	mcmc_checkpoint_options ckpt(checkpoint_file, checkpoint_every, min_ess);
+	engine_profile prof = prs_cs_profile();
+	thread_budget budget(n_threads, thread_limit());
+	std::map<std::string, arma::vec> output = prs_cs_mcmc(a, b, phi.isNotNull() ? &phi_val : nullptr, bhat_vec, maf_vec, n, ld_blk_vec.blocks(),
+	                                                      n_iter, n_burnin, thin, verbose, seed_val, budget.engine_threads(), ckpt,
+	                                                      profile ? &prof : nullptr);
 
 	// Convert the output to an Rcpp::List
 	Rcpp::List result;
@@ -65,8 +74,82 @@ Rcpp::List prs_cs_rcpp(double a, double b, Rcpp::Nullable<double> phi,
 	result["psi_est"] = output["psi_est"];
 	result["sigma_est"] = output["sigma_est"](0);
 	result["phi_est"] = output["phi_est"](0);
+	result["sigma_ess"] = output["sigma_ess"](0);
+	result["n_iter"] = output["n_iter"](0);
+	if (profile) {
+		result["profile"] = profile_list(prof);
+	}
+
+	return result;
+}
+
+/**
+ * @brief Rcpp wrapper for the prs_cs_grid function.
+ *
+ * @param a Shape parameter for the prior distribution of psi.
+ * @param b Scale parameter for the prior distribution of psi.
+ * @param phi Global shrinkage parameters, one chain each; NA estimates phi.
+ * @param bhat Vector of effect sizes.
+ * @param maf Vector of minor allele frequencies. If nullptr, it is assumed to be a vector of zeros.
+ * @param n Sample size.
+ * @param ld_blk List of LD blocks, a character vector of LD block files or an LD handle (see `ld_blocks`).
+ * @param n_iter Number of MCMC iterations.
+ * @param n_burnin Number of burn-in iterations.
+ * @param thin Thinning interval.
+ * @param verbose Whether to print verbose output.
+ * @param seed Random seed. If nullptr, a random seed is drawn.
+ * @param n_threads Number of threads. Results for a given seed do not depend on it.
+ * @param checkpoint_file Checkpoint file (see `mcmc_checkpoint.h`); empty disables checkpoints.
+ * @param checkpoint_every Iterations between checkpoints.
+ * @param min_ess Stop once the effective sample size of sigma reaches it; 0 runs all iterations.
+ * @param profile Whether to add `profile`, the phase times and counters of the run (see `prs_cs_profile()`).
+ * @return A list containing the posterior estimates, one column or element per value of phi.
+ */
+// [[Rcpp::export]]
+Rcpp::List prs_cs_grid_rcpp(double a, double b, Rcpp::NumericVector phi,
+                            Rcpp::NumericVector bhat, Rcpp::Nullable<Rcpp::NumericVector> maf,
+                            int n, SEXP ld_blk,
+                            int n_iter, int n_burnin, int thin,
+                            bool verbose, Rcpp::Nullable<unsigned int> seed, unsigned n_threads = 1,
+                            const std::string& checkpoint_file = "", int checkpoint_every = 100, double min_ess = 0,
+                            bool profile = false) {
+	std::vector<double> bhat_vec = Rcpp::as<std::vector<double> >(bhat);
+	std::vector<double> maf_vec;
+	if (maf.isNotNull()) {
+		maf_vec = Rcpp::as<std::vector<double> >(maf.get());
+	} else {
+		maf_vec = std::vector<double>(bhat_vec.size(), 0.0);
+	}
+
+	// One shared copy of the LD blocks for every chain of the grid
+	ld_blocks ld_blk_vec(ld_blk);
+
+	// NA_real_ is a NaN, which requests a chain that estimates phi
+	std::vector<double> phi_grid = Rcpp::as<std::vector<double> >(phi);
+
+	unsigned int seed_val = 0;
+	if (seed.isNotNull()) {
+		seed_val = Rcpp::as<unsigned int>(seed);
+	} else {
+		seed_val = std::random_device{}();
+	}
 
-	// Clean up dynamically allocated memory
-	delete phi_ptr;
+	mcmc_checkpoint_options ckpt(checkpoint_file, checkpoint_every, min_ess);
+	engine_profile prof = prs_cs_profile();
+	thread_budget budget(n_threads, thread_limit());
+	std::map<std::string, arma::mat> output = prs_cs_mcmc_grid(a, b, phi_grid, bhat_vec, maf_vec, n, ld_blk_vec.blocks(),
+	                                                           n_iter, n_burnin, thin, verbose, seed_val, budget.engine_threads(), ckpt,
+	                                                           profile ? &prof : nullptr);
+
+	Rcpp::List result;
+	result["beta_est"] = output["beta_est"];
+	result["psi_est"] = output["psi_est"];
+	result["sigma_est"] = Rcpp::NumericVector(output["sigma_est"].begin(), output["sigma_est"].end());
+	result["phi_est"] = Rcpp::NumericVector(output["phi_est"].begin(), output["phi_est"].end());
+	result["sigma_ess"] = Rcpp::NumericVector(output["sigma_ess"].begin(), output["sigma_ess"].end());
+	result["n_iter"] = output["n_iter"](0);
+	if (profile) {
+		result["profile"] = profile_list(prof);
+	}
 	return result;
 }
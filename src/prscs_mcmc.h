@@ -9,10 +9,21 @@
 #include <armadillo>
 #include <vector>
 #include <string>
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <map>
 #include <iomanip>
+#include <limits>
+#include <numeric>
 #include <random>
+#include <stdexcept>
+#include "content_hash.h"
+#include "engine_profile.h"
+#include "function_pool.h"
+#include "mcmc_checkpoint.h"
+#include "mcmc_diagnostics.h"
+#include "rng_stream.h"
 
 /**
  * @brief Evaluate the function psi(x, alpha, lambda).
@@ -66,9 +77,11 @@ double g(double x, double sd, double td, double f1, double f2) {
  * @param p Shape parameter.
  * @param a Scale parameter.
  * @param b Scale parameter.
+ * @param rng Uniform random bit generator.
  * @return Random variate from the generalized inverse Gaussian distribution.
  */
-double gigrnd(double p, double a, double b, std::mt19937& rng) {
+template <typename RNG>
+double gigrnd(double p, double a, double b, RNG& rng) {
 	double lambda = p;
 	double omega = std::sqrt(a * b);
 	bool swap = false;
@@ -176,11 +189,349 @@ double gigrnd(double p, double a, double b, std::mt19937& rng) {
 }
 
 /**
- * @brief Markov Chain Monte Carlo (MCMC) sampler for polygenic prediction with continuous shrinkage (CS) priors.
+ * @class gig_batch
+ * @brief Generalized inverse Gaussian draws for a whole block of SNPs at once.
+ *
+ * Runs the same ratio-of-uniforms rejection sampler as `gigrnd` (identical
+ * envelope, proposal and acceptance test for every draw), restructured for
+ * batches:
+ * - the envelope parameters of all draws are computed up front into
+ *   structure-of-arrays buffers;
+ * - every round draws the three uniforms of all pending draws in one pass from
+ *   a counter-based stream and evaluates the proposals with branch-free selects;
+ * - only the rejected draws are carried over to the next round.
+ * The buffers are sized on first use and reused.
+ *
+ * Callers fill `a` and `b` (one entry per draw) and call `sample()`.
+ */
+class gig_batch {
+public:
+std::vector<double> a, b;
+
+/**
+ * @param p Shape parameter, shared by all draws.
+ * @param rng Counter-based stream the uniforms are drawn from.
+ * @param out Output, `a.size()` draws.
+ * @return The number of proposals, `a.size()` plus the number of rejections.
+ */
+std::size_t sample(double p, rng_stream& rng, double* out) {
+	std::size_t n = a.size();
+	setup(p, n);
+	std::size_t n_proposal = 0;
+
+	pending.resize(n);
+	for (std::size_t i = 0; i < n; ++i) {
+		pending[i] = static_cast<uint32_t>(i);
+	}
+	std::size_t m = n;
+	while (m > 0) {
+		n_proposal += m;
+		for (std::size_t k = 0; k < m; ++k) {
+			u[k] = rng.uniform();
+			v[k] = rng.uniform();
+			w[k] = rng.uniform();
+		}
+		// proposals and acceptance tests of all pending draws. The test
+		// W g(rnd) <= exp(fpsi(rnd)) of gigrnd is evaluated on the log scale,
+		// with g's exponent selected instead of computing both tails, and
+		// cosh(rnd) from exp(rnd), which leaves three log/exp per proposal.
+		for (std::size_t k = 0; k < m; ++k) {
+			std::size_t i = pending[k];
+			double log_v = std::log(v[k]);
+			double rnd = (u[k] < c1[i]) ? -sd[i] + q[i] * v[k] :
+			             (u[k] < c2[i]) ? td[i] - r[i] * log_v : -sd[i] + p_r[i] * log_v;
+			double log_g = (rnd > td[i]) ? -eta[i] - zeta[i] * (rnd - t[i]) :
+			               (rnd < -sd[i]) ? -theta[i] + xi[i] * (rnd + s[i]) : 0.0;
+			double e = std::exp(rnd);
+			double f = -alpha[i] * (0.5 * (e + 1.0 / e) - 1.0) - lambda * (e - rnd - 1.0);
+			cand[k] = rnd;
+			accept[k] = (std::log(w[k]) + log_g <= f) ? 1 : 0;
+		}
+		// finish accepted draws, keep the rejected ones for the next round
+		std::size_t n_rej = 0;
+		for (std::size_t k = 0; k < m; ++k) {
+			std::size_t i = pending[k];
+			if (accept[k]) {
+				out[i] = finish(cand[k], i);
+			}
+			else {
+				pending[n_rej++] = static_cast<uint32_t>(i);
+			}
+		}
+		m = n_rej;
+	}
+	return n_proposal;
+}
+
+private:
+// Envelope of every draw, as in gigrnd
+void setup(double p, std::size_t n) {
+	lambda = std::fabs(p);
+	swap = (p < 0);
+	std::vector<double>* buffers[] = {&omega, &alpha, &t, &s, &eta, &zeta, &theta, &xi, &p_r, &r, &td, &sd, &q,
+		                          &c1, &c2, &u, &v, &w, &cand};
+	for (std::size_t k = 0; k < sizeof(buffers) / sizeof(buffers[0]); ++k) {
+		buffers[k]->resize(n);
+	}
+	accept.resize(n);
+
+	for (std::size_t i = 0; i < n; ++i) {
+		omega[i] = std::sqrt(a[i] * b[i]);
+		alpha[i] = std::sqrt(omega[i] * omega[i] + lambda * lambda) - lambda;
+	}
+	// fpsi(+-1) and the hyperbolic functions of t and s use closed forms of
+	// cosh/sinh in terms of exp, with the constants at +-1 computed once
+	const double cosh1 = std::cosh(1.0);
+	const double e1 = std::exp(1.0);
+	for (std::size_t i = 0; i < n; ++i) {
+		double al = alpha[i];
+		bool degenerate = (al == 0 && lambda == 0);
+
+		double x = al * (cosh1 - 1.0) + lambda * (e1 - 2.0);     // -fpsi(1)
+		double t_i = 1.0;
+		if (x > 2.0 && !degenerate) {
+			t_i = std::sqrt(2.0 / (al + lambda));
+		} else if (x < 0.5 && !degenerate) {
+			t_i = std::log(4.0 / (al + 2.0 * lambda));
+		}
+
+		x = al * (cosh1 - 1.0) + lambda / e1;                    // -fpsi(-1)
+		double s_i = 1.0;
+		if (x > 2.0 && !degenerate) {
+			s_i = std::sqrt(4.0 / (al * cosh1 + lambda));
+		} else if (x < 0.5 && !degenerate) {
+			if (al == 0) {
+				s_i = 1.0 / lambda;
+			} else {
+				double s_alpha = std::log(1.0 + 1.0 / al + std::sqrt(1.0 / (al * al) + 2.0 / al));
+				s_i = (lambda == 0) ? s_alpha : std::min(1.0 / lambda, s_alpha);
+			}
+		}
+		t[i] = t_i;
+		s[i] = s_i;
+	}
+	for (std::size_t i = 0; i < n; ++i) {
+		double al = alpha[i];
+		double et = std::exp(t[i]);
+		double es = std::exp(-s[i]);
+		eta[i] = al * (0.5 * (et + 1.0 / et) - 1.0) + lambda * (et - t[i] - 1.0);    // -fpsi(t)
+		zeta[i] = al * 0.5 * (et - 1.0 / et) + lambda * (et - 1.0);                  // -fdpsi(t)
+		theta[i] = al * (0.5 * (es + 1.0 / es) - 1.0) + lambda * (es + s[i] - 1.0);  // -fpsi(-s)
+		xi[i] = al * 0.5 * (1.0 / es - es) - lambda * (es - 1.0);                    // fdpsi(-s)
+		p_r[i] = 1.0 / xi[i];
+		r[i] = 1.0 / zeta[i];
+		td[i] = t[i] - r[i] * eta[i];
+		sd[i] = s[i] - p_r[i] * theta[i];
+		q[i] = td[i] + sd[i];
+		c1[i] = q[i] / (p_r[i] + q[i] + r[i]);
+		c2[i] = (q[i] + r[i]) / (p_r[i] + q[i] + r[i]);
+	}
+}
+
+// Back-transform an accepted draw, as in gigrnd
+double finish(double rnd, std::size_t i) const {
+	double lo = lambda / omega[i];
+	rnd = std::exp(rnd) * (lo + std::sqrt(1.0 + lo * lo));
+	if (swap) {
+		rnd = 1.0 / rnd;
+	}
+	double result = rnd / std::sqrt(a[i] / b[i]);
+	if (result == 0.0) {
+		result = std::numeric_limits<double>::min();
+	}
+	if (result > 1.0) {
+		result = 1.0;
+	}
+	return result;
+}
+
+double lambda;
+bool swap;
+std::vector<double> omega, alpha, t, s, eta, zeta, theta, xi, p_r, r, td, sd, q, c1, c2;
+std::vector<double> u, v, w, cand;
+std::vector<char> accept;
+std::vector<uint32_t> pending;
+};
+
+/**
+ * @brief Per-block buffers of `prs_cs_mcmc`, sized on the first iteration and reused.
+ *
+ * Blocks are contiguous, so the block's slices of beta and psi are accessed
+ * through `subvec` views and only these buffers are written.
+ */
+struct prs_cs_workspace {
+	arma::mat chol;     // R + diag(1 / psi), overwritten by its upper Cholesky factor
+	arma::vec x;        // right-hand side, then the draw of beta
+	arma::vec ld_beta;  // R beta, for the quadratic term of the sigma update
+	gig_batch gig;      // psi draws
+};
+
+// x <- U^-T x for an upper triangular U; reads contiguous columns of U
+inline void solve_chol_upper_t(const arma::mat& U, arma::vec& x) {
+	double* xp = x.memptr();
+	for (arma::uword i = 0; i < U.n_rows; ++i) {
+		const double* u = U.colptr(i);
+		double sum = xp[i];
+		for (arma::uword k = 0; k < i; ++k) {
+			sum -= u[k] * xp[k];
+		}
+		xp[i] = sum / u[i];
+	}
+}
+
+// x <- U^-1 x for an upper triangular U, column by column (axpy form)
+inline void solve_chol_upper(const arma::mat& U, arma::vec& x) {
+	double* xp = x.memptr();
+	for (arma::uword i = U.n_rows; i-- > 0;) {
+		const double* u = U.colptr(i);
+		double xi = xp[i] / u[i];
+		xp[i] = xi;
+		for (arma::uword k = 0; k < i; ++k) {
+			xp[k] -= xi * u[k];
+		}
+	}
+}
+
+/**
+ * @brief Random number streams of `prs_cs_mcmc`.
+ *
+ * Every stage of an iteration draws from its own counter-based stream, keyed by
+ * the seed, the stage, the LD block (for block-local stages) and the iteration,
+ * so blocks can be updated in any order and on any thread with identical results.
+ */
+enum prs_cs_stage {
+	PRS_CS_STAGE_BETA = 0,
+	PRS_CS_STAGE_SIGMA,
+	PRS_CS_STAGE_PSI,
+	PRS_CS_STAGE_PHI
+};
+
+/**
+ * @brief Phases and counters of `prs_cs_mcmc_grid` (see `engine_profile`).
+ *
+ * The block-local stages (the Cholesky factorization of each block, the draw of
+ * beta given the factor, and the delta and psi draws) are timed inside the
+ * tasks of their parallel region and report thread time; sigma, phi and the
+ * checkpoints are the wall time of their stage. `gig_proposals` counts the
+ * proposals of the psi draws, so `gig_proposals / gig_draws` is the mean number
+ * of proposals per accepted draw.
+ */
+enum prs_cs_phase {
+	PRS_CS_PHASE_CHOLESKY = 0,
+	PRS_CS_PHASE_BETA,
+	PRS_CS_PHASE_SIGMA,
+	PRS_CS_PHASE_PSI,
+	PRS_CS_PHASE_PHI,
+	PRS_CS_PHASE_CHECKPOINT
+};
+enum prs_cs_counter {
+	PRS_CS_COUNT_ITERATIONS = 0,
+	PRS_CS_COUNT_CHOLESKY,
+	PRS_CS_COUNT_GIG_DRAWS,
+	PRS_CS_COUNT_GIG_PROPOSALS
+};
+inline engine_profile prs_cs_profile() {
+	return engine_profile({"cholesky", "sample_beta", "sample_sigma", "sample_psi", "sample_phi", "checkpoint"},
+	                      {"iterations", "cholesky_factorizations", "gig_draws", "gig_proposals"});
+}
+
+inline rng_stream prs_cs_stream(unsigned int seed, prs_cs_stage stage, size_t block, int itr) {
+	return rng_stream(seed, (static_cast<uint64_t>(stage) << 40) | block, static_cast<uint32_t>(itr));
+}
+
+/**
+ * @brief State of one PRS-CS chain of a `prs_cs_mcmc_grid` run.
+ *
+ * Posterior means are kept as sums over the `n_kept` retained draws, so a run
+ * stopped early averages over the draws it has.
+ */
+struct prs_cs_run {
+	prs_cs_run(int p, std::size_t n_blk, double phi_init, bool phi_updt, std::size_t n_keep)
+		: phi(phi_init), phi_updt(phi_updt), sigma(1.0), sigma_sum(0.0), phi_sum(0.0), n_kept(0),
+		beta(p, arma::fill::zeros), psi(p, arma::fill::ones), delta(p, arma::fill::zeros),
+		beta_sum(p, arma::fill::zeros), psi_sum(p, arma::fill::zeros),
+		sigma_monitor(n_keep), quad_blk(n_blk, 0.0), ws(n_blk) {
+	}
+
+	/// Save or restore the state through a checkpoint archive (see `mcmc_checkpoint.h`)
+	template <typename Archive>
+	void checkpoint(Archive& ar) {
+		ar.field(phi);
+		ar.field(sigma);
+		ar.field(sigma_sum);
+		ar.field(phi_sum);
+		ar.field(n_kept);
+		ar.field(beta);
+		ar.field(psi);
+		ar.field(delta);
+		ar.field(beta_sum);
+		ar.field(psi_sum);
+		ar.field(sigma_monitor);
+	}
+
+	double phi;
+	bool phi_updt;
+	double sigma, sigma_sum, phi_sum;
+	uint64_t n_kept;
+	arma::vec beta, psi, delta;
+	arma::vec beta_sum, psi_sum;
+	chain_monitor sigma_monitor;          // for the effective-sample-size stopping rule
+	std::vector<double> quad_blk;         // per-block beta^T D^-1 beta
+	std::vector<prs_cs_workspace> ws;     // per-block buffers
+};
+
+/// Fingerprint of the inputs and settings of a `prs_cs_mcmc_grid` run, stored in its checkpoints
+inline content_hash prs_cs_fingerprint(double a, double b, const std::vector<double>& phi_grid,
+                                       const std::vector<double>& bhat, const std::vector<double>& maf,
+                                       int n, const std::vector<arma::mat>& ld_blk,
+                                       int n_iter, int n_burnin, int thin, unsigned int seed, double min_ess) {
+	content_hasher h;
+	h.add(static_cast<uint64_t>(0x50525343));   // "PRSC"
+	h.add(a);
+	h.add(b);
+	h.add(static_cast<uint64_t>(phi_grid.size()));
+	h.add(phi_grid.data(), phi_grid.size());
+	h.add(static_cast<uint64_t>(bhat.size()));
+	h.add(bhat.data(), bhat.size());
+	h.add(maf.data(), maf.size());
+	h.add(static_cast<uint64_t>(n));
+	h.add(static_cast<uint64_t>(ld_blk.size()));
+	for (std::size_t kk = 0; kk < ld_blk.size(); ++kk) {
+		h.add(static_cast<uint64_t>(ld_blk[kk].n_rows));
+		h.add(ld_blk[kk].memptr(), ld_blk[kk].n_elem);
+	}
+	h.add(static_cast<uint64_t>(n_iter));
+	h.add(static_cast<uint64_t>(n_burnin));
+	h.add(static_cast<uint64_t>(thin));
+	h.add(static_cast<uint64_t>(seed));
+	h.add(min_ess);
+	return h.digest();
+}
+
+/**
+ * @brief Markov Chain Monte Carlo (MCMC) sampler for polygenic prediction with continuous shrinkage (CS)
+ * priors, for a grid of global shrinkage parameters.
+ *
+ * One chain is run per value of `phi_grid`, all in lock-step against the same
+ * read-only LD blocks, so the LD is loaded once for the whole grid and each
+ * block is reused by every chain while it is in cache. Given sigma, psi and phi
+ * the LD blocks are conditionally independent, so the beta update and the
+ * per-SNP delta and psi updates run in parallel over (block, chain) pairs.
+ * Per-block terms of the sigma update are summed in block order, and each block
+ * draws from its own stream (`prs_cs_stage`), so the output does not depend on
+ * `n_threads`. All chains use the same streams: chain g reproduces a single run
+ * with `phi_grid[g]` and the same seed, and the grid points are compared under
+ * common random numbers.
+ *
+ * With `ckpt.path` set, the state of every chain is saved every `ckpt.every`
+ * iterations and when the run ends; a run started with an existing checkpoint of
+ * the same inputs and settings resumes from it (see `mcmc_checkpoint.h`). With
+ * `ckpt.min_ess > 0` the run stops once the effective sample size of sigma
+ * reaches `ckpt.min_ess` in every chain (see `ess_reached`).
  *
  * @param a Shape parameter for the prior distribution of psi.
  * @param b Scale parameter for the prior distribution of psi.
- * @param phi Global shrinkage parameter. If nullptr, it will be estimated automatically.
+ * @param phi_grid Global shrinkage parameters, one chain each. NaN requests a chain that estimates phi.
  * @param bhat Vector of effect sizes.
  * @param maf Vector of minor allele frequencies.
  * @param n Sample size.
@@ -189,126 +540,245 @@ double gigrnd(double p, double a, double b, std::mt19937& rng) {
  * @param n_burnin Number of burn-in iterations.
  * @param thin Thinning interval.
  * @param verbose Whether to print verbose output.
- * @param seed Random seed. If nullptr, no seed is set.
- * @return A map containing the posterior estimates.
+ * @param seed Seed of the random number streams.
+ * @param n_threads Number of threads to use.
+ * @param ckpt Checkpointing and early stopping settings.
+ * @param profile Phase times and counters of the run (see `prs_cs_profile()`), or null.
+ * @return A map of the posterior estimates with one column per grid value: "beta_est" and "psi_est"
+ *         (SNPs x grid), "sigma_est", "phi_est" and "sigma_ess" (1 x grid, the effective sample size
+ *         of sigma), and "n_iter" (1 x 1), the number of iterations run.
  */
-std::map<std::string, arma::vec> prs_cs_mcmc(double a, double b, double* phi,
-                                             const std::vector<double>& bhat, const std::vector<double>& maf,
-                                             int n, const std::vector<arma::mat>& ld_blk,
-                                             int n_iter, int n_burnin, int thin,
-                                             bool verbose, unsigned int seed) {
+std::map<std::string, arma::mat> prs_cs_mcmc_grid(double a, double b, const std::vector<double>& phi_grid,
+                                                  const std::vector<double>& bhat, const std::vector<double>& maf,
+                                                  int n, const std::vector<arma::mat>& ld_blk,
+                                                  int n_iter, int n_burnin, int thin,
+                                                  bool verbose, unsigned int seed, unsigned n_threads = 1,
+                                                  const mcmc_checkpoint_options& ckpt = mcmc_checkpoint_options(),
+                                                  engine_profile* profile = nullptr) {
 	if (verbose) {
 		std::cout << "Running Markov Chain Monte Carlo (MCMC) sampler..." << std::endl;
 	}
 
 	// Derived statistics
 	arma::vec beta_mrg(bhat);
-	// std::cout << "beta_mrg " << beta_mrg << std::endl;
-	int n_pst = (n_iter - n_burnin) / thin;
 	int p = beta_mrg.n_elem;
+	std::size_t n_keep = 0;
+	for (int itr = n_burnin + 1; itr <= n_iter; ++itr) {
+		if (itr % thin == 0) {
+			n_keep++;
+		}
+	}
+
+	// Block offsets; cost weights for distributing (block, chain) pairs to threads
+	std::size_t n_blk = ld_blk.size();
+	std::size_t n_run = phi_grid.size();
+	std::vector<std::size_t> blk_start(n_blk + 1, 0);
+	std::vector<double> chol_cost(n_blk * n_run), snp_cost(n_blk * n_run);
+	for (std::size_t kk = 0; kk < n_blk; ++kk) {
+		blk_start[kk + 1] = blk_start[kk] + ld_blk[kk].n_rows;
+		for (std::size_t g = 0; g < n_run; ++g) {
+			chol_cost[kk * n_run + g] = std::pow(static_cast<double>(ld_blk[kk].n_rows), 3);
+			snp_cost[kk * n_run + g] = ld_blk[kk].n_rows;
+		}
+	}
+	Function_pool& func_pool = Function_pool::shared(n_threads);
 
 	// Initialization
-	std::mt19937 rng(seed);
-	std::normal_distribution<double> normal_dist(0.0, 1.0);
-	std::gamma_distribution<double> gamma_dist_sigma((n + p) / 2.0, 1.0);
-
-	arma::vec beta(p, arma::fill::zeros);
-	arma::vec psi(p, arma::fill::ones);
-	double sigma = 1.0;
-	bool phi_updt = (phi == nullptr);
-	if (phi_updt) {
-		phi = new double(1.0);
+	std::vector<prs_cs_run> runs;
+	runs.reserve(n_run);
+	for (std::size_t g = 0; g < n_run; ++g) {
+		bool phi_updt = std::isnan(phi_grid[g]);
+		runs.emplace_back(p, n_blk, phi_updt ? 1.0 : phi_grid[g], phi_updt, n_keep);
 	}
 
-	arma::vec beta_est(p, arma::fill::zeros);
-	arma::vec psi_est(p, arma::fill::zeros);
-	double sigma_est = 0.0;
-	double phi_est = 0.0;
+	// Resume from a checkpoint of the same run
+	content_hash fingerprint = content_hash();
+	int first_itr = 1;
+	bool finished = false;
+	if (ckpt.enabled()) {
+		fingerprint = prs_cs_fingerprint(a, b, phi_grid, bhat, maf, n, ld_blk, n_iter, n_burnin, thin, seed, ckpt.min_ess);
+		checkpoint_reader in(ckpt.path, fingerprint);
+		if (in.found()) {
+			for (std::size_t g = 0; g < n_run; ++g) {
+				runs[g].checkpoint(in);
+			}
+			in.finish();
+			first_itr = static_cast<int>(in.iteration()) + 1;
+			finished = in.finished();
+			if (verbose) {
+				std::cout << "Resuming from the checkpoint at iteration " << in.iteration() << std::endl;
+			}
+		}
+	}
+	int last_itr = finished ? first_itr - 1 : n_iter;
 
 	// MCMC
-	for (int itr = 1; itr <= n_iter; ++itr) {
+	for (int itr = first_itr; itr <= n_iter && !finished; ++itr) {
 		if (verbose && itr % 100 == 0) {
 			std::cout << "Iteration " << std::setw(4) << itr << " of " << n_iter << std::endl;
 		}
+		if (profile != nullptr) {
+			profile->add_count(PRS_CS_COUNT_ITERATIONS, 1);
+		}
 
-		int mm = 0;
-		double quad = 0.0;
-		for (std::size_t kk = 0; kk < ld_blk.size(); ++kk) {
+		// pairs are block-major, so the chains sharing a block run next to each other
+		func_pool.parallel_for(0, n_blk * n_run, 1, [&](std::size_t pair) {
+			std::size_t kk = pair / n_run;
+			prs_cs_run& run = runs[pair % n_run];
+			run.quad_blk[kk] = 0.0;
 			if (ld_blk[kk].n_rows == 0) {
-				continue;
+				return;
 			}
-
-			arma::uvec idx_blk = arma::regspace<arma::uvec>(mm, mm + ld_blk[kk].n_rows - 1);
-			mm += ld_blk[kk].n_rows;
-
-			arma::mat dinvt = ld_blk[kk] + arma::diagmat(1.0 / psi.elem(idx_blk));
-
-			arma::mat dinvt_chol = arma::chol(dinvt);
-
-			arma::vec beta_tmp = arma::solve(arma::trimatl(dinvt_chol.t()), beta_mrg(idx_blk)) +
-			                     arma::vec(ld_blk[kk].n_rows).transform([&](double) {
-				return normal_dist(rng);
-			}) * std::sqrt(sigma / n);
-			// std::cout << "beta_tmp " << beta_tmp << std::endl;
-			beta(idx_blk) = arma::solve(arma::trimatu(dinvt_chol), beta_tmp);
-
-			quad += arma::as_scalar(beta(idx_blk).t() * dinvt * beta(idx_blk));
-			// std::cout << "quad " << quad << std::endl;
+			rng_stream rng = prs_cs_stream(seed, PRS_CS_STAGE_BETA, kk, itr);
+			std::normal_distribution<double> normal_dist(0.0, 1.0);
+			prs_cs_workspace& ws = run.ws[kk];
+			const arma::mat& ld = ld_blk[kk];
+			std::size_t first = blk_start[kk];
+			std::size_t last = blk_start[kk + 1] - 1;
+
+			// D^-1 = R + diag(1 / psi) = U^T U, factored in place
+			{
+				profile_scope timer(profile, PRS_CS_PHASE_CHOLESKY);
+				profile_tally factorizations(profile, PRS_CS_COUNT_CHOLESKY);
+				ws.chol = ld;
+				ws.chol.diag() += 1.0 / run.psi.subvec(first, last);
+				if (!arma::chol(ws.chol, ws.chol)) {
+					throw std::runtime_error("prs_cs_mcmc: LD block is not positive definite.");
+				}
+				factorizations.add();
+			}
+			profile_scope timer(profile, PRS_CS_PHASE_BETA);
+
+			// beta = U^-1 (U^-T beta_mrg + sqrt(sigma / n) z)
+			ws.x = beta_mrg.subvec(first, last);
+			solve_chol_upper_t(ws.chol, ws.x);
+			double scale = std::sqrt(run.sigma / n);
+			for (arma::uword i = 0; i < ws.x.n_elem; ++i) {
+				ws.x(i) += normal_dist(rng) * scale;
+			}
+			solve_chol_upper(ws.chol, ws.x);
+			run.beta.subvec(first, last) = ws.x;
+
+			// beta^T D^-1 beta = beta^T R beta + sum(beta^2 / psi)
+			ws.ld_beta = ld * ws.x;
+			run.quad_blk[kk] = arma::dot(ws.x, ws.ld_beta) + arma::accu(arma::square(ws.x) / run.psi.subvec(first, last));
+		}, chol_cost);
+
+		profile_scope sigma_timer(profile, PRS_CS_PHASE_SIGMA);
+		for (std::size_t g = 0; g < n_run; ++g) {
+			prs_cs_run& run = runs[g];
+			// summed in block order so the result does not depend on thread scheduling
+			double quad = std::accumulate(run.quad_blk.begin(), run.quad_blk.end(), 0.0);
+			double err = std::max(n / 2.0 * (1.0 - 2.0 * arma::dot(run.beta, beta_mrg) + quad),
+			                      n / 2.0 * arma::sum(arma::pow(run.beta, 2) / run.psi));
+
+			rng_stream rng_sigma = prs_cs_stream(seed, PRS_CS_STAGE_SIGMA, 0, itr);
+			std::gamma_distribution<double> gamma_dist_sigma((n + p) / 2.0, 1.0);
+			run.sigma = 1.0 / gamma_dist_sigma(rng_sigma) / err;
 		}
-		// std::cout << "beta " << beta << std::endl;
-		double err = std::max(n / 2.0 * (1.0 - 2.0 * arma::dot(beta, beta_mrg) + quad),
-		                      n / 2.0 * arma::sum(arma::pow(beta, 2) / psi));
-
-		sigma = 1.0 / gamma_dist_sigma(rng) / err;
+		sigma_timer.stop();
+
+		// delta and psi are independent across SNPs given beta, sigma and phi;
+		// the psi draws of a block are one batch
+		func_pool.parallel_for(0, n_blk * n_run, 1, [&](std::size_t pair) {
+			std::size_t kk = pair / n_run;
+			prs_cs_run& run = runs[pair % n_run];
+			profile_scope timer(profile, PRS_CS_PHASE_PSI);
+			rng_stream rng = prs_cs_stream(seed, PRS_CS_STAGE_PSI, kk, itr);
+			std::size_t first = blk_start[kk];
+			std::size_t size = blk_start[kk + 1] - first;
+			gig_batch& gig = run.ws[kk].gig;
+			gig.a.resize(size);
+			gig.b.resize(size);
+			for (std::size_t jj = 0; jj < size; ++jj) {
+				std::gamma_distribution<double> gamma_dist_delta(a + b, 1.0 / (run.psi(first + jj) + run.phi));
+				run.delta(first + jj) = gamma_dist_delta(rng);
+				gig.a[jj] = 2.0 * run.delta(first + jj);
+				gig.b[jj] = n * std::pow(run.beta(first + jj), 2) / run.sigma;
+			}
+			std::size_t n_proposal = gig.sample(a - 0.5, rng, run.psi.memptr() + first);
+			if (profile != nullptr) {
+				profile->add_count(PRS_CS_COUNT_GIG_DRAWS, size);
+				profile->add_count(PRS_CS_COUNT_GIG_PROPOSALS, n_proposal);
+			}
+		}, snp_cost);
+
+		for (std::size_t g = 0; g < n_run; ++g) {
+			prs_cs_run& run = runs[g];
+			profile_scope timer(profile, PRS_CS_PHASE_PHI);
+			if (run.phi_updt) {
+				rng_stream rng_phi = prs_cs_stream(seed, PRS_CS_STAGE_PHI, 0, itr);
+				std::gamma_distribution<double> gamma_dist_phi(1.0, 1.0 / (run.phi + 1.0));
+				double w = gamma_dist_phi(rng_phi);
+				std::gamma_distribution<double> gamma_dist_phi_new(p * b + 0.5, 1.0 / (arma::sum(run.delta) + w));
+				run.phi = gamma_dist_phi_new(rng_phi);
+			}
 
-		arma::vec delta = arma::vec(p);
-		for (int jj = 0; jj < p; ++jj) {
-			std::gamma_distribution<double> gamma_dist_delta(a + b, 1.0 / (psi(jj) + *phi));
-			delta(jj) = gamma_dist_delta(rng);
+			// Posterior
+			if (itr > n_burnin && (itr % thin == 0)) {
+				run.beta_sum += run.beta;
+				run.psi_sum += run.psi;
+				run.sigma_sum += run.sigma;
+				run.phi_sum += run.phi;
+				run.n_kept++;
+				run.sigma_monitor.add(run.sigma);
+			}
 		}
 
-		// std::cout << "sigma " << sigma << std::endl;
-		// std::cout << "delta " << delta << std::endl;
-		for (int jj = 0; jj < p; ++jj) {
-			psi(jj) = gigrnd(a - 0.5, 2.0 * delta(jj), n * std::pow(beta(jj), 2) / sigma, rng);
+		bool converged = ckpt.min_ess > 0 && itr > n_burnin && (itr % thin == 0);
+		for (std::size_t g = 0; g < n_run && converged; ++g) {
+			converged = ess_reached(std::vector<const chain_monitor*>(1, &runs[g].sigma_monitor), ckpt.min_ess);
 		}
-
-		if (phi_updt) {
-			std::gamma_distribution<double> gamma_dist_phi(1.0, 1.0 / (*phi + 1.0));
-			double w = gamma_dist_phi(rng);
-			std::gamma_distribution<double> gamma_dist_phi_new(p * b + 0.5, 1.0 / (arma::sum(delta) + w));
-			*phi = gamma_dist_phi_new(rng);
+		finished = converged || itr == n_iter;
+		if (ckpt.enabled() && (finished || (ckpt.every > 0 && itr % ckpt.every == 0))) {
+			profile_scope timer(profile, PRS_CS_PHASE_CHECKPOINT);
+			checkpoint_writer out;
+			for (std::size_t g = 0; g < n_run; ++g) {
+				runs[g].checkpoint(out);
+			}
+			out.commit(ckpt.path, fingerprint, itr, finished);
 		}
-
-		// Posterior
-		if (itr > n_burnin && (itr % thin == 0)) {
-			beta_est += beta / n_pst;
-			psi_est += psi / n_pst;
-			sigma_est += sigma / n_pst;
-			phi_est += *phi / n_pst;
+		if (converged) {
+			last_itr = itr;
+			if (verbose) {
+				std::cout << "Effective sample size of sigma reached " << ckpt.min_ess << " at iteration " << itr << std::endl;
+			}
 		}
 	}
 
-	if (phi_updt) {
-		delete phi;
-	}
-
 	// Convert standardized beta to per-allele beta only if not all maf are zeros
 	arma::vec maf_vec(maf);
-	if (arma::max(maf_vec) > 0) {
-		beta_est /= arma::sqrt(2.0 * maf_vec % (1.0 - maf_vec));
+	bool rescale = arma::max(maf_vec) > 0;
+	arma::vec allele_sd;
+	if (rescale) {
+		allele_sd = arma::sqrt(2.0 * maf_vec % (1.0 - maf_vec));
 	}
+
 	// Prepare the output map
-	std::map<std::string, arma::vec> output;
+	arma::mat beta_est(p, n_run), psi_est(p, n_run);
+	arma::mat sigma_est(1, n_run), phi_est(1, n_run), sigma_ess(1, n_run);
+	for (std::size_t g = 0; g < n_run; ++g) {
+		const prs_cs_run& run = runs[g];
+		double n_kept = static_cast<double>(std::max<uint64_t>(run.n_kept, 1));
+		arma::vec beta_mean = run.beta_sum / n_kept;
+		beta_est.col(g) = rescale ? arma::vec(beta_mean / allele_sd) : beta_mean;
+		psi_est.col(g) = run.psi_sum / n_kept;
+		sigma_est(0, g) = run.sigma_sum / n_kept;
+		phi_est(0, g) = run.phi_sum / n_kept;
+		sigma_ess(0, g) = effective_size(std::vector<const chain_monitor*>(1, &run.sigma_monitor));
+
+		// Print estimated phi
+		if (verbose && run.phi_updt) {
+			std::cout << "Estimated global shrinkage parameter: " << phi_est(0, g) << std::endl;
+		}
+	}
+	std::map<std::string, arma::mat> output;
 	output["beta_est"] = beta_est;
 	output["psi_est"] = psi_est;
-	output["sigma_est"] = arma::vec(1).fill(sigma_est);
-	output["phi_est"] = arma::vec(1).fill(phi_est);
-
-	// Print estimated phi
-	if (verbose && phi_updt) {
-		std::cout << "Estimated global shrinkage parameter: " << phi_est << std::endl;
-	}
+	output["sigma_est"] = sigma_est;
+	output["phi_est"] = phi_est;
+	output["sigma_ess"] = sigma_ess;
+	output["n_iter"] = arma::mat(1, 1).fill(last_itr);
 
 	if (verbose) {
 		std::cout << "MCMC sampling completed." << std::endl;
@@ -316,4 +786,48 @@ std::map<std::string, arma::vec> prs_cs_mcmc(double a, double b, double* phi,
 
 	return output;
 }
+
+/**
+ * @brief Markov Chain Monte Carlo (MCMC) sampler for polygenic prediction with continuous shrinkage (CS) priors.
+ *
+ * A single chain of `prs_cs_mcmc_grid`.
+ *
+ * @param a Shape parameter for the prior distribution of psi.
+ * @param b Scale parameter for the prior distribution of psi.
+ * @param phi Global shrinkage parameter. If nullptr, it will be estimated automatically.
+ * @param bhat Vector of effect sizes.
+ * @param maf Vector of minor allele frequencies.
+ * @param n Sample size.
+ * @param ld_blk List of LD blocks.
+ * @param n_iter Number of MCMC iterations.
+ * @param n_burnin Number of burn-in iterations.
+ * @param thin Thinning interval.
+ * @param verbose Whether to print verbose output.
+ * @param seed Seed of the random number streams.
+ * @param n_threads Number of threads to use.
+ * @param ckpt Checkpointing and early stopping settings.
+ * @param profile Phase times and counters of the run (see `prs_cs_profile()`), or null.
+ * @return A map containing the posterior estimates.
+ */
+std::map<std::string, arma::vec> prs_cs_mcmc(double a, double b, double* phi,
+                                             const std::vector<double>& bhat, const std::vector<double>& maf,
+                                             int n, const std::vector<arma::mat>& ld_blk,
+                                             int n_iter, int n_burnin, int thin,
+                                             bool verbose, unsigned int seed, unsigned n_threads = 1,
+                                             const mcmc_checkpoint_options& ckpt = mcmc_checkpoint_options(),
+                                             engine_profile* profile = nullptr) {
+	std::vector<double> phi_grid(1, phi == nullptr ? std::numeric_limits<double>::quiet_NaN() : *phi);
+	std::map<std::string, arma::mat> grid = prs_cs_mcmc_grid(a, b, phi_grid, bhat, maf, n, ld_blk,
+	                                                         n_iter, n_burnin, thin, verbose, seed, n_threads, ckpt, profile);
+
+	std::map<std::string, arma::vec> output;
+	output["beta_est"] = grid["beta_est"].col(0);
+	output["psi_est"] = grid["psi_est"].col(0);
+	output["sigma_est"] = grid["sigma_est"].col(0);
+	output["phi_est"] = grid["phi_est"].col(0);
+	output["sigma_ess"] = grid["sigma_ess"].col(0);
+	output["n_iter"] = grid["n_iter"].col(0);
+	return output;
+}
+
 #endif // MCMC_HPP
\ No newline at end of file
@@ -1,33 +1,255 @@
 #include "qtl_enrichment.hpp"
+#include "engine_profile_rcpp.h"
+#include "thread_budget_rcpp.h"
 
+/**
+ * Convert r_qtl_susie_fit to C++ type, resolving the variants of every fit against the GWAS once.
+ *
+ * r_qtl_susie_fit is a list of SuSiE fits, the path of a store written by
+ * write_susie_fits(), or a "susie_fit_store" object (list with the `file` and the
+ * `variants` of the store, which may have been renamed to match the GWAS).
+ */
+static std::vector<SuSiEFit> load_susie_fits(SEXP r_qtl_susie_fit, const gwas_variant_index& gwas_variants, bool keep_alpha = false) {
+	std::vector<SuSiEFit> susie_fits;
+	if (Rf_isString(r_qtl_susie_fit) || Rf_inherits(r_qtl_susie_fit, "susie_fit_store")) {
+		std::vector<std::string> variants;
+		std::string path;
+		if (Rf_isString(r_qtl_susie_fit)) {
+			path = Rcpp::as<std::string>(r_qtl_susie_fit);
+		}
+		else {
+			Rcpp::List store_info(r_qtl_susie_fit);
+			path = Rcpp::as<std::string>(store_info["file"]);
+			variants = Rcpp::as<std::vector<std::string> >(store_info["variants"]);
+		}
+		susie_fit_store store(path);
+		if (variants.empty()) {
+			variants = store.variant_names();
+		}
+		if (variants.size() != store.n_variants()) {
+			Rcpp::stop("The variants of the SuSiE fit store object do not match the store " + path + ".");
+		}
+		std::vector<int> variant_positions(variants.size());
+		for (size_t i = 0; i < variants.size(); ++i) {
+			auto it = gwas_variants.find(variants[i]);
+			variant_positions[i] = (it != gwas_variants.end()) ? it->second : -1;
+		}
+		susie_fits.reserve(store.n_fits());
+		for (size_t f = 0; f < store.n_fits(); ++f) {
+			susie_fits.emplace_back(store, f, variant_positions, keep_alpha);
+		}
+		return susie_fits;
+	}
+
+	Rcpp::List susie_fit_list(r_qtl_susie_fit);
+	susie_fits.reserve(susie_fit_list.size());
+
+	for (int i = 0; i < susie_fit_list.size(); ++i) {
+		susie_fits.emplace_back(Rcpp::wrap(susie_fit_list[i]), gwas_variants, keep_alpha);
+	}
+	return susie_fits;
+}
+
+static Rcpp::IntegerVector one_based(const std::vector<int>& index) {
+	Rcpp::IntegerVector out(index.size());
+	for (size_t i = 0; i < index.size(); i++) {
+		out[i] = index[i] + 1;
+	}
+	return out;
+}
+
+/**
+ * @brief The `coloc` element of an enrichment result.
+ *
+ * @return A list with `signal`, one row per single effect with its `fit`, `effect`
+ *         (row of alpha), `qtl_cpip`, `gwas_cpip` and `rcp`; `variant`, one row per
+ *         variant reported with its `signal` (row of `signal`), `variant` (position
+ *         in the GWAS PIP vector), `qtl_pip`, `gwas_pip` and `scp`; and `fit_rcp`,
+ *         the probability that each fit has a colocalized signal. Indices are 1-based.
+ */
+static Rcpp::List coloc_list(const qtl_coloc_result& coloc) {
+	return Rcpp::List::create(
+		Rcpp::Named("signal") = Rcpp::DataFrame::create(
+			Rcpp::Named("fit") = one_based(coloc.signal_fit),
+			Rcpp::Named("effect") = one_based(coloc.signal_effect),
+			Rcpp::Named("qtl_cpip") = coloc.signal_qtl_cpip,
+			Rcpp::Named("gwas_cpip") = coloc.signal_gwas_cpip,
+			Rcpp::Named("rcp") = coloc.signal_rcp),
+		Rcpp::Named("variant") = Rcpp::DataFrame::create(
+			Rcpp::Named("signal") = one_based(coloc.variant_signal),
+			Rcpp::Named("variant") = one_based(coloc.variant_position),
+			Rcpp::Named("qtl_pip") = coloc.variant_qtl_pip,
+			Rcpp::Named("gwas_pip") = coloc.variant_gwas_pip,
+			Rcpp::Named("scp") = coloc.variant_scp),
+		Rcpp::Named("fit_rcp") = coloc.fit_rcp
+		);
+}
+
+static unsigned int enrichment_seed(Rcpp::Nullable<unsigned int> seed) {
+	if (seed.isNotNull()) {
+		return Rcpp::as<unsigned int>(seed);
+	}
+	return std::random_device{}();
+}
+
+/**
+ * @brief Dictionary and per-fit summaries of a SuSiE fit store.
+ *
+ * @return A list with the `variants` dictionary, the `fits` names, and the number
+ *         of variables (`n_variables`) and sum of PIPs (`pip_sum`) of each fit.
+ */
+// [[Rcpp::export]]
+Rcpp::List susie_fit_store_info(const std::string& file) {
+	susie_fit_store store(file);
+	Rcpp::IntegerVector n_variables(store.n_fits());
+	Rcpp::NumericVector pip_sum(store.n_fits());
+	for (size_t f = 0; f < store.n_fits(); ++f) {
+		n_variables[f] = store.n_variables(f);
+		pip_sum[f] = store.pip_sum(f);
+	}
+	return Rcpp::List::create(
+		Rcpp::Named("variants") = store.variant_names(),
+		Rcpp::Named("fits") = store.fit_names(),
+		Rcpp::Named("n_variables") = n_variables,
+		Rcpp::Named("pip_sum") = pip_sum
+		);
+}
+
+/**
+ * @param coloc Whether to also compute the colocalization probabilities of every
+ *              signal with the GWAS, in the `coloc` element (see `coloc_list()`).
+ * @param coloc_threshold Smallest SCP of the variants reported.
+ */
 // [[Rcpp::export]]
 Rcpp::List qtl_enrichment_rcpp(
 	SEXP r_gwas_pip, SEXP r_qtl_susie_fit,
 	double pi_gwas = 0, double pi_qtl = 0,
 	int ImpN = 25, double shrinkage_lambda = 1.0,
-	int num_threads = 1)
+	int num_threads = 1, Rcpp::Nullable<unsigned int> seed = R_NilValue, bool profile = false,
+	bool coloc = false, double coloc_threshold = 1e-4)
 {
+	unsigned int seed_val = enrichment_seed(seed);
+	thread_budget budget(num_threads, thread_limit());
+	num_threads = budget.engine_threads();
+	engine_profile prof = qtl_enrichment_profile();
+	engine_profile* prof_ptr = profile ? &prof : nullptr;
+
 	// Convert r_gwas_pip to C++ type
 	Rcpp::NumericVector gwas_pip_vec = Rcpp::as<Rcpp::NumericVector>(r_gwas_pip);
 	std::vector<double> gwas_pip = Rcpp::as<std::vector<double> >(gwas_pip_vec);
 	std::vector<std::string> gwas_pip_names = Rcpp::as<std::vector<std::string> >(gwas_pip_vec.names());
 
-	// Convert r_qtl_susie_fit to C++ type
-	Rcpp::List susie_fit_list(r_qtl_susie_fit);
-	std::vector<SuSiEFit> susie_fits;
+	profile_scope load_timer(prof_ptr, QTL_ENRICHMENT_PHASE_LOAD);
+	std::vector<SuSiEFit> susie_fits = load_susie_fits(r_qtl_susie_fit, index_gwas_variants(gwas_pip_names), coloc);
+	load_timer.stop();
 
-	for (int i = 0; i < susie_fit_list.size(); ++i) {
-		SuSiEFit susie_fit(Rcpp::wrap(susie_fit_list[i]));
-		susie_fits.push_back(susie_fit);
+	std::map<std::string, double> output = qtl_enrichment_workhorse(susie_fits, gwas_pip, pi_gwas, pi_qtl, ImpN, shrinkage_lambda, num_threads, seed_val,
+	                                                                prof_ptr);
+	// Colocalization of every signal, from the fits and GWAS loaded for the enrichment
+	Rcpp::List coloc_output;
+	if (coloc) {
+		coloc_output = coloc_list(qtl_coloc_workhorse(susie_fits, gwas_bayes_factors(gwas_pip, pi_gwas), std::vector<int>(), output,
+		                                              coloc_threshold, num_threads, prof_ptr));
 	}
 
-	std::map<std::string, double> output = qtl_enrichment_workhorse(susie_fits, gwas_pip, gwas_pip_names, pi_gwas, pi_qtl, ImpN, shrinkage_lambda, num_threads);
-
 	// Convert std::map to Rcpp::List
 	Rcpp::List output_list;
 	for (auto const& element : output) {
 		output_list[element.first] = element.second;
 	}
+	if (coloc) {
+		output_list["coloc"] = coloc_output;
+	}
+	if (profile) {
+		output_list["profile"] = profile_list(prof);
+	}
+
+	return output_list;
+}
+
+/**
+ * @brief Enrichment of one set of QTL fits in each GWAS of a list.
+ *
+ * The fits are resolved against the union of the GWAS variants, in order of
+ * first appearance, and the QTN annotations are imputed once for all GWAS.
+ *
+ * @param r_gwas_pips List of named GWAS PIP vectors.
+ * @param pi_gwas The prior inclusion probability of each GWAS.
+ * @return A list with one element per estimate of `qtl_enrichment_rcpp`, each a
+ *         vector over the GWAS and, with `coloc`, a list of the colocalization with
+ *         each GWAS.
+ */
+// [[Rcpp::export]]
+Rcpp::List qtl_enrichment_multi_rcpp(
+	Rcpp::List r_gwas_pips, SEXP r_qtl_susie_fit,
+	std::vector<double> pi_gwas, double pi_qtl = 0,
+	int ImpN = 25, double shrinkage_lambda = 1.0,
+	int num_threads = 1, Rcpp::Nullable<unsigned int> seed = R_NilValue,
+	bool coloc = false, double coloc_threshold = 1e-4)
+{
+	size_t n_gwas = r_gwas_pips.size();
+	if (n_gwas == 0) {
+		Rcpp::stop("r_gwas_pips must have at least one GWAS.");
+	}
+	if (pi_gwas.size() != n_gwas) {
+		Rcpp::stop("pi_gwas must have one element per GWAS.");
+	}
+	unsigned int seed_val = enrichment_seed(seed);
+	thread_budget budget(num_threads, thread_limit());
+	num_threads = budget.engine_threads();
+
+	std::vector<gwas_bayes_factors> gwas;
+	std::vector<std::vector<std::string> > gwas_names(n_gwas);
+	gwas.reserve(n_gwas);
+	std::vector<std::string> variant_names;
+	gwas_variant_index variants;
+	for (size_t t = 0; t < n_gwas; t++) {
+		Rcpp::NumericVector gwas_pip_vec = Rcpp::as<Rcpp::NumericVector>(r_gwas_pips[t]);
+		gwas.emplace_back(Rcpp::as<std::vector<double> >(gwas_pip_vec), pi_gwas[t]);
+		gwas_names[t] = Rcpp::as<std::vector<std::string> >(gwas_pip_vec.names());
+		for (size_t i = 0; i < gwas_names[t].size(); i++) {
+			if (variants.emplace(gwas_names[t][i], variant_names.size()).second) {
+				variant_names.push_back(gwas_names[t][i]);
+			}
+		}
+	}
+
+	// Position of every variant of the union in each GWAS; left empty when a GWAS is the union
+	std::vector<std::vector<int> > gwas_positions(n_gwas);
+	for (size_t t = 0; t < n_gwas; t++) {
+		if (gwas_names[t] == variant_names) {
+			continue;
+		}
+		gwas_variant_index index = index_gwas_variants(gwas_names[t]);
+		gwas_positions[t].assign(variant_names.size(), -1);
+		for (size_t i = 0; i < variant_names.size(); i++) {
+			auto it = index.find(variant_names[i]);
+			if (it != index.end()) {
+				gwas_positions[t][i] = it->second;
+			}
+		}
+	}
+
+	std::vector<SuSiEFit> susie_fits = load_susie_fits(r_qtl_susie_fit, variants, coloc);
+
+	std::vector<std::map<std::string, double> > output = qtl_enrichment_multi_workhorse(
+		susie_fits, gwas, gwas_positions, pi_qtl, ImpN, shrinkage_lambda, num_threads, seed_val);
+
+	Rcpp::List output_list;
+	for (auto const& element : output[0]) {
+		Rcpp::NumericVector column(n_gwas);
+		for (size_t t = 0; t < n_gwas; t++) {
+			column[t] = output[t][element.first];
+		}
+		output_list[element.first] = column;
+	}
+	if (coloc) {
+		Rcpp::List coloc_output(n_gwas);
+		for (size_t t = 0; t < n_gwas; t++) {
+			coloc_output[t] = coloc_list(qtl_coloc_workhorse(susie_fits, gwas[t], gwas_positions[t], output[t], coloc_threshold, num_threads));
+		}
+		output_list["coloc"] = coloc_output;
+	}
 
 	return output_list;
-}
\ No newline at end of file
+}
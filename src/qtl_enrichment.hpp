@@ -1,14 +1,21 @@
 #ifndef QTL_ENRICHMENT_HPP
 #define QTL_ENRICHMENT_HPP
 #include <RcppArmadillo.h> // need to include this before RcppGSL otherwise it complains about conflicts
+#include <algorithm>
+#include <numeric>
 #include <vector>
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <memory>
 #include <random>
+#include <sstream>
 #include <omp.h>
 #include <cmath>
 #include <cstdio>
+#include "engine_profile.h"
+#include "rng_stream.h"
+#include "susie_fit_store.h"
 
 // Enable C++11
 // [[Rcpp::plugins(cpp11)]]
@@ -17,24 +24,134 @@
 // Import Armadillo
 // [[Rcpp::depends(RcppArmadillo)]]
 
-class SuSiEFit {
+/// Position of each GWAS variant in the GWAS PIP vector, by variant name
+typedef std::unordered_map<std::string, int> gwas_variant_index;
+
+/**
+ * @brief Phases and counters of an enrichment run (see `engine_profile`).
+ *
+ * `em` is timed inside the parallel (GWAS, round) tasks (thread time); the
+ * other phases, including the optional `coloc`, are wall time. `em_iterations` sums the EM iterations of all
+ * the tasks.
+ */
+enum qtl_enrichment_phase {
+	QTL_ENRICHMENT_PHASE_LOAD = 0,
+	QTL_ENRICHMENT_PHASE_IMPUTE,
+	QTL_ENRICHMENT_PHASE_EM,
+	QTL_ENRICHMENT_PHASE_SUMMARY,
+	QTL_ENRICHMENT_PHASE_COLOC
+};
+enum qtl_enrichment_counter {
+	QTL_ENRICHMENT_COUNT_ROUNDS = 0,
+	QTL_ENRICHMENT_COUNT_EM_RUNS,
+	QTL_ENRICHMENT_COUNT_EM_ITERATIONS
+};
+inline engine_profile qtl_enrichment_profile() {
+	return engine_profile({"load_fits", "impute_qtn", "em", "summary", "coloc"},
+	                      {"imputation_rounds", "em_runs", "em_iterations"});
+}
+
+inline gwas_variant_index index_gwas_variants(const std::vector<std::string> &gwas_variable_names) {
+	gwas_variant_index index;
+	index.reserve(gwas_variable_names.size());
+	for (size_t i = 0; i < gwas_variable_names.size(); ++i) {
+		index[gwas_variable_names[i]] = i;
+	}
+	return index;
+}
+
+/**
+ * @class alias_table
+ * @brief Walker's alias method for drawing from a fixed discrete distribution.
+ *
+ * Built in O(n) with Vose's algorithm (Vose, 1991); each draw then costs one
+ * uniform number and one table lookup, whatever the number of outcomes.
+ */
+class alias_table {
 public:
-std::vector<std::string> variable_names;
-arma::mat alpha;
-std::vector<double> prior_variance;
+alias_table() {
+}
+
+/// @param w Non-negative weights of the n outcomes, not necessarily normalized
+alias_table(const double* w, size_t n) : prob(n), alias(n) {
+	double total = std::accumulate(w, w + n, 0.0);
+	std::vector<int> small, large;
+	for (size_t i = 0; i < n; ++i) {
+		prob[i] = w[i] * n / total;
+		alias[i] = i;
+		(prob[i] < 1.0 ? small : large).push_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		int s = small.back(), l = large.back();
+		small.pop_back();
+		alias[s] = l;
+		prob[l] -= 1.0 - prob[s];
+		if (prob[l] < 1.0) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	// whatever is left is 1 up to rounding
+	for (int i : small) {
+		prob[i] = 1.0;
+	}
+	for (int i : large) {
+		prob[i] = 1.0;
+	}
+}
+
+size_t size() const {
+	return prob.size();
+}
 
-SuSiEFit(SEXP r_susie_fit) {
+/// Outcome for a uniform number u on [0, 1): its integer part picks a column of the table, its fraction the side
+int draw(double u) const {
+	double x = u * prob.size();
+	size_t i = std::min(static_cast<size_t>(x), prob.size() - 1);
+	return (x - i < prob[i]) ? static_cast<int>(i) : alias[i];
+}
+
+private:
+std::vector<double> prob;
+std::vector<int> alias;
+};
+
+class SuSiEFit {
+public:
+/// Distribution of the QTN of each single effect over its outcomes
+std::vector<alias_table> effects;
+/// Outcome k of single effect i is the GWAS variant positions[effect_start[i] + k], -1 if the GWAS lacks it
+std::vector<int> positions;
+std::vector<size_t> effect_start;
+/// Number of outcomes missing from the GWAS
+int n_missing;
+/// Row of each single effect in the fit, 0-based
+std::vector<int> effect_row;
+/// With `keep_alpha`: outcome k of single effect i has probability alpha_values[alpha_start[i] + k]
+std::vector<double> alpha_values;
+std::vector<size_t> alpha_start;
+
+/**
+ * @param r_susie_fit A SuSiE fit: a list with a named `pip` vector, `alpha` and `prior_variance`.
+ * @param gwas_variants Index of the GWAS variants the fit annotates; the variable names are resolved
+ *                      against it once, here, so imputation never looks names up.
+ * @param keep_alpha Whether to keep the probabilities of the outcomes, for `qtl_coloc_workhorse()`.
+ */
+SuSiEFit(SEXP r_susie_fit, const gwas_variant_index &gwas_variants, bool keep_alpha = false) : n_missing(0) {
 	Rcpp::List susie_fit(r_susie_fit);
 
 	Rcpp::NumericVector pip_vec = Rcpp::as<Rcpp::NumericVector>(susie_fit["pip"]);
-	// std::vector<double> pip = Rcpp::as<std::vector<double> >(pip_vec);
-	variable_names = Rcpp::as<std::vector<std::string> >(pip_vec.names());
-	alpha = Rcpp::as<arma::mat>(susie_fit["alpha"]);
-	prior_variance = Rcpp::as<std::vector<double> >(susie_fit["prior_variance"]);
+	std::vector<std::string> variable_names = Rcpp::as<std::vector<std::string> >(pip_vec.names());
+	// A view of R's matrix when alpha is stored as doubles
+	Rcpp::NumericMatrix alpha = Rcpp::as<Rcpp::NumericMatrix>(susie_fit["alpha"]);
+	std::vector<double> prior_variance = Rcpp::as<std::vector<double> >(susie_fit["prior_variance"]);
 
-	if (alpha.n_rows != prior_variance.size()) {
+	if (static_cast<size_t>(alpha.nrow()) != prior_variance.size()) {
 		Rcpp::stop("The number of rows in alpha must match the length of prior_variance.");
 	}
+	if (static_cast<size_t>(alpha.ncol()) != variable_names.size()) {
+		Rcpp::stop("The number of columns in alpha must match the length of pip.");
+	}
 
 	// Check if all elements in prior_variance are not greater than 0
 	if (std::all_of(prior_variance.begin(), prior_variance.end(), [](double x) {
@@ -43,93 +160,178 @@ SuSiEFit(SEXP r_susie_fit) {
 		Rcpp::stop("At least one element in prior_variance must be greater than 0.");
 	}
 
-	// Filter out rows with prior_variance = 0
-	std::vector<arma::uword> valid_rows;
-	for (size_t i = 0; i < prior_variance.size(); ++i) {
-		if (prior_variance[i] > 0) {
-			valid_rows.push_back(i);
+	// Rows with prior_variance = 0 are left out; the others must sum to 1
+	std::vector<double> row(alpha.ncol());
+	for (int i = 0; i < alpha.nrow(); ++i) {
+		if (prior_variance[i] <= 0) {
+			continue;
+		}
+		double row_sum = 0;
+		for (size_t j = 0; j < row.size(); ++j) {
+			row[j] = alpha(i, j);
+			row_sum += row[j];
 		}
-	}
-	alpha = alpha.rows(arma::uvec(valid_rows));
-	prior_variance.erase(std::remove(prior_variance.begin(), prior_variance.end(), 0), prior_variance.end());
-
-	// Add a check to make sure each row of alpha sums to 1
-	for (arma::uword i = 0; i < alpha.n_rows; ++i) {
-		double row_sum = arma::sum(alpha.row(i));
 		if (std::abs(row_sum - 1.0) > 1e-6) {
 			Rcpp::stop("Row " + std::to_string(i + 1) + " of single effect PIP matrix (alpha) does not sum to 1. It is: " + std::to_string(row_sum));
 		}
+		effects.emplace_back(row.data(), row.size());
+		// all single effects share the variables of the fit
+		effect_start.push_back(0);
+		effect_row.push_back(i);
+		if (keep_alpha) {
+			alpha_start.push_back(alpha_values.size());
+			alpha_values.insert(alpha_values.end(), row.begin(), row.end());
+		}
 	}
-}
 
-std::vector<std::string> impute_qtn(std::mt19937 &gen) const {
-	std::vector<std::string> qtn_names;
+	positions.resize(variable_names.size());
+	for (size_t j = 0; j < variable_names.size(); ++j) {
+		auto it = gwas_variants.find(variable_names[j]);
+		positions[j] = (it != gwas_variants.end()) ? it->second : -1;
+		n_missing += (it == gwas_variants.end());
+	}
+}
 
-	for (arma::uword i = 0; i < alpha.n_rows; ++i) {
-		std::vector<double> alpha_row(alpha.colptr(i), alpha.colptr(i) + alpha.n_cols);
-		std::discrete_distribution<> dist(alpha_row.begin(), alpha_row.end());
-		int random_index = dist(gen);
-		qtn_names.push_back(variable_names[random_index]);
+/**
+ * @brief Fit f of a binary store, whose sparse alpha rows are used in place.
+ *
+ * @param variant_positions GWAS position of each variant of the store dictionary, -1 if the GWAS lacks it.
+ * @param keep_alpha Whether to copy the alpha rows out of the store, for `qtl_coloc_workhorse()`.
+ */
+SuSiEFit(const susie_fit_store &store, size_t f, const std::vector<int> &variant_positions, bool keep_alpha = false) : n_missing(0) {
+	effects.reserve(store.effect_end(f) - store.effect_begin(f));
+	for (size_t e = store.effect_begin(f); e < store.effect_end(f); ++e) {
+		effects.emplace_back(store.effect_alpha(e), store.effect_size(e));
+		effect_start.push_back(positions.size());
+		effect_row.push_back(e - store.effect_begin(f));
+		if (keep_alpha) {
+			alpha_start.push_back(alpha_values.size());
+			alpha_values.insert(alpha_values.end(), store.effect_alpha(e), store.effect_alpha(e) + store.effect_size(e));
+		}
+		const int32_t *variant = store.effect_variants(e);
+		for (size_t k = 0; k < store.effect_size(e); ++k) {
+			positions.push_back(variant_positions[variant[k]]);
+			n_missing += (positions.back() < 0);
+		}
 	}
+}
+
+/// Number of QTNs drawn by `impute_qtn()`, one per single effect
+size_t n_effects() const {
+	return effects.size();
+}
 
-	return qtn_names;
+/**
+ * @brief Draws one QTN per single effect and appends its GWAS index to `annotated`.
+ *
+ * @return The number of QTNs missing from the GWAS, which are left out of the annotation.
+ */
+int impute_qtn(rng_stream &gen, std::vector<int> &annotated) const {
+	int missing = 0;
+	for (size_t i = 0; i < effects.size(); ++i) {
+		int g = positions[effect_start[i] + effects[i].draw(gen.uniform())];
+		if (n_missing == 0 || g >= 0) {
+			annotated.push_back(g);
+		}
+		else {
+			++missing;
+		}
+	}
+	return missing;
 }
 };
 
+/**
+ * @class gwas_bayes_factors
+ * @brief The per-variant quantities of one GWAS that the EM of every imputation round shares.
+ *
+ * `bf[i]` is the Bayes factor of variant i implied by its PIP under the GWAS prior
+ * odds pi_gwas / (1 - pi_gwas).
+ */
+struct gwas_bayes_factors {
+	std::vector<double> bf;
+	double pi_gwas;
+	/// Number of variants genome-wide, sum(gwas_pip) / pi_gwas
+	double total_snp;
+
+	gwas_bayes_factors(const std::vector<double> &gwas_pip, double pi_gwas) : bf(gwas_pip.size()), pi_gwas(pi_gwas) {
+		double r_null = pi_gwas / (1 - pi_gwas);
+		for (size_t i = 0; i < gwas_pip.size(); i++) {
+			double val = gwas_pip[i];
+			if (val == 1)
+				val = 1 - 1e-8;
+			bf[i] = val / (1 - val) / r_null;
+		}
+		total_snp = std::accumulate(gwas_pip.begin(), gwas_pip.end(), 0.0) / pi_gwas;
+	}
+};
+
+/// Sum of the posterior probabilities r * bf / (1 + r * bf) over all variants, under prior odds r
+inline double sum_posterior(const std::vector<double> &bf, double r) {
+	const double *x = bf.data();
+	size_t n = bf.size();
+	double s = 0;
+	#pragma omp simd reduction(+:s)
+	for (size_t i = 0; i < n; i++) {
+		double v = r * x[i];
+		s += v / (1 + v);
+	}
+	return s;
+}
+
+/**
+ * @brief EM estimate of the enrichment of GWAS signals in one QTL annotation.
+ *
+ * @param annotated Sorted, distinct GWAS indices of the annotated variants. Only
+ *                  these are visited one by one; the unannotated variants enter
+ *                  each E step through a vectorized pass over all variants minus
+ *                  the annotated ones.
+ * @param messages Receives the progress messages; run_EM may run on a worker thread,
+ *            so it never writes to the R console itself.
+ * @param profile Receives the number of iterations run (if not null).
+ * @return {a0, a1, var(a0), var(a1)}.
+ */
 std::vector<double> run_EM(
-	const std::vector<double> &gwas_pip,
-	const std::vector<int> &   annotation_vector,
-	double                     pi_gwas,
-	double                     pi_qtl,
-	double                     total_snp,
-	int                        max_iter = 1000,
-	double                     a1_tol = 0.01)
+	const gwas_bayes_factors &gwas,
+	const std::vector<int> &  annotated,
+	double                    pi_qtl,
+	std::ostream &            messages,
+	int                       max_iter = 1000,
+	double                    a1_tol = 0.01,
+	engine_profile *          profile = nullptr)
 {
+	double pi_gwas = gwas.pi_gwas;
 	double a0 = log(pi_gwas / (1 - pi_gwas));
 	double a1 = 0;
 	double var0 = 0;
 	double var1 = 0;
 	double r0, r1;
 	r0 = r1 = exp(a0);
-	double r_null = pi_gwas / (1 - pi_gwas);
+	double n_annotated = annotated.size();
 	int iter = 0;
 
 	while (true) {
 		iter++;
-		// E step
+		// E step; the pseudo counts are 1 split by the prior
 		double pseudo_count = 1.0;
-		double e0g0 = pseudo_count * (1 - pi_gwas) * (1 - pi_qtl);
 		double e0g1 = pseudo_count * (1 - pi_qtl) * pi_gwas;
 		double e1g0 = pseudo_count * (1 - pi_gwas) * pi_qtl;
 		double e1g1 = pseudo_count * pi_gwas * pi_qtl;
 
-		for (size_t i = 0; i < gwas_pip.size(); i++) {
-			double val = gwas_pip[i];
-			if (val == 1)
-				val = 1 - 1e-8;
-			// posterior ratio
-			val = val / (1 - val);
-			// val/r_null is marginal likelihood/bayes factor
-			if (annotation_vector[i] == 0) {
-				val = r0 * (val / r_null);
-				// updated posterior with current prior given eqtl = 0
-				val = val / (1 + val);
-				e0g1 += val;
-				e0g0 += 1 - val;
-			}
-
-			if (annotation_vector[i] == 1) {
-				val = r1 * (val / r_null);
-				// updated posterior with current prior given eqtl = 1
-				val = val / (1 + val);
-				e1g1 += val;
-				e1g0 += 1 - val;
-			}
+		double annotated_r0 = 0, annotated_r1 = 0;
+		for (size_t k = 0; k < annotated.size(); k++) {
+			double x = gwas.bf[annotated[k]];
+			annotated_r0 += r0 * x / (1 + r0 * x);
+			annotated_r1 += r1 * x / (1 + r1 * x);
 		}
-
-		e0g0 += total_snp - (e0g0 + e0g1 + e1g0 + e1g1);
+		e0g1 += sum_posterior(gwas.bf, r0) - annotated_r0;
+		e1g1 += annotated_r1;
+		e1g0 += n_annotated - annotated_r1;
+		// unannotated without signal, including the variants missing from the GWAS
+		double e0g0 = gwas.total_snp - (e0g1 + e1g0 + e1g1);
 
 		double a1_new = log(e1g1 * e0g0 / (e1g0 * e0g1));
+		bool converged = fabs(a1_new - a1) < a1_tol;
 		a1 = a1_new;
 		a0 = log(e0g1 / e0g0); // a0 = log((e0g1+1)/(e0g0+1));
 		r0 = exp(a0);
@@ -137,15 +339,18 @@ std::vector<double> run_EM(
 		var1 = (1.0 / e0g0 + 1.0 / e1g0 + 1.0 / e1g1 + 1.0 / e0g1);
 		var0 = (1.0 / e0g1 + 1.0 / e0g0);
 
-		if (fabs(a1_new - a1) < a1_tol || iter >= max_iter) {
+		if (converged || iter >= max_iter) {
 			break;
 		}
 		if (iter % 100 == 0) {
-			Rcpp::Rcout << "EM Iteration " << iter << ": a0 = " << a0 << ", a1 = " << a1 << std::endl;
+			messages << "EM Iteration " << iter << ": a0 = " << a0 << ", a1 = " << a1 << std::endl;
 		}
 	}
 	if (iter == max_iter) {
-		Rcpp::Rcout << "WARNING: EM algorithm did not converge after " << iter << "iterations!" << std::endl;
+		messages << "WARNING: EM algorithm did not converge after " << iter << "iterations!" << std::endl;
+	}
+	if (profile != nullptr) {
+		profile->add_count(QTL_ENRICHMENT_COUNT_EM_ITERATIONS, iter);
 	}
 
 	std::vector<double> av;
@@ -157,74 +362,65 @@ std::vector<double> run_EM(
 	return av;
 }
 
-std::map<std::string, double> qtl_enrichment_workhorse(
-	const std::vector<SuSiEFit> &   qtl_susie_fits,
-	const std::vector<double> &     gwas_pip,
-	const std::vector<std::string> &gwas_variable_names,
-	double                          pi_gwas,
-	double                          pi_qtl,
-	int                             ImpN,
-	double                          shrinkage_lambda,
-	int                             num_threads = 4)
-{
-
-	std::vector<double> a0_vec(ImpN, 0.0);
-	std::vector<double> v0_vec(ImpN, 0.0);
-	std::vector<double> a1_vec(ImpN, 0.0);
-	std::vector<double> v1_vec(ImpN, 0.0);
-
-	std::map<std::string, int> gwas_variant_index;
+/**
+ * @brief QTN annotations of the multiple imputation rounds.
+ *
+ * They only depend on the QTL fits, so they are drawn once and shared by every
+ * GWAS of a batched run. Round k holds the sorted indices of its draws in the
+ * variant index the fits were resolved against, with repeats (a variant drawn by
+ * several single effects appears once per draw).
+ */
+struct qtn_annotations {
+	std::vector<std::vector<int> > rounds;
+	/// Draws of each round missing from the variant index
+	std::vector<int> missing;
+	/// Number of draws per round, one per single effect of every fit
+	size_t n_draws;
+};
 
-	for (size_t i = 0; i < gwas_variable_names.size(); ++i) {
-		gwas_variant_index[gwas_variable_names[i]] = i;
+inline qtn_annotations impute_qtn_annotations(
+	const std::vector<SuSiEFit> &qtl_susie_fits,
+	int                          ImpN,
+	int                          num_threads,
+	unsigned int                 seed)
+{
+	qtn_annotations qtn;
+	qtn.rounds.resize(ImpN);
+	qtn.missing.assign(ImpN, 0);
+	qtn.n_draws = 0;
+	for (size_t i = 0; i < qtl_susie_fits.size(); i++) {
+		qtn.n_draws += qtl_susie_fits[i].n_effects();
 	}
 
-	// pi_gwas = sum(gwas_pip) / total_snp
-	double total_snp = std::accumulate(gwas_pip.begin(), gwas_pip.end(), 0.0) / pi_gwas;
-
-	Rcpp::Rcout << "Fine-mapped GWAS and QTL data loaded successfully for enrichment analysis!" << std::endl;
-
 	#pragma omp parallel for num_threads(num_threads)
 	for (int k = 0; k < ImpN; k++) {
-		// Initialize the RNG for this thread
-		std::random_device rd;
-		std::mt19937 gen(rd());
-
-		// Use QTL to annotate GWAS variants
-		std::vector<int> annotation_vector(gwas_pip.size(), 0);
-		int missing_qtl_count = 0; // Counter for xQTL not in gwas_variant_index
-		int total_qtl_count = 0;
-
+		// Round k draws from its own stream, whichever thread runs it
+		rng_stream gen(seed, k);
+		std::vector<int> &annotated = qtn.rounds[k];
+		annotated.reserve(qtn.n_draws);
 		for (size_t i = 0; i < qtl_susie_fits.size(); i++) {
-			std::vector<std::string> variants = qtl_susie_fits[i].impute_qtn(gen);
-			for (const auto &variant : variants) {
-				auto it = gwas_variant_index.find(variant);
-				if (it != gwas_variant_index.end()) {
-					// Update annotation_vector only if variant is found
-					annotation_vector[it->second] = 1;
-				} else {
-					++missing_qtl_count;
-				}
-			}
-			total_qtl_count += variants.size();
-		}
-
-		// Calculate the proportion of missing variants
-		double missing_variant_proportion = static_cast<double>(missing_qtl_count) / total_qtl_count;
-		std::vector<double> rst = run_EM(gwas_pip, annotation_vector, pi_gwas, pi_qtl, total_snp);
-
-	#pragma omp critical
-		{
-			a0_vec[k] = rst[0];
-			a1_vec[k] = rst[1];
-			v0_vec[k] = rst[2];
-			v1_vec[k] = rst[3];
-			Rcpp::Rcout << "Proportion of xQTL missing from GWAS variants: " << missing_variant_proportion << " in MI round " << k << std::endl;
+			qtn.missing[k] += qtl_susie_fits[i].impute_qtn(gen, annotated);
 		}
+		std::sort(annotated.begin(), annotated.end());
 	}
+	return qtn;
+}
 
-	Rcpp::Rcout << "EM updates completed!" << std::endl;
-
+/**
+ * @brief Combines the EM estimates of the imputation rounds (Rubin's rules) into the enrichment estimates.
+ *
+ * @param a0_vec,a1_vec,v0_vec,v1_vec Estimates {a0, a1, var(a0), var(a1)} of each round.
+ */
+std::map<std::string, double> enrichment_summary(
+	const std::vector<double> &a0_vec,
+	const std::vector<double> &a1_vec,
+	const std::vector<double> &v0_vec,
+	const std::vector<double> &v1_vec,
+	double                     pi_gwas,
+	double                     pi_qtl,
+	double                     shrinkage_lambda)
+{
+	int ImpN = a0_vec.size();
 	double a0_est = 0;
 	double a1_est = 0;
 	double var0 = 0;
@@ -286,4 +482,269 @@ std::map<std::string, double> qtl_enrichment_workhorse(
 	return output_map;
 }
 
-#endif // QTL_ENRICHMENT_HPP
\ No newline at end of file
+/**
+ * @brief Enrichment of the same QTL fits in several GWAS.
+ *
+ * The QTN annotations are imputed once (`impute_qtn_annotations()`) in the
+ * variant index the fits were resolved against, and every (GWAS, round) pair then
+ * runs its EM in parallel. Each GWAS gets the same estimates as a run of its own
+ * with the same seed.
+ *
+ * @param gwas The Bayes factors of each GWAS.
+ * @param gwas_positions For each GWAS, the position in its PIP vector of each
+ *                       variant of the shared index (-1 if it lacks the variant);
+ *                       an empty vector when the GWAS is the index itself.
+ * @param profile Where to record the time and counts of the run (see
+ *                `qtl_enrichment_profile()`), or null.
+ */
+std::vector<std::map<std::string, double> > qtl_enrichment_multi_workhorse(
+	const std::vector<SuSiEFit> &          qtl_susie_fits,
+	const std::vector<gwas_bayes_factors> &gwas,
+	const std::vector<std::vector<int> > & gwas_positions,
+	double                                 pi_qtl,
+	int                                    ImpN,
+	double                                 shrinkage_lambda,
+	int                                    num_threads = 4,
+	unsigned int                           seed = 0,
+	engine_profile *                       profile = nullptr)
+{
+	int n_gwas = gwas.size();
+	profile_scope impute_timer(profile, QTL_ENRICHMENT_PHASE_IMPUTE);
+	qtn_annotations qtn = impute_qtn_annotations(qtl_susie_fits, ImpN, num_threads, seed);
+	impute_timer.stop();
+	if (profile != nullptr) {
+		profile->add_count(QTL_ENRICHMENT_COUNT_ROUNDS, ImpN);
+		profile->add_count(QTL_ENRICHMENT_COUNT_EM_RUNS, n_gwas * ImpN);
+	}
+
+	Rcpp::Rcout << "Fine-mapped GWAS and QTL data loaded successfully for enrichment analysis!" << std::endl;
+
+	std::vector<std::vector<double> > a0_vec(n_gwas, std::vector<double>(ImpN, 0.0));
+	std::vector<std::vector<double> > v0_vec(a0_vec), a1_vec(a0_vec), v1_vec(a0_vec);
+	// Messages of each EM, written to the console in order once all of them are done
+	std::vector<std::string> em_log(n_gwas * ImpN);
+
+	#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+	for (int tk = 0; tk < n_gwas * ImpN; tk++) {
+		int t = tk / ImpN, k = tk % ImpN;
+		profile_scope timer(profile, QTL_ENRICHMENT_PHASE_EM);
+		std::ostringstream messages;
+
+		// Annotation of GWAS t: the distinct QTNs of round k it has
+		const std::vector<int> &drawn = qtn.rounds[k];
+		int missing_qtl_count = qtn.missing[k];
+		std::vector<int> annotated;
+		annotated.reserve(drawn.size());
+		if (gwas_positions[t].empty()) {
+			annotated = drawn;
+		}
+		else {
+			for (size_t i = 0; i < drawn.size(); i++) {
+				int g = gwas_positions[t][drawn[i]];
+				if (g >= 0) {
+					annotated.push_back(g);
+				}
+				else {
+					++missing_qtl_count;
+				}
+			}
+			std::sort(annotated.begin(), annotated.end());
+		}
+		annotated.erase(std::unique(annotated.begin(), annotated.end()), annotated.end());
+
+		// Calculate the proportion of missing variants
+		double missing_variant_proportion = static_cast<double>(missing_qtl_count) / qtn.n_draws;
+		std::vector<double> rst = run_EM(gwas[t], annotated, pi_qtl, messages, 1000, 0.01, profile);
+
+		a0_vec[t][k] = rst[0];
+		a1_vec[t][k] = rst[1];
+		v0_vec[t][k] = rst[2];
+		v1_vec[t][k] = rst[3];
+		messages << "Proportion of xQTL missing from GWAS variants: " << missing_variant_proportion << " in MI round " << k;
+		if (n_gwas > 1) {
+			messages << " of GWAS " << t + 1;
+		}
+		messages << std::endl;
+		em_log[tk] = messages.str();
+	}
+
+	for (int tk = 0; tk < n_gwas * ImpN; tk++) {
+		Rcpp::Rcout << em_log[tk];
+	}
+
+	Rcpp::Rcout << "EM updates completed!" << std::endl;
+
+	profile_scope summary_timer(profile, QTL_ENRICHMENT_PHASE_SUMMARY);
+	std::vector<std::map<std::string, double> > output(n_gwas);
+	for (int t = 0; t < n_gwas; t++) {
+		output[t] = enrichment_summary(a0_vec[t], a1_vec[t], v0_vec[t], v1_vec[t], gwas[t].pi_gwas, pi_qtl, shrinkage_lambda);
+	}
+	return output;
+}
+
+/// Enrichment of QTL fits resolved against the variants of a single GWAS
+std::map<std::string, double> qtl_enrichment_workhorse(
+	const std::vector<SuSiEFit> &   qtl_susie_fits,
+	const std::vector<double> &     gwas_pip,
+	double                          pi_gwas,
+	double                          pi_qtl,
+	int                             ImpN,
+	double                          shrinkage_lambda,
+	int                             num_threads = 4,
+	unsigned int                    seed = 0,
+	engine_profile *                profile = nullptr)
+{
+	std::vector<gwas_bayes_factors> gwas(1, gwas_bayes_factors(gwas_pip, pi_gwas));
+	std::vector<std::vector<int> > gwas_positions(1);
+	return qtl_enrichment_multi_workhorse(qtl_susie_fits, gwas, gwas_positions, pi_qtl, ImpN, shrinkage_lambda, num_threads, seed,
+	                                      profile)[0];
+}
+
+/// Colocalization probabilities of the signals of the QTL fits with one GWAS (see `qtl_coloc_workhorse()`)
+struct qtl_coloc_result {
+	/// Fit (0-based) and row of the single effect in the fit (0-based) of each signal
+	std::vector<int> signal_fit, signal_effect;
+	/// Sum of the QTL PIPs and of the GWAS PIPs of the variants of each signal, and its RCP
+	std::vector<double> signal_qtl_cpip, signal_gwas_cpip, signal_rcp;
+	/// Variants with SCP >= scp_threshold: signal (index in the signal vectors), GWAS position,
+	/// QTL PIP, GWAS PIP (renormalized within the signal) and SCP
+	std::vector<int> variant_signal, variant_position;
+	std::vector<double> variant_qtl_pip, variant_gwas_pip, variant_scp;
+	/// 1 - prod(1 - RCP) over the signals of each fit
+	std::vector<double> fit_rcp;
+};
+
+/**
+ * @brief fastenloc colocalization probabilities of the single effects of the QTL fits with one GWAS.
+ *
+ * Every single effect is a signal, as a signal cluster of fastenloc
+ * (inst/code/fastenloc_archive, `controller::compute_coloc_prob`): its variants
+ * are the outcomes of the effect, with QTL PIP alpha. From the GWAS PIPs of these
+ * variants, the GWAS prior pi_gwas and the enrichment estimates (intercept a0
+ * and enrichment a1 with shrinkage), the SCP of a variant is the probability
+ * that it is both the QTN of the signal and a GWAS causal variant, and the RCP
+ * of the signal is the sum of its SCPs. The per-fit probability of at least one
+ * colocalized signal is 1 - prod(1 - RCP), the GRCP of fastenloc.
+ *
+ * The signals of all fits are computed in parallel, each from the fits and
+ * GWAS Bayes factors loaded for the enrichment.
+ *
+ * @param qtl_susie_fits Fits loaded with `keep_alpha`.
+ * @param gwas_positions Position in the GWAS of each variant of the index the fits were
+ *                       resolved against (-1 if it lacks the variant), or empty when the
+ *                       GWAS is the index.
+ * @param enrichment The estimates of `enrichment_summary()` for this GWAS.
+ * @param scp_threshold Smallest SCP of the variants reported.
+ */
+inline qtl_coloc_result qtl_coloc_workhorse(
+	const std::vector<SuSiEFit> &          qtl_susie_fits,
+	const gwas_bayes_factors &             gwas,
+	const std::vector<int> &               gwas_positions,
+	const std::map<std::string, double> &  enrichment,
+	double                                 scp_threshold,
+	int                                    num_threads = 4,
+	engine_profile *                       profile = nullptr)
+{
+	profile_scope timer(profile, QTL_ENRICHMENT_PHASE_COLOC);
+	double pi1 = gwas.pi_gwas;
+	double a0 = enrichment.at("Intercept");
+	double a1 = enrichment.at("Enrichment (w/ shrinkage)");
+	double pi1_ne = exp(a0) / (1 + exp(a0));
+	double pi1_e = exp(a0 + a1) / (1 + exp(a0 + a1));
+	double odds_e = (1 - pi1_e) / pi1_e;
+	double r0 = pi1_ne / (1 - pi1_ne);
+	double r_null = pi1 / (1 - pi1);
+
+	qtl_coloc_result result;
+	for (size_t f = 0; f < qtl_susie_fits.size(); f++) {
+		for (size_t i = 0; i < qtl_susie_fits[f].n_effects(); i++) {
+			result.signal_fit.push_back(f);
+			result.signal_effect.push_back(qtl_susie_fits[f].effect_row[i]);
+		}
+	}
+	size_t n_signals = result.signal_fit.size();
+	std::vector<size_t> fit_signal(qtl_susie_fits.size() + 1, 0);
+	for (size_t f = 0; f < qtl_susie_fits.size(); f++) {
+		fit_signal[f + 1] = fit_signal[f] + qtl_susie_fits[f].n_effects();
+	}
+	result.signal_qtl_cpip.assign(n_signals, 0);
+	result.signal_gwas_cpip.assign(n_signals, 0);
+	result.signal_rcp.assign(n_signals, 0);
+	// Variants of each signal above the threshold, gathered in order afterwards
+	struct reported_variant {
+		size_t outcome;
+		double gwas_pip, scp;
+	};
+	std::vector<std::vector<reported_variant> > reported(n_signals);
+
+	#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+	for (long s = 0; s < static_cast<long>(n_signals); s++) {
+		const SuSiEFit &fit = qtl_susie_fits[result.signal_fit[s]];
+		size_t i = s - fit_signal[result.signal_fit[s]];
+		size_t m = fit.effects[i].size();
+		const double *pip = fit.alpha_values.data() + fit.alpha_start[i];
+		const int *position = fit.positions.data() + fit.effect_start[i];
+
+		// GWAS PIP of each variant, renormalized as in fastenloc when they sum to about 1
+		std::vector<double> gwas_pip(m, 0.0);
+		double qtl_cpip = 0, gwas_cpip = 0;
+		for (size_t k = 0; k < m; k++) {
+			qtl_cpip += pip[k];
+			int g = position[k];
+			if (g >= 0 && !gwas_positions.empty()) {
+				g = gwas_positions[g];
+			}
+			if (g >= 0) {
+				double v = r_null * gwas.bf[g];
+				gwas_pip[k] = v / (1 + v);
+				gwas_cpip += gwas_pip[k];
+			}
+		}
+		if (gwas_cpip > 1 - 1e-5) {
+			for (size_t k = 0; k < m; k++) {
+				gwas_pip[k] *= (1 - 1e-5) / gwas_cpip;
+			}
+			gwas_cpip = 1 - 1e-5;
+		}
+
+		// Bayes factor of each variant being the GWAS causal one, then its SCP
+		double nc = ((1 - pi1) / pi1) / (1 - gwas_cpip);
+		double sum_bf = nc - (1 - pi1) / pi1;
+		double rcp = 0;
+		for (size_t k = 0; k < m; k++) {
+			double bf = gwas_pip[k] * nc;
+			double scp = pip[k] * bf / (odds_e + odds_e * r0 * (sum_bf - bf) + bf);
+			rcp += scp;
+			if (scp >= scp_threshold && scp > 0) {
+				reported[s].push_back({k, gwas_pip[k], scp});
+			}
+		}
+		result.signal_qtl_cpip[s] = qtl_cpip;
+		result.signal_gwas_cpip[s] = gwas_cpip;
+		result.signal_rcp[s] = rcp;
+	}
+
+	for (size_t s = 0; s < n_signals; s++) {
+		const SuSiEFit &fit = qtl_susie_fits[result.signal_fit[s]];
+		size_t i = s - fit_signal[result.signal_fit[s]];
+		for (const reported_variant &variant : reported[s]) {
+			int g = fit.positions[fit.effect_start[i] + variant.outcome];
+			result.variant_signal.push_back(s);
+			result.variant_position.push_back(gwas_positions.empty() ? g : gwas_positions[g]);
+			result.variant_qtl_pip.push_back(fit.alpha_values[fit.alpha_start[i] + variant.outcome]);
+			result.variant_gwas_pip.push_back(variant.gwas_pip);
+			result.variant_scp.push_back(variant.scp);
+		}
+	}
+	result.fit_rcp.assign(qtl_susie_fits.size(), 0);
+	for (size_t f = 0; f < qtl_susie_fits.size(); f++) {
+		double none = 1;
+		for (size_t s = fit_signal[f]; s < fit_signal[f + 1]; s++) {
+			none *= 1 - result.signal_rcp[s];
+		}
+		result.fit_rcp[f] = 1 - none;
+	}
+	return result;
+}
+
+#endif // QTL_ENRICHMENT_HPP
@@ -0,0 +1,113 @@
+/**
+ * @file rng_stream.h
+ * @brief Counter-based random number streams for reproducible parallel sampling.
+ *
+ * `rng_stream` implements the Philox4x32-10 generator of Salmon et al. (2011),
+ * "Parallel random numbers: as easy as 1, 2, 3". The output is a pure function
+ * of (seed, stream, substream, position), so each LD block, imputation round or
+ * chain can own an independent stream that yields the same numbers regardless of
+ * which thread consumes it or in what order. It satisfies the C++11
+ * UniformRandomBitGenerator requirements and can be used with the <random>
+ * distributions.
+ */
+
+#ifndef RNG_STREAM_H
+#define RNG_STREAM_H
+
+#include <cstdint>
+#include <limits>
+
+class rng_stream {
+public:
+typedef uint32_t result_type;
+
+/**
+ * @param seed User seed (the Philox key).
+ * @param stream Stream identifier, e.g. the index of an LD block.
+ * @param substream Secondary identifier, e.g. the MCMC iteration.
+ */
+rng_stream(uint64_t seed = 0, uint64_t stream = 0, uint32_t substream = 0) {
+	key[0] = static_cast<uint32_t>(seed);
+	key[1] = static_cast<uint32_t>(seed >> 32);
+	ctr[0] = 0;
+	ctr[1] = substream;
+	ctr[2] = static_cast<uint32_t>(stream);
+	ctr[3] = static_cast<uint32_t>(stream >> 32);
+	pos = 4;
+}
+
+static constexpr result_type min() {
+	return 0;
+}
+static constexpr result_type max() {
+	return std::numeric_limits<uint32_t>::max();
+}
+
+result_type operator()() {
+	if (pos == 4) {
+		refill();
+	}
+	return out[pos++];
+}
+
+/// Uniform double on [0, 1) using 53 random bits.
+double uniform() {
+	uint64_t hi = (*this)() >> 5;
+	uint64_t lo = (*this)() >> 6;
+	return (hi * 67108864.0 + lo) * (1.0 / 9007199254740992.0);
+}
+
+/// Number of 32-bit values drawn so far; together with the constructor
+/// arguments this fully describes the stream state (see seek()).
+uint64_t position() const {
+	return (pos == 4 ? 4 * static_cast<uint64_t>(ctr[0]) : 4 * (static_cast<uint64_t>(ctr[0]) - 1) + pos);
+}
+
+/// Jump to an absolute position in the stream.
+void seek(uint64_t position) {
+	ctr[0] = static_cast<uint32_t>(position / 4);
+	pos = 4;
+	unsigned skip = static_cast<unsigned>(position % 4);
+	if (skip > 0) {
+		refill();
+		pos = skip;
+	}
+}
+
+void discard(unsigned long long n) {
+	seek(position() + n);
+}
+
+/// Philox4x32-10 bijection of a 128-bit counter under a 64-bit key.
+static void philox(const uint32_t in[4], const uint32_t k[2], uint32_t res[4]) {
+	const uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+	const uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+	uint32_t c0 = in[0], c1 = in[1], c2 = in[2], c3 = in[3];
+	uint32_t k0 = k[0], k1 = k[1];
+	for (int round = 0; round < 10; round++) {
+		uint64_t p0 = static_cast<uint64_t>(M0) * c0;
+		uint64_t p1 = static_cast<uint64_t>(M1) * c2;
+		uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+		uint32_t n1 = static_cast<uint32_t>(p1);
+		uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+		uint32_t n3 = static_cast<uint32_t>(p0);
+		c0 = n0; c1 = n1; c2 = n2; c3 = n3;
+		k0 += W0; k1 += W1;
+	}
+	res[0] = c0; res[1] = c1; res[2] = c2; res[3] = c3;
+}
+
+private:
+void refill() {
+	philox(ctr, key, out);
+	ctr[0]++;
+	pos = 0;
+}
+
+uint32_t key[2];
+uint32_t ctr[4];
+uint32_t out[4];
+unsigned pos;
+};
+
+#endif // RNG_STREAM_H
@@ -1,12 +1,98 @@
 #include <RcppArmadillo.h>
 #include <unordered_map>
+#include "engine_profile_rcpp.h"
+#include "ld_blocks.h"
+#include "ld_handle.h"
 #include "sdpr_mcmc.h"
+#include "thread_budget_rcpp.h"
+
+// Shared by sdpr_rcpp and sdpr_multi_rcpp: build the mcmc_data and run the sampler.
+// `bhat` has one row per SNP and one column per trait.
+static std::unordered_map<std::string, arma::mat> run_sdpr(
+	const arma::mat&                    bhat,
+	SEXP                                LD,
+	int                                 n,
+	Rcpp::Nullable<Rcpp::NumericVector> per_variant_sample_size,
+	Rcpp::Nullable<Rcpp::IntegerVector> array,
+	double                              a,
+	double                              c,
+	size_t                              M,
+	double                              a0k,
+	double                              b0k,
+	int                                 iter,
+	int                                 burn,
+	int                                 thin,
+	unsigned                            n_threads,
+	int                                 opt_llk,
+	bool                                verbose,
+	Rcpp::Nullable<unsigned int>        seed,
+	const std::string&                  ld_cache_dir,
+	unsigned                            n_chains,
+	bool                                compact_ld,
+	const mcmc_checkpoint_options&      ckpt,
+	engine_profile*                     profile,
+	size_t                              active_buffer
+	) {
+	// Views of R's matrices, of mapped LD block files or of an LD handle; outlives `data` below
+	ld_blocks ref_ld(LD);
+	// an LD handle keeps the LD preprocessing for later runs
+	ldmat_memo* ld_memo = is_ld_handle(LD) ? &as_ld_handle(LD).sdpr_cache() : nullptr;
+
+	// Initialize per_variant_sample_size and array if NULL
+	std::vector<double> sz;
+	std::vector<int> arr;
+	if (per_variant_sample_size.isNotNull()) {
+		sz = Rcpp::as<std::vector<double> >(per_variant_sample_size);
+	} else {
+		sz = std::vector<double>(bhat.n_rows, n);
+	}
+	if (array.isNotNull()) {
+		arr = Rcpp::as<std::vector<int> >(array);
+	} else {
+		arr = std::vector<int>(bhat.n_rows, 1);
+	}
+
+	unsigned int seed_val = 0;
+	if (seed.isNotNull()) {
+		seed_val = Rcpp::as<unsigned int>(seed);
+	} else {
+		seed_val = std::random_device{}();
+	}
+
+	// Create mcmc_data object
+	mcmc_data data(bhat, std::move(ref_ld.blocks()), sz, arr);
+
+	// Call the mcmc function
+	thread_budget budget(n_threads, thread_limit());
+	return mcmc(
+		data, n, a, c, M, active_buffer, a0k, b0k, iter, burn, thin, budget.engine_threads(), opt_llk, verbose, seed_val, ld_cache_dir,
+		n_chains, compact_ld, ckpt, ld_memo, profile
+		);
+}
+
+// Diagnostics of h2 and of the monitored SNPs (1-based indices) of trait t
+static Rcpp::DataFrame sdpr_diagnostics(std::unordered_map<std::string, arma::mat>& results, size_t t) {
+	arma::vec top = results["top_index"].col(t) + 1;
+	Rcpp::CharacterVector parameter(top.n_elem + 1);
+	parameter[0] = "h2";
+	for (size_t k=0; k<top.n_elem; k++) {
+		parameter[k+1] = "beta[" + std::to_string(static_cast<long long>(top(k))) + "]";
+	}
+	const arma::vec rhat = results["rhat"].col(t);
+	const arma::vec ess = results["ess"].col(t);
+	return Rcpp::DataFrame::create(
+		Rcpp::Named("parameter") = parameter,
+		Rcpp::Named("rhat") = Rcpp::NumericVector(rhat.begin(), rhat.end()),
+		Rcpp::Named("ess") = Rcpp::NumericVector(ess.begin(), ess.end()),
+		Rcpp::Named("stringsAsFactors") = false
+		);
+}
 
 // Rcpp interface function
 // [[Rcpp::export]]
 Rcpp::List sdpr_rcpp(
 	const std::vector<double>&          bhat,
-	const Rcpp::List&                   LD,
+	SEXP                                LD,
 	int                                 n,
 	Rcpp::Nullable<Rcpp::NumericVector> per_variant_sample_size = R_NilValue,
 	Rcpp::Nullable<Rcpp::IntegerVector> array = R_NilValue,
@@ -20,41 +106,106 @@ Rcpp::List sdpr_rcpp(
 	int                                 thin = 5,
 	unsigned                            n_threads = 1,
 	int                                 opt_llk = 1,
-	bool                                verbose = true
+	bool                                verbose = true,
+	Rcpp::Nullable<unsigned int>        seed = R_NilValue,
+	const std::string&                  ld_cache_dir = "",
+	unsigned                            n_chains = 1,
+	bool                                compact_ld = false,
+	const std::string&                  checkpoint_file = "",
+	int                                 checkpoint_every = 100,
+	double                              min_ess = 0,
+	bool                                profile = false,
+	size_t                              active_buffer = 0
 	) {
-	// Convert Rcpp::List to std::vector<arma::mat>
-	std::vector<arma::mat> ref_ld_mat;
-	for (int i = 0; i < LD.size(); i++) {
-		ref_ld_mat.push_back(Rcpp::as<arma::mat>(LD[i]));
-	}
+	mcmc_checkpoint_options ckpt(checkpoint_file, checkpoint_every, min_ess);
+	engine_profile prof = sdpr_profile();
+	std::unordered_map<std::string, arma::mat> results = run_sdpr(
+		arma::conv_to<arma::vec>::from(bhat), LD, n, per_variant_sample_size, array, a, c, M, a0k, b0k,
+		iter, burn, thin, n_threads, opt_llk, verbose, seed, ld_cache_dir, n_chains, compact_ld, ckpt,
+		profile ? &prof : nullptr, active_buffer
+		);
 
-	// Initialize per_variant_sample_size and array if NULL
-	std::vector<double> sz;
-	std::vector<int> arr;
-	if (per_variant_sample_size.isNotNull()) {
-		sz = Rcpp::as<std::vector<double> >(per_variant_sample_size);
-	} else {
-		sz = std::vector<double>(bhat.size(), n);
+	// Convert results to Rcpp::List
+	Rcpp::List output = Rcpp::List::create(
+		Rcpp::Named("beta_est") = results["beta"],
+		Rcpp::Named("h2") = results["h2"]
+		);
+
+	if (n_chains > 1) {
+		output["beta_chains"] = results["beta_chains"];
+		output["h2_chains"] = Rcpp::NumericVector(results["h2_chains"].begin(), results["h2_chains"].end());
+		output["diagnostics"] = sdpr_diagnostics(results, 0);
 	}
-	if (array.isNotNull()) {
-		arr = Rcpp::as<std::vector<int> >(array);
-	} else {
-		arr = std::vector<int>(bhat.size(), 1);
+	if (min_ess > 0) {
+		output["n_iter"] = results["n_iter"](0);
+	}
+	if (profile) {
+		output["profile"] = profile_list(prof);
 	}
 
-	// Create mcmc_data object
-	mcmc_data data(bhat, ref_ld_mat, sz, arr);
+	return output;
+}
 
-	// Call the mcmc function
-	std::unordered_map<std::string, arma::vec> results = mcmc(
-		data, n, a, c, M, a0k, b0k, iter, burn, thin, n_threads, opt_llk, verbose
+// Several traits against one LD panel; bhat has one column per trait
+// [[Rcpp::export]]
+Rcpp::List sdpr_multi_rcpp(
+	const arma::mat&                    bhat,
+	SEXP                                LD,
+	int                                 n,
+	Rcpp::Nullable<Rcpp::NumericVector> per_variant_sample_size = R_NilValue,
+	Rcpp::Nullable<Rcpp::IntegerVector> array = R_NilValue,
+	double                              a = 0.1,
+	double                              c = 1.0,
+	size_t                              M = 1000,
+	double                              a0k = 0.5,
+	double                              b0k = 0.5,
+	int                                 iter = 1000,
+	int                                 burn = 200,
+	int                                 thin = 5,
+	unsigned                            n_threads = 1,
+	int                                 opt_llk = 1,
+	bool                                verbose = true,
+	Rcpp::Nullable<unsigned int>        seed = R_NilValue,
+	const std::string&                  ld_cache_dir = "",
+	unsigned                            n_chains = 1,
+	bool                                compact_ld = false,
+	const std::string&                  checkpoint_file = "",
+	int                                 checkpoint_every = 100,
+	double                              min_ess = 0,
+	bool                                profile = false,
+	size_t                              active_buffer = 0
+	) {
+	mcmc_checkpoint_options ckpt(checkpoint_file, checkpoint_every, min_ess);
+	engine_profile prof = sdpr_profile();
+	std::unordered_map<std::string, arma::mat> results = run_sdpr(
+		bhat, LD, n, per_variant_sample_size, array, a, c, M, a0k, b0k,
+		iter, burn, thin, n_threads, opt_llk, verbose, seed, ld_cache_dir, n_chains, compact_ld, ckpt,
+		profile ? &prof : nullptr, active_buffer
 		);
 
-	// Convert results to Rcpp::List
 	Rcpp::List output = Rcpp::List::create(
 		Rcpp::Named("beta_est") = results["beta"],
-		Rcpp::Named("h2") = results["h2"]
+		Rcpp::Named("h2") = Rcpp::NumericVector(results["h2"].begin(), results["h2"].end())
 		);
 
+	if (n_chains > 1) {
+		// Chains of trait t are columns t * n_chains, ..., (t + 1) * n_chains - 1
+		size_t n_trait = bhat.n_cols;
+		Rcpp::List diagnostics(n_trait);
+		for (size_t t=0; t<n_trait; t++) {
+			diagnostics[t] = sdpr_diagnostics(results, t);
+		}
+		arma::mat h2_chains = arma::reshape(results["h2_chains"], n_chains, n_trait).t();
+		output["beta_chains"] = results["beta_chains"];
+		output["h2_chains"] = h2_chains;
+		output["diagnostics"] = diagnostics;
+	}
+	if (min_ess > 0) {
+		output["n_iter"] = results["n_iter"](0);
+	}
+	if (profile) {
+		output["profile"] = profile_list(prof);
+	}
+
 	return output;
-}
\ No newline at end of file
+}
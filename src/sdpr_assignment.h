@@ -0,0 +1,367 @@
+/**
+ * @file sdpr_assignment.h
+ * @brief SIMD kernels for the SDPR cluster assignment step.
+ *
+ * For one SNP with C1 = eta^2 * N * B_jj and q = (N * b_j)^2 / 2, the log
+ * posterior weight of mixture component k is
+ *
+ *     log_p[k] - 0.5 * log(C1 * var[k] + 1) + q * var[k] / (C1 * var[k] + 1),
+ *
+ * which reduces to log_p[0] for the null component (var[0] = 0). A kernel
+ * evaluates these M weights into a scratch row, computes their log-sum-exp and
+ * returns the component selected by the uniform draw `u`.
+ *
+ * Three implementations are provided: a 4-wide SSE kernel built on
+ * sse_mathfun.h (mapped to NEON through simde on ARM), and 8-wide AVX2 and
+ * 16-wide AVX-512 kernels compiled with function-level target attributes. The
+ * widest kernel supported by the running CPU is selected once at run time.
+ *
+ * All arrays must be 64-byte aligned and padded to a multiple of
+ * `assignment_padding` floats; padded lanes must hold log_p = -inf and var = 0.
+ *
+ * This header defines non-inline functions from sse_mathfun.h and must only be
+ * included in one translation unit.
+ */
+
+#ifndef SDPR_ASSIGNMENT_H
+#define SDPR_ASSIGNMENT_H
+
+#include <cmath>
+#include <cstdlib>
+#include <cstddef>
+#include <limits>
+#include <new>
+#ifdef __arm64__
+#include "simde/x86/avx512.h"
+#else
+#include <x86intrin.h>
+#endif
+#include "sse_mathfun.h"
+
+#if !defined(__arm64__) && (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SDPR_RUNTIME_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+static const size_t assignment_padding = 16;
+
+/// Round up to the padded row length used by the kernels
+inline size_t assignment_padded_size(size_t M) {
+	return (M + assignment_padding - 1) / assignment_padding * assignment_padding;
+}
+
+/**
+ * @brief 64-byte aligned scratch buffer that only grows.
+ *
+ * Used as a per-thread arena (`thread_local`) so that the assignment step does
+ * not allocate once the buffer has reached its working size.
+ */
+class aligned_arena {
+public:
+aligned_arena() : ptr(nullptr), cap(0) {
+}
+~aligned_arena() {
+	release();
+}
+aligned_arena(const aligned_arena&) = delete;
+aligned_arena& operator=(const aligned_arena&) = delete;
+
+float* get(size_t n) {
+	if (n > cap) {
+		release();
+		void* p = nullptr;
+#ifdef _WIN32
+		p = _aligned_malloc(n * sizeof(float), 64);
+#else
+		if (posix_memalign(&p, 64, n * sizeof(float)) != 0) {
+			p = nullptr;
+		}
+#endif
+		if (p == nullptr) {
+			throw std::bad_alloc();
+		}
+		ptr = static_cast<float*>(p);
+		cap = n;
+	}
+	return ptr;
+}
+
+private:
+void release() {
+	if (ptr != nullptr) {
+#ifdef _WIN32
+		_aligned_free(ptr);
+#else
+		free(ptr);
+#endif
+	}
+	ptr = nullptr;
+	cap = 0;
+}
+
+float* ptr;
+size_t cap;
+};
+
+typedef size_t (*assignment_kernel_fn)(const float* log_p, const float* var, size_t M_pad, size_t M,
+                                       float C1, float q, float u, float* scratch);
+
+/// Draw the component once the exponentiated weights are in scratch[0..M)
+inline size_t assignment_draw(const float* w, size_t M, float total, float u) {
+	float threshold = u * total;
+	float acc = 0;
+	for (size_t k=0; k<M-1; k++) {
+		acc += w[k];
+		if (acc > threshold) {
+			return k;
+		}
+	}
+	return M-1;
+}
+
+// SSE kernel, the portable fallback
+inline size_t assignment_kernel_sse(const float* log_p, const float* var, size_t M_pad, size_t M,
+                                    float C1, float q, float u, float* scratch) {
+	const __m128 _c1 = _mm_set1_ps(C1);
+	const __m128 _q = _mm_set1_ps(q);
+	const __m128 _one = _mm_set1_ps(1.0f);
+	const __m128 _half = _mm_set1_ps(-0.5f);
+	__m128 _max = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+	for (size_t k=0; k<M_pad; k+=4) {
+		__m128 _v = _mm_load_ps(var + k);
+		__m128 _d = _mm_add_ps(_mm_mul_ps(_c1, _v), _one);
+		__m128 _w = _mm_add_ps(_mm_mul_ps(_half, log_ps(_d)), _mm_load_ps(log_p + k));
+		_w = _mm_add_ps(_w, _mm_div_ps(_mm_mul_ps(_q, _v), _d));
+		_mm_store_ps(scratch + k, _w);
+		_max = _mm_max_ps(_max, _w);
+	}
+	for (size_t m=0; m<3; m++) {
+		_max = _mm_max_ps(_max, _mm_shuffle_ps(_max, _max, 0x93));
+	}
+	__m128 _sum = _mm_setzero_ps();
+	for (size_t k=0; k<M_pad; k+=4) {
+		__m128 _e = exp_ps(_mm_sub_ps(_mm_load_ps(scratch + k), _max));
+		_mm_store_ps(scratch + k, _e);
+		_sum = _mm_add_ps(_sum, _e);
+	}
+	// Horizontal sum with SSE2 only
+	_sum = _mm_add_ps(_sum, _mm_movehl_ps(_sum, _sum));
+	_sum = _mm_add_ss(_sum, _mm_shuffle_ps(_sum, _sum, 0x55));
+	float total;
+	_mm_store_ss(&total, _sum);
+	return assignment_draw(scratch, M, total, u);
+}
+
+#ifdef SDPR_RUNTIME_DISPATCH
+
+// Cephes log/exp, as in sse_mathfun.h, widened to 8 lanes
+__attribute__((target("avx2,fma"))) static inline __m256 log256_ps(__m256 x) {
+	const __m256 one = _mm256_set1_ps(1.0f);
+	__m256 invalid = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LE_OS);
+	x = _mm256_max_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x00800000)));
+	__m256i imm0 = _mm256_srli_epi32(_mm256_castps_si256(x), 23);
+	x = _mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(~0x7f800000)));
+	x = _mm256_or_ps(x, _mm256_set1_ps(0.5f));
+	imm0 = _mm256_sub_epi32(imm0, _mm256_set1_epi32(0x7f));
+	__m256 e = _mm256_add_ps(_mm256_cvtepi32_ps(imm0), one);
+	__m256 mask = _mm256_cmp_ps(x, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OS);
+	__m256 tmp = _mm256_and_ps(x, mask);
+	x = _mm256_sub_ps(x, one);
+	e = _mm256_sub_ps(e, _mm256_and_ps(one, mask));
+	x = _mm256_add_ps(x, tmp);
+	__m256 z = _mm256_mul_ps(x, x);
+	__m256 y = _mm256_set1_ps(7.0376836292E-2f);
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.1514610310E-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.1676998740E-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.2420140846E-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.4249322787E-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.6668057665E-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(2.0000714765E-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-2.4999993993E-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(3.3333331174E-1f));
+	y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+	y = _mm256_fmadd_ps(e, _mm256_set1_ps(-2.12194440e-4f), y);
+	y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+	x = _mm256_add_ps(x, y);
+	x = _mm256_fmadd_ps(e, _mm256_set1_ps(0.693359375f), x);
+	return _mm256_or_ps(x, invalid);
+}
+
+__attribute__((target("avx2,fma"))) static inline __m256 exp256_ps(__m256 x) {
+	x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+	x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+	__m256 fx = _mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f), _mm256_set1_ps(0.5f));
+	fx = _mm256_floor_ps(fx);
+	x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+	x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+	__m256 z = _mm256_mul_ps(x, x);
+	__m256 y = _mm256_set1_ps(1.9875691500E-4f);
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507E-3f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073E-3f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894E-2f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459E-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201E-1f));
+	y = _mm256_fmadd_ps(y, z, x);
+	y = _mm256_add_ps(y, _mm256_set1_ps(1.0f));
+	__m256i imm0 = _mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(0x7f));
+	imm0 = _mm256_slli_epi32(imm0, 23);
+	return _mm256_mul_ps(y, _mm256_castsi256_ps(imm0));
+}
+
+__attribute__((target("avx2,fma"))) static inline size_t assignment_kernel_avx2(
+	const float* log_p, const float* var, size_t M_pad, size_t M,
+	float C1, float q, float u, float* scratch) {
+	const __m256 _c1 = _mm256_set1_ps(C1);
+	const __m256 _q = _mm256_set1_ps(q);
+	const __m256 _one = _mm256_set1_ps(1.0f);
+	const __m256 _half = _mm256_set1_ps(-0.5f);
+	__m256 _max = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+	for (size_t k=0; k<M_pad; k+=8) {
+		__m256 _v = _mm256_load_ps(var + k);
+		__m256 _d = _mm256_fmadd_ps(_c1, _v, _one);
+		__m256 _w = _mm256_fmadd_ps(_half, log256_ps(_d), _mm256_load_ps(log_p + k));
+		_w = _mm256_add_ps(_w, _mm256_div_ps(_mm256_mul_ps(_q, _v), _d));
+		_mm256_store_ps(scratch + k, _w);
+		_max = _mm256_max_ps(_max, _w);
+	}
+	__m128 _m4 = _mm_max_ps(_mm256_castps256_ps128(_max), _mm256_extractf128_ps(_max, 1));
+	_m4 = _mm_max_ps(_m4, _mm_movehl_ps(_m4, _m4));
+	_m4 = _mm_max_ss(_m4, _mm_shuffle_ps(_m4, _m4, 0x55));
+	const __m256 _mx = _mm256_set1_ps(_mm_cvtss_f32(_m4));
+	__m256 _sum = _mm256_setzero_ps();
+	for (size_t k=0; k<M_pad; k+=8) {
+		__m256 _e = exp256_ps(_mm256_sub_ps(_mm256_load_ps(scratch + k), _mx));
+		_mm256_store_ps(scratch + k, _e);
+		_sum = _mm256_add_ps(_sum, _e);
+	}
+	__m128 _s4 = _mm_add_ps(_mm256_castps256_ps128(_sum), _mm256_extractf128_ps(_sum, 1));
+	_s4 = _mm_add_ps(_s4, _mm_movehl_ps(_s4, _s4));
+	_s4 = _mm_add_ss(_s4, _mm_shuffle_ps(_s4, _s4, 0x55));
+	return assignment_draw(scratch, M, _mm_cvtss_f32(_s4), u);
+}
+
+// Cephes log/exp widened to 16 lanes
+__attribute__((target("avx512f"))) static inline __m512 log512_ps(__m512 x) {
+	const __m512 one = _mm512_set1_ps(1.0f);
+	__mmask16 invalid = _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_LE_OS);
+	x = _mm512_max_ps(x, _mm512_castsi512_ps(_mm512_set1_epi32(0x00800000)));
+	__m512i imm0 = _mm512_srli_epi32(_mm512_castps_si512(x), 23);
+	__m512i bits = _mm512_and_si512(_mm512_castps_si512(x), _mm512_set1_epi32(~0x7f800000));
+	x = _mm512_castsi512_ps(_mm512_or_si512(bits, _mm512_castps_si512(_mm512_set1_ps(0.5f))));
+	imm0 = _mm512_sub_epi32(imm0, _mm512_set1_epi32(0x7f));
+	__m512 e = _mm512_add_ps(_mm512_cvtepi32_ps(imm0), one);
+	__mmask16 mask = _mm512_cmp_ps_mask(x, _mm512_set1_ps(0.707106781186547524f), _CMP_LT_OS);
+	// x < SQRTHF: x = 2x - 1 and e -= 1, otherwise x = x - 1
+	x = _mm512_mask_add_ps(_mm512_sub_ps(x, one), mask, _mm512_sub_ps(x, one), x);
+	e = _mm512_mask_sub_ps(e, mask, e, one);
+	__m512 z = _mm512_mul_ps(x, x);
+	__m512 y = _mm512_set1_ps(7.0376836292E-2f);
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(-1.1514610310E-1f));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(1.1676998740E-1f));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(-1.2420140846E-1f));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(1.4249322787E-1f));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(-1.6668057665E-1f));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(2.0000714765E-1f));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(-2.4999993993E-1f));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(3.3333331174E-1f));
+	y = _mm512_mul_ps(_mm512_mul_ps(y, x), z);
+	y = _mm512_fmadd_ps(e, _mm512_set1_ps(-2.12194440e-4f), y);
+	y = _mm512_fnmadd_ps(z, _mm512_set1_ps(0.5f), y);
+	x = _mm512_add_ps(x, y);
+	x = _mm512_fmadd_ps(e, _mm512_set1_ps(0.693359375f), x);
+	return _mm512_mask_blend_ps(invalid, x, _mm512_set1_ps(std::numeric_limits<float>::quiet_NaN()));
+}
+
+__attribute__((target("avx512f"))) static inline __m512 exp512_ps(__m512 x) {
+	x = _mm512_min_ps(x, _mm512_set1_ps(88.3762626647949f));
+	x = _mm512_max_ps(x, _mm512_set1_ps(-88.3762626647949f));
+	__m512 fx = _mm512_fmadd_ps(x, _mm512_set1_ps(1.44269504088896341f), _mm512_set1_ps(0.5f));
+	fx = _mm512_roundscale_ps(fx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+	x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(0.693359375f), x);
+	x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(-2.12194440e-4f), x);
+	__m512 z = _mm512_mul_ps(x, x);
+	__m512 y = _mm512_set1_ps(1.9875691500E-4f);
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(1.3981999507E-3f));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(8.3334519073E-3f));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(4.1665795894E-2f));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(1.6666665459E-1f));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(5.0000001201E-1f));
+	y = _mm512_fmadd_ps(y, z, x);
+	y = _mm512_add_ps(y, _mm512_set1_ps(1.0f));
+	__m512i imm0 = _mm512_add_epi32(_mm512_cvttps_epi32(fx), _mm512_set1_epi32(0x7f));
+	imm0 = _mm512_slli_epi32(imm0, 23);
+	return _mm512_mul_ps(y, _mm512_castsi512_ps(imm0));
+}
+
+__attribute__((target("avx512f"))) static inline size_t assignment_kernel_avx512(
+	const float* log_p, const float* var, size_t M_pad, size_t M,
+	float C1, float q, float u, float* scratch) {
+	const __m512 _c1 = _mm512_set1_ps(C1);
+	const __m512 _q = _mm512_set1_ps(q);
+	const __m512 _one = _mm512_set1_ps(1.0f);
+	const __m512 _half = _mm512_set1_ps(-0.5f);
+	__m512 _max = _mm512_set1_ps(-std::numeric_limits<float>::infinity());
+	for (size_t k=0; k<M_pad; k+=16) {
+		__m512 _v = _mm512_load_ps(var + k);
+		__m512 _d = _mm512_fmadd_ps(_c1, _v, _one);
+		__m512 _w = _mm512_fmadd_ps(_half, log512_ps(_d), _mm512_load_ps(log_p + k));
+		_w = _mm512_add_ps(_w, _mm512_div_ps(_mm512_mul_ps(_q, _v), _d));
+		_mm512_store_ps(scratch + k, _w);
+		_max = _mm512_max_ps(_max, _w);
+	}
+	const __m512 _mx = _mm512_set1_ps(_mm512_reduce_max_ps(_max));
+	__m512 _sum = _mm512_setzero_ps();
+	for (size_t k=0; k<M_pad; k+=16) {
+		__m512 _e = exp512_ps(_mm512_sub_ps(_mm512_load_ps(scratch + k), _mx));
+		_mm512_store_ps(scratch + k, _e);
+		_sum = _mm512_add_ps(_sum, _e);
+	}
+	return assignment_draw(scratch, M, _mm512_reduce_add_ps(_sum), u);
+}
+
+#endif // SDPR_RUNTIME_DISPATCH
+
+enum assignment_isa {
+	ISA_AUTO = 0,
+	ISA_SSE,
+	ISA_AVX2,
+	ISA_AVX512
+};
+
+/// Widest instruction set supported by the running CPU
+inline assignment_isa detect_assignment_isa() {
+#ifdef SDPR_RUNTIME_DISPATCH
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return ISA_AVX512;
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return ISA_AVX2;
+	}
+#endif
+	return ISA_SSE;
+}
+
+/**
+ * @brief Kernel for the requested instruction set.
+ *
+ * ISA_AUTO resolves to the widest supported kernel (detected once per process);
+ * requesting an instruction set the CPU does not support falls back to SSE.
+ */
+inline assignment_kernel_fn select_assignment_kernel(assignment_isa isa = ISA_AUTO) {
+	static const assignment_isa detected = detect_assignment_isa();
+	if (isa == ISA_AUTO || isa > detected) {
+		isa = (isa == ISA_AUTO) ? detected : ISA_SSE;
+	}
+#ifdef SDPR_RUNTIME_DISPATCH
+	if (isa == ISA_AVX512) {
+		return assignment_kernel_avx512;
+	}
+	if (isa == ISA_AVX2) {
+		return assignment_kernel_avx2;
+	}
+#endif
+	return assignment_kernel_sse;
+}
+
+#endif // SDPR_ASSIGNMENT_H
@@ -1,17 +1,19 @@
 #include <algorithm>
 #include <cmath>
+#include <functional>
 #include <thread>
 #include <chrono>
 #include <fstream>
 #include <numeric>
 #include <random>
-#ifdef __arm64__
-#include "simde/x86/avx512.h"
-#else
-#include <x86intrin.h>
-#endif
-#include "sse_mathfun.h"
+#include <limits>
+#include <stdexcept>
+#include "content_hash.h"
 #include "function_pool.h"
+#include "ldmat_cache.h"
+#include "mcmc_checkpoint.h"
+#include "mcmc_diagnostics.h"
+#include "sdpr_assignment.h"
 #include "sdpr_mcmc.h"
 
 using namespace std::chrono;
@@ -24,8 +26,10 @@ using std::string; using std::min;
 #define square(x) ((x)*(x))
 
 void MCMC_state::sample_sigma2() {
+	rng_stream r = stream(STAGE_SIGMA2);
 	std::gamma_distribution<double> dist;
-	for (size_t i=1; i<M; i++) {
+	for (size_t k=1; k<active.size(); k++) {
+		size_t i = active[k];
 		double a = suff_stats[i] / 2.0 + a0k;
 		double b = 1.0 / (sumsq[i] / 2.0 + b0k);
 		dist = std::gamma_distribution<double>(a, 1.0/b);
@@ -41,123 +45,53 @@ void MCMC_state::sample_sigma2() {
 	}
 }
 
-void MCMC_state::calc_b(size_t j, const mcmc_data &dat, const ldmat_data &ldmat_dat) {
+void MCMC_state::calc_b(size_t j, const mcmc_data &dat, const ldmat_data &ldmat_dat, const arma::vec &B_beta) {
 	size_t start_i = dat.boundary[j].first;
 	size_t end_i = dat.boundary[j].second;
-	arma::vec b_j = b.subvec(start_i, end_i-1);
-	arma::vec beta_j = beta.subvec(start_i, end_i-1);
-
-	arma::vec diag = ldmat_dat.B[j].diag();
+	// views into b and beta: updates are written back to the state
+	arma::subview_col<double> b_j = b.subvec(start_i, end_i-1);
+	const arma::subview_col<double> beta_j = beta.subvec(start_i, end_i-1);
 
 	// diag(B) * beta
-	b_j = beta_j % diag;
-
 	// eta^2 * (diag(B) * beta) - eta^2 * B * beta
-	b_j = eta*eta * (b_j - ldmat_dat.B[j] * beta_j);
-
 	// eta^2 * (diag(B) * beta) - eta^2 * B * beta + eta * A^T * beta_mrg
-	b_j += eta * ldmat_dat.calc_b_tmp[j];
+	b_j = eta*eta * (beta_j % ldmat_dat.B_diag[j] - B_beta) + eta * ldmat_dat.calc_b_tmp[j].col(trait_id);
 }
 
 void MCMC_state::sample_assignment(size_t j, const mcmc_data &dat, const ldmat_data &ldmat_dat) {
 	size_t start_i = dat.boundary[j].first;
 	size_t end_i = dat.boundary[j].second;
 
-	vector<vector<float> > prob(end_i-start_i, vector<float>(M));
-	vector<vector<float> > tmp(end_i-start_i, vector<float>(M));
-	vector<float> Bjj(end_i-start_i);
-	vector<float> bj(end_i-start_i);
-	vector<float> rnd(end_i-start_i);
-
-	float max_elem, log_exp_sum = 0;
+	// Per-thread, 64-byte aligned rows: log_p, cluster_var and the weights
+	// being evaluated, padded with empty components (log_p = -inf, var = 0)
+	static const assignment_kernel_fn kernel = select_assignment_kernel();
+	// Only the active components are evaluated; the collapsed tail mass is
+	// carried by the highest empty active component
+	static thread_local aligned_arena arena;
+	size_t K = active.size();
+	size_t K_pad = assignment_padded_size(K);
+	float* log_p_f = arena.get(3*K_pad);
+	float* var_f = log_p_f + K_pad;
+	float* scratch = var_f + K_pad;
+	for (size_t k=0; k<K_pad; k++) {
+		log_p_f[k] = (k < K) ? static_cast<float>(log_p[active[k]]) : -std::numeric_limits<float>::infinity();
+		var_f[k] = (k < K && k > 0) ? static_cast<float>(cluster_var[active[k]]) : 0.0f;
+	}
+	if (tail_mass > 0) {
+		log_p_f[tail_slot] = logf(p[active[tail_slot]] + tail_mass + 1e-40);
+	}
 
+	rng_stream r = stream(STAGE_ASSIGNMENT, j);
 	std::uniform_real_distribution<float> unif(0.0, 1.0);
 
-	for (size_t i=0; i<end_i-start_i; i++) {
-		Bjj[i] = ldmat_dat.B[j](i, i);
-		bj[i] = b(start_i+i);
-
-		prob[i][0] = log_p[0];
-		rnd[i] = unif(r);
-	}
-
 	// N = 1.0 after May 21 2021
 	float C = pow(eta, 2.0) * N;
 
-	// auto vectorized
-	for (size_t i=0; i<end_i-start_i; i++) {
-		for (size_t k=1; k<M; k++) {
-			prob[i][k] = C * Bjj[i] * cluster_var[k] + 1;
-		}
-	}
-
-	// unable to auto vectorize due to log
-	// explicitly using SSE
-	__m128 _v, _m;
-	for (size_t i=0; i<end_i-start_i; i++) {
-		size_t k = 1;
-		for (; k<M; k+=4) { // require M >= 4
-			_v = log_ps(_mm_loadu_ps(&prob[i][k]));
-			_mm_storeu_ps(&tmp[i][k], _v);
-		}
-
-		for (; k<M; k++) {
-			tmp[i][k] = logf(prob[i][k]);
-		}
-	}
-
-	// auto vectorized
-	for (size_t i=0; i<end_i-start_i; i++) {
-		for (size_t k=1; k<M; k++) {
-			prob[i][k] = -0.5*tmp[i][k] + log_p[k] + square(N*bj[i]) * cluster_var[k] / (2*prob[i][k]);
-		}
-	}
-
 	for (size_t i=0; i<end_i-start_i; i++) {
-		// SSE version to find max
-		_v = _mm_loadu_ps(&prob[i][0]);
-		size_t k = 4;
-		for (; k<M; k+=4) {
-			_v = _mm_max_ps(_v, _mm_loadu_ps(&prob[i][k]));
-		}
-
-		for (size_t m=0; m<3; m++) {
-			_v = _mm_max_ps(_v, _mm_shuffle_ps(_v, _v, 0x93));
-		}
-
-		_mm_store_ss(&max_elem, _v);
-
-		for (; k<M; k++) {
-			max_elem = (max_elem > prob[i][k]) ? max_elem : prob[i][k];
-		}
-
-		// SSE version log exp sum
-		_m = _mm_load1_ps(&max_elem);
-		_v = exp_ps(_mm_sub_ps(_mm_loadu_ps(&prob[i][0]), _m));
-
-		k = 4;
-		for (; k<M; k+=4) {
-			_v = _mm_add_ps(_v, exp_ps(_mm_sub_ps(_mm_loadu_ps(&prob[i][k]), _m)));
-		}
-
-		_v = _mm_hadd_ps(_v, _v);
-		_v = _mm_hadd_ps(_v, _v);
-		_mm_store_ss(&log_exp_sum, _v);
-
-		for (; k<M; k++) {
-			log_exp_sum += expf(prob[i][k] - max_elem);
-		}
-
-		log_exp_sum = max_elem + logf(log_exp_sum);
-
-		cls_assgn[i+start_i] = M-1;
-		for (size_t k=0; k<M-1; k++) {
-			rnd[i] -= expf(prob[i][k] - log_exp_sum);
-			if (rnd[i] < 0) {
-				cls_assgn[i+start_i] = k;
-				break;
-			}
-		}
+		float Bjj = ldmat_dat.B_diag[j](i);
+		float bj = b(start_i+i);
+		float u = unif(r);
+		cls_assgn[i+start_i] = active[kernel(log_p_f, var_f, K_pad, K, C*Bjj, square(N*bj)/2, u, scratch)];
 	}
 }
 
@@ -169,17 +103,39 @@ void MCMC_state::update_suffstats() {
 		double tmp = beta(i);
 		sumsq[cls_assgn[i]] += square(tmp);
 	}
+	update_active();
 }
 
-void MCMC_state::sample_V() {
-	vector<double> a(M-1);
+void MCMC_state::update_active() {
+	active.clear();
+	tail_slot = 0;
+	size_t n_fresh = 0;
+	for (size_t k=0; k<M; k++) {
+		if (active_buffer == 0 || k == 0 || suff_stats[k] > 0) {
+			active.push_back(k);
+		}
+		else if (n_fresh < active_buffer) {
+			active.push_back(k);
+			tail_slot = active.size()-1;
+			n_fresh++;
+		}
+	}
+}
 
-	a[M-2] = suff_stats[M-1];
-	for (int i=M-3; i>=0; i--) {
+void MCMC_state::sample_V() {
+	rng_stream r = stream(STAGE_V);
+	// Components above the highest active one are empty and collapsed into the
+	// tail, so only the sticks up to it are needed
+	size_t L = active.back();
+	size_t n_v = min(L+1, M-1);
+	vector<double> a(n_v);
+
+	a[n_v-1] = (n_v < M-1) ? 0 : suff_stats[M-1];
+	for (int i=n_v-2; i>=0; i--) {
 		a[i] = suff_stats[i+1] + a[i+1];
 	}
 
-	for (size_t i=0; i<M-1; i++) {
+	for (size_t i=0; i<n_v; i++) {
 		beta_distribution dist(1 + suff_stats[i], alpha + a[i]);
 		V[i] = dist(r);
 	}
@@ -187,11 +143,13 @@ void MCMC_state::sample_V() {
 }
 
 void MCMC_state::update_p() {
-	vector<double> cumprod(M-1);
+	size_t L = active.back();
+	size_t n_v = min(L+1, M-1);
+	vector<double> cumprod(n_v);
 
 	cumprod[0] = 1 - V[0];
 
-	for (size_t i=1; i<M-1; i++) {
+	for (size_t i=1; i<n_v; i++) {
 		cumprod[i] = cumprod[i-1] * (1 - V[i]);
 
 		if (V[i] == 1) {
@@ -201,26 +159,35 @@ void MCMC_state::update_p() {
 	}
 
 	p[0] = V[0];
-	for (size_t i=1; i<M-1; i++) {
+	for (size_t i=1; i<n_v; i++) {
 		p[i] = cumprod[i-1] * V[i];
 	}
 
-	double sum = std::accumulate(p.begin(), p.end()-1, 0.0);
-	if (1 - sum > 0) {
-		p[M-1] = 1 - sum;
-	}
-	else {
-		p[M-1] = 0;
+	if (L == M-1) {
+		double sum = std::accumulate(p.begin(), p.end()-1, 0.0);
+		if (1 - sum > 0) {
+			p[M-1] = 1 - sum;
+		}
+		else {
+			p[M-1] = 0;
+		}
 	}
 
-	for (size_t i=0; i<M; i++) {
+	for (size_t i=0; i<=L; i++) {
 		log_p[i] = logf(p[i] + 1e-40);
 	}
+
+	// Remaining stick mass of the components that are not active
+	double active_sum = 0;
+	for (size_t k=0; k<active.size(); k++) {
+		active_sum += p[active[k]];
+	}
+	tail_mass = (active.size() < M && 1 - active_sum > 0) ? 1 - active_sum : 0;
 }
 
 void MCMC_state::sample_alpha() {
 	double sum = 0, m = 0;
-	for (size_t i=0; i<M; i++) {
+	for (size_t i=0; i<=active.back(); i++) {
 		if (V[i] != 1) {
 			sum += log(1 - V[i]);
 			m++;
@@ -229,11 +196,12 @@ void MCMC_state::sample_alpha() {
 
 	if (m == 0) m = 1;
 
+	rng_stream r = stream(STAGE_ALPHA);
 	std::gamma_distribution<double> dist(0.1+m-1, 1.0/(0.1-sum));
 	alpha = dist(r);
 }
 
-void MCMC_state::sample_beta(size_t j, const mcmc_data &dat, ldmat_data &ldmat_dat) {
+void MCMC_state::sample_beta(size_t j, const mcmc_data &dat, const ldmat_data &ldmat_dat) {
 	size_t start_i = dat.boundary[j].first;
 	size_t end_i = dat.boundary[j].second;
 
@@ -244,193 +212,478 @@ void MCMC_state::sample_beta(size_t j, const mcmc_data &dat, ldmat_data &ldmat_d
 		}
 	}
 
-	arma::vec beta_j = beta.subvec(start_i, end_i-1);
+	// view into beta: the sampled effects are written back to the state
+	arma::subview_col<double> beta_j = beta.subvec(start_i, end_i-1);
 
 	beta_j.zeros();
 
+	rng_stream r = stream(STAGE_BETA, j);
+
 	if (causal_list.size() == 0) {
-		ldmat_dat.num[j] = 0;
-		ldmat_dat.denom[j] = 0;
+		num[j] = 0;
+		denom[j] = 0;
 		return;
 	}
 	else if (causal_list.size() == 1) {
 		double var_k = cluster_var[cls_assgn[causal_list[0]]];
 		double bj = b(causal_list[0]);
-		double Bjj = ldmat_dat.B[j](causal_list[0]-start_i, causal_list[0]-start_i);
+		double Bjj = ldmat_dat.B_diag[j](causal_list[0]-start_i);
 		double C = var_k / (N*var_k*square(eta)*Bjj + 1.0);
 		std::normal_distribution<double> dist(0.0, sqrt(C));
 		double rv = dist(r) + C*N*bj;
 		beta_j(causal_list[0]-start_i) = rv;
-		ldmat_dat.num[j] = bj*rv;
-		ldmat_dat.denom[j] = square(rv)*Bjj;
+		num[j] = bj*rv;
+		denom[j] = square(rv)*Bjj;
 		return;
 	}
 
-	arma::vec A_vec(causal_list.size());
-	arma::vec A_vec2(causal_list.size());
-
-	double C = square(eta)*N;
-
-	arma::mat B(causal_list.size(), causal_list.size());
-
-	for (size_t i=0; i<causal_list.size(); i++) {
-		A_vec(i) = N*eta*ldmat_dat.calc_b_tmp[j](causal_list[i]-start_i);
-
-		for (size_t k=0; k<causal_list.size(); k++) {
-			if (i != k) {
-				B(i, k) = C * ldmat_dat.B[j](causal_list[i]-start_i, causal_list[k]-start_i);
+	// Causal SNPs as block-local indices; the LD submatrix of the previous
+	// iteration is reused when the set has not changed
+	causal_workspace& ws = causal_ws[j];
+	size_t n_causal = causal_list.size();
+	bool same_set = (ws.causal.size() == n_causal);
+	for (size_t i=0; same_set && i<n_causal; i++) {
+		same_set = (ws.causal[i] == causal_list[i]-start_i);
+	}
+	if (!same_set) {
+		ws.causal.resize(n_causal);
+		for (size_t i=0; i<n_causal; i++) {
+			ws.causal[i] = causal_list[i]-start_i;
+		}
+		// promoted to double here in compact mode
+		ws.ld.set_size(n_causal, n_causal);
+		if (ldmat_dat.compact) {
+			const arma::fmat& B_j = ldmat_dat.B_f[j];
+			for (size_t k=0; k<n_causal; k++) {
+				for (size_t i=0; i<n_causal; i++) {
+					ws.ld(i, k) = B_j(ws.causal[i], ws.causal[k]);
+				}
 			}
-			else {
-				B(i, k) = C * ldmat_dat.B[j](causal_list[i]-start_i, causal_list[i]-start_i) + 1.0/cluster_var[cls_assgn[causal_list[i]]];
+		}
+		else {
+			const arma::mat& B_j = ldmat_dat.B[j];
+			for (size_t k=0; k<n_causal; k++) {
+				for (size_t i=0; i<n_causal; i++) {
+					ws.ld(i, k) = B_j(ws.causal[i], ws.causal[k]);
+				}
 			}
 		}
 	}
 
-	A_vec2 = A_vec;
+	double C = square(eta)*N;
+
+	arma::vec& A_vec = ws.mu;
+	A_vec.set_size(n_causal);
+	for (size_t i=0; i<n_causal; i++) {
+		A_vec(i) = N*eta*ldmat_dat.calc_b_tmp[j](ws.causal[i], trait_id);
+	}
 
-	arma::vec beta_c(causal_list.size());
+	// (N B_gamma + \Sigma_0^-1)
+	ws.prec = C * ws.ld;
+	for (size_t i=0; i<n_causal; i++) {
+		ws.prec(i, i) += 1.0/cluster_var[cls_assgn[causal_list[i]]];
+	}
+
+	arma::vec& beta_c = ws.draw;
+	beta_c.set_size(n_causal);
 	std::normal_distribution<double> dist(0.0, 1.0);
-	for (size_t i=0; i<causal_list.size(); i++) {
+	for (size_t i=0; i<n_causal; i++) {
 		beta_c(i) = dist(r);
 	}
 
-	// (N B_gamma + \Sigma_0^-1) = L L^T
-	B = arma::chol(B, "lower");
+	// (N B_gamma + \Sigma_0^-1) = L L^T, factored in place
+	if (!arma::chol(ws.prec, ws.prec, "lower")) {
+		throw std::runtime_error("sample_beta: posterior precision is not positive definite.");
+	}
 
 	// \mu = L^{-1} A_vec
-	A_vec = arma::solve(trimatl(B), A_vec);
+	A_vec = arma::solve(trimatl(ws.prec), A_vec);
 
 	// N(\mu, I)
 	beta_c += A_vec;
 
 	// X ~ N(\mu, I), L^{-T} X ~ N( L^{-T} \mu, (L L^T)^{-1} )
-	beta_c = arma::solve(trimatl(B).t(), beta_c);
-
-	// compute eta related terms
-	for (size_t i=0; i<causal_list.size(); i++) {
-		B(i, i) = C*ldmat_dat.B[j](causal_list[i]-start_i, causal_list[i]-start_i);
+	beta_c = arma::solve(trimatl(ws.prec).t(), beta_c);
+
+	// compute eta related terms: num = N beta_c' A^T beta_mrg and
+	// denom = N beta_c' B_gamma beta_c, the full quadratic form (the
+	// factorization leaves no copy of the off-diagonal B_gamma terms to use)
+	double num_j = 0;
+	for (size_t i=0; i<n_causal; i++) {
+		num_j += ldmat_dat.calc_b_tmp[j](ws.causal[i], trait_id) * beta_c(i);
+		beta_j(ws.causal[i]) = beta_c(i);
 	}
+	num[j] = N * num_j;
+	denom[j] = N * arma::dot(beta_c, ws.ld * beta_c);
+}
 
-	ldmat_dat.num[j] = arma::dot(A_vec2, beta_c);
-	arma::vec tmp = B * beta_c;
-	ldmat_dat.denom[j] = arma::dot(beta_c, tmp);
-	ldmat_dat.denom[j] /= square(eta);
-	ldmat_dat.num[j] /= eta;
-
-	for (size_t i=0; i<causal_list.size(); i++) {
-		beta_j(causal_list[i]-start_i) = beta_c(i);
-	}
+void MCMC_state::compute_h2(size_t j, const mcmc_data &dat, const arma::vec &R_beta) {
+	size_t start_i = dat.boundary[j].first;
+	size_t end_i = dat.boundary[j].second;
+	h2_block[j] = arma::dot(R_beta, beta.subvec(start_i, end_i-1));
 }
 
-void MCMC_state::compute_h2(const mcmc_data &dat) {
-	double h2_tmp = 0;
-	h2 = 0;
-	for (size_t j=0; j<dat.ref_ld_mat.size(); j++) {
-		size_t start_i = dat.boundary[j].first;
-		size_t end_i = dat.boundary[j].second;
-		arma::vec tmp(end_i-start_i);
-		arma::vec beta_j = beta.subvec(start_i, end_i-1);
-		tmp = dat.ref_ld_mat[j] * beta_j;
-		h2_tmp = arma::dot(tmp, beta_j);
-		h2 += h2_tmp;
-	}
+void MCMC_state::reduce_h2() {
+	// summed in block order so the result does not depend on thread scheduling
+	h2 = std::accumulate(h2_block.begin(), h2_block.end(), 0.0);
 }
 
-void MCMC_state::sample_eta(const ldmat_data &ldmat_dat) {
-	double num_sum = std::accumulate(ldmat_dat.num.begin(), ldmat_dat.num.end(), 0.0);
-	double denom_sum = std::accumulate(ldmat_dat.denom.begin(), ldmat_dat.denom.end(), 0.0);
+void MCMC_state::sample_eta() {
+	double num_sum = std::accumulate(num.begin(), num.end(), 0.0);
+	double denom_sum = std::accumulate(denom.begin(), denom.end(), 0.0);
 	denom_sum += 1e-6;
 
+	rng_stream r = stream(STAGE_ETA);
 	std::normal_distribution<double> dist(num_sum/denom_sum, sqrt(1.0/denom_sum));
 	eta = dist(r);
 }
 
-void solve_ldmat(const mcmc_data &dat, ldmat_data &ldmat_dat, const double a, unsigned sz, int opt_llk) {
-	for (size_t i=0; i<dat.ref_ld_mat.size(); i++) {
+// A = (R + aI)^-1 R and B = R A for one LD block
+static void factor_ldmat(const mcmc_data &dat, size_t i, const double a, unsigned sz, int opt_llk, arma::mat &A_out, arma::mat &B_out) {
+	size_t size = dat.boundary[i].second - dat.boundary[i].first;
+	arma::mat A = dat.ref_ld_mat[i];
+	arma::mat B = dat.ref_ld_mat[i];
+
+	if (opt_llk == 1) {
+		// (R + aNI) / N A = R via cholesky decomp
+		// Changed May 21 2021 to divide by N
+		// replace aN with a
+		B.diag() += a;
+	}
+	else {
+		// R_ij N_s,ij / N_i N_j
+		// Added May 24 2021
+		for (size_t j=0; j<size; j++) {
+			for (size_t k=0; k<size; k++) {
+				double tmp = B(j, k);
+				size_t idx1 = j + dat.boundary[i].first;
+				size_t idx2 = k + dat.boundary[i].first;
+				if ((dat.array[idx1] == 1 && dat.array[idx2] == 2) || (dat.array[idx1] == 2 && dat.array[idx2] == 1)) {
+					tmp = 0;
+				}
+				else {
+					tmp *= min(dat.sz[idx1], dat.sz[idx2]) / (1.1 * dat.sz[idx1] * dat.sz[idx2]);
+				}
+				B(j, k) = tmp;
+			}
+		}
+		// force positive definite
+		// B = Q \Lambda Q^T
+		arma::vec eval;
+		arma::mat evec;
+		arma::eig_sym(eval, evec, B);
+		double eval_min = eval.min();
+
+		// restore lower half of B
+		B = arma::symmatu(B);
+
+		// if min eigen value < 0, add -1.1 * eval to diagonal
+		for (size_t j=0; j<size; j++) {
+			if (eval_min < 0) {
+				B(j, j) = 1.0/dat.sz[j+dat.boundary[i].first] - 1.1*eval_min;
+			}
+			else {
+				B(j, j) = 1.0/dat.sz[j+dat.boundary[i].first];
+			}
+		}
+	}
+
+	B = arma::chol(B, "lower");
+
+	A = arma::solve(trimatl(B), A);
+
+	A = arma::solve(trimatl(B).t(), A);
+
+	if (opt_llk == 1) {
+		A *= sz;
+	}
+
+	B_out = dat.ref_ld_mat[i] * A;
+	A_out = std::move(A);
+}
+
+void solve_ldmat(const mcmc_data &dat, ldmat_data &ldmat_dat, const double a, unsigned sz, int opt_llk,
+                 unsigned n_threads, const std::string &cache_dir, bool compact, ldmat_memo *memo,
+                 engine_profile *profile) {
+	size_t n_block = dat.ref_ld_mat.size();
+	ldmat_cache cache(cache_dir, memo);
+	Function_pool& func_pool = Function_pool::shared(n_threads);
+
+	// Serve blocks from the cache where possible
+	vector<ldmat_cache::key> keys(n_block);
+	vector<double*> hit(n_block, nullptr);
+	vector<double> block_cost(n_block);
+	ldmat_dat.backing.assign(n_block, std::shared_ptr<const void>());
+	for (size_t i=0; i<n_block; i++) {
 		size_t size = dat.boundary[i].second - dat.boundary[i].first;
-		arma::mat A = dat.ref_ld_mat[i];
-		arma::mat B = dat.ref_ld_mat[i];
-		arma::mat L = dat.ref_ld_mat[i];
+		if (cache.enabled()) {
+			size_t first = dat.boundary[i].first;
+			keys[i] = ldmat_cache::block_key(dat.ref_ld_mat[i], a, sz, opt_llk, &dat.sz[first], &dat.array[first]);
+			hit[i] = cache.load(keys[i], size, ldmat_dat.backing[i]);
+		}
+		block_cost[i] = pow(static_cast<double>(size), hit[i] != nullptr ? 2.0 : 3.0);
+	}
+	if (profile != nullptr) {
+		size_t n_hit = n_block - std::count(hit.begin(), hit.end(), nullptr);
+		profile->add_count(SDPR_COUNT_LD_CACHED, n_hit);
+		profile->add_count(SDPR_COUNT_LD_FACTORED, n_block - n_hit);
+	}
 
-		if (opt_llk == 1) {
-			// (R + aNI) / N A = R via cholesky decomp
-			// Changed May 21 2021 to divide by N
-			// replace aN with a
-			B.diag() += a;
+	// In double mode, blocks served from the cache are non-owning views into the
+	// memo entries or mapped files; reserving first keeps them from being moved
+	ldmat_dat.compact = compact;
+	ldmat_dat.B.reserve(n_block);
+	for (size_t i=0; i<n_block; i++) {
+		size_t size = dat.boundary[i].second - dat.boundary[i].first;
+		if (hit[i] != nullptr && !compact) {
+			ldmat_dat.B.emplace_back(hit[i] + size*size, size, size, false, true);
 		}
 		else {
-			// R_ij N_s,ij / N_i N_j
-			// Added May 24 2021
-			for (size_t j=0; j<size; j++) {
-				for (size_t k=0; k<size; k++) {
-					double tmp = B(j, k);
-					size_t idx1 = j + dat.boundary[i].first;
-					size_t idx2 = k + dat.boundary[i].first;
-					if ((dat.array[idx1] == 1 && dat.array[idx2] == 2) || (dat.array[idx1] == 2 && dat.array[idx2] == 1)) {
-						tmp = 0;
-					}
-					else {
-						tmp *= min(dat.sz[idx1], dat.sz[idx2]) / (1.1 * dat.sz[idx1] * dat.sz[idx2]);
-					}
-					B(j, k) = tmp;
-				}
+			ldmat_dat.B.emplace_back();
+		}
+	}
+	ldmat_dat.B_f.resize(compact ? n_block : 0);
+	ldmat_dat.R_f.resize(compact ? n_block : 0);
+	ldmat_dat.B_diag.resize(n_block);
+	ldmat_dat.beta_mrg.resize(n_block);
+	ldmat_dat.calc_b_tmp.resize(n_block);
+
+	// Factor the remaining blocks in parallel, largest first. A is only needed
+	// for the GWAS-dependent calc_b_tmp and is not kept.
+	vector<char> stored(n_block, 1);
+	func_pool.parallel_for(0, n_block, 1, [&](size_t i) {
+		size_t size = dat.boundary[i].second - dat.boundary[i].first;
+		arma::mat A_own, B_own;
+		if (hit[i] == nullptr) {
+			factor_ldmat(dat, i, a, sz, opt_llk, A_own, B_own);
+			if (cache.enabled()) {
+				stored[i] = cache.store(keys[i], A_own, B_own);
 			}
-			// force positive definite
-			// B = Q \Lambda Q^T
-			arma::vec eval;
-			arma::mat evec;
-			arma::eig_sym(eval, evec, B);
-			double eval_min = eval.min();
-
-			// restore lower half of B
-			B = arma::symmatu(B);
-
-			// if min eigen value < 0, add -1.1 * eval to diagonal
-			for (size_t j=0; j<size; j++) {
-				if (eval_min < 0) {
-					B(j, j) = 1.0/dat.sz[j+dat.boundary[i].first] - 1.1*eval_min;
-				}
-				else {
-					B(j, j) = 1.0/dat.sz[j+dat.boundary[i].first];
-				}
+		}
+		// views into the memo entry or mapped cache file on a hit
+		const arma::mat A_hit = (hit[i] != nullptr) ? arma::mat(hit[i], size, size, false, true) : arma::mat();
+		const arma::mat B_hit = (hit[i] != nullptr) ? arma::mat(hit[i] + size*size, size, size, false, true) : arma::mat();
+		const arma::mat& A = (hit[i] != nullptr) ? A_hit : A_own;
+		const arma::mat& B = (hit[i] != nullptr) ? B_hit : B_own;
+
+		// one column per trait: A^T beta_mrg of all traits in one GEMM
+		ldmat_dat.beta_mrg[i] = dat.beta_mrg.rows(dat.boundary[i].first, dat.boundary[i].second-1);
+		ldmat_dat.calc_b_tmp[i] = A.t() * ldmat_dat.beta_mrg[i];
+		ldmat_dat.B_diag[i] = B.diag();
+
+		if (compact) {
+			ldmat_dat.B_f[i] = arma::conv_to<arma::fmat>::from(B);
+			ldmat_dat.R_f[i] = arma::conv_to<arma::fmat>::from(dat.ref_ld_mat[i]);
+		}
+		else if (hit[i] == nullptr) {
+			ldmat_dat.B[i] = std::move(B_own);
+		}
+	}, block_cost);
+	if (std::find(stored.begin(), stored.end(), 0) != stored.end()) {
+		std::cerr << "Unable to write the LD cache in " << cache_dir << "." << std::endl;
+	}
+
+	if (compact) {
+		// Everything needed was converted; unmap the cache files
+		ldmat_dat.backing.clear();
+	}
+}
+
+// X times the block's effects of every state, one column per state. All chains
+// and traits share the LD, so their products are one GEMM rather than one GEMV
+// each; in compact mode the GEMM is single precision.
+template <typename eT>
+static arma::mat block_product(const arma::Mat<eT> &X, const vector<MCMC_state> &states, size_t start, size_t end) {
+	arma::Mat<eT> beta(end-start, states.size());
+	for (size_t s=0; s<states.size(); s++) {
+		beta.col(s) = arma::conv_to<arma::Col<eT> >::from(states[s].beta.subvec(start, end-1));
+	}
+	return arma::conv_to<arma::mat>::from(X * beta);
+}
+
+// Run every state (the chains of every trait, trait-major) in lock-step
+// against the shared, read-only LD data
+// Runs iterations first_iter, ..., iter or until `end_of_iteration(j)` returns true; returns the last iteration run
+static int run_states(vector<MCMC_state> &states, vector<MCMC_samples> &samples,
+                      vector<vector<chain_monitor> > &monitors, const vector<vector<size_t> > &top,
+                      unsigned n_chains, const mcmc_data &data, const ldmat_data &ldmat_dat,
+                      Function_pool &func_pool, const vector<double> &block_cost,
+                      int first_iter, int iter, int burn, int thin, bool verbose,
+                      const std::function<bool(int)> &end_of_iteration, engine_profile *profile) {
+	size_t n_block = data.ref_ld_mat.size();
+	size_t n_state = states.size();
+	size_t n_trait = n_state / n_chains;
+
+	// sample_beta runs over every (block, state) pair
+	vector<double> pair_cost(n_block*n_state);
+	for (size_t k=0; k<pair_cost.size(); k++) {
+		pair_cost[k] = block_cost[k / n_state];
+	}
+
+	// a resumed state holds the statistics of the iteration it was saved at
+	if (first_iter == 1) {
+		for (size_t s=0; s<n_state; s++) {
+			states[s].update_suffstats();
+		}
+	}
+
+	for (int j=first_iter; j<iter+1; j++) {
+		if (profile != nullptr) {
+			profile->add_count(SDPR_COUNT_ITERATIONS, 1);
+		}
+		{
+			profile_scope timer(profile, SDPR_PHASE_SIGMA2);
+			for (size_t s=0; s<n_state; s++) {
+				states[s].set_iteration(j);
+				states[s].sample_sigma2();
 			}
 		}
 
-		B = arma::chol(B, "lower");
+		// block-local stages only touch their own slice of b, beta and cls_assgn
+		func_pool.parallel_for(0, n_block, 1, [&](size_t i) {
+			size_t start = data.boundary[i].first;
+			size_t end = data.boundary[i].second;
+			arma::mat B_beta;
+			{
+				profile_scope timer(profile, SDPR_PHASE_CALC_B);
+				B_beta = ldmat_dat.compact ? block_product(ldmat_dat.B_f[i], states, start, end)
+				                           : block_product(ldmat_dat.B[i], states, start, end);
+			}
+			func_pool.parallel_for(0, n_state, 1, [&](size_t s) {
+				const arma::vec B_beta_s(B_beta.colptr(s), end-start, false, true);
+				{
+					profile_scope timer(profile, SDPR_PHASE_CALC_B);
+					states[s].calc_b(i, data, ldmat_dat, B_beta_s);
+				}
+				{
+					profile_scope timer(profile, SDPR_PHASE_ASSIGNMENT);
+					states[s].sample_assignment(i, data, ldmat_dat);
+				}
+				if (profile != nullptr) {
+					profile_tally causal(profile, SDPR_COUNT_CAUSAL);
+					causal.add(end - start - std::count(states[s].cls_assgn.begin()+start, states[s].cls_assgn.begin()+end, 0));
+				}
+			});
+		}, block_cost);
+
+		{
+			profile_scope timer(profile, SDPR_PHASE_MIXTURE);
+			func_pool.parallel_for(0, n_state, 1, [&](size_t s) {
+				states[s].update_suffstats();
+				states[s].sample_V();
+				states[s].update_p();
+				states[s].sample_alpha();
+			});
+		}
 
-		A = arma::solve(trimatl(B), A);
+		{
+			profile_scope timer(profile, SDPR_PHASE_BETA);
+			func_pool.parallel_for(0, n_block*n_state, 1, [&](size_t k) {
+				states[k % n_state].sample_beta(k / n_state, data, ldmat_dat);
+			}, pair_cost);
+		}
 
-		A = arma::solve(trimatl(B).t(), A);
+		{
+			profile_scope timer(profile, SDPR_PHASE_ETA);
+			for (size_t s=0; s<n_state; s++) {
+				states[s].sample_eta();
+			}
+		}
 
-		if (opt_llk == 1) {
-			A *= sz;
+		bool keep = (j>burn) && (j%thin == 0);
+		bool report = verbose && j % 100 == 0;
+		if (keep || report) {
+			profile_scope timer(profile, SDPR_PHASE_H2);
+			func_pool.parallel_for(0, n_block, 1, [&](size_t i) {
+				size_t start = data.boundary[i].first;
+				size_t end = data.boundary[i].second;
+				arma::mat R_beta = ldmat_dat.compact ? block_product(ldmat_dat.R_f[i], states, start, end)
+				                                     : block_product(data.ref_ld_mat[i], states, start, end);
+				for (size_t s=0; s<n_state; s++) {
+					const arma::vec R_beta_s(R_beta.colptr(s), end-start, false, true);
+					states[s].compute_h2(i, data, R_beta_s);
+				}
+			}, block_cost);
+			for (size_t s=0; s<n_state; s++) {
+				states[s].reduce_h2();
+			}
 		}
 
-		B = L * A;
-		L %= L;
+		for (size_t s=0; s<n_state; s++) {
+			MCMC_state &state = states[s];
+			if (keep) {
+				samples[s].h2 += state.h2*square(state.eta);
+				samples[s].beta += state.eta * state.beta;
+				samples[s].n++;
+
+				const vector<size_t> &top_s = top[s / n_chains];
+				monitors[s][0].add(state.h2*square(state.eta));
+				for (size_t k=0; k<top_s.size(); k++) {
+					monitors[s][k+1].add(state.eta * state.beta(top_s[k]));
+				}
+			}
 
-		arma::vec beta_mrg(size);
-		for (size_t j=0; j<size; j++) {
-			beta_mrg(j) = dat.beta_mrg[j+dat.boundary[i].first];
+			// progress of the first chain of each trait
+			if (report && s % n_chains == 0) {
+				if (n_trait > 1) {
+					cout << "trait " << s / n_chains + 1 << ": ";
+				}
+				cout << j << " iter. h2: " << state.h2*square(state.eta) << " max beta: " << arma::max(state.beta)*state.eta << endl;
+			}
 		}
-		arma::vec b_tmp = A.t() * beta_mrg;
 
-		ldmat_dat.A.push_back(A);
-		ldmat_dat.B.push_back(B);
-		ldmat_dat.L.push_back(L);
-		ldmat_dat.calc_b_tmp.push_back(b_tmp);
-		ldmat_dat.beta_mrg.push_back(beta_mrg);
-		ldmat_dat.denom.push_back(0);
-		ldmat_dat.num.push_back(0);
+		profile_scope timer(profile, SDPR_PHASE_CHECKPOINT);
+		if (end_of_iteration(j)) {
+			return j;
+		}
+	}
+	return iter;
+}
+
+// Fingerprint of the inputs and settings of an `mcmc` run, stored in its checkpoints
+static content_hash mcmc_fingerprint(const mcmc_data &data, unsigned sz, double a, double c, size_t M,
+                                     size_t active_buffer, double a0k, double b0k, int iter, int burn, int thin,
+                                     int opt_llk, unsigned int seed, unsigned n_chains, bool compact_ld,
+                                     double min_ess) {
+	content_hasher h;
+	h.add(static_cast<uint64_t>(0x53445052));   // "SDPR"
+	h.add(static_cast<uint64_t>(data.beta_mrg.n_rows));
+	h.add(static_cast<uint64_t>(data.beta_mrg.n_cols));
+	h.add(data.beta_mrg.memptr(), data.beta_mrg.n_elem);
+	h.add(data.sz.data(), data.sz.size());
+	for (size_t i=0; i<data.array.size(); i++) {
+		h.add(static_cast<uint64_t>(data.array[i]));
+	}
+	h.add(static_cast<uint64_t>(data.ref_ld_mat.size()));
+	for (size_t i=0; i<data.ref_ld_mat.size(); i++) {
+		h.add(static_cast<uint64_t>(data.ref_ld_mat[i].n_rows));
+		h.add(data.ref_ld_mat[i].memptr(), data.ref_ld_mat[i].n_elem);
 	}
+	h.add(static_cast<uint64_t>(sz));
+	h.add(a);
+	h.add(c);
+	h.add(static_cast<uint64_t>(M));
+	h.add(static_cast<uint64_t>(active_buffer));
+	h.add(a0k);
+	h.add(b0k);
+	h.add(static_cast<uint64_t>(iter));
+	h.add(static_cast<uint64_t>(burn));
+	h.add(static_cast<uint64_t>(thin));
+	h.add(static_cast<uint64_t>(opt_llk));
+	h.add(static_cast<uint64_t>(seed));
+	h.add(static_cast<uint64_t>(n_chains));
+	h.add(static_cast<uint64_t>(compact_ld));
+	h.add(min_ess);
+	return h.digest();
 }
 
-std::unordered_map<std::string, arma::vec> mcmc(
+std::unordered_map<std::string, arma::mat> mcmc(
 	mcmc_data& data,
 	unsigned   sz,
 	double     a = 0.1,
 	double     c = 1.0,
 	size_t     M = 1000,
+	size_t     active_buffer = 0,
 	double     a0k = 0.5,
 	double     b0k = 0.5,
 	int        iter = 1000,
@@ -438,70 +691,185 @@ std::unordered_map<std::string, arma::vec> mcmc(
 	int        thin = 5,
 	unsigned   n_threads = 1,
 	int        opt_llk = 1,
-	bool       verbose = true
+	bool       verbose = true,
+	unsigned int seed = 0,
+	const std::string &cache_dir = "",
+	unsigned   n_chains = 1,
+	bool       compact_ld = false,
+	const mcmc_checkpoint_options &ckpt = mcmc_checkpoint_options(),
+	ldmat_memo *ld_memo = nullptr,
+	engine_profile *profile = nullptr
 	) {
 
-	int n_pst = (iter-burn) / thin;
-
 	ldmat_data ldmat_dat;
 
-	MCMC_state state(data.beta_mrg.size(), M, a0k, b0k, sz);
+	size_t n_snp = data.beta_mrg.n_rows;
+	size_t n_trait = data.beta_mrg.n_cols;
+	size_t n_block = data.ref_ld_mat.size();
+	n_chains = std::max(n_chains, 1u);
 
-	for (size_t i=0; i<data.beta_mrg.size(); i++) {
-		data.beta_mrg[i] /= c;
+	// computed before the LD is preprocessed (and possibly released)
+	content_hash fingerprint = content_hash();
+	if (ckpt.enabled()) {
+		fingerprint = mcmc_fingerprint(data, sz, a, c, M, active_buffer, a0k, b0k, iter, burn, thin, opt_llk, seed,
+		                               n_chains, compact_ld, ckpt.min_ess);
 	}
 
-	MCMC_samples samples(data.beta_mrg.size());
+	data.beta_mrg /= c;
 
-	solve_ldmat(data, ldmat_dat, a, sz, opt_llk);
-	state.update_suffstats();
+	{
+		profile_scope timer(profile, SDPR_PHASE_LDMAT);
+		solve_ldmat(data, ldmat_dat, a, sz, opt_llk, n_threads, cache_dir, compact_ld, ld_memo, profile);
+	}
+	if (compact_ld) {
+		// the reference LD is kept in single precision in ldmat_dat; blocks that
+		// are views of memory owned elsewhere (R, a mapped file, an LD handle) are left alone
+		for (size_t i=0; i<n_block; i++) {
+			if (data.ref_ld_mat[i].mem_state == 0) {
+				data.ref_ld_mat[i].reset();
+			}
+		}
+	}
 
-	Function_pool func_pool(n_threads);
+	Function_pool& func_pool = Function_pool::shared(n_threads);
 
-	for (int j=1; j<iter+1; j++) {
-		state.sample_sigma2();
+	// Block sizes are used as cost weights when distributing blocks to threads
+	vector<double> block_cost(n_block);
+	for (size_t i=0; i<n_block; i++) {
+		block_cost[i] = data.boundary[i].second - data.boundary[i].first;
+	}
 
-		for (size_t i=0; i<data.ref_ld_mat.size(); i++) {
-			state.calc_b(i, data, ldmat_dat);
-		}
+	// Convergence is monitored for h2 and the SNPs with the largest marginal effects
+	const size_t n_top = 10;
+	size_t n_monitor = min(n_top, n_snp);
+	vector<vector<size_t> > top(n_trait);
+	for (size_t t=0; t<n_trait; t++) {
+		vector<size_t> order(n_snp);
+		std::iota(order.begin(), order.end(), 0);
+		std::partial_sort(order.begin(), order.begin()+n_monitor, order.end(), [&data, t](size_t x, size_t y) {
+			return std::fabs(data.beta_mrg(x, t)) > std::fabs(data.beta_mrg(y, t));
+		});
+		top[t].assign(order.begin(), order.begin()+n_monitor);
+	}
 
-		for (size_t i=0; i<data.ref_ld_mat.size(); i++) {
-			func_pool.push(std::bind(&MCMC_state::sample_assignment, &state, i, ref(data), ref(ldmat_dat)));
+	size_t n_keep = 0;
+	for (int j=burn+1; j<iter+1; j++) {
+		if (j%thin == 0) {
+			n_keep++;
 		}
+	}
 
-		func_pool.waitFinished();
-
-		state.update_suffstats();
+	// States share data and ldmat_dat; everything they update lives in MCMC_state.
+	// State t * n_chains + ch is chain ch of trait t.
+	size_t n_state = n_trait * n_chains;
+	vector<MCMC_state> states;
+	vector<MCMC_samples> samples;
+	vector<vector<chain_monitor> > monitors(n_state, vector<chain_monitor>(n_monitor+1, chain_monitor(n_keep)));
+	states.reserve(n_state);
+	samples.reserve(n_state);
+	for (size_t s=0; s<n_state; s++) {
+		states.emplace_back(n_snp, n_block, M, active_buffer, a0k, b0k, sz, seed, s, s / n_chains);
+		samples.emplace_back(n_snp);
+	}
 
-		state.sample_V();
-		state.update_p();
-		state.sample_alpha();
+	// Resume from a checkpoint of the same run
+	int first_iter = 1;
+	bool finished = false;
+	if (ckpt.enabled()) {
+		checkpoint_reader in(ckpt.path, fingerprint);
+		if (in.found()) {
+			for (size_t s=0; s<n_state; s++) {
+				states[s].checkpoint(in);
+				samples[s].checkpoint(in);
+			}
+			in.field(monitors);
+			in.finish();
+			first_iter = static_cast<int>(in.iteration()) + 1;
+			finished = in.finished();
+			if (verbose) {
+				cout << "Resuming from the checkpoint at iteration " << in.iteration() << endl;
+			}
+		}
+	}
 
-		for (size_t i=0; i<data.ref_ld_mat.size(); i++) {
-			state.sample_beta(i, data, ldmat_dat);
+	// Stopping rule and checkpoints, after every iteration
+	auto end_of_iteration = [&](int j) {
+		bool converged = ckpt.min_ess > 0 && j > burn && j % thin == 0;
+		for (size_t t=0; t<n_trait && converged; t++) {
+			vector<const chain_monitor*> chains;
+			for (size_t s=t*n_chains; s<(t+1)*n_chains; s++) {
+				chains.push_back(&monitors[s][0]);
+			}
+			converged = ess_reached(chains, ckpt.min_ess);
+		}
+		bool done = converged || j == iter;
+		if (ckpt.enabled() && (done || (ckpt.every > 0 && j % ckpt.every == 0))) {
+			checkpoint_writer out;
+			for (size_t s=0; s<n_state; s++) {
+				states[s].checkpoint(out);
+				samples[s].checkpoint(out);
+			}
+			out.field(monitors);
+			out.commit(ckpt.path, fingerprint, j, done);
+		}
+		if (converged && verbose) {
+			cout << "Effective sample size of h2 reached " << ckpt.min_ess << " at iteration " << j << endl;
 		}
+		return converged;
+	};
 
-		state.sample_eta(ldmat_dat);
+	int last_iter = first_iter - 1;
+	if (!finished) {
+		last_iter = run_states(states, samples, monitors, top, n_chains, data, ldmat_dat, func_pool, block_cost,
+		                       first_iter, iter, burn, thin, verbose, end_of_iteration, profile);
+	}
 
-		if ((j>burn) && (j%thin == 0)) {
-			state.compute_h2(data);
-			samples.h2 += state.h2*square(state.eta) / n_pst;
-			samples.beta += state.eta/n_pst * state.beta;
-		}
+	arma::mat beta_chains(n_snp, n_state);
+	arma::mat h2_chains(1, n_state);
+	for (size_t s=0; s<n_state; s++) {
+		double n_kept = static_cast<double>(std::max<uint64_t>(samples[s].n, 1));
+		beta_chains.col(s) = samples[s].beta / n_kept;
+		h2_chains(0, s) = samples[s].h2 / n_kept;
+	}
 
-		if (verbose && j % 100 == 0) {
-			state.compute_h2(data);
-			cout << j << " iter. h2: " << state.h2*square(state.eta) << " max beta: " << arma::max(state.beta)*state.eta << endl;
+	arma::mat beta(n_snp, n_trait), h2(1, n_trait);
+	arma::mat rhat(n_monitor+1, n_trait), ess(n_monitor+1, n_trait), top_index(n_monitor, n_trait);
+	for (size_t t=0; t<n_trait; t++) {
+		size_t first = t * n_chains, last = first + n_chains - 1;
+		beta.col(t) = arma::mean(beta_chains.cols(first, last), 1);
+		h2(0, t) = arma::mean(h2_chains.row(0).subvec(first, last));
+		for (size_t k=0; k<n_monitor+1; k++) {
+			vector<const chain_monitor*> chains;
+			for (size_t s=first; s<=last; s++) {
+				chains.push_back(&monitors[s][k]);
+			}
+			rhat(k, t) = split_rhat(chains);
+			ess(k, t) = effective_size(chains);
+			if (k > 0) {
+				top_index(k-1, t) = top[t][k-1];
+			}
 		}
-	}
 
-	if (verbose) {
-		cout << "h2: " << samples.h2 << " max: " << arma::max(samples.beta) << endl;
+		if (verbose) {
+			if (n_trait > 1) {
+				cout << "trait " << t+1 << ": ";
+			}
+			cout << "h2: " << h2(0, t) << " max: " << arma::max(beta.col(t)) << endl;
+			if (n_chains > 1) {
+				cout << "h2 split-R-hat: " << rhat(0, t) << " ESS: " << ess(0, t) << endl;
+			}
+		}
 	}
 
-	std::unordered_map<std::string, arma::vec> results;
-	results["beta"] = samples.beta;
-	results["h2"] = arma::vec(1, arma::fill::value(samples.h2));
+	std::unordered_map<std::string, arma::mat> results;
+	results["beta"] = beta;
+	results["h2"] = h2;
+	results["beta_chains"] = beta_chains;
+	results["h2_chains"] = h2_chains;
+	results["rhat"] = rhat;
+	results["ess"] = ess;
+	results["top_index"] = top_index;
+	results["n_iter"] = arma::mat(1, 1).fill(last_iter);
 
 	return results;
 }
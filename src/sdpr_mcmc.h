@@ -4,15 +4,33 @@
 #include <cmath>
 #include <random>
 #include <unordered_map>
+#include "rng_stream.h"
+#include "engine_profile.h"
+#include "ldmat_cache.h"
+#include "mcmc_checkpoint.h"
 
+/**
+ * Preprocessed LD blocks, read-only during sampling.
+ *
+ * By default `B` holds every block in double precision. In compact mode (`compact`)
+ * `B` is empty and `B_f` holds single-precision copies instead, together with
+ * `R_f`, a single-precision copy of the reference LD used for the heritability;
+ * `mcmc_data::ref_ld_mat` is then released, except for blocks that are views of memory
+ * owned by the caller. `B_diag` is kept in double in both modes.
+ * A = (R + aI)^-1 R is only needed for `calc_b_tmp` and is not kept.
+ * `beta_mrg` and `calc_b_tmp` = A^T beta_mrg hold one column per trait.
+ */
 typedef struct {
-	std::vector<arma::mat> A;
+	// Cache files or LD handle entries backing the B blocks loaded from the LD
+	// cache (declared first so they outlive the matrices that point into them)
+	std::vector<std::shared_ptr<const void> > backing;
+	bool compact;
 	std::vector<arma::mat> B;
-	std::vector<arma::mat> L;
-	std::vector<arma::vec> beta_mrg;
-	std::vector<arma::vec> calc_b_tmp;
-	std::vector<double> num;
-	std::vector<double> denom;
+	std::vector<arma::fmat> B_f;
+	std::vector<arma::fmat> R_f;
+	std::vector<arma::vec> B_diag;
+	std::vector<arma::mat> beta_mrg;
+	std::vector<arma::mat> calc_b_tmp;
 } ldmat_data;
 
 class beta_distribution {
@@ -45,7 +63,7 @@ std::gamma_distribution<double> b_distribution;
  * @details
  * The mcmc_data class is designed to store and manage the data required for the MCMC
  * algorithm. It includes the following member variables:
- * - beta_mrg: A vector of marginal beta values for each SNP.
+ * - beta_mrg: Marginal beta values, one row per SNP and one column per trait.
  * - ref_ld_mat: A vector of LD matrices, where each matrix corresponds to a subset of SNPs.
  * - sz: A vector of sample sizes for each SNP.
  * - array: A vector of genotyping array information for each SNP.
@@ -58,6 +76,9 @@ std::gamma_distribution<double> b_distribution;
  * @param sz A vector of sample sizes for each SNP.
  * @param array A vector of genotyping array information for each SNP.
  *
+ * @note Several traits measured in the same sample can be fitted against one LD panel by
+ * passing their marginal betas as the columns of a matrix; `sz` and `array` are shared.
+ *
  * @note The `array` parameter is used to store information about the genotyping array for each SNP.
  * It is typically an integer value that represents the specific array used for genotyping.
  * For example, 1 may represent the Affymetrix array, while 2 may represent the Illumina array.
@@ -77,7 +98,7 @@ std::gamma_distribution<double> b_distribution;
  */
 class mcmc_data {
 public:
-std::vector<double> beta_mrg;
+arma::mat beta_mrg;
 std::vector<std::pair<size_t, size_t> > boundary;
 std::vector<arma::mat> ref_ld_mat;
 std::vector<double> sz;
@@ -95,7 +116,25 @@ mcmc_data(const std::vector<double>&    beta_mrg,
           const std::vector<arma::mat>& ref_ld_mat,
           const std::vector<double>&    sz,
           const std::vector<int>&       array)
-	: beta_mrg(beta_mrg), ref_ld_mat(ref_ld_mat), sz(sz), array(array) {
+	: beta_mrg(arma::conv_to<arma::vec>::from(beta_mrg)), ref_ld_mat(ref_ld_mat), sz(sz), array(array) {
+	compute_boundary();
+}
+
+/// As above, taking ownership of the LD matrices instead of copying them.
+mcmc_data(const std::vector<double>&    beta_mrg,
+          std::vector<arma::mat>&&      ref_ld_mat,
+          const std::vector<double>&    sz,
+          const std::vector<int>&       array)
+	: beta_mrg(arma::conv_to<arma::vec>::from(beta_mrg)), ref_ld_mat(std::move(ref_ld_mat)), sz(sz), array(array) {
+	compute_boundary();
+}
+
+/// Several traits: `beta_mrg` has one row per SNP and one column per trait.
+mcmc_data(const arma::mat&              beta_mrg,
+          std::vector<arma::mat>&&      ref_ld_mat,
+          const std::vector<double>&    sz,
+          const std::vector<int>&       array)
+	: beta_mrg(beta_mrg), ref_ld_mat(std::move(ref_ld_mat)), sz(sz), array(array) {
 	compute_boundary();
 }
 
@@ -110,6 +149,21 @@ void compute_boundary() {
 }
 };
 
+/**
+ * @brief Per-block buffers of `MCMC_state::sample_beta`, kept across iterations.
+ *
+ * `ld` is B restricted to the causal SNPs (`cls_assgn != 0`) of the previous
+ * update; it is reused as long as the causal set does not change. `prec` holds
+ * the posterior precision eta^2 N B_gamma + Sigma_0^-1 and its Cholesky factor.
+ */
+struct causal_workspace {
+	std::vector<size_t> causal;
+	arma::mat ld;
+	arma::mat prec;
+	arma::vec mu;
+	arma::vec draw;
+};
+
 class MCMC_state {
 public:
 double alpha;
@@ -125,9 +179,56 @@ std::vector<double> log_p;
 std::vector<double> cluster_var;
 std::vector<unsigned> suff_stats;
 std::vector<double> sumsq;
-MCMC_state(size_t num_snp, size_t max_cluster, \
-           double a0, double b0, double sz) {
+std::vector<double> h2_block;
+std::vector<causal_workspace> causal_ws;
+// Per-block terms of the eta update, written by sample_beta
+std::vector<double> num;
+std::vector<double> denom;
+
+/**
+ * @brief Components represented in the current iteration.
+ *
+ * With adaptive truncation (`buffer > 0`) only the null component, the occupied
+ * components and the first `buffer` empty components (in stick-breaking order)
+ * are sampled. `active` lists them in increasing order. The stick mass of all
+ * other components is collapsed into `tail_mass` and added to the highest
+ * empty component in `active` when SNPs are assigned. With `buffer == 0` every
+ * component is active and `tail_mass` is zero.
+ */
+std::vector<size_t> active;
+double tail_mass;
+
+/**
+ * @brief Random number streams used by the sampler.
+ *
+ * Every stage of an iteration draws from its own counter-based stream, keyed by
+ * the user seed, the chain, the stage, the LD block (for block-local stages) and
+ * the iteration number. Blocks can therefore be updated in any order and on any
+ * thread while producing bit-identical results, and chains are independent.
+ * `chain` numbers the chains of all traits of a run, so that every chain of
+ * every trait has its own streams.
+ */
+enum rng_stage {
+	STAGE_INIT = 0,
+	STAGE_SIGMA2,
+	STAGE_ASSIGNMENT,
+	STAGE_V,
+	STAGE_ALPHA,
+	STAGE_BETA,
+	STAGE_ETA
+};
+
+MCMC_state(size_t num_snp, size_t num_block, size_t max_cluster, size_t buffer, \
+           double a0, double b0, double sz, unsigned int seed, unsigned int chain = 0, \
+           size_t trait = 0) {
 	a0k = a0; b0k = b0; N = sz;
+	chain_id = chain;
+	trait_id = trait;
+	active_buffer = buffer;
+	tail_mass = 0;
+	tail_slot = 0;
+	rng_seed = seed;
+	iteration = 0;
 	// Changed May 20 2021
 	// Now N (sz) is absorbed into A, B; so set to 1.
 	N = 1.0;
@@ -149,43 +250,142 @@ MCMC_state(size_t num_snp, size_t max_cluster, \
 	sumsq.assign(max_cluster, 0.0);
 	V.assign(max_cluster, 0.0);
 	cls_assgn.assign(num_snp, 0);
-	std::random_device rd;
-	r.seed(rd());
+	h2_block.assign(num_block, 0.0);
+	causal_ws.resize(num_block);
+	num.assign(num_block, 0.0);
+	denom.assign(num_block, 0.0);
+	rng_stream r = stream(STAGE_INIT);
 	std::uniform_int_distribution<int> dist(0, M-1);
 	for (size_t i=0; i<num_snp; i++) {
 		cls_assgn[i] = dist(r);
 	}
+	update_active();
+}
+
+/// Advance to the given MCMC iteration; selects the substream used by every stage.
+void set_iteration(unsigned int iter) {
+	iteration = iter;
+}
+
+/// Stream for a given stage, LD block and the current iteration.
+rng_stream stream(rng_stage stage, size_t block = 0) const {
+	return rng_stream(rng_seed, (static_cast<uint64_t>(chain_id) << 48) | (static_cast<uint64_t>(stage) << 40) | block, iteration);
 }
 
 void sample_sigma2();
-void calc_b(size_t j, const mcmc_data &dat, const ldmat_data &ldmat_dat);
+/// Residualized betas of block j; `B_beta` = B_j beta_j is computed by the caller so it can be batched over states.
+void calc_b(size_t j, const mcmc_data &dat, const ldmat_data &ldmat_dat, const arma::vec &B_beta);
 void sample_assignment(size_t j, const mcmc_data &dat, \
                        const ldmat_data &ldmat_dat);
 void update_suffstats();
+void update_active();
 void sample_V();
 void update_p();
 void sample_alpha();
 void sample_beta(size_t j, const mcmc_data &dat, \
-                 ldmat_data &ldmat_dat);
-void compute_h2(const mcmc_data &dat);
-void sample_eta(const ldmat_data &ldmat_dat);
+                 const ldmat_data &ldmat_dat);
+/// Heritability of block j; `R_beta` is R_j beta_j.
+void compute_h2(size_t j, const mcmc_data &dat, const arma::vec &R_beta);
+void reduce_h2();
+void sample_eta();
+
+/// Save or restore the state through a checkpoint archive (see `mcmc_checkpoint.h`)
+template <typename Archive>
+void checkpoint(Archive& ar) {
+	ar.field(alpha);
+	ar.field(eta);
+	ar.field(h2);
+	ar.field(beta);
+	ar.field(b);
+	ar.field(cls_assgn);
+	ar.field(V);
+	ar.field(p);
+	ar.field(log_p);
+	ar.field(cluster_var);
+	ar.field(suff_stats);
+	ar.field(sumsq);
+	ar.field(h2_block);
+	ar.field(num);
+	ar.field(denom);
+	ar.field(active);
+	ar.field(tail_mass);
+	ar.field(tail_slot);
+	ar.field(iteration);
+}
 
 private:
 double a0k;
 double b0k;
 size_t M, n_snp;
-std::mt19937 r;
+size_t active_buffer;
+size_t tail_slot;
+size_t trait_id;
+unsigned int rng_seed;
+unsigned int chain_id;
+unsigned int iteration;
 };
 
+/// Sums of the retained draws of one state; posterior means are taken over the `n` draws a run kept.
 class MCMC_samples {
 public:
 arma::vec beta;
 double h2;
+uint64_t n;
 MCMC_samples(size_t num_snps) {
 	beta = arma::vec(num_snps, arma::fill::zeros);
 	h2 = 0;
+	n = 0;
 }
+
+template <typename Archive>
+void checkpoint(Archive& ar) {
+	ar.field(beta);
+	ar.field(h2);
+	ar.field(n);
+}
+};
+
+/**
+ * @brief Phases and counters of an `mcmc` run (see `engine_profile`).
+ *
+ * calc_b and sample_assignment share one parallel region and are timed inside
+ * its tasks (thread time); the other phases are the wall time of their stage.
+ * `causal_variants` sums, over iterations and states, the variants assigned to
+ * a non-null component, which sets the size of the `sample_beta` systems.
+ */
+enum sdpr_phase {
+	SDPR_PHASE_LDMAT = 0,
+	SDPR_PHASE_SIGMA2,
+	SDPR_PHASE_CALC_B,
+	SDPR_PHASE_ASSIGNMENT,
+	SDPR_PHASE_MIXTURE,
+	SDPR_PHASE_BETA,
+	SDPR_PHASE_ETA,
+	SDPR_PHASE_H2,
+	SDPR_PHASE_CHECKPOINT
 };
+enum sdpr_counter {
+	SDPR_COUNT_ITERATIONS = 0,
+	SDPR_COUNT_LD_CACHED,
+	SDPR_COUNT_LD_FACTORED,
+	SDPR_COUNT_CAUSAL
+};
+inline engine_profile sdpr_profile() {
+	return engine_profile({"solve_ldmat", "sample_sigma2", "calc_b", "sample_assignment", "sample_mixture",
+	                       "sample_beta", "sample_eta", "compute_h2", "checkpoint"},
+	                      {"iterations", "ld_blocks_cached", "ld_blocks_factored", "causal_variants"});
+}
+
+/**
+ * @brief Preprocess the LD blocks of `dat` into `ldmat_dat` (run once by `mcmc`).
+ *
+ * Factors every block into A = (R + aI)^-1 R and B = R A (see `ldmat_data`) in
+ * parallel over blocks, serving blocks found in `memo` or `cache_dir` instead.
+ * The arguments are those of `mcmc`; `compact` is its `compact_ld`.
+ */
+void solve_ldmat(const mcmc_data &dat, ldmat_data &ldmat_dat, const double a, unsigned sz, int opt_llk,
+                 unsigned n_threads, const std::string &cache_dir, bool compact, ldmat_memo *memo,
+                 engine_profile *profile = nullptr);
 
 /**
  * @brief Perform Markov Chain Monte Carlo (MCMC) for estimating effect sizes.
@@ -195,6 +395,9 @@ MCMC_samples(size_t num_snps) {
  * @param a Factor to shrink the reference LD matrix. Default is 0.1.
  * @param c Factor to correct for the deflation. Default is 1.
  * @param M Max number of variance components. Default is 1000.
+ * @param active_buffer Number of empty components sampled alongside the occupied ones
+ *                      (adaptive truncation, an approximation). 0 samples all M components
+ *                      every iteration (exact). Default is 0.
  * @param a0k Hyperparameter for inverse gamma distribution. Default is 0.5.
  * @param b0k Hyperparameter for inverse gamma distribution. Default is 0.5.
  * @param iter Number of iterations for MCMC. Default is 1000.
@@ -205,28 +408,45 @@ MCMC_samples(size_t num_snps) {
  *                and 2 for equation 5 (SNPs genotyped on different arrays in a separate cohort).
  *                Default is 1.
  * @param verbose Whether to print verbose output. Default is true.
+ * @param seed Seed of the random number streams. Results are identical for any `n_threads`.
+ * @param cache_dir Directory of the persistent LD preprocessing cache (see `ldmat_cache`).
+ *                  An empty string disables the cache.
+ * @param n_chains Number of independent chains, run concurrently. Default is 1.
+ * @param compact_ld Keep the preprocessed LD in single precision (see `ldmat_data`). Default is false.
+ * @param ckpt Checkpointing and early stopping settings (see `mcmc_checkpoint.h`).
+ * @param ld_memo In-memory LD preprocessing cache of the LD handle the blocks come from, or null.
+ * @param profile Phase times and counters of the run (see `sdpr_profile()`), or null.
  *
- * @return An `std::unordered_map` containing the estimated effect sizes (beta) and heritability (h2).
+ * @return An `std::unordered_map` containing the estimated effect sizes (beta), heritability (h2)
+ *         and per-chain results with convergence diagnostics, with one column per trait.
  *
  * @details
  * This function performs Markov Chain Monte Carlo (MCMC) to estimate effect sizes and heritability
  * based on the provided `mcmc_data` object and other parameters.
  *
  * The `mcmc_data` object should contain the following:
- * - `beta_mrg`: A vector of marginal beta values for each SNP.
+ * - `beta_mrg`: Marginal beta values, one row per SNP and one column per trait.
  * - `ref_ld_mat`: A vector of LD matrices, where each matrix corresponds to a subset of SNPs.
  * - `sz`: A vector of sample sizes for each SNP.
  * - `array`: A vector of genotyping array information for each SNP.
  *
  * The function returns an `std::unordered_map` with the following key-value pairs:
- * - "beta": An `arma::vec` containing the estimated effect sizes for each SNP.
- * - "h2": An `arma::vec` containing the estimated heritability.
+ * - "beta": Estimated effect sizes for each SNP (p x T for T traits), averaged over chains.
+ * - "h2": The estimated heritability (1 x T), averaged over chains.
+ * - "beta_chains", "h2_chains": Posterior means of each chain (p x T n_chains, 1 x T n_chains);
+ *   column t * n_chains + ch is chain ch of trait t.
+ * - "rhat", "ess": Split-R-hat and effective sample size of h2 followed by the monitored
+ *   effects (see `mcmc_diagnostics.h`), one column per trait.
+ * - "top_index": 0-based indices of the monitored SNPs, the (up to) 10 SNPs with the
+ *   largest absolute marginal effects of each trait.
+ * - "n_iter": The number of iterations run (1 x 1).
  *
  * Additional parameters:
  * - `sz`: The sample size of the GWAS.
  * - `a`: Factor to shrink the reference LD matrix. Default is 0.1.
  * - `c`: Factor to correct for the deflation. Default is 1.
  * - `M`: Max number of variance components. Default is 1000.
+ * - `active_buffer`: Number of empty components kept next to the occupied ones. Default is 0 (no truncation).
  * - `a0k`, `b0k`: Hyperparameters for the inverse gamma distribution. Default is 0.5 for both.
  * - `iter`: Number of iterations for MCMC. Default is 1000.
  * - `burn`: Number of burn-in iterations for MCMC. Default is 200.
@@ -236,16 +456,44 @@ MCMC_samples(size_t num_snps) {
  *              and 2 for equation 5 (SNPs genotyped on different arrays in a separate cohort).
  *              Default is 1.
  * - `verbose`: Whether to print verbose output. Default is true.
+ * - `seed`: Seed of the random number streams.
+ * - `cache_dir`: Directory of the LD preprocessing cache; empty to disable.
+ * - `n_chains`: Number of independent chains.
+ * - `compact_ld`: Store the LD blocks in single precision. Halves the memory of the LD and the
+ *   bytes moved by the `calc_b` GEMV; entries are promoted to double for the Cholesky in `sample_beta`.
+ * - `ckpt`: With `ckpt.path` set, every state, its posterior sums and its monitors are saved every
+ *   `ckpt.every` iterations and when the run ends, and a run with the same inputs and settings
+ *   resumes from an existing checkpoint. With `ckpt.min_ess > 0` the run stops once the effective
+ *   sample size of h2, summed over the chains of each trait, reaches `ckpt.min_ess` for every trait.
+ *
+ * The LD preprocessing (`solve_ldmat`) depends only on the reference panel and the
+ * preprocessing options. Blocks found in `ld_memo` or `cache_dir` are reused instead of
+ * being factored; the others are factored in parallel and written to both.
+ *
+ * All block-local stages (calc_b, sample_assignment, sample_beta and the per-block
+ * heritability) run in parallel over LD blocks. Each block draws from its own
+ * random number stream, so the output does not depend on `n_threads`.
+ *
+ * Chains and traits share `data` and the preprocessed LD (`ldmat_data` is read-only
+ * during sampling), so each costs only its own `MCMC_state`. The LD preprocessing is
+ * done once for all traits, which therefore must share the sample sizes and arrays.
+ * All states advance in lock-step: for each block, the products B_j beta_j in
+ * `calc_b` and R_j beta_j in the heritability are one GEMM over the effects of every
+ * state, which reads each LD block once per iteration instead of once per state. The
+ * per-state stages of a block and the (block, state) pairs of `sample_beta` are tasks
+ * of the shared pool, which keeps all threads busy even when the LD blocks are too
+ * few or too small to do so on their own.
  *
  * @note The `mcmc` function assumes the existence of the `Function_pool` class and its member functions,
  *       as well as the `mcmc.h` header file with the necessary class and struct definitions.
  */
-std::unordered_map<std::string, arma::vec> mcmc(
+std::unordered_map<std::string, arma::mat> mcmc(
 	mcmc_data& data,
 	unsigned         sz,
 	double           a,
 	double           c,
 	size_t           M,
+	size_t           active_buffer,
 	double           a0k,
 	double           b0k,
 	int              iter,
@@ -253,5 +501,12 @@ std::unordered_map<std::string, arma::vec> mcmc(
 	int              thin,
 	unsigned         n_threads,
 	int              opt_llk,
-	bool             verbose
+	bool             verbose,
+	unsigned int     seed,
+	const std::string& cache_dir,
+	unsigned         n_chains,
+	bool             compact_ld,
+	const mcmc_checkpoint_options& ckpt,
+	ldmat_memo*      ld_memo,
+	engine_profile*  profile
 	);
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include "susie_fit_store.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+const char store_magic[8] = {'P', 'E', 'C', 'O', 'S', 'U', 'S', '1'};
+const int32_t store_version = 1;
+const size_t header_size = 32;
+
+struct store_header {
+	char magic[8];
+	int32_t version;
+	int32_t n_fits;
+	int32_t n_effects;
+	int32_t n_variants;
+	int32_t name_bytes;
+	int32_t reserved;
+};
+
+// Reads consecutive arrays out of the mapping, checking that they fit
+class store_reader {
+public:
+store_reader(const char* data, size_t size, const std::string& path) : data(data), size(size), pos(0), path(path) {
+}
+
+const char* take(size_t n_bytes) {
+	if (n_bytes > size - pos) {
+		fail("is truncated");
+	}
+	const char* p = data + pos;
+	pos += n_bytes;
+	return p;
+}
+template <typename T>
+const T* take_array(size_t n) {
+	return reinterpret_cast<const T*>(take(n * sizeof(T)));
+}
+void align(size_t n) {
+	take((n - pos % n) % n);
+}
+size_t remaining() const {
+	return size - pos;
+}
+void fail(const std::string& what) const {
+	throw std::runtime_error("The SuSiE fit store " + path + " " + what + ".");
+}
+
+private:
+const char* data;
+size_t size, pos;
+const std::string& path;
+};
+}
+
+susie_fit_store::susie_fit_store(const std::string& path) : file(new mapped_file(path)) {
+	if (file->data() == nullptr) {
+		throw std::runtime_error("Unable to read the SuSiE fit store " + path + ".");
+	}
+	store_reader in(file->data(), file->size(), path);
+	store_header h;
+	std::memcpy(&h, in.take(header_size), sizeof(h));
+	if (std::memcmp(h.magic, store_magic, sizeof(store_magic)) != 0) {
+		in.fail("is not a SuSiE fit store");
+	}
+	if (h.version != store_version) {
+		in.fail("was written by an incompatible version");
+	}
+	if (h.n_fits < 0 || h.n_effects < 0 || h.n_variants < 0 || h.name_bytes < 0) {
+		in.fail("has a corrupt header");
+	}
+
+	const int32_t* n_fit_effects = in.take_array<int32_t>(h.n_fits);
+	const int32_t* n_effect_entries = in.take_array<int32_t>(h.n_effects);
+	const int32_t* n_variables = in.take_array<int32_t>(h.n_fits);
+	const int32_t* name_lengths = in.take_array<int32_t>(static_cast<size_t>(h.n_variants) + h.n_fits);
+	in.align(sizeof(double));
+
+	fit_effects.assign(1, 0);
+	for (int32_t f = 0; f < h.n_fits; f++) {
+		if (n_fit_effects[f] < 0) {
+			in.fail("has a corrupt effect count");
+		}
+		fit_effects.push_back(fit_effects.back() + n_fit_effects[f]);
+	}
+	if (fit_effects.back() != static_cast<uint64_t>(h.n_effects)) {
+		in.fail("has inconsistent effect counts");
+	}
+	effect_entries.assign(1, 0);
+	for (int32_t e = 0; e < h.n_effects; e++) {
+		if (n_effect_entries[e] <= 0) {
+			in.fail("has a single effect without entries");
+		}
+		effect_entries.push_back(effect_entries.back() + n_effect_entries[e]);
+	}
+	fit_n_variables.assign(n_variables, n_variables + h.n_fits);
+
+	const double* pip_sum = in.take_array<double>(h.n_fits);
+	fit_pip_sum.assign(pip_sum, pip_sum + h.n_fits);
+	size_t n_entries = effect_entries.back();
+	alpha = in.take_array<double>(n_entries);
+	variant = in.take_array<int32_t>(n_entries);
+	for (size_t k = 0; k < n_entries; k++) {
+		if (variant[k] < 0 || variant[k] >= h.n_variants) {
+			in.fail("refers to a variant outside of its dictionary");
+		}
+	}
+
+	const char* names = in.take(h.name_bytes);
+	if (in.remaining() != 0) {
+		in.fail("has trailing data");
+	}
+	size_t offset = 0;
+	variants.reserve(h.n_variants);
+	fits.reserve(h.n_fits);
+	for (size_t i = 0; i < static_cast<size_t>(h.n_variants) + h.n_fits; i++) {
+		if (name_lengths[i] < 0 || static_cast<size_t>(name_lengths[i]) > h.name_bytes - offset) {
+			in.fail("has corrupt names");
+		}
+		(i < static_cast<size_t>(h.n_variants) ? variants : fits).emplace_back(names + offset, name_lengths[i]);
+		offset += name_lengths[i];
+	}
+}
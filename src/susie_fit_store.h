@@ -0,0 +1,97 @@
+#ifndef SUSIE_FIT_STORE_H
+#define SUSIE_FIT_STORE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ldmat_cache.h"
+
+/**
+ * @class susie_fit_store
+ * @brief Read-only view of a binary store of SuSiE fits (`write_susie_fits()` in R).
+ *
+ * A store holds the single effects of many fits as sparse rows of alpha over one
+ * dictionary of variant IDs, with the probabilities below a pruning threshold
+ * left out. All values are in native byte order:
+ *
+ * | field                                      | type                              |
+ * |--------------------------------------------|-----------------------------------|
+ * | magic "PECOSUS1", version                  | char[8], int32                    |
+ * | n_fits, n_effects, n_variants, name_bytes  | int32 each; 4 bytes of padding    |
+ * | effects of each fit                        | int32[n_fits]                     |
+ * | entries of each single effect              | int32[n_effects]                  |
+ * | variables of each fit                      | int32[n_fits]                     |
+ * | name lengths, variant IDs then fit names   | int32[n_variants + n_fits]        |
+ * | padding to a multiple of 8 bytes           |                                   |
+ * | sum of the PIPs of each fit                | double[n_fits]                    |
+ * | alpha of each entry                        | double[n_entries]                 |
+ * | variant of each entry (0-based)            | int32[n_entries]                  |
+ * | names                                      | char[name_bytes]                  |
+ *
+ * Only single effects with a positive prior variance are stored. The file is
+ * mapped, and the alpha and variant arrays of an effect are used in place, so
+ * opening a store costs the dictionary and the offsets, whatever its size.
+ */
+class susie_fit_store {
+public:
+/// Map and check the store at `path`; throws std::runtime_error if it is not a valid store.
+explicit susie_fit_store(const std::string& path);
+
+size_t n_fits() const {
+	return fit_effects.size() - 1;
+}
+size_t n_variants() const {
+	return variants.size();
+}
+/// The variant dictionary
+const std::vector<std::string>& variant_names() const {
+	return variants;
+}
+const std::vector<std::string>& fit_names() const {
+	return fits;
+}
+/// Number of variables of fit f, before pruning
+int n_variables(size_t f) const {
+	return fit_n_variables[f];
+}
+/// Sum of the PIPs of fit f
+double pip_sum(size_t f) const {
+	return fit_pip_sum[f];
+}
+
+/// Single effects of fit f: the range [effect_begin(f), effect_end(f))
+size_t effect_begin(size_t f) const {
+	return fit_effects[f];
+}
+size_t effect_end(size_t f) const {
+	return fit_effects[f + 1];
+}
+
+/// Number of entries of single effect e
+size_t effect_size(size_t e) const {
+	return effect_entries[e + 1] - effect_entries[e];
+}
+/// alpha of the entries of single effect e
+const double* effect_alpha(size_t e) const {
+	return alpha + effect_entries[e];
+}
+/// Dictionary index of the variants of the entries of single effect e
+const int32_t* effect_variants(size_t e) const {
+	return variant + effect_entries[e];
+}
+
+private:
+std::shared_ptr<mapped_file> file;
+std::vector<uint64_t> fit_effects;
+std::vector<uint64_t> effect_entries;
+std::vector<int32_t> fit_n_variables;
+std::vector<double> fit_pip_sum;
+std::vector<std::string> variants;
+std::vector<std::string> fits;
+const double* alpha;
+const int32_t* variant;
+};
+
+#endif // SUSIE_FIT_STORE_H
@@ -0,0 +1,97 @@
+#include <cstdint>
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+#include "thread_budget_rcpp.h"
+
+namespace {
+
+// The thread controls of the BLAS loaded in the process, looked up once
+struct blas_symbols {
+	const char* name;
+	int (*get_int)();
+	void (*set_int)(int);
+	int64_t (*get_dim)();
+	void (*set_dim)(int64_t);
+
+	blas_symbols() : name(nullptr), get_int(nullptr), set_int(nullptr), get_dim(nullptr), set_dim(nullptr) {
+#ifndef _WIN32
+		if (find("OpenBLAS", "openblas_get_num_threads", "openblas_set_num_threads") ||
+		    find("MKL", "MKL_Get_Max_Threads", "MKL_Set_Num_Threads")) {
+			return;
+		}
+		// BLIS counts threads in its dim_t, a 64-bit integer
+		void* get = dlsym(RTLD_DEFAULT, "bli_thread_get_num_threads");
+		void* set = dlsym(RTLD_DEFAULT, "bli_thread_set_num_threads");
+		if (get != nullptr && set != nullptr) {
+			name = "BLIS";
+			get_dim = reinterpret_cast<int64_t (*)()>(get);
+			set_dim = reinterpret_cast<void (*)(int64_t)>(set);
+		}
+#endif
+	}
+
+#ifndef _WIN32
+	bool find(const char* library, const char* get_symbol, const char* set_symbol) {
+		void* get = dlsym(RTLD_DEFAULT, get_symbol);
+		void* set = dlsym(RTLD_DEFAULT, set_symbol);
+		if (get == nullptr || set == nullptr) {
+			return false;
+		}
+		name = library;
+		get_int = reinterpret_cast<int (*)()>(get);
+		set_int = reinterpret_cast<void (*)(int)>(set);
+		return true;
+	}
+#endif
+};
+
+const blas_symbols& blas() {
+	static const blas_symbols symbols;
+	return symbols;
+}
+
+}
+
+const char* blas_thread_control::name() {
+	return blas().name;
+}
+
+int blas_thread_control::get() {
+	if (blas().get_int != nullptr) {
+		return blas().get_int();
+	}
+	if (blas().get_dim != nullptr) {
+		return static_cast<int>(blas().get_dim());
+	}
+	return 0;
+}
+
+void blas_thread_control::set(int n) {
+	if (blas().set_int != nullptr) {
+		blas().set_int(n);
+	}
+	else if (blas().set_dim != nullptr) {
+		blas().set_dim(n);
+	}
+}
+
+/**
+ * @brief The thread settings the engines run under.
+ *
+ * @return A list with `limit`, the thread budget of every engine call (option
+ *         `pecotmr.threads`, 0 when unset), `omp_threads`, the OpenMP thread
+ *         count outside the calls, `blas`, the BLAS library whose threads the
+ *         budget controls (NA if none), and `blas_threads`, its thread count
+ *         outside the calls (NA if it is not controlled).
+ */
+// [[Rcpp::export]]
+Rcpp::List thread_budget_info() {
+	const char* library = blas_thread_control::name();
+	return Rcpp::List::create(
+		Rcpp::Named("limit") = thread_limit(),
+		Rcpp::Named("omp_threads") = omp_get_max_threads(),
+		Rcpp::Named("blas") = library != nullptr ? Rcpp::String(library) : Rcpp::String(NA_STRING),
+		Rcpp::Named("blas_threads") = library != nullptr ? blas_thread_control::get() : NA_INTEGER
+		);
+}
@@ -0,0 +1,86 @@
+#ifndef THREAD_BUDGET_H
+#define THREAD_BUDGET_H
+
+#include <algorithm>
+#include <omp.h>
+
+/**
+ * @brief Threads of the BLAS/LAPACK library R is linked to, for the libraries whose
+ *        thread count can be set at run time (OpenBLAS, MKL, BLIS).
+ *
+ * The controls are looked up in the running process, so nothing is linked
+ * against a particular BLAS; with any other library (the reference BLAS,
+ * Accelerate) `name()` is null and the calls do nothing.
+ */
+struct blas_thread_control {
+	/// Name of the library whose threads are controlled, or null if there is none
+	static const char* name();
+	/// Current number of BLAS threads; 0 if they cannot be controlled
+	static int get();
+	/// Set the number of BLAS threads (no effect if they cannot be controlled)
+	static void set(int n);
+};
+
+/**
+ * @class thread_budget
+ * @brief Threads of one engine call, and the OpenMP and BLAS settings around it.
+ *
+ * Every entry point asks for its threads through a budget held for the
+ * duration of the call. Of a budget of `limit` threads, the engine gets
+ * `engine_threads()` (the threads it asked for, capped by the limit) and every
+ * engine thread may use `blas_threads()` for the BLAS/LAPACK calls it makes,
+ * so that the two together stay within the limit: with a limit, the BLAS gets
+ * `limit / engine_threads()` threads; without one, an engine running several
+ * threads keeps the BLAS single-threaded and a single-threaded engine leaves
+ * it as it is.
+ *
+ * The budget sets the OpenMP thread count to `engine_threads()` and the BLAS
+ * threads to `blas_threads()`, and restores the caller's settings when it is
+ * destroyed, so nothing leaks into later R code. It must be created and
+ * destroyed on the calling (main) thread.
+ */
+class thread_budget {
+public:
+/**
+ * @param requested Threads asked for by the caller; 0 or less for all of the limit.
+ * @param limit Total threads available to the call; 0 or less for no limit.
+ */
+thread_budget(int requested, int limit)
+	: saved_omp(omp_get_max_threads()), saved_blas(blas_thread_control::get()) {
+	n_engine = requested > 0 ? requested : (limit > 0 ? limit : omp_get_num_procs());
+	if (limit > 0) {
+		n_engine = std::min(n_engine, limit);
+		n_blas = std::max(1, limit / n_engine);
+	}
+	else {
+		n_blas = n_engine > 1 ? 1 : std::max(1, saved_blas);
+	}
+	omp_set_num_threads(n_engine);
+	if (saved_blas > 0 && n_blas != saved_blas) {
+		blas_thread_control::set(n_blas);
+	}
+}
+~thread_budget() {
+	omp_set_num_threads(saved_omp);
+	if (saved_blas > 0 && n_blas != saved_blas) {
+		blas_thread_control::set(saved_blas);
+	}
+}
+thread_budget(const thread_budget&) = delete;
+thread_budget& operator=(const thread_budget&) = delete;
+
+/// Threads for the engine's own parallelism (OpenMP regions, the Function_pool)
+int engine_threads() const {
+	return n_engine;
+}
+/// Threads of each BLAS/LAPACK call during the budget
+int blas_threads() const {
+	return n_blas;
+}
+
+private:
+int saved_omp, saved_blas;
+int n_engine, n_blas;
+};
+
+#endif // THREAD_BUDGET_H
@@ -0,0 +1,24 @@
+#ifndef THREAD_BUDGET_RCPP_H
+#define THREAD_BUDGET_RCPP_H
+
+#include <RcppArmadillo.h>
+#include "thread_budget.h"
+
+/**
+ * @brief The thread budget of an engine call, from the R option `pecotmr.threads`.
+ *
+ * @return The option as a positive thread count, or 0 (no limit) when it is
+ *         unset. Must be called on the main thread.
+ */
+inline int thread_limit() {
+	SEXP option = Rf_GetOption1(Rf_install("pecotmr.threads"));
+	if (Rf_isNull(option)) {
+		return 0;
+	}
+	if (!Rf_isNumeric(option) || Rf_length(option) != 1 || Rf_asInteger(option) == NA_INTEGER || Rf_asInteger(option) < 1) {
+		Rcpp::stop("Option pecotmr.threads must be a positive number of threads.");
+	}
+	return Rf_asInteger(option);
+}
+
+#endif // THREAD_BUDGET_RCPP_H